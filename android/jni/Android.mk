@@ -74,7 +74,7 @@ LOCAL_SRC_FILES := $(MY_FILES)
 LOCAL_CFLAGS += $(MY_CFLAGS)
 LOCAL_C_INCLUDES := $(ARTOOLKIT_ROOT)/include/android $(ARTOOLKIT_ROOT)/include
 #LOCAL_C_INCLUDES += $(ARTOOLKIT_ROOT)/include/android-$(TARGET_ARCH_ABI)
-LOCAL_STATIC_LIBRARIES := aricp
+LOCAL_STATIC_LIBRARIES := aricp util
 LOCAL_MODULE := ar
 include $(BUILD_STATIC_LIBRARY)
 
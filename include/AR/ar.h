@@ -489,6 +489,8 @@ typedef enum {
 	@field		pattHandle (description)
     @field      pattRatio A value between 0.0 and 1.0, representing the proportion of the marker width which constitutes the pattern. In earlier versions, this value was fixed at 0.5.
     @field      matrixCodeType When matrix code pattern detection mode is active, indicates the type of matrix code to detect.
+    @field      arStaticSceneThresh Tile change threshold for static scene detection. 0 if disabled.
+        To query this value, call arGetStaticSceneThresh(). To set this value, call arSetStaticSceneThresh().
  */
 typedef struct {
     int                arDebug;
@@ -515,22 +517,34 @@ typedef struct {
     int                arLabelingThreshAutoIntervalTTL;
     int                arLabelingThreshAutoBracketOver;
     int                arLabelingThreshAutoBracketUnder;
+    int                arLabelingThreshAutoHistSubsample;
     ARImageProcInfo   *arImageProcInfo;
     ARdouble           pattRatio;
     AR_MATRIX_CODE_TYPE matrixCodeType;
+    int                arStaticSceneThresh;
+    int                arStaticSceneRefValid;
+    ARUint8           *arStaticSceneRef;
+    ARUint8           *arStaticSceneCur;
 } ARHandle;
 
 
 /* --------------------------------------------------*/
 
+struct _THREAD_POOL_T;
+
 /*!
     @typedef
     @abstract   (description)
     @discussion (description)
     @field      icpHandle (description)
+    @field      threadNum Number of threads (including the calling thread) used by arGetTransMatSquareBatch().
+        0 selects one thread per online CPU. To query this value, call ar3DGetThreadNum(). To set this value, call ar3DSetThreadNum().
+    @field      threadPool Worker threads used by arGetTransMatSquareBatch(), created on first use.
 */
 typedef struct {
     ICPHandleT          *icpHandle;
+    int                  threadNum;
+    struct _THREAD_POOL_T *threadPool;
 } AR3DHandle;
 
 #define   AR_TRANS_MAT_IDENTITY            ICP_TRANS_MAT_IDENTITY
@@ -785,6 +799,37 @@ int arSetLabelingThreshModeAutoInterval(ARHandle *handle, const int interval);
  */
 int arGetLabelingThreshModeAutoInterval(const ARHandle *handle, int *interval_p);
 
+/*!
+    @function
+    @abstract   Set the sampling stride of the luminance histogram used in auto-threshold calculations.
+    @discussion
+        The median and Otsu auto-threshold modes derive the threshold from
+        a histogram of the luminance image. On large frames, the histogram
+        can be estimated from every subsample'th pixel of every subsample'th
+        row without materially affecting the resulting threshold.
+        A value of 1 samples every pixel.
+    @param      handle An ARHandle referring to the current AR tracker
+        for which the histogram subsampling factor will be set.
+    @param		subsample The sampling stride, in pixels, in both x and y.
+        An integer in the range [1,INT_MAX] (inclusive). Default
+        value is AR_LABELING_THRESH_AUTO_HIST_SUBSAMPLE_DEFAULT.
+    @result     0 if no error occured.
+    @seealso arGetLabelingThreshModeAutoHistSubsample arGetLabelingThreshModeAutoHistSubsample
+ */
+int arSetLabelingThreshModeAutoHistSubsample(ARHandle *handle, const int subsample);
+
+/*!
+    @function
+    @abstract   Get the sampling stride of the luminance histogram used in auto-threshold calculations.
+    @param      handle An ARHandle referring to the current AR tracker
+        to be queried for its histogram subsampling factor.
+    @param		subsample_p Pointer into which will be placed the
+        value of the histogram subsampling factor.
+    @result     0 if no error occured.
+    @seealso arSetLabelingThreshModeAutoHistSubsample arSetLabelingThreshModeAutoHistSubsample
+ */
+int arGetLabelingThreshModeAutoHistSubsample(const ARHandle *handle, int *subsample_p);
+
 /*!
     @function
     @abstract   Set the image processing mode.
@@ -924,6 +969,43 @@ int            arSetMarkerExtractionMode( ARHandle *handle, int mode );
  */
 int            arGetMarkerExtractionMode( ARHandle *handle, int *mode );
 
+/*!
+    @function
+    @abstract   Set the threshold for static scene detection.
+    @discussion
+        With a fixed camera, many consecutive frames are nearly identical. When
+        static scene detection is enabled, arDetectMarker() samples the luminance
+        image on a sparse grid (every AR_STATIC_SCENE_SAMPLE_STEP pixels) and
+        compares it, in tiles of AR_STATIC_SCENE_TILE_SIZE x AR_STATIC_SCENE_TILE_SIZE
+        pixels, against the samples from the frame on which detection last ran.
+        If the mean absolute difference in every tile is at or below the threshold,
+        detection is skipped and the marker results of the previous call are
+        left in place. As soon as any tile exceeds the threshold, full detection
+        runs on that frame, so no latency is added when motion resumes.
+
+        Changes made to the tracker's other settings are not detected. Calling
+        arSetStaticSceneThresh() again discards the reference samples, forcing
+        detection on the next frame.
+    @param      handle An ARHandle referring to the current AR tracker to have its threshold set.
+    @param      thresh The threshold, in luminance levels, in the range [0,255].
+        A value of 0 disables static scene detection. Default value is
+        AR_STATIC_SCENE_THRESH_DEFAULT.
+    @result     0 if no error occured.
+    @seealso arGetStaticSceneThresh arGetStaticSceneThresh
+ */
+int            arSetStaticSceneThresh( ARHandle *handle, const int thresh );
+
+/*!
+    @function
+    @abstract   Get the threshold for static scene detection.
+    @discussion See the description for arSetStaticSceneThresh().
+    @param      handle An ARHandle referring to the current AR tracker to be queried for its threshold.
+    @param      thresh_p Pointer into which will be placed the value of the threshold.
+    @result     0 if no error occured.
+    @seealso arSetStaticSceneThresh arSetStaticSceneThresh
+ */
+int            arGetStaticSceneThresh( ARHandle *handle, int *thresh_p );
+
 /*!
      @function
      @abstract   Set the border size.
@@ -1510,6 +1592,36 @@ int            ar3DChangeLoopBreakThresh( AR3DHandle *handle, ARdouble loopBreak
 */
 int            ar3DChangeLoopBreakThreshRatio( AR3DHandle *handle, ARdouble loopBreakThreshRatio );
 
+/*!
+    @function
+    @abstract   Set the number of threads used for batched pose estimation.
+    @discussion
+        arGetTransMatSquareBatch() splits the markers passed to it across this many
+        threads, one of which is the calling thread. The worker threads are created
+        on the first batch of at least AR_3D_BATCH_THREAD_MIN_MARKERS markers and are
+        then kept until the thread count is changed or the handle is deleted.
+        The threads are provided by the thread pool of libARUtil (see thread_sub.h).
+    @param      handle An AR3DHandle.
+    @param      threadNum Number of threads, in the range [0, AR_3D_THREAD_MAX]. 1 processes
+        batches serially on the calling thread, and 0 selects one thread per online CPU.
+        Default value is AR_3D_THREAD_NUM_DEFAULT.
+    @result     0 if no error occured, or -1 if threadNum is out of range.
+    @seealso    ar3DGetThreadNum ar3DGetThreadNum
+    @seealso    arGetTransMatSquareBatch arGetTransMatSquareBatch
+*/
+int            ar3DSetThreadNum( AR3DHandle *handle, int threadNum );
+
+/*!
+    @function
+    @abstract   Get the number of threads used for batched pose estimation.
+    @discussion See the description for ar3DSetThreadNum().
+    @param      handle An AR3DHandle.
+    @param      threadNum Pointer into which will be placed the thread count.
+    @result     0 if no error occured.
+    @seealso    ar3DSetThreadNum ar3DSetThreadNum
+*/
+int            ar3DGetThreadNum( AR3DHandle *handle, int *threadNum );
+
 /*!
     @function
     @abstract   (description)
@@ -1538,6 +1650,31 @@ ARdouble         arGetTransMatSquareCont( AR3DHandle *handle, ARMarkerInfo *mark
                                         ARdouble initConv[3][4],
                                         ARdouble width, ARdouble conv[3][4] );
 
+/*!
+    @function
+    @abstract   Calculate the poses of a set of square markers in one call.
+    @discussion
+        Equivalent to calling arGetTransMatSquare() on each of marker_info[0..marker_num-1]
+        in turn, but the markers are processed in parallel on the threads of the handle
+        (see ar3DSetThreadNum()) and without heap allocation. Typically called with the
+        results of arDetectMarker(), i.e. arGetMarker() and arGetMarkerNum().
+
+        A handle must not be used by more than one arGetTransMatSquareBatch() call at a time.
+    @param      handle An AR3DHandle.
+    @param      marker_info Array of marker_num markers.
+    @param      marker_num Number of markers in marker_info.
+    @param      widths Array of marker_num marker widths. A marker with a width of 0.0
+        or less is skipped; its conv entry is left unchanged and its err entry is set to -1.0.
+    @param      conv Array of marker_num matrices into which the marker poses will be placed.
+    @param      err Array of marker_num values into which the fitting error of each pose will
+        be placed, as returned by arGetTransMatSquare(). May be NULL.
+    @result     The number of markers for which a pose was calculated, or -1 in case of error.
+    @seealso    arGetTransMatSquare arGetTransMatSquare
+    @seealso    ar3DSetThreadNum ar3DSetThreadNum
+*/
+int              arGetTransMatSquareBatch( AR3DHandle *handle, ARMarkerInfo *marker_info, int marker_num,
+                                         const ARdouble *widths, ARdouble (*conv)[3][4], ARdouble *err );
+
 /*!
     @function
     @abstract   (description)
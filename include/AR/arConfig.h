@@ -116,6 +116,18 @@
 #define   AR_LABELING_THRESH_MODE_DEFAULT     AR_LABELING_THRESH_MODE_MANUAL
 #define   AR_LABELING_THRESH_ADAPTIVE_KERNEL_SIZE_DEFAULT 9
 #define   AR_LABELING_THRESH_ADAPTIVE_BIAS_DEFAULT (-7)
+#define   AR_LABELING_THRESH_AUTO_HIST_SUBSAMPLE_DEFAULT 1 // Histogram sampling stride for auto-threshold calculations.
+
+#define   AR_STATIC_SCENE_THRESH_DEFAULT      0     // Mean absolute luma difference in a tile above which it is considered changed. 0 disables static scene detection.
+#define   AR_STATIC_SCENE_SAMPLE_STEP         4     // Spacing (in pixels) of the luma samples making up the static scene signature.
+#define   AR_STATIC_SCENE_TILE_SIZE          32     // Width and height (in pixels) of static scene signature tiles. Must be a multiple of AR_STATIC_SCENE_SAMPLE_STEP.
+
+#define   AR_3D_THREAD_MAX                   16     // Maximum number of threads used by arGetTransMatSquareBatch().
+#define   AR_3D_THREAD_NUM_DEFAULT            0     // 0 = one thread per online CPU.
+#define   AR_3D_BATCH_THREAD_MIN_MARKERS      8     // Batches smaller than this are processed on the calling thread.
+
+#define   AR_PARAM_LT_THREAD_MIN_ROWS        64     // Minimum number of lookup table rows calculated per thread.
+#define   AR_PARAM_LT_MOBILE_STEP             1     // Lookup table entry spacing for ARWrapper's Android video source. 1 = full table; set to e.g. 8 to use arParamLTCreateCompact().
 
 #define   AR_CONFIDENCE_CUTOFF_DEFAULT        0.5
 #define   AR_MATRIX_CODE_TYPE_DEFAULT         AR_MATRIX_CODE_3x3
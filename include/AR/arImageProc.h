@@ -63,6 +63,8 @@ struct _ARImageProcInfo {
     int imageY; // Height of image buffer.
     unsigned long histBins[256]; // Luminance histogram.
     unsigned long cdfBins[256]; // Luminance cumulative density function.
+    unsigned long histCount; // Number of pixels counted into histBins.
+    int histSubsample; // Histogram sampling stride in x and y (1 = every pixel).
     unsigned char min; // Minimum luminance.
     unsigned char max; // Maximum luminance.
 #if AR_IMAGEPROC_USE_VIMAGE
@@ -83,6 +85,7 @@ extern "C" {
 
 ARImageProcInfo *arImageProcInit(const int xsize, const int ysize, const AR_PIXEL_FORMAT pixFormat, int alwaysCopy);
 void arImageProcFinal(ARImageProcInfo *ipi);
+int arImageProcSetHistSubsample(ARImageProcInfo *ipi, const int subsample);
 int arImageProcLumaHist(ARImageProcInfo *ipi, const ARUint8 *__restrict dataPtr);
 unsigned char *arImageProcGetHistImage(ARImageProcInfo *ipi);
 int arImageProcLumaHistAndCDF(ARImageProcInfo *ipi, const ARUint8 *__restrict dataPtr);
@@ -94,6 +97,42 @@ int arImageProcLumaHistAndBoxFilterWithBias(ARImageProcInfo *ipi, const ARUint8
 #endif
 int arImageProcLumaHistAndCDFAndLevels(ARImageProcInfo *ipi, const ARUint8 *__restrict dataPtr);
 
+// Reduced-resolution luma images, as used by KPM's KPM_PROC_MODE values.
+typedef enum {
+    AR_IMAGE_PYRAMID_LEVEL_FULL = 0, // 1:1, i.e. the source image itself.
+    AR_IMAGE_PYRAMID_LEVEL_TWO_THIRD, // 3:2 reduction.
+    AR_IMAGE_PYRAMID_LEVEL_HALF, // 2:1 reduction (2x2 box filter).
+    AR_IMAGE_PYRAMID_LEVEL_ONE_THIRD, // 3:1 reduction (3x3 box filter).
+    AR_IMAGE_PYRAMID_LEVEL_QUARTER, // 4:1 reduction (4x4 box filter).
+    AR_IMAGE_PYRAMID_LEVEL_COUNT
+} AR_IMAGE_PYRAMID_LEVEL;
+
+// A per-frame set of reduced-resolution copies of a luma image. Each level is
+// built the first time it is requested after arImagePyramidSetImage(), and the
+// level buffers are allocated once and reused on subsequent frames, so several
+// consumers of the same frame share one reduction, and none allocate per frame.
+// Levels are built lazily and without locking, so a pyramid shared between
+// threads should have its levels requested on one thread before being handed on.
+struct _ARImagePyramid {
+    int xsize; // Width of source image.
+    int ysize; // Height of source image.
+    const ARUint8 *image; // Source image (not owned).
+    ARUint8 *levelImage[AR_IMAGE_PYRAMID_LEVEL_COUNT]; // Level buffers, allocated as required.
+    int levelValid[AR_IMAGE_PYRAMID_LEVEL_COUNT]; // Non-zero if level has been built from image.
+};
+typedef struct _ARImagePyramid ARImagePyramid;
+
+ARImagePyramid *arImagePyramidInit(const int xsize, const int ysize);
+void arImagePyramidFinal(ARImagePyramid *pyramid);
+int arImagePyramidSetImage(ARImagePyramid *pyramid, const ARUint8 *imageLuma);
+const ARUint8 *arImagePyramidGetLevel(ARImagePyramid *pyramid, const AR_IMAGE_PYRAMID_LEVEL level, int *xsize_p, int *ysize_p);
+int arImagePyramidGetLevelSize(const int xsize, const int ysize, const AR_IMAGE_PYRAMID_LEVEL level, int *xsize_p, int *ysize_p);
+int arImagePyramidReduce(const ARUint8 *__restrict src, const int xsize, const int ysize, const AR_IMAGE_PYRAMID_LEVEL level, ARUint8 *__restrict dst);
+// Sets dst to a copy, in dstImage (xsize*ysize bytes), of the frame src is set to, along with
+// the given level, which is built in src first if need be. Lets a consumer which runs
+// asynchronously keep the frame without reducing it again. dst and src must be the same size.
+int arImagePyramidCopy(ARImagePyramid *dst, ARImagePyramid *src, ARUint8 *dstImage, const AR_IMAGE_PYRAMID_LEVEL level);
+
 #ifdef __cplusplus
 }
 #endif
@@ -80,6 +80,16 @@ typedef struct {
     uint64_t globalID;
 } ARMultiEachMarkerInfoT;
 
+#define    AR_MULTI_INDEX_KEY_TEMPLATE   0 // id is the template pattern ID.
+#define    AR_MULTI_INDEX_KEY_MATRIX     1 // id is the matrix code ID.
+#define    AR_MULTI_INDEX_KEY_GLOBAL_ID  2 // id is the 64-bit global ID of a barcode.
+
+typedef struct {
+    int      type;    // One of AR_MULTI_INDEX_KEY_*.
+    int      marker;  // Index into ARMultiMarkerInfoT.marker.
+    uint64_t id;
+} ARMultiMarkerIndexT;
+
 typedef struct {
     ARMultiEachMarkerInfoT *marker;
     int                     marker_num;
@@ -89,12 +99,22 @@ typedef struct {
     ARdouble                cfPattCutoff;
     ARdouble                cfMatrixCutoff;
     int                     min_submarker;
+    ARMultiMarkerIndexT    *index;        // Lookup from detected marker ID to marker[], sorted by (type, id, marker).
+    int                     index_num;
+    ICP2DCoordT            *screenCoord;  // Correspondence buffers of 4*marker_num points, reused on every pose estimate.
+    ICP3DCoordT            *worldCoord;
+    ARdouble               *icpWork;      // Robust ICP and IPPE workspace for 4*marker_num correspondences.
+    int                     indexed_marker_num; // marker_num when index and buffers were last built.
 } ARMultiMarkerInfoT;
 
 ARMultiMarkerInfoT *arMultiReadConfigFile( const char *filename, ARPattHandle *pattHandle );
 
 int arMultiFreeConfig( ARMultiMarkerInfoT *config );
 
+// Rebuilds config->index and the correspondence buffers. Called by arMultiReadConfigFile(), and
+// automatically when config->marker_num changes; call it after changing the IDs in config->marker.
+int arMultiUpdateConfigIndex( ARMultiMarkerInfoT *config );
+
 ARdouble  arGetTransMatMultiSquare(AR3DHandle *handle, ARMarkerInfo *marker_info, int marker_num,
                                  ARMultiMarkerInfoT *config);
 
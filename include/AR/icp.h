@@ -78,6 +78,8 @@ typedef struct {
     ARdouble     breakLoopErrorRatioThresh;
     ARdouble     breakLoopErrorThresh2;
     ARdouble     inlierProb;
+    int          robustMode;
+    ARdouble     breakLoopDeltaThresh;
 } ICPHandleT;
 
 typedef struct {
@@ -90,6 +92,8 @@ typedef struct {
     ARdouble     breakLoopErrorRatioThresh;
     ARdouble     breakLoopErrorThresh2;
     ARdouble     inlierProb;
+    int          robustMode;
+    ARdouble     breakLoopDeltaThresh;
 } ICPStereoHandleT;
 
 
@@ -97,6 +101,9 @@ typedef struct {
 
 /*------------ icpUtil.c --------------*/
 int icpGetInitXw2Xc_from_PlanarData( ARdouble matXc2U[3][4], ICP2DCoordT screenCoord[], ICP3DCoordT worldCoord[], int num, ARdouble initMatXw2Xc[3][4] );
+int icpGetInitXw2Xc_from_PlanarDataIPPE( ARdouble matXc2U[3][4], ICP2DCoordT screenCoord[], ICP3DCoordT worldCoord[], int num, ARdouble initMatXw2Xc[3][4] );
+int icpGetInitXw2Xc_from_PlanarDataIPPEWork( ARdouble matXc2U[3][4], ICP2DCoordT screenCoord[], ICP3DCoordT worldCoord[], int num, ARdouble initMatXw2Xc[3][4], ARdouble *work );
+ARdouble icpGetReprojectionError( ARdouble matXc2U[3][4], ARdouble matXw2Xc[3][4], ICP2DCoordT screenCoord[], ICP3DCoordT worldCoord[], int num );
 
 
 /*------------ icpPoint.c --------------*/
@@ -114,8 +121,13 @@ int                icpSetBreakLoopErrorThresh2     ( ICPHandleT *handle, ARdoubl
 int                icpGetBreakLoopErrorThresh2     ( ICPHandleT *handle, ARdouble *breakLoopErrorThresh2 );
 int                icpSetInlierProbability         ( ICPHandleT *handle, ARdouble  inlierProbability );
 int                icpGetInlierProbability         ( ICPHandleT *handle, ARdouble *inlierProbability );
+int                icpSetRobustMode                ( ICPHandleT *handle, int  robustMode );
+int                icpGetRobustMode                ( ICPHandleT *handle, int *robustMode );
+int                icpSetBreakLoopDeltaThresh      ( ICPHandleT *handle, ARdouble  breakLoopDeltaThresh );
+int                icpGetBreakLoopDeltaThresh      ( ICPHandleT *handle, ARdouble *breakLoopDeltaThresh );
 int                icpPoint                        ( ICPHandleT *handle, ICPDataT *data, ARdouble initMatXw2Xc[3][4], ARdouble matXw2Xc[3][4], ARdouble *err );
 int                icpPointRobust                  ( ICPHandleT *handle, ICPDataT *data, ARdouble initMatXw2Xc[3][4], ARdouble matXw2Xc[3][4], ARdouble *err );
+int                icpPointRobustWork              ( ICPHandleT *handle, ICPDataT *data, ARdouble initMatXw2Xc[3][4], ARdouble matXw2Xc[3][4], ARdouble *err, ARdouble *work );
 
 
 /*------------ icpPointStereo.c --------------*/
@@ -139,8 +151,13 @@ int                icpStereoSetBreakLoopErrorThresh2     ( ICPStereoHandleT *han
 int                icpStereoGetBreakLoopErrorThresh2     ( ICPStereoHandleT *handle, ARdouble *breakLoopErrorThresh2 );
 int                icpStereoSetInlierProbability         ( ICPStereoHandleT *handle, ARdouble  inlierProbability );
 int                icpStereoGetInlierProbability         ( ICPStereoHandleT *handle, ARdouble *inlierProbability );
+int                icpStereoSetRobustMode                ( ICPStereoHandleT *handle, int  robustMode );
+int                icpStereoGetRobustMode                ( ICPStereoHandleT *handle, int *robustMode );
+int                icpStereoSetBreakLoopDeltaThresh      ( ICPStereoHandleT *handle, ARdouble  breakLoopDeltaThresh );
+int                icpStereoGetBreakLoopDeltaThresh      ( ICPStereoHandleT *handle, ARdouble *breakLoopDeltaThresh );
 int                icpStereoPoint                        ( ICPStereoHandleT *handle, ICPStereoDataT *data, ARdouble initMatXw2Xc[3][4], ARdouble matXw2Xc[3][4], ARdouble *err );
 int                icpStereoPointRobust                  ( ICPStereoHandleT *handle, ICPStereoDataT *data, ARdouble initMatXw2Xc[3][4], ARdouble matXw2Xc[3][4], ARdouble *err );
+int                icpStereoPointRobustWork              ( ICPStereoHandleT *handle, ICPStereoDataT *data, ARdouble initMatXw2Xc[3][4], ARdouble matXw2Xc[3][4], ARdouble *err, ARdouble *work );
 
 
 #if 0
@@ -52,6 +52,16 @@ extern "C" {
 #define      ICP_BREAK_LOOP_ERROR_RATIO_THRESH   0.99F
 #define      ICP_BREAK_LOOP_ERROR_THRESH2        4.0F
 #define      ICP_INLIER_PROBABILITY              0.50F
+#define      ICP_BREAK_LOOP_DELTA_THRESH         0.0F
+#define      ICP_ROBUST_STACK_POINT_NUM          256         // Correspondences the robust variants handle without allocating.
+#define      ICP_ROBUST_WORK_SIZE(num)           (2*(num))   // ARdoubles of workspace icpPointRobustWork()/icpStereoPointRobustWork() need for num correspondences.
+#define      ICP_IPPE_WORK_SIZE(num)             (4*(num))   // ARdoubles of workspace icpGetInitXw2Xc_from_PlanarDataIPPEWork() needs for num points.
+
+// M-estimators available to the robust ICP variants (icpPointRobust(), icpStereoPointRobust()).
+#define      ICP_ROBUST_MODE_TUKEY               0
+#define      ICP_ROBUST_MODE_HUBER               1
+#define      ICP_ROBUST_MODE_CAUCHY              2
+#define      ICP_ROBUST_MODE_DEFAULT             ICP_ROBUST_MODE_TUKEY
 
 typedef struct {
     ARdouble    x;
@@ -85,6 +95,12 @@ int        icpGetXc_from_Xw_by_MatXw2Xc( ICP3DCoordT *Xc, ARdouble matXw2Xc[3][4
 int        icpGetU_from_X_by_MatX2U( ICP2DCoordT *u, ARdouble matX2U[3][4], ICP3DCoordT *coord3d );
 int        icpGetJ_U_S( ARdouble J_U_S[2][6], ARdouble matXc2U[3][4], ARdouble matXw2Xc[3][4], ICP3DCoordT *worldCoord );
 int        icpGetDeltaS( ARdouble S[6], ARdouble dU[], ARdouble J_U_S[][6], int n );
+void       icpNormalEquationsInit( ARdouble JtJ[6][6], ARdouble JtU[6] );
+void       icpNormalEquationsAdd( ARdouble JtJ[6][6], ARdouble JtU[6], ARdouble J_U_S[2][6], ARdouble dU[2], ARdouble w );
+int        icpNormalEquationsSolve( ARdouble S[6], ARdouble JtJ[6][6], ARdouble JtU[6] );
+ARdouble   icpSelectNth( ARdouble *E, int num, int n );
+ARdouble   icpRobustWeight( int robustMode, ARdouble e2, ARdouble K2 );
+ARdouble   icpRobustError( int robustMode, ARdouble e2, ARdouble K2 );
 int        icpUpdateMat( ARdouble matXw2Xc[3][4], ARdouble dS[6] );
 
 void       icpDispMat( char *title, ARdouble *mat, int row, int clm );
@@ -123,12 +123,13 @@ typedef struct {
 extern const arParamVersionInfo_t arParamVersionInfo[AR_DIST_FUNCTION_VERSION_MAX];
 
 typedef struct {
-    float   *i2o;
-    float   *o2i;
-    int      xsize;
-    int      ysize;
-    int      xOff;
-    int      yOff;
+    float   *i2o;   // Ideal-to-observed table, xsize*ysize (x, y) pairs.
+    float   *o2i;   // Observed-to-ideal table, xsize*ysize (x, y) pairs.
+    int      xsize; // Table width, in entries.
+    int      ysize; // Table height, in entries.
+    int      xOff;  // Padding, in pixels, added to the left of the image.
+    int      yOff;  // Padding, in pixels, added above the image.
+    int      step;  // Pixel spacing between table entries. 1 for a full-resolution table.
 } ARParamLTf;
     
 //typedef struct {
@@ -155,11 +156,14 @@ typedef struct {
         values covering the camera image width and height, plus a padded border.
     @field      param A copy of original ARParam from which the lookup table was calculated.
     @field      paramLTf The lookup table.
+    @field      mapped If the lookup table was loaded from the cache by memory mapping,
+        the address of the mapping, otherwise NULL. For internal use.
 */
 typedef struct {
     ARParam      param;
     ARParamLTf   paramLTf;
     //ARParamLTi   paramLTi;
+    void        *mapped;
 } ARParamLT;
 
 int    arParamDisp( const ARParam *param );
@@ -357,13 +361,76 @@ ARParamLT  *arParamLTLoad( char *filename, char *ext );
         AR_PARAM_LT_DEFAULT_OFFSET (defined elsewhere in this header) should be used. However,
         when using a camera with a large amount of lens distortion, a higher value may be
         required to cope with the corners or sides of the camera image frame.
+    
+        On multi-processor systems, the rows of the table are calculated in parallel.
+        If a cache directory has been set with arParamLTSetCacheDirectory(), the
+        table is first looked for in the cache and, if found, is mapped from disk
+        rather than calculated. If not found, the calculated table is saved to the cache.
     @result A pointer to a newly-allocated ARParamLT structure, or NULL if an error
         occurred. Once the ARParamLT is no longer needed, it should be disposed
         of by calling arParamLTFree() on it.
     @seealso arParamLTFree arParamLTFree
+    @seealso arParamLTSetCacheDirectory arParamLTSetCacheDirectory
  */
 ARParamLT  *arParamLTCreate( ARParam *param, int offset );
 
+/*!
+    @function
+    @abstract Allocate and calculate a compact lookup-table camera parameter.
+    @discussion
+        As arParamLTCreate(), except that the table holds one entry every step pixels
+        in each direction, and lookups interpolate bilinearly between entries. Memory
+        use is reduced by a factor of approximately step*step; a full-resolution table
+        uses 16 bytes per pixel (about 33 MB at 1920x1080).
+
+        The interpolation error grows with the square of step and with the curvature
+        of the lens distortion. For typical calibrated phone camera lenses at 1920x1080,
+        the maximum error is around 0.003 pixel with a step of 8, 0.01 pixel with a
+        step of 16 and 0.04 pixel with a step of 32. This compares with up to 0.5 pixel
+        for the nearest-entry lookup of a full-resolution table. Lenses with strong
+        distortion near the image corners will see more. The measured maximum error
+        is logged at debug level on creation.
+
+        Lookups through arParamObserv2IdealLTf() and arParamIdeal2ObservLTf() return
+        the interpolated value rather than the nearest entry. A step of 1 gives the
+        same table as arParamLTCreate().
+    @param param A pointer to an ARParam structure from which the lookup table will be generated.
+    @param offset Padding around the image, as for arParamLTCreate().
+    @param step Pixel spacing between table entries, 1 or more.
+    @result A pointer to a newly-allocated ARParamLT structure, or NULL if an error
+        occurred. Dispose of it by calling arParamLTFree().
+    @seealso arParamLTCreate arParamLTCreate
+    @seealso arParamLTFree arParamLTFree
+ */
+ARParamLT  *arParamLTCreateCompact( ARParam *param, int offset, int step );
+
+/*!
+    @function
+    @abstract Set the directory used to cache lookup-table camera parameters.
+    @discussion
+        Tables created by arParamLTCreate() or arParamLTCreateCompact() are saved in
+        this directory, in files named from a hash of the camera parameters, offset and
+        step, and subsequent calls with the same values load the table from the cache.
+        Caching is disabled by default.
+        Each table is written to a temporary file and renamed into place, so several
+        processes may share one cache directory.
+    @param path Path to an existing, writable directory, or NULL to disable caching.
+        The string is copied.
+    @result 0 if the cache directory was set, or -1 if path is not an existing, writable
+        directory, in which case the previous setting is kept.
+    @seealso arParamLTGetCacheDirectory arParamLTGetCacheDirectory
+    @seealso arParamLTCreate arParamLTCreate
+ */
+int         arParamLTSetCacheDirectory( const char *path );
+
+/*!
+    @function
+    @abstract Get the directory used to cache lookup-table camera parameters.
+    @result The path set by arParamLTSetCacheDirectory(), or NULL if caching is disabled.
+    @seealso arParamLTSetCacheDirectory arParamLTSetCacheDirectory
+ */
+const char *arParamLTGetCacheDirectory( void );
+
 /*!
     @function
     @abstract Dispose of a memory allocated to a lookup-table camera parameter.
@@ -441,6 +508,72 @@ int         arParamIdeal2ObservLTf( const ARParamLTf *paramLTf, const float  ix,
 */
 int         arParamObserv2IdealLTf( const ARParamLTf *paramLTf, const float  ox, const float  oy, float  *ix, float  *iy);
 
+/*!
+    @function
+    @abstract   Convert an array of observed (distorted) window coordinates to idealised coordinates.
+    @discussion
+        Batch form of arParamObserv2IdealLTf(). Unlike that function, which for a
+        full-resolution table returns the entry nearest to the input, the table is
+        always bilinearly interpolated, so
+        sub-pixel input positions give sub-pixel accurate results. Integer input positions
+        give exactly the table values. Where SIMD is available, two points are converted
+        per step.
+    @param      paramLTf A lookup-table based version of the lens distortion parameters.
+    @param      o Input array of num observed coordinate pairs (x0, y0, x1, y1, ...).
+    @param      i Output array of num idealised coordinate pairs. May be the same array as o.
+    @param      num Number of coordinate pairs.
+    @result     0 in case of function success, or -1 if any input pair is outside the
+        range covered by the lookup table. All other pairs are still converted; the output
+        for pairs outside the table is left unchanged.
+    @seealso arParamObserv2IdealBatch arParamObserv2IdealBatch
+    @seealso arParamIdeal2ObservLTfBatch arParamIdeal2ObservLTfBatch
+*/
+int         arParamObserv2IdealLTfBatch( const ARParamLTf *paramLTf, const float *o, float *i, const int num );
+
+/*!
+    @function
+    @abstract   Convert an array of idealised window coordinates to observed (distorted) coordinates.
+    @discussion See the description for arParamObserv2IdealLTfBatch().
+    @param      paramLTf A lookup-table based version of the lens distortion parameters.
+    @param      i Input array of num idealised coordinate pairs (x0, y0, x1, y1, ...).
+    @param      o Output array of num observed coordinate pairs. May be the same array as i.
+    @param      num Number of coordinate pairs.
+    @result     0 in case of function success, or -1 if any input pair is outside the
+        range covered by the lookup table.
+    @seealso arParamObserv2IdealLTfBatch arParamObserv2IdealLTfBatch
+*/
+int         arParamIdeal2ObservLTfBatch( const ARParamLTf *paramLTf, const float *i, float *o, const int num );
+
+/*!
+    @function
+    @abstract   Convert an array of observed (distorted) window coordinates to idealised coordinates.
+    @discussion
+        As arParamObserv2IdealLTfBatch(), except that pairs outside the range of the
+        lookup table are converted with arParamObserv2Ideal() from paramLT->param,
+        so every pair is converted.
+    @param      paramLT A lookup-table camera parameter, as created by arParamLTCreate().
+    @param      o Input array of num observed coordinate pairs (x0, y0, x1, y1, ...).
+    @param      i Output array of num idealised coordinate pairs. May be the same array as o.
+    @param      num Number of coordinate pairs.
+    @result     0 in case of function success, or -1 in case of error.
+    @seealso arParamObserv2IdealLTfBatch arParamObserv2IdealLTfBatch
+    @seealso arParamIdeal2ObservBatch arParamIdeal2ObservBatch
+*/
+int         arParamObserv2IdealBatch( const ARParamLT *paramLT, const float *o, float *i, const int num );
+
+/*!
+    @function
+    @abstract   Convert an array of idealised window coordinates to observed (distorted) coordinates.
+    @discussion See the description for arParamObserv2IdealBatch().
+    @param      paramLT A lookup-table camera parameter, as created by arParamLTCreate().
+    @param      i Input array of num idealised coordinate pairs (x0, y0, x1, y1, ...).
+    @param      o Output array of num observed coordinate pairs. May be the same array as i.
+    @param      num Number of coordinate pairs.
+    @result     0 in case of function success, or -1 in case of error.
+    @seealso arParamObserv2IdealBatch arParamObserv2IdealBatch
+*/
+int         arParamIdeal2ObservBatch( const ARParamLT *paramLT, const float *i, float *o, const int num );
+
 //int         arParamIdeal2ObservLTi( const ARParamLTi *paramLTi, const int    ix, const int    iy, int    *ox, int    *oy);
 
 //int         arParamObserv2IdealLTi( const ARParamLTi *paramLTi, const int    ox, const int    oy, int    *ix, int    *iy);
@@ -91,9 +91,15 @@ extern "C" {
 #endif
 
 
-#define AR2_THREAD_MAX                              8
+#define AR2_THREAD_MAX                              64          // Maximum number of NFT texture tracking threads, including the calling thread.
 
 #define AR2_DEFAULT_SEARCH_SIZE	                    25          // Default radius of feature search window.
+#define AR2_DEFAULT_SEARCH_PYRAMID_LEVEL            0           // Default resolution of the first search stage. 0 = full resolution, 1 = half, 2 = quarter.
+#define AR2_SEARCH_PYRAMID_LEVEL_MAX                2
+#define AR2_DEFAULT_ADAPTIVE_SEARCH                 0           // Default for whether the search radius adapts to the error of motion prediction.
+#define AR2_SEARCH_SIZE_MIN                         6           // Smallest search radius used when the search radius adapts.
+#define AR2_SEARCH_RADIUS_GAIN                      2.0F        // Adaptive search radius, as a multiple of recent prediction error.
+#define AR2_SEARCH_RADIUS_DECAY                     0.7F        // Fraction of the adaptive search radius kept per frame while prediction error falls.
 
 #define AR2_DEFAULT_SEARCH_FEATURE_NUM	            10          // May not be higher than AR2_SEARCH_FEATURE_MAX.
 
@@ -104,15 +110,20 @@ extern "C" {
 
 #define AR2_DEFAULT_TRACKING_THRESH                 2.0F
 
+#define AR2_DEFAULT_TEMPLATE_REUSE_THRESH           0.0F        // Default largest template distortion, in pixels, for which a template built in an earlier frame is reused. 0 = never reuse.
+
 
 
 /* tracking.c */
 #define    AR2_TRACKING_SURFACE_MAX                 10          // Maximum number of surfaces per surface set (i.e. maximum number of discrete surfaces with fixed relationship to each other able to be combined into a surface set.)
 #define    AR2_TRACKING_CANDIDATE_MAX               200         // Maximum number of candidate feature points.
+#define    AR2_VISIBLE_BOUNDS_MARGIN                2.0F        // Pixels added around the frame before culling features outside it.
+#define    AR2_VISIBLE_DPI_MARGIN                   2.0F        // Factor by which the resolution range of a cell of features is widened before culling scales.
 
 /* tracking2d.c */
 #define AR2_DEFAULT_TRACKING_SD_THRESH              5.0F
 #define AR2_SEARCH_FEATURE_MAX                      40
+#define AR2_TEMPLATE_CACHE_MAX                      (AR2_SEARCH_FEATURE_MAX*2)  // Templates kept for reuse in later frames.
 
 
 /* genFeatureSet.c */
@@ -74,6 +74,21 @@ typedef struct {
     int               num;
 } AR2FeatureSetT;
 
+#define AR2_FEATURE_INDEX_GRID_MAX      16          // Maximum number of cells along each axis of an AR2FeatureIndexT.
+#define AR2_FEATURE_INDEX_CELL_FEATURES 4           // Approximate number of features per cell aimed for in the largest scale.
+
+// The features of an AR2FeatureSetT bucketed on a grid in marker coordinates. One grid covers all
+// scales; each scale has its own buckets. Lets tracking skip whole cells of features which cannot
+// be visible at the current pose.
+typedef struct {
+    float             mx0, my0;     // Marker coordinates of the lower corner of cell 0.
+    float             cellSize;     // Width and height of a cell, in millimetres.
+    int               xnum, ynum;   // Number of cells along each axis. Cell (cx, cy) is cell number cy*xnum + cx.
+    int               num;          // Number of scales, as in the AR2FeatureSetT.
+    int             **cellStart;    // For each scale, xnum*ynum + 1 offsets into cellFeature[scale].
+    int             **cellFeature;  // For each scale, feature numbers grouped by cell, ascending within each cell.
+} AR2FeatureIndexT;
+
 
 AR2FeatureMapT *ar2GenFeatureMap( AR2ImageT *image,
                                   int ts1, int ts2,
@@ -101,6 +116,9 @@ AR2FeatureSetT *ar2ReadFeatureSet( char *filename, char *ext );
 int             ar2SaveFeatureSet( char *filename, char *ext, AR2FeatureSetT *featureSet );
 int             ar2FreeFeatureSet( AR2FeatureSetT **featureSet );
 
+AR2FeatureIndexT *ar2GenFeatureIndex ( AR2FeatureSetT *featureSet );
+int               ar2FreeFeatureIndex( AR2FeatureIndexT **featureIndex );
+
 #ifdef __cplusplus
 }
 #endif
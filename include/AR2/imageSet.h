@@ -63,14 +63,91 @@ typedef struct {
 typedef struct {
     AR2ImageT   **scale;
     int32_t       num;
+    void         *map;          // File mapped into memory, in which uncompressed scales lie, or NULL.
+    size_t        mapSize;
+    struct _AR2ImageSetResidencyT *residency; // Non-NULL if scales are materialised on demand. See ar2AcquireImageScale().
 } AR2ImageSetT;
 
+// Formats for ar2WriteImageSet2(). ar2ReadImageSet() reads all of them.
+#define AR2_IMAGESET_FORMAT_JPEG    0   // Scale 0 as a JPEG image; other scales are regenerated from it on reading.
+#define AR2_IMAGESET_FORMAT_RAW     1   // All scales as uncompressed planes, mapped into memory on reading.
+#define AR2_IMAGESET_FORMAT_LZ4     2   // All scales as LZ4-compressed planes (or uncompressed, where compression does not help).
+
+#define AR2_IMAGESET_VERSION        1   // Version of the container written for AR2_IMAGESET_FORMAT_RAW and AR2_IMAGESET_FORMAT_LZ4.
+#define AR2_IMAGESET_PLANE_ALIGN    4096 // Alignment of each plane within the file, so planes can be paged in independently.
+
 /*   image.c   */
 AR2ImageSetT   *ar2GenImageSet   ( ARUint8 *image, int xsize, int ysize, int nc, float dpi, float dpi_list[], int dpi_num );
 AR2ImageSetT   *ar2ReadImageSet  ( char *filename );
 int             ar2WriteImageSet ( char *filename, AR2ImageSetT *imageSet );
+int             ar2WriteImageSet2( char *filename, AR2ImageSetT *imageSet, int format );
 int             ar2FreeImageSet  ( AR2ImageSetT **imageSet );
 
+/*!
+    @function
+    @abstract   Set the memory budget for image set scales.
+    @discussion
+        By default, every scale of every image set is held in memory for as long as the set exists.
+        When a budget is set, image sets subsequently read by ar2ReadImageSet() are managed: the
+        pixels of a scale are materialised when ar2AcquireImageScale() first needs them, and
+        least-recently-used scales of all managed sets are released to keep the total pixel memory
+        within the budget. Released scales are regenerated from the image set file when next
+        needed, which is cheapest for sets written in AR2_IMAGESET_FORMAT_RAW or
+        AR2_IMAGESET_FORMAT_LZ4.
+
+        The budget is a soft one: scales in use (acquired but not yet released) are never
+        released, so a budget smaller than the scales in use at once is exceeded.
+
+        Sets generated by ar2GenImageSet(), or read in ARToolKit v4.x format, are never managed.
+    @param      budget Budget in bytes, or 0 for no budget. Setting 0 stops further sets being
+        managed, and stops releasing scales of those already managed.
+    @result     0 if successful, or -1 on error.
+    @seealso ar2GetImageSetResidencyBudget ar2GetImageSetResidencyBudget
+    @seealso ar2AcquireImageScale ar2AcquireImageScale
+ */
+int             ar2SetImageSetResidencyBudget( size_t budget );
+
+/*!
+    @function
+    @abstract   Get the memory budget for image set scales.
+    @param      budget Pointer to a size_t which will be filled with the budget in bytes, or 0 if there is none.
+    @param      resident If non-NULL, pointer to a size_t which will be filled with the bytes of
+        pixels presently held by managed image sets.
+    @result     0 if successful, or -1 on error.
+    @seealso ar2SetImageSetResidencyBudget ar2SetImageSetResidencyBudget
+ */
+int             ar2GetImageSetResidencyBudget( size_t *budget, size_t *resident );
+
+/*!
+    @function
+    @abstract   Make the pixels of one scale of an image set available.
+    @discussion
+        The pixels of a scale of a managed image set (see ar2SetImageSetResidencyBudget()) may
+        be accessed only between a call to this function and the matching call to
+        ar2ReleaseImageScale(); at other times, imgBW may be NULL or may change. Calls may
+        be nested, and may be made from several threads at once; acquiring a scale already in
+        memory takes no lock. For unmanaged image sets, the pixels are always available and this
+        function does nothing.
+    @param      imageSet The image set.
+    @param      scale Index of the scale, in the range [0, imageSet->num - 1].
+    @result     0 if successful, or -1 if the scale could not be materialised.
+    @seealso ar2ReleaseImageScale ar2ReleaseImageScale
+ */
+int             ar2AcquireImageScale ( AR2ImageSetT *imageSet, int scale );
+
+/*!
+    @function
+    @abstract   Finish with the pixels of one scale of an image set.
+    @discussion
+        Ends access begun by a successful call to ar2AcquireImageScale(). Once no access remains,
+        the scale may be released to keep within the budget.
+    @param      imageSet The image set.
+    @param      scale Index of the scale, as passed to ar2AcquireImageScale().
+    @result     0 if successful, or -1 on error.
+    @seealso ar2AcquireImageScale ar2AcquireImageScale
+ */
+int             ar2ReleaseImageScale ( AR2ImageSetT *imageSet, int scale );
+
 #ifdef __cplusplus
 }
 #endif
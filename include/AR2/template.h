@@ -60,6 +60,17 @@ typedef struct {
     int          validNum;
 } AR2TemplateT;
 
+typedef struct {
+    ARUint32    *subImage1;         /* integral image of pixel values, for fine matching */
+    ARUint32    *subImage2;         /* integral image of squared pixel values            */
+    int          size;              /* entries allocated in each of the above            */
+    ARInt16     *templ;             /* template with null pixels zeroed, rows padded     */
+    ARInt16     *mask;              /* -1 where the template pixel is valid, else 0      */
+    ARInt16     *luma;              /* one padded row of luma samples                    */
+    int          templSize;         /* entries allocated in each of templ and mask       */
+    AR2TemplateT coarse;            /* reduced template for pyramid search               */
+} AR2MatchingScratchT;
+
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
 typedef struct {
     int          xsize, ysize;      /* template size         */
@@ -105,10 +116,27 @@ int ar2SetTemplateSub ( const ARParamLT *cparamLT, const float  trans[3][4], AR2
 #endif
 
 
+// mfImage is no longer used and may be NULL; it is kept for source compatibility.
 int ar2GetBestMatching ( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
                          AR2TemplateT *mtemp, int rx, int ry,
                          int search[3][2], int *bx, int *by, float *val);
 
+// As ar2GetBestMatching(), but uses caller-owned working memory instead of allocating it on each call.
+// ar2AllocMatchingScratch() (re)allocates scratch only if it is too small for mtemp, so it may be
+// called once per template size; scratch must be zeroed before its first use.
+int ar2GetBestMatchingScratch( ARUint8 *img, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                               AR2TemplateT *mtemp, int rx, int ry,
+                               int search[3][2], int *bx, int *by, float *val, AR2MatchingScratchT *scratch );
+// Coarse-to-fine variant of ar2GetBestMatchingScratch(). The template is first located at reduced
+// resolution in pyrImg, which is img's luma reduced by 2^pyrLevel in each dimension (pyrLevel 1 or 2),
+// and the best candidates are then refined at full resolution in a small window.
+int ar2GetBestMatchingPyramid( ARUint8 *img, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                               const ARUint8 *pyrImg, int pyrLevel,
+                               AR2TemplateT *mtemp, int rx, int ry,
+                               int search[3][2], int *bx, int *by, float *val, AR2MatchingScratchT *scratch );
+int ar2AllocMatchingScratch( AR2MatchingScratchT *scratch, AR2TemplateT *mtemp );
+int ar2FreeMatchingScratch ( AR2MatchingScratchT *scratch );
+
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
 int ar2GetBestMatching2( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
                          AR2Template2T *mtemp, int rx, int ry,
@@ -121,9 +149,9 @@ int ar2GetResolution( const ARParamLT *cparamLT, const float  trans[3][4], const
 int ar2GetResolution2( const ARParam *cparam, const float  trans[3][4], const float  pos[2], float  dpi[2] );
 
 // Returns -1 if no template selected, otherwise returns the 0-based index of the selected template
-// and sets 'flag' of the template to 1.
+// and sets 'flag' of the template to 1. 'seed' is the caller's random state for the random choice.
 int ar2SelectTemplate( AR2TemplateCandidateT *candidate, AR2TemplateCandidateT *prevFeature, int num,
-                       float  pos[4][2], int xsize, int ysize );
+                       float  pos[4][2], int xsize, int ysize, unsigned int *seed );
 
 
 
@@ -49,6 +49,7 @@
 #define AR2_TRACKING_H
 #include <thread_sub.h>
 #include <AR/ar.h>
+#include <AR/arImageProc.h>
 #include <AR/icp.h>
 #include <AR2/config.h>
 #include <AR2/featureSet.h>
@@ -67,6 +68,7 @@ extern "C" {
 typedef struct {
     AR2ImageSetT         *imageSet;
     AR2FeatureSetT       *featureSet;
+    AR2FeatureIndexT     *featureIndex;     // May be NULL, in which case every feature is examined for visibility.
     AR2MarkerSetT        *markerSet;
     float                 trans[3][4];
     float                 itrans[3][4];
@@ -81,12 +83,14 @@ typedef struct {
     float                 trans3[3][4];
     int                   contNum;
     AR2TemplateCandidateT     prevFeature[AR2_SEARCH_FEATURE_MAX+1];
+    float                 searchRadius;     // Adaptive search radius from recent prediction error, or 0 if not yet known.
 } AR2SurfaceSetT;
 
 typedef struct {
     float             sim;
     float             pos2d[2];
     float             pos3d[3];
+    float             residual;     // Distance of the match from the nearest search point, in pixels.
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     int               blurLevel;
 #endif
@@ -96,20 +100,36 @@ typedef struct {
 typedef struct _AR2HandleT           AR2HandleT;
 typedef struct _AR2Tracking2DParamT  AR2Tracking2DParamT;
 
-// Structure to pass parameters to threads spawned to run ar2Tracking2d().
+// Per-thread state for threads running ar2Tracking2d(), and for the thread calling ar2Tracking().
 struct _AR2Tracking2DParamT {
     struct _AR2HandleT      *ar2Handle;  // Reference to parent AR2HandleT.
-    AR2SurfaceSetT          *surfaceSet;
-    AR2TemplateCandidateT   *candidate;
-    ARUint8                 *dataPtr;    // Input image.
-    ARUint8                 *mfImage;    // (Internally allocated buffer same size as input image).
     AR2TemplateT            *templ;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     AR2Template2T           *templ2;
 #endif
+    AR2MatchingScratchT      scratch;    // Matching working memory, allocated with templ and reused for every search.
+};
+
+// A template built in an earlier frame, kept for reuse while the pose of its feature changes little.
+typedef struct {
+    AR2SurfaceSetT          *surfaceSet;    // surfaceSet, snum, level and num identify the feature.
+    int                      snum;
+    int                      level;
+    int                      num;
+    int                      frame;         // Frame in which the entry was last given to a search, or 0.
+    int                      valid;         // Non-zero if templ and J are set.
+    float                    J[2][2];       // Screen Jacobian of the feature at the pose templ was built for.
+    float                    offset[2];     // Sub-pixel offset of the feature from the pixel templ is centred on.
+    AR2TemplateT             templ;
+} AR2TemplateCacheT;
+
+// A single template search, as queued by ar2Tracking().
+typedef struct {
+    AR2TemplateCandidateT   *candidate;
+    AR2TemplateCacheT       *cache;      // Template cache entry for the candidate's feature, or NULL.
     AR2Tracking2DResultT     result;
     int                      ret;
-};
+} AR2Tracking2DTaskT;
 
 struct _AR2HandleT {
     int               trackingMode;
@@ -123,11 +143,14 @@ struct _AR2HandleT {
     int               blurLevel;
 #endif
     int               searchSize;
+    int               searchPyramidLevel;
+    int               adaptiveSearch;
     int               templateSize1;
     int               templateSize2;
     int               searchFeatureNum;
     float             simThresh;
     float             trackingThresh;
+    float             templateReuseThresh;
     /*--------------------------------*/
     float                     wtrans1[AR2_TRACKING_SURFACE_MAX][3][4];
     float                     wtrans2[AR2_TRACKING_SURFACE_MAX][3][4];
@@ -138,9 +161,25 @@ struct _AR2HandleT {
     AR2TemplateCandidateT     candidate[AR2_TRACKING_CANDIDATE_MAX+1];
     AR2TemplateCandidateT     candidate2[AR2_TRACKING_CANDIDATE_MAX+1];
     AR2TemplateCandidateT     usedFeature[AR2_SEARCH_FEATURE_MAX];
-    int                       threadNum;
-    struct _AR2Tracking2DParamT       arg[AR2_THREAD_MAX];
-    THREAD_HANDLE_T          *threadHandle[AR2_THREAD_MAX];
+    unsigned int              selectSeed;                       // Random state for ar2SelectTemplate().
+    int                       threadNum;                        // Including the thread calling ar2Tracking().
+    struct _AR2Tracking2DParamT       arg[AR2_THREAD_MAX];      // arg[0] is used by the thread calling ar2Tracking().
+    THREAD_HANDLE_T          *threadHandle[AR2_THREAD_MAX];     // threadHandle[0] is unused.
+    AR2Tracking2DTaskT        task[AR2_SEARCH_FEATURE_MAX];     // Searches for the current frame.
+    int                       taskNum;
+    volatile int              taskClaim;                        // (generation << 16) | index of next unclaimed task; 0xFFFF while closed.
+    AR2SurfaceSetT           *taskSurfaceSet;
+    ARUint8                  *taskDataPtr;
+    int                       taskSearchSize;                   // Search radius for the current frame, before per-feature adjustment.
+    ARImagePyramid           *searchPyramid;                    // Reduced frames for the first search stage.
+    ARImagePyramid           *searchPyramidShared;              // Caller's pyramid used instead of searchPyramid, or NULL.
+    ARUint8                  *searchLuma;                       // Luma of the current frame, if pixFormat is not planar.
+    const ARUint8            *taskSearchImage;                  // Reduced frame searched first, or NULL.
+    AR2TemplateCacheT         templateCache[AR2_TEMPLATE_CACHE_MAX];
+    int                       templateCacheFrame;               // Incremented on each call to ar2Tracking().
+    float                     idealBounds[4];                   // xmin, xmax, ymin, ymax of the frame in ideal screen coordinates.
+    int                      *visibleFeature;                   // Features of one scale not culled by the surface's feature index.
+    int                       visibleFeatureSize;
 };
 
 
@@ -172,6 +211,7 @@ struct _AR2HandleT {
 int             ar2Tracking              ( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet,
                                            ARUint8 *dataPtr, float  trans[3][4], float  *err );
 void           *ar2Tracking2d            ( THREAD_HANDLE_T *threadHandle );
+void            ar2Tracking2dRun         ( AR2Tracking2DParamT *arg );
 /*
 int             ar2Tracking2d            ( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet,
                                            AR2TemplateCandidateT *candidate,
@@ -236,7 +276,8 @@ int             ar2SetInitTrans          ( AR2SurfaceSetT *surfaceSet, float  tr
         This structure also specifies the size of video frames which will be later supplied to the
         ar2Tracking() function as cparamLT->param.xsize and cparamLT->param.ysize.
     @param pixFormat Pixel format of video frames which will be later supplied to the ar2Tracking() function.
-    @param threadNum Number of threads to spawn for the NFT texture tracking task.
+    @param threadNum Number of threads to use for the NFT texture tracking task, including the
+        thread calling ar2Tracking(); threadNum - 1 worker threads are spawned.
         Use AR2_TRACKING_DEFAULT_THREAD_NUM to have ARToolKit calculate a sensible default.
     @result Pointer to a newly allocated AR2HandleT structure, which holds the current state of the NFT
         texture tracker, or NULL if an error occurred.
@@ -256,7 +297,8 @@ AR2HandleT     *ar2CreateHandle          ( ARParamLT *cparamLT, AR_PIXEL_FORMAT
     @param xsize Width of video frames which will be later supplied to the ar2Tracking() function.
     @param ysize Height of video frames which will be later supplied to the ar2Tracking() function.
     @param pixFormat Pixel format of video frames which will be later supplied to the ar2Tracking() function.
-    @param threadNum Number of threads to spawn for the NFT texture tracking task.
+    @param threadNum Number of threads to use for the NFT texture tracking task, including the
+        thread calling ar2Tracking(); threadNum - 1 worker threads are spawned.
         Use AR2_TRACKING_DEFAULT_THREAD_NUM to have ARToolKit calculate a sensible default.
     @result Pointer to a newly allocated AR2HandleT structure, which holds the current state of the NFT
         texture tracker, or NULL if an error occurred.
@@ -301,6 +343,8 @@ int             ar2GetBlurLevel          ( AR2HandleT *ar2Handle, int *blurLevel
         resolution), at the cost of greater search effort. Search effort increases with
         the square of the search radius.
  
+        When the search radius adapts (see ar2SetAdaptiveSearch), this is the largest radius used.
+ 
         Default value is AR2_DEFAULT_SEARCH_SIZE, as defined in &lt;AR2/config.h&gt;
     @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
     @param searchSize The new search size to use.
@@ -323,6 +367,138 @@ int             ar2SetSearchSize         ( AR2HandleT *ar2Handle, int  searchSiz
  */
 int             ar2GetSearchSize         ( AR2HandleT *ar2Handle, int *searchSize        );
 
+/*!
+    @function
+    @abstract Set whether the feature search window adapts to how well motion is predicted.
+    @discussion
+        Each feature is searched for around positions extrapolated from its positions in up to
+        three previous frames. With adaptive search enabled, the distance between those
+        predictions and where features are actually found is measured in each frame, and the
+        search radius for the next frame is set to a multiple of it, between AR2_SEARCH_SIZE_MIN
+        and the size set with ar2SetSearchSize. The radius grows at once when prediction error
+        rises, and shrinks over several frames when motion is smooth. Each feature's radius is
+        further widened by the disagreement between its own linear and quadratic predictions.
+        When many searches fail, or tracking is restarted, the full search size is used.
+ 
+        Default value is AR2_DEFAULT_ADAPTIVE_SEARCH, as defined in &lt;AR2/config.h&gt;
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param adaptiveSearch 1 to adapt the search radius, or 0 to always use the search size.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2GetAdaptiveSearch ar2GetAdaptiveSearch
+ */
+int             ar2SetAdaptiveSearch     ( AR2HandleT *ar2Handle, int  adaptiveSearch    );
+
+/*!
+    @function
+    @abstract Get whether the feature search window adapts to how well motion is predicted.
+    @discussion
+        See the discussion under ar2SetAdaptiveSearch.
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param adaptiveSearch Pointer to an int, which on return will be filled with 1 if adaptive search is enabled, or 0 otherwise.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2SetAdaptiveSearch ar2SetAdaptiveSearch
+ */
+int             ar2GetAdaptiveSearch     ( AR2HandleT *ar2Handle, int *adaptiveSearch    );
+
+/*!
+    @function
+    @abstract Set the resolution at which features are first searched for.
+    @discussion
+        With a search pyramid level of 1 or 2, each feature is first located in a copy
+        of the frame reduced to half or quarter resolution respectively, using a template
+        reduced by the same factor, and the best few locations are then refined at full
+        resolution in a small window. Search effort in the first stage falls with the square
+        of the reduction, so larger search sizes (see ar2SetSearchSize) become affordable,
+        at some risk of missing features with little texture at the reduced scale.
+
+        Level 0 searches only at full resolution.
+
+        Default value is AR2_DEFAULT_SEARCH_PYRAMID_LEVEL, as defined in &lt;AR2/config.h&gt;
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param searchPyramidLevel 0, 1 or 2.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2GetSearchPyramidLevel ar2GetSearchPyramidLevel
+ */
+int             ar2SetSearchPyramidLevel ( AR2HandleT *ar2Handle, int  searchPyramidLevel );
+
+/*!
+    @function
+    @abstract Get the resolution at which features are first searched for.
+    @discussion
+        See the discussion under ar2SetSearchPyramidLevel.
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param searchPyramidLevel Pointer to an int, which on return will be filled with the current level.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2SetSearchPyramidLevel ar2SetSearchPyramidLevel
+ */
+int             ar2GetSearchPyramidLevel ( AR2HandleT *ar2Handle, int *searchPyramidLevel );
+
+/*!
+    @function
+    @abstract Supply the reduced frames for the first search stage from a caller's pyramid.
+    @discussion
+        By default each handle keeps its own ARImagePyramid for the first search stage (see
+        ar2SetSearchPyramidLevel). When several consumers process the same frame, such as KPM
+        and one AR2 handle per page, the frame can instead be reduced once in a pyramid owned
+        by the caller. The caller must set the pyramid to the luma of each frame with
+        arImagePyramidSetImage() before passing the frame to ar2Tracking(). If handles sharing
+        the pyramid are tracked on different threads, call ar2PrepareSearchPyramid() for each
+        beforehand, as pyramid levels are built without locking.
+
+        The pyramid is not freed by ar2DeleteHandle().
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param pyramid Pyramid of the same size as the frames passed to ar2Tracking(), or NULL to use
+        the handle's own pyramid again.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2PrepareSearchPyramid ar2PrepareSearchPyramid
+ */
+int             ar2SetSearchPyramid      ( AR2HandleT *ar2Handle, ARImagePyramid *pyramid  );
+
+/*!
+    @function
+    @abstract Build the level of the pyramid set with ar2SetSearchPyramid which the handle searches first.
+    @discussion
+        Does nothing if no pyramid has been set, or if the search pyramid level is 0.
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2SetSearchPyramid ar2SetSearchPyramid
+ */
+int             ar2PrepareSearchPyramid  ( AR2HandleT *ar2Handle );
+
+/*!
+    @function
+    @abstract Set how far the pose may change before a feature's template is rebuilt.
+    @discussion
+        The template for a feature is normally rebuilt from the reference image in every
+        frame. Instead, a template built in an earlier frame is reused as long as the local
+        perspective of the feature in the image has changed so little that no template pixel
+        would move by more than this many pixels. Whole-pixel changes in the position of the
+        feature in the image do not count, as the template is always centred on the pixel
+        nearest the feature, but changes in its sub-pixel offset from that pixel do.
+        After ar2SetInitTrans(), templates are always rebuilt in the first frame.
+
+        A value of 0 disables reuse.
+
+        Default value is AR2_DEFAULT_TEMPLATE_REUSE_THRESH, as defined in &lt;AR2/config.h&gt;
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param templateReuseThresh Largest movement of a template pixel, in pixels, for which a template is reused.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2GetTemplateReuseThresh ar2GetTemplateReuseThresh
+ */
+int             ar2SetTemplateReuseThresh( AR2HandleT *ar2Handle, float  templateReuseThresh );
+
+/*!
+    @function
+    @abstract Get how far the pose may change before a feature's template is rebuilt.
+    @discussion
+        See the discussion under ar2SetTemplateReuseThresh.
+    @param ar2Handle Tracking settings structure, as returned via ar2CreateHandle.
+    @param templateReuseThresh Pointer to a float, which on return will be filled with the current threshold.
+    @result -1 in case of error, or 0 otherwise.
+    @seealso ar2SetTemplateReuseThresh ar2SetTemplateReuseThresh
+ */
+int             ar2GetTemplateReuseThresh( AR2HandleT *ar2Handle, float *templateReuseThresh );
+
 /*!
     @function
     @abstract 
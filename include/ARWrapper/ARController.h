@@ -52,6 +52,7 @@
 #include <ARWrapper/ARMarker.h>
 #include <ARWrapper/ARMarkerSquare.h>
 #include <ARWrapper/ARMarkerMulti.h>
+#include <thread_sub.h>
 #if HAVE_NFT
 #  include <AR2/tracking.h>
 #  include <KPM/kpm.h>
@@ -133,6 +134,9 @@ private:
 	AR3DHandle *m_ar3DHandle;		    ///< Structure used to compute 3D poses from tracking data
     ARdouble m_transL2R[3][4];
     AR3DStereoHandle *m_ar3DStereoHandle;
+    THREAD_HANDLE_T *m_detectionThread1;  ///< In stereo mode, worker running arDetectMarker() on the right frame concurrently with the left.
+    AR2VideoBufferT *m_detectionImage1;   ///< Right frame passed to m_detectionThread1.
+    int m_detectionResult1;               ///< Result of arDetectMarker() on m_detectionThread1.
     
 #if HAVE_NFT
     bool doNFTMarkerDetection;
@@ -141,9 +145,18 @@ private:
     bool m_kpmBusy;
     // NFT data.
     THREAD_HANDLE_T     *trackingThreadHandle;
-    AR2HandleT          *m_ar2Handle;
     KpmHandle           *m_kpmHandle;
+    ARImagePyramid      *m_nftPyramid;                      ///< Reductions of the current frame's luma, shared by KPM and the AR2 handles.
     AR2SurfaceSetT      *surfaceSet[PAGES_MAX]; // Weak-reference. Strong reference is now in ARMarkerNFT class.
+    AR2HandleT          *m_ar2Handles[PAGES_MAX];           ///< One per loaded page, so that pages can be tracked concurrently.
+    int                  m_nftTrackingThreadCount;
+    THREAD_HANDLE_T     *m_nftTrackingThreads[PAGES_MAX];   ///< Workers running ar2Tracking() on pages alongside the thread calling update().
+    ARUint8             *m_nftTrackingImage;                ///< Frame passed to the page tracking workers.
+    int                  m_nftTrackingPageCount;            ///< Number of entries in m_nftTrackingPages.
+    int                  m_nftTrackingPages[PAGES_MAX];     ///< Pages to be tracked in the current frame.
+    int                  m_nftTrackingResults[PAGES_MAX];   ///< Per-page result of ar2Tracking().
+    float                m_nftTrackingTrans[PAGES_MAX][3][4];
+    float                m_nftTrackingErr[PAGES_MAX];
 #endif
     
     int m_error;
@@ -180,10 +193,15 @@ private:
     //
     
     bool initAR(void);
+    static void *detectionWorker1(THREAD_HANDLE_T *threadHandle);
+    void stopDetectionThread(void);
 #if HAVE_NFT
     bool unloadNFTData(void);
     bool loadNFTData(void);
     bool initNFT(void);
+    AR2HandleT *createAR2Handle(int threadNum);
+    static void *nftTrackingWorker(THREAD_HANDLE_T *threadHandle);
+    void trackNFTPages(int index);
 #endif
 
 public:
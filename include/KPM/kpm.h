@@ -216,6 +216,7 @@ int         kpmHandleGetYSize(const KpmHandle *kpmHandle);
     
 int         kpmSetProcMode( KpmHandle *kpmHandle, KPM_PROC_MODE  procMode );
 int         kpmGetProcMode( KpmHandle *kpmHandle, KPM_PROC_MODE *procMode );
+int         kpmGetPyramidLevel( KpmHandle *kpmHandle, AR_IMAGE_PYRAMID_LEVEL *level ); // Level of an ARImagePyramid read by kpmMatchingPyramid() in the current proc mode.
 int         kpmSetDetectedFeatureMax( KpmHandle *kpmHandle, int  detectedMaxFeature );
 int         kpmGetDetectedFeatureMax( KpmHandle *kpmHandle, int *detectedMaxFeature );
 int         kpmSetSurfThreadNum( KpmHandle *kpmHandle, int surfThreadNum );
@@ -274,6 +275,23 @@ int         kpmSetRefDataSetFileOld( KpmHandle *kpmHandle, const char *filename,
  */
 int         kpmMatching(KpmHandle *kpmHandle, ARUint8 *inImageLuma);
 
+/*!
+    @function
+    @abstract Perform key-point matching on an image held in a shared image pyramid.
+    @discussion This variant of kpmMatching() takes its input from an ARImagePyramid,
+        so that a reduced-resolution level already built for the current frame by another
+        consumer is reused rather than regenerated. The level required by the handle's
+        processing mode is built on demand if not already valid.
+    @param kpmHandle
+    @param pyramid Pyramid which has been set to the frame to search via arImagePyramidSetImage().
+        The dimensions of the pyramid must match the values specified at the time of creation
+        of the KPM handle.
+    @result 0 if successful, or value &lt;0 in case of error.
+    @seealso kpmMatching kpmMatching
+    @seealso arImagePyramidSetImage arImagePyramidSetImage
+ */
+int         kpmMatchingPyramid(KpmHandle *kpmHandle, ARImagePyramid *pyramid);
+
 int         kpmSetMatchingSkipPage( KpmHandle *kpmHandle, int *skipPages, int num );
 #if !BINARY_FEATURE
 int         kpmSetMatchingSkipRegion( KpmHandle *kpmHandle, SurfSubRect *skipRegion, int regionNum);
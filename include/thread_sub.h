@@ -109,6 +109,34 @@ void *threadGetArg( THREAD_HANDLE_T *flag );    // Get the 'arg' value passed to
 
 int threadGetCPU(void); // Returns the number of online CPUs in the system.
 
+//
+// Thread pool.
+//
+// Splits a range [0, count) into contiguous bands, and runs func() on each band, one band per thread.
+// The calling thread processes the first band, so a pool of threadNum threads has threadNum - 1 workers.
+//
+
+#define THREAD_POOL_MAX 64 // Maximum number of threads in a pool, including the calling thread.
+
+typedef struct _THREAD_POOL_T THREAD_POOL_T;
+
+THREAD_POOL_T *threadPoolInit( int threadNum ); // Create a pool of threadNum threads (including the calling thread). 0 = one thread per online CPU. Returns NULL in case of failure.
+int threadPoolFree( THREAD_POOL_T **pool );     // Stops the workers and frees the pool pointed to by the location pointed to by pool. Location pointed to by pool is set to NULL.
+int threadPoolGetThreadNum( THREAD_POOL_T *pool ); // Number of threads (including the calling thread) actually started.
+int threadPoolRun( THREAD_POOL_T *pool, int count, int minCount, void (*func)( void *arg, int begin, int end ), void *arg ); // Run func() over [0, count), with bands of at least minCount, and wait for all bands to complete. Not reentrant for a given pool.
+int threadParallelRun( int count, int minCount, void (*func)( void *arg, int begin, int end ), void *arg ); // As threadPoolRun(), on a pool of one thread per online CPU which is created and freed for this call only.
+
+// Example:
+//
+//    static void rows( void *arg, int begin, int end )
+//    {
+//        for (int j = begin; j < end; j++) {
+//            // Process row j of arg.
+//        }
+//    }
+//
+//    threadParallelRun(ysize, 16, rows, image);
+
 
 #ifdef __cplusplus
 }
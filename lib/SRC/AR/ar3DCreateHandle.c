@@ -64,6 +64,8 @@ AR3DHandle *ar3DCreateHandle2(ARdouble cpara[3][4])
         free( handle );
         return NULL;
     }
+    handle->threadNum  = AR_3D_THREAD_NUM_DEFAULT;
+    handle->threadPool = NULL;
 
     return handle;
 }
@@ -72,6 +74,7 @@ int ar3DDeleteHandle( AR3DHandle **handle )
 {
     if( *handle == NULL ) return -1;
 
+    ar3DSetThreadNum( *handle, 1 ); // Stops any worker threads.
     icpDeleteHandle( &((*handle)->icpHandle) );
     free( *handle );
     *handle = NULL;
@@ -60,6 +60,7 @@ ARHandle *arCreateHandle( ARParamLT *paramLT )
     handle->labelInfo.bwImage       = NULL;
 #endif
     handle->arImageProcInfo         = NULL;
+    handle->arLabelingThreshAutoHistSubsample = AR_LABELING_THRESH_AUTO_HIST_SUBSAMPLE_DEFAULT;
     handle->arPixelFormat           = AR_PIXEL_FORMAT_INVALID;
     handle->arPixelSize             = 0;
     handle->arLabelingMode          = AR_DEFAULT_LABELING_MODE;
@@ -69,6 +70,10 @@ ARHandle *arCreateHandle( ARParamLT *paramLT )
     handle->arMarkerExtractionMode  = AR_DEFAULT_MARKER_EXTRACTION_MODE;
     handle->pattRatio               = AR_PATT_RATIO;
     handle->matrixCodeType          = AR_MATRIX_CODE_TYPE_DEFAULT;
+    handle->arStaticSceneThresh     = AR_STATIC_SCENE_THRESH_DEFAULT;
+    handle->arStaticSceneRefValid   = 0;
+    handle->arStaticSceneRef        = NULL;
+    handle->arStaticSceneCur        = NULL;
 
     handle->arParamLT           = paramLT;
     handle->xsize               = paramLT->param.xsize;
@@ -109,6 +114,9 @@ int arDeleteHandle( ARHandle *handle )
         handle->arImageProcInfo = NULL;
     }
 
+    free( handle->arStaticSceneRef );
+    free( handle->arStaticSceneCur );
+
     //if( handle->arParamLT != NULL ) arParamLTFree( &handle->arParamLT );
     free( handle->labelInfo.labelImage );
 #if !AR_DISABLE_LABELING_DEBUG_MODE
@@ -208,6 +216,7 @@ int arSetLabelingThreshMode(ARHandle *handle, const AR_LABELING_THRESH_MODE mode
             case AR_LABELING_THRESH_MODE_AUTO_ADAPTIVE:
 #endif
                 handle->arImageProcInfo = arImageProcInit(handle->xsize, handle->ysize, handle->arPixelFormat, 0);
+                arImageProcSetHistSubsample(handle->arImageProcInfo, handle->arLabelingThreshAutoHistSubsample);
                 break;
             case AR_LABELING_THRESH_MODE_AUTO_BRACKETING:
                 handle->arLabelingThreshAutoBracketOver = handle->arLabelingThreshAutoBracketUnder = 1;
@@ -255,6 +264,21 @@ int arGetLabelingThreshModeAutoInterval(const ARHandle *handle, int *interval_p)
     return (0);
 }
 
+int arSetLabelingThreshModeAutoHistSubsample(ARHandle *handle, const int subsample)
+{
+    if (!handle || subsample < 1) return (-1);
+    handle->arLabelingThreshAutoHistSubsample = subsample;
+    if (handle->arImageProcInfo) arImageProcSetHistSubsample(handle->arImageProcInfo, subsample);
+    return (0);
+}
+
+int arGetLabelingThreshModeAutoHistSubsample(const ARHandle *handle, int *subsample_p)
+{
+    if (!handle || !subsample_p) return (-1);
+    *subsample_p = handle->arLabelingThreshAutoHistSubsample;
+    return (0);
+}
+
 int arSetImageProcMode( ARHandle *handle, int mode )
 {
     if( handle == NULL ) return -1;
@@ -348,6 +372,33 @@ int arGetMarkerExtractionMode( ARHandle *handle, int *mode )
     return 0;
 }
 
+int arSetStaticSceneThresh( ARHandle *handle, const int thresh )
+{
+    int    sampleCount;
+
+    if( handle == NULL ) return -1;
+    if( thresh < 0 || thresh > 255 ) return -1;
+
+    if( thresh > 0 && handle->arStaticSceneRef == NULL ) {
+        sampleCount = ((handle->xsize + AR_STATIC_SCENE_SAMPLE_STEP - 1) / AR_STATIC_SCENE_SAMPLE_STEP)
+                    * ((handle->ysize + AR_STATIC_SCENE_SAMPLE_STEP - 1) / AR_STATIC_SCENE_SAMPLE_STEP);
+        arMalloc( handle->arStaticSceneRef, ARUint8, sampleCount );
+        arMalloc( handle->arStaticSceneCur, ARUint8, sampleCount );
+    }
+    handle->arStaticSceneThresh   = thresh;
+    handle->arStaticSceneRefValid = 0;
+
+    return 0;
+}
+
+int arGetStaticSceneThresh( ARHandle *handle, int *thresh_p )
+{
+    if( handle == NULL || thresh_p == NULL ) return -1;
+    *thresh_p = handle->arStaticSceneThresh;
+
+    return 0;
+}
+
 int arSetBorderSize( ARHandle *handle, const ARdouble borderSize )
 {
     if( handle == NULL ) return -1;
@@ -421,6 +472,7 @@ int arSetPixelFormat( ARHandle *handle, AR_PIXEL_FORMAT pixFormat )
     if (handle->arImageProcInfo) {
         arImageProcFinal(handle->arImageProcInfo);
         handle->arImageProcInfo = arImageProcInit(handle->xsize, handle->ysize, handle->arPixelFormat, 0);
+        arImageProcSetHistSubsample(handle->arImageProcInfo, handle->arLabelingThreshAutoHistSubsample);
     }
 
     // If template matching, automatically switch to these most suitable colour template matching mode.
@@ -36,6 +36,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h> // abs()
 #include <AR/ar.h>
 #include <AR/arImageProc.h>
 
@@ -57,8 +58,68 @@ const char *arMarkerInfoCutoffPhaseDescriptions[AR_MARKER_INFO_CUTOFF_PHASE_DESC
 };
 
 static void confidenceCutoff(ARHandle *arHandle);
+static int  staticSceneIsUnchanged(ARHandle *arHandle, const ARUint8 *buffLuma);
+static int  detectMarker(ARHandle *arHandle, AR2VideoBufferT *frame);
 
 int arDetectMarker(ARHandle *arHandle, AR2VideoBufferT *frame)
+{
+    ARUint8    *tmp;
+    int         ret;
+
+    if (!arHandle || !frame) return (-1);
+
+    if (arHandle->arStaticSceneThresh > 0 && frame->buffLuma) {
+        // If no tile has changed since the last detection, the previous results stand.
+        if (staticSceneIsUnchanged(arHandle, frame->buffLuma)) return (0);
+
+        ret = detectMarker(arHandle, frame);
+
+        // This frame's samples become the reference, but only if it produced valid results.
+        tmp = arHandle->arStaticSceneRef;
+        arHandle->arStaticSceneRef = arHandle->arStaticSceneCur;
+        arHandle->arStaticSceneCur = tmp;
+        arHandle->arStaticSceneRefValid = (ret == 0);
+        return (ret);
+    }
+
+    return (detectMarker(arHandle, frame));
+}
+
+// Samples the luma image into arStaticSceneCur, and compares it tile-by-tile against
+// arStaticSceneRef. Returns 1 if the reference is valid and no tile's mean absolute
+// difference exceeds arStaticSceneThresh, 0 otherwise.
+static int staticSceneIsUnchanged(ARHandle *arHandle, const ARUint8 *buffLuma)
+{
+    const int   sx = (arHandle->xsize + AR_STATIC_SCENE_SAMPLE_STEP - 1) / AR_STATIC_SCENE_SAMPLE_STEP;
+    const int   sy = (arHandle->ysize + AR_STATIC_SCENE_SAMPLE_STEP - 1) / AR_STATIC_SCENE_SAMPLE_STEP;
+    const int   tileSamples = AR_STATIC_SCENE_TILE_SIZE / AR_STATIC_SCENE_SAMPLE_STEP;
+    const int   refValid = arHandle->arStaticSceneRefValid;
+    int         unchanged = refValid;
+    int         tx, ty, i, j, iMax, jMax;
+    int         sad;
+
+    for (ty = 0; ty < sy; ty += tileSamples) {
+        jMax = (ty + tileSamples < sy ? ty + tileSamples : sy);
+        for (tx = 0; tx < sx; tx += tileSamples) {
+            iMax = (tx + tileSamples < sx ? tx + tileSamples : sx);
+            sad = 0;
+            for (j = ty; j < jMax; j++) {
+                const ARUint8 *src = buffLuma + (size_t)j*AR_STATIC_SCENE_SAMPLE_STEP*arHandle->xsize;
+                ARUint8       *cur = arHandle->arStaticSceneCur + j*sx;
+                const ARUint8 *ref = arHandle->arStaticSceneRef + j*sx;
+                for (i = tx; i < iMax; i++) {
+                    cur[i] = src[i*AR_STATIC_SCENE_SAMPLE_STEP];
+                    if (refValid) sad += abs((int)cur[i] - (int)ref[i]);
+                }
+            }
+            if (sad > arHandle->arStaticSceneThresh * (jMax - ty) * (iMax - tx)) unchanged = 0;
+        }
+    }
+
+    return (unchanged);
+}
+
+static int detectMarker(ARHandle *arHandle, AR2VideoBufferT *frame)
 {
     ARdouble    rarea, rlen, rlenmin;
     ARdouble    diff, diffmin;
@@ -71,8 +132,6 @@ int arDetectMarker(ARHandle *arHandle, AR2VideoBufferT *frame)
 cnt = 0;
 #endif
 
-    if (!arHandle || !frame) return (-1);
-
     arHandle->marker_num = 0;
 
     if (arHandle->arLabelingThreshMode == AR_LABELING_THRESH_MODE_AUTO_BRACKETING) {
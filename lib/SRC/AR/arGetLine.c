@@ -62,6 +62,8 @@
 #  define FABS(x) fabs(x)
 #endif
 
+#define AR_GET_LINE_BATCH 64
+
 int arGetLine(int x_coord[], int y_coord[],
               __attribute__((unused)) int coord_num, int vertex[],
               ARParamLTf *paramLTf, ARdouble line[4][3], ARdouble v[4][2])
@@ -69,8 +71,9 @@ int arGetLine(int x_coord[], int y_coord[],
     ARMat    *input, *evec;
     ARVec    *ev, *mean;
     ARdouble   w1;
+    float    pos[AR_GET_LINE_BATCH][2];
     int      st, ed, n;
-    int      i, j;
+    int      i, j, k, l;
 
     ev     = arVecAlloc( 2 );
     mean   = arVecAlloc( 2 );
@@ -81,16 +84,17 @@ int arGetLine(int x_coord[], int y_coord[],
         ed = (int)(vertex[i+1] - w1);
         n = ed - st + 1;
         input  = arMatrixAlloc( n, 2 );
-        for( j = 0; j < n; j++ ) {
-#ifdef ARDOUBLE_IS_FLOAT
-            if (arParamObserv2IdealLTf( paramLTf, (float)x_coord[st+j], (float)y_coord[st+j],
-                                       &(input->m[j*2+0]), &(input->m[j*2+1]) ) < 0) goto bail;
-#else
-            float m0, m1;
-            if (arParamObserv2IdealLTf( paramLTf, (float)x_coord[st+j], (float)y_coord[st+j], &m0, &m1 ) < 0) goto bail;
-            input->m[j*2+0] = (ARdouble)m0;
-            input->m[j*2+1] = (ARdouble)m1;
-#endif
+        for( j = 0; j < n; j += k ) {
+            k = (n - j < AR_GET_LINE_BATCH) ? n - j : AR_GET_LINE_BATCH;
+            for( l = 0; l < k; l++ ) {
+                pos[l][0] = (float)x_coord[st+j+l];
+                pos[l][1] = (float)y_coord[st+j+l];
+            }
+            if( arParamObserv2IdealLTfBatch( paramLTf, &(pos[0][0]), &(pos[0][0]), k ) < 0 ) goto bail;
+            for( l = 0; l < k; l++ ) {
+                input->m[(j+l)*2+0] = (ARdouble)pos[l][0];
+                input->m[(j+l)*2+1] = (ARdouble)pos[l][1];
+            }
             //arParamObserv2Ideal( dist_factor, (ARdouble)x_coord[st+j], (ARdouble)y_coord[st+j],
             //                     &(input->m[j*2+0]), &(input->m[j*2+1]), dist_function_version );
         }
@@ -90,7 +90,10 @@ ARdouble arGetTransMatSquare( AR3DHandle *handle, ARMarkerInfo *marker_info, ARd
     data.worldCoord  = worldCoord;
     data.num         = 4;
 
-    if( icpGetInitXw2Xc_from_PlanarData( handle->icpHandle->matXc2U, data.screenCoord, data.worldCoord, data.num, initMatXw2Xc ) < 0 ) return 100000000.0;
+    // Prefer the analytic (IPPE) planar pose, which usually leaves ICP very little to do.
+    if( icpGetInitXw2Xc_from_PlanarDataIPPE( handle->icpHandle->matXc2U, data.screenCoord, data.worldCoord, data.num, initMatXw2Xc ) < 0 ) {
+        if( icpGetInitXw2Xc_from_PlanarData( handle->icpHandle->matXc2U, data.screenCoord, data.worldCoord, data.num, initMatXw2Xc ) < 0 ) return 100000000.0;
+    }
 
 
     if( icpPoint( handle->icpHandle, &data, initMatXw2Xc, conv, &err ) < 0 ) return 100000000.0;
@@ -104,6 +107,7 @@ ARdouble arGetTransMatSquareCont( AR3DHandle *handle, ARMarkerInfo *marker_info,
     ICP2DCoordT    screenCoord[4];
     ICP3DCoordT    worldCoord[4];
     ICPDataT       data;
+    ARdouble         initMatXw2Xc[3][4];
     ARdouble         err;
     int            dir;
 
@@ -138,7 +142,15 @@ ARdouble arGetTransMatSquareCont( AR3DHandle *handle, ARMarkerInfo *marker_info,
     data.worldCoord  = worldCoord;
     data.num         = 4;
 
-    if( icpPoint( handle->icpHandle, &data, initConv, conv, &err ) < 0 ) return 100000000.0;
+    // Start from whichever of the previous pose and the analytic planar pose fits better.
+    if( icpGetInitXw2Xc_from_PlanarDataIPPE( handle->icpHandle->matXc2U, data.screenCoord, data.worldCoord, data.num, initMatXw2Xc ) == 0
+        && icpGetReprojectionError( handle->icpHandle->matXc2U, initMatXw2Xc, data.screenCoord, data.worldCoord, data.num )
+         < icpGetReprojectionError( handle->icpHandle->matXc2U, initConv, data.screenCoord, data.worldCoord, data.num ) ) {
+        if( icpPoint( handle->icpHandle, &data, initMatXw2Xc, conv, &err ) < 0 ) return 100000000.0;
+    }
+    else {
+        if( icpPoint( handle->icpHandle, &data, initConv, conv, &err ) < 0 ) return 100000000.0;
+    }
 
     return err;
 }
@@ -0,0 +1,123 @@
+/*
+ *  arGetTransMatBatch.c
+ *  ARToolKit5
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  ARToolKit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ARToolKit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with ARToolKit.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2015 Daqri, LLC.
+ *
+ */
+
+#include <AR/ar.h>
+#include <AR/icp.h>
+#include <thread_sub.h>
+
+typedef struct {
+    AR3DHandle      *handle;
+    ARMarkerInfo    *marker_info;
+    const ARdouble  *widths;
+    ARdouble       (*conv)[3][4];
+    ARdouble        *err;
+} AR3DBatchJobT;
+
+// Processes markers [begin, end) of the batch.
+static void ar3DBatchRun( void *arg, int begin, int end )
+{
+    AR3DBatchJobT  *job = (AR3DBatchJobT *)arg;
+    ARdouble        err;
+    int             i;
+
+    for( i = begin; i < end; i++ ) {
+        if( job->widths[i] <= 0.0 ) {
+            if( job->err ) job->err[i] = -1.0;
+            continue;
+        }
+        err = arGetTransMatSquare( job->handle, &(job->marker_info[i]), job->widths[i], job->conv[i] );
+        if( job->err ) job->err[i] = err;
+    }
+}
+
+int ar3DSetThreadNum( AR3DHandle *handle, int threadNum )
+{
+    if( handle == NULL ) return -1;
+    if( threadNum < 0 || threadNum > AR_3D_THREAD_MAX ) {
+        ARLOGe("Error: Pose estimation thread count %d out of range.\n", threadNum);
+        return -1;
+    }
+
+    if( handle->threadPool ) threadPoolFree( &(handle->threadPool) );
+    handle->threadNum = threadNum;
+
+    return 0;
+}
+
+int ar3DGetThreadNum( AR3DHandle *handle, int *threadNum )
+{
+    if( handle == NULL || threadNum == NULL ) return -1;
+    *threadNum = handle->threadNum;
+
+    return 0;
+}
+
+int arGetTransMatSquareBatch( AR3DHandle *handle, ARMarkerInfo *marker_info, int marker_num,
+                              const ARdouble *widths, ARdouble (*conv)[3][4], ARdouble *err )
+{
+    AR3DBatchJobT   job;
+    int             threadNum;
+    int             i, count;
+
+    if( handle == NULL || marker_num < 0 ) return -1;
+    if( marker_num == 0 ) return 0;
+    if( marker_info == NULL || widths == NULL || conv == NULL ) return -1;
+
+    job.handle      = handle;
+    job.marker_info = marker_info;
+    job.widths      = widths;
+    job.conv        = conv;
+    job.err         = err;
+
+    if( marker_num >= AR_3D_BATCH_THREAD_MIN_MARKERS && handle->threadNum != 1 ) {
+        if( handle->threadPool == NULL ) {
+            threadNum = handle->threadNum;
+            if( threadNum == 0 ) {
+                threadNum = threadGetCPU();
+                if( threadNum > AR_3D_THREAD_MAX ) threadNum = AR_3D_THREAD_MAX;
+            }
+            if( threadNum > 1 ) handle->threadPool = threadPoolInit( threadNum );
+        }
+    }
+    if( handle->threadPool && marker_num >= AR_3D_BATCH_THREAD_MIN_MARKERS ) {
+        threadPoolRun( handle->threadPool, marker_num, 1, ar3DBatchRun, &job );
+    } else {
+        ar3DBatchRun( &job, 0, marker_num );
+    }
+
+    count = 0;
+    for( i = 0; i < marker_num; i++ ) if( widths[i] > 0.0 ) count++;
+
+    return count;
+}
@@ -41,9 +41,28 @@
 
 #include <AR/arImageProc.h>
 #include <string.h> // memset(), memcpy()
+#include <stdint.h>
 #if AR_IMAGEPROC_USE_VIMAGE
 #include <Accelerate/Accelerate.h>
 #endif
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+#include <arm_neon.h>
+#elif defined(HAVE_INTEL_SIMD)
+#include <emmintrin.h> // SSE2.
+#endif
+
+// Number of partial histograms. Consecutive pixels are counted into different
+// partial histograms, so that runs of equal values (common in flat image
+// regions) don't serialise on a store-to-load dependency on a single bin.
+#define AR_IMAGEPROC_HIST_WAYS 4
+
+#define COUNT_WORD(counts, w)                                                  \
+    do {                                                                       \
+        (counts)[0][(w)&0xff]++;                                               \
+        (counts)[1][((w) >> 8) & 0xff]++;                                      \
+        (counts)[2][((w) >> 16) & 0xff]++;                                     \
+        (counts)[3][(w) >> 24]++;                                              \
+    } while (0)
 
 ARImageProcInfo *arImageProcInit(const int xsize, const int ysize,
                                  __attribute__((unused))
@@ -54,6 +73,8 @@ ARImageProcInfo *arImageProcInit(const int xsize, const int ysize,
         ipi->image2 = NULL;
         ipi->imageX = xsize;
         ipi->imageY = ysize;
+        ipi->histCount = 0;
+        ipi->histSubsample = 1;
 #if AR_IMAGEPROC_USE_VIMAGE
         ipi->tempBuffer = NULL;
 #endif
@@ -73,31 +94,117 @@ void arImageProcFinal(ARImageProcInfo *ipi) {
     free(ipi);
 }
 
+int arImageProcSetHistSubsample(ARImageProcInfo *ipi, const int subsample) {
+    if (!ipi || subsample < 1)
+        return (-1);
+    ipi->histSubsample = subsample;
+    return (0);
+}
+
+// Count n contiguous pixels into the partial histograms.
+static void lumaHistCountContiguous(
+    unsigned int counts[AR_IMAGEPROC_HIST_WAYS][256],
+    const ARUint8 *__restrict p, const size_t n) {
+    size_t i = 0;
+    uint32_t w;
+
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+    for (; i + 16 <= n; i += 16) {
+        uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(p + i));
+        w = vgetq_lane_u32(v, 0);
+        COUNT_WORD(counts, w);
+        w = vgetq_lane_u32(v, 1);
+        COUNT_WORD(counts, w);
+        w = vgetq_lane_u32(v, 2);
+        COUNT_WORD(counts, w);
+        w = vgetq_lane_u32(v, 3);
+        COUNT_WORD(counts, w);
+    }
+#elif defined(HAVE_INTEL_SIMD)
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        w = (uint32_t)_mm_cvtsi128_si32(v);
+        COUNT_WORD(counts, w);
+        w = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(v, 4));
+        COUNT_WORD(counts, w);
+        w = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+        COUNT_WORD(counts, w);
+        w = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(v, 12));
+        COUNT_WORD(counts, w);
+    }
+#else
+    for (; i + 8 <= n; i += 8) {
+        uint32_t w1;
+        memcpy(&w, p + i, sizeof(w)); // Compiles to a single (unaligned) load.
+        memcpy(&w1, p + i + 4, sizeof(w1));
+        COUNT_WORD(counts, w);
+        COUNT_WORD(counts, w1);
+    }
+#endif
+    for (; i < n; i++)
+        counts[i & (AR_IMAGEPROC_HIST_WAYS - 1)][p[i]]++;
+}
+
+// Count every step'th pixel of a row of n pixels into the partial histograms.
+static void lumaHistCountStrided(
+    unsigned int counts[AR_IMAGEPROC_HIST_WAYS][256],
+    const ARUint8 *__restrict p, const size_t n, const size_t step) {
+    size_t i = 0;
+
+    for (; i + 3 * step < n; i += 4 * step) {
+        counts[0][p[i]]++;
+        counts[1][p[i + step]]++;
+        counts[2][p[i + 2 * step]]++;
+        counts[3][p[i + 3 * step]]++;
+    }
+    for (; i < n; i += step)
+        counts[0][p[i]]++;
+}
+
 int arImageProcLumaHist(ARImageProcInfo *ipi,
                         const ARUint8 *__restrict dataPtr) {
     if (!ipi || !dataPtr)
         return (-1);
 
 #ifdef AR_IMAGEPROC_USE_VIMAGE
-    vImage_Error err;
-    vImage_Buffer buf = {
-        (void *)dataPtr, ipi->imageY, ipi->imageX, ipi->imageX};
-    if ((err = vImageHistogramCalculation_Planar8(&buf, ipi->histBins, 0)) !=
-        kvImageNoError) {
-        ARLOGe("arImageProcLumaHist(): vImageHistogramCalculation_Planar8 "
-               "error %ld.\n",
-               err);
-        return (-1);
+    if (ipi->histSubsample == 1) {
+        vImage_Error err;
+        vImage_Buffer buf = {
+            (void *)dataPtr, ipi->imageY, ipi->imageX, ipi->imageX};
+        if ((err = vImageHistogramCalculation_Planar8(
+                 &buf, ipi->histBins, 0)) != kvImageNoError) {
+            ARLOGe("arImageProcLumaHist(): vImageHistogramCalculation_Planar8 "
+                   "error %ld.\n",
+                   err);
+            return (-1);
+        }
+        ipi->histCount = (unsigned long)ipi->imageX * ipi->imageY;
+        return (0);
     }
-#else
-    unsigned char *__restrict p;
-    memset(ipi->histBins, 0, sizeof(ipi->histBins));
-    for (p = (unsigned char *__restrict)dataPtr;
-         p < dataPtr + ipi->imageX * ipi->imageY;
-         p++)
-        ipi->histBins[*p]++;
 #endif // AR_IMAGEPROC_USE_VIMAGE
 
+    unsigned int counts[AR_IMAGEPROC_HIST_WAYS][256];
+    int i, j;
+    const int step = ipi->histSubsample;
+
+    memset(counts, 0, sizeof(counts));
+    if (step == 1) {
+        lumaHistCountContiguous(counts, dataPtr,
+                                (size_t)ipi->imageX * ipi->imageY);
+        ipi->histCount = (unsigned long)ipi->imageX * ipi->imageY;
+    } else {
+        for (j = 0; j < ipi->imageY; j += step)
+            lumaHistCountStrided(counts, dataPtr + (size_t)j * ipi->imageX,
+                                 ipi->imageX, step);
+        ipi->histCount = (unsigned long)((ipi->imageX + step - 1) / step) *
+                         ((ipi->imageY + step - 1) / step);
+    }
+
+    for (i = 0; i < 256; i++)
+        ipi->histBins[i] =
+            (unsigned long)counts[0][i] + counts[1][i] + counts[2][i] +
+            counts[3][i];
+
     return (0);
 }
 
@@ -170,7 +277,7 @@ int arImageProcLumaHistAndCDFAndPercentile(ARImageProcInfo *ipi,
     if (ret < 0)
         return (ret);
 
-    requiredCD = (unsigned int)(ipi->imageX * ipi->imageY * percentile);
+    requiredCD = (unsigned int)(ipi->histCount * percentile);
     i = 0;
     while (ipi->cdfBins[i] < requiredCD)
         i++; // cdfBins[i] >= requiredCD
@@ -207,7 +314,7 @@ int arImageProcLumaHistAndOtsu(ARImageProcInfo *ipi,
         i++;
     } while (i != 0);
 
-    float count = (float)(ipi->imageX * ipi->imageY);
+    float count = (float)ipi->histCount;
     float sumB = 0.0f;
     float wB = 0.0f;
     float wF = 0.0f;
@@ -340,7 +447,7 @@ int arImageProcLumaHistAndCDFAndLevels(ARImageProcInfo *ipi,
     while (ipi->cdfBins[l] == 0)
         l++;
     ipi->min = l;
-    maxCD = ipi->imageX * ipi->imageY;
+    maxCD = ipi->histCount;
     while (ipi->cdfBins[l] < maxCD)
         l++;
     ipi->max = l;
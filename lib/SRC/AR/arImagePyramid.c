@@ -0,0 +1,378 @@
+/*
+ *  arImagePyramid.c
+ *  ARToolKit5
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  ARToolKit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ARToolKit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with ARToolKit.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2015-2016 Daqri, LLC.
+ *
+ */
+
+#include <AR/arImageProc.h>
+#include <string.h> // memcpy()
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+#  include <arm_neon.h>
+#elif defined(HAVE_INTEL_SIMD)
+#  include <emmintrin.h> // SSE2.
+#  include <tmmintrin.h> // SSSE3.
+#endif
+
+static void reduceHalf(const ARUint8 *__restrict src, const int xsize, const int ysize, ARUint8 *__restrict dst);
+static void reduceQuarter(const ARUint8 *__restrict src, const int xsize, const int ysize, ARUint8 *__restrict dst);
+static void reduceOneThird(const ARUint8 *__restrict src, const int xsize, const int ysize, ARUint8 *__restrict dst);
+static void reduceTwoThird(const ARUint8 *__restrict src, const int xsize, const int ysize, ARUint8 *__restrict dst);
+
+ARImagePyramid *arImagePyramidInit(const int xsize, const int ysize)
+{
+    ARImagePyramid *pyramid;
+    int i;
+
+    if (xsize <= 0 || ysize <= 0) return (NULL);
+
+    pyramid = (ARImagePyramid *)malloc(sizeof(ARImagePyramid));
+    if (!pyramid) {
+        ARLOGe("Out of memory!!\n");
+        return (NULL);
+    }
+    pyramid->xsize = xsize;
+    pyramid->ysize = ysize;
+    pyramid->image = NULL;
+    for (i = 0; i < AR_IMAGE_PYRAMID_LEVEL_COUNT; i++) {
+        pyramid->levelImage[i] = NULL;
+        pyramid->levelValid[i] = 0;
+    }
+    return (pyramid);
+}
+
+void arImagePyramidFinal(ARImagePyramid *pyramid)
+{
+    int i;
+
+    if (!pyramid) return;
+    for (i = 0; i < AR_IMAGE_PYRAMID_LEVEL_COUNT; i++) free(pyramid->levelImage[i]);
+    free(pyramid);
+}
+
+int arImagePyramidSetImage(ARImagePyramid *pyramid, const ARUint8 *imageLuma)
+{
+    int i;
+
+    if (!pyramid) return (-1);
+
+    // Always invalidate, as video sources may reuse the same buffer for successive frames.
+    pyramid->image = imageLuma;
+    for (i = 0; i < AR_IMAGE_PYRAMID_LEVEL_COUNT; i++) pyramid->levelValid[i] = 0;
+    return (0);
+}
+
+int arImagePyramidGetLevelSize(const int xsize, const int ysize, const AR_IMAGE_PYRAMID_LEVEL level, int *xsize_p, int *ysize_p)
+{
+    int xsize2, ysize2;
+
+    switch (level) {
+        case AR_IMAGE_PYRAMID_LEVEL_FULL:
+            xsize2 = xsize;
+            ysize2 = ysize;
+            break;
+        case AR_IMAGE_PYRAMID_LEVEL_TWO_THIRD:
+            xsize2 = xsize/3*2;
+            ysize2 = ysize/3*2;
+            break;
+        case AR_IMAGE_PYRAMID_LEVEL_HALF:
+            xsize2 = xsize/2;
+            ysize2 = ysize/2;
+            break;
+        case AR_IMAGE_PYRAMID_LEVEL_ONE_THIRD:
+            xsize2 = xsize/3;
+            ysize2 = ysize/3;
+            break;
+        case AR_IMAGE_PYRAMID_LEVEL_QUARTER:
+            xsize2 = xsize/4;
+            ysize2 = ysize/4;
+            break;
+        default:
+            return (-1);
+    }
+    if (xsize_p) *xsize_p = xsize2;
+    if (ysize_p) *ysize_p = ysize2;
+    return (0);
+}
+
+const ARUint8 *arImagePyramidGetLevel(ARImagePyramid *pyramid, const AR_IMAGE_PYRAMID_LEVEL level, int *xsize_p, int *ysize_p)
+{
+    int xsize2, ysize2;
+
+    if (!pyramid || !pyramid->image) return (NULL);
+    if (arImagePyramidGetLevelSize(pyramid->xsize, pyramid->ysize, level, &xsize2, &ysize2) < 0) return (NULL);
+    if (xsize_p) *xsize_p = xsize2;
+    if (ysize_p) *ysize_p = ysize2;
+
+    if (level == AR_IMAGE_PYRAMID_LEVEL_FULL) return (pyramid->image);
+
+    if (!pyramid->levelValid[level]) {
+        if (!pyramid->levelImage[level]) {
+            pyramid->levelImage[level] = (ARUint8 *)malloc(xsize2*ysize2);
+            if (!pyramid->levelImage[level]) {
+                ARLOGe("Out of memory!!\n");
+                return (NULL);
+            }
+        }
+        arImagePyramidReduce(pyramid->image, pyramid->xsize, pyramid->ysize, level, pyramid->levelImage[level]);
+        pyramid->levelValid[level] = 1;
+    }
+    return (pyramid->levelImage[level]);
+}
+
+int arImagePyramidCopy(ARImagePyramid *dst, ARImagePyramid *src, ARUint8 *dstImage, const AR_IMAGE_PYRAMID_LEVEL level)
+{
+    const ARUint8 *levelImage;
+    int xsize2, ysize2;
+
+    if (!dst || !src || !src->image || !dstImage) return (-1);
+    if (dst->xsize != src->xsize || dst->ysize != src->ysize) {
+        ARLOGe("arImagePyramidCopy(): Pyramid size %dx%d does not match %dx%d.\n", dst->xsize, dst->ysize, src->xsize, src->ysize);
+        return (-1);
+    }
+    if (!(levelImage = arImagePyramidGetLevel(src, level, &xsize2, &ysize2))) return (-1);
+
+    memcpy(dstImage, src->image, src->xsize*src->ysize);
+    arImagePyramidSetImage(dst, dstImage);
+    if (level == AR_IMAGE_PYRAMID_LEVEL_FULL) return (0);
+
+    if (!dst->levelImage[level]) {
+        dst->levelImage[level] = (ARUint8 *)malloc(xsize2*ysize2);
+        if (!dst->levelImage[level]) {
+            ARLOGe("Out of memory!!\n");
+            return (-1);
+        }
+    }
+    memcpy(dst->levelImage[level], levelImage, xsize2*ysize2);
+    dst->levelValid[level] = 1;
+    return (0);
+}
+
+int arImagePyramidReduce(const ARUint8 *__restrict src, const int xsize, const int ysize, const AR_IMAGE_PYRAMID_LEVEL level, ARUint8 *__restrict dst)
+{
+    if (!src || !dst) return (-1);
+
+    switch (level) {
+        case AR_IMAGE_PYRAMID_LEVEL_FULL:
+            memcpy(dst, src, xsize*ysize);
+            break;
+        case AR_IMAGE_PYRAMID_LEVEL_TWO_THIRD:
+            reduceTwoThird(src, xsize, ysize, dst);
+            break;
+        case AR_IMAGE_PYRAMID_LEVEL_HALF:
+            reduceHalf(src, xsize, ysize, dst);
+            break;
+        case AR_IMAGE_PYRAMID_LEVEL_ONE_THIRD:
+            reduceOneThird(src, xsize, ysize, dst);
+            break;
+        case AR_IMAGE_PYRAMID_LEVEL_QUARTER:
+            reduceQuarter(src, xsize, ysize, dst);
+            break;
+        default:
+            return (-1);
+    }
+    return (0);
+}
+
+// Each output pixel is the truncated mean of a 2x2 block.
+static void reduceHalf(const ARUint8 *__restrict src, const int xsize, const int ysize, ARUint8 *__restrict dst)
+{
+    const ARUint8 *p1, *p2;
+    ARUint8       *q;
+    int            xsize2 = xsize/2;
+    int            ysize2 = ysize/2;
+    int            i, j;
+
+    for (j = 0; j < ysize2; j++) {
+        p1 = src + xsize*(j*2 + 0);
+        p2 = src + xsize*(j*2 + 1);
+        q  = dst + xsize2*j;
+        i = 0;
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+        for (; i + 8 <= xsize2; i += 8) {
+            uint16x8_t s = vaddq_u16(vpaddlq_u8(vld1q_u8(p1 + i*2)), vpaddlq_u8(vld1q_u8(p2 + i*2)));
+            vst1_u8(q + i, vmovn_u16(vshrq_n_u16(s, 2)));
+        }
+#elif defined(HAVE_INTEL_SIMD)
+        const __m128i lo = _mm_set1_epi16(0x00ff);
+        for (; i + 16 <= xsize2; i += 16) {
+            __m128i a1 = _mm_loadu_si128((const __m128i *)(p1 + i*2));
+            __m128i b1 = _mm_loadu_si128((const __m128i *)(p1 + i*2 + 16));
+            __m128i a2 = _mm_loadu_si128((const __m128i *)(p2 + i*2));
+            __m128i b2 = _mm_loadu_si128((const __m128i *)(p2 + i*2 + 16));
+            // Sum horizontally adjacent pairs into 16-bit lanes, then vertically.
+            __m128i sa = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a1, lo), _mm_srli_epi16(a1, 8)),
+                                       _mm_add_epi16(_mm_and_si128(a2, lo), _mm_srli_epi16(a2, 8)));
+            __m128i sb = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(b1, lo), _mm_srli_epi16(b1, 8)),
+                                       _mm_add_epi16(_mm_and_si128(b2, lo), _mm_srli_epi16(b2, 8)));
+            _mm_storeu_si128((__m128i *)(q + i), _mm_packus_epi16(_mm_srli_epi16(sa, 2), _mm_srli_epi16(sb, 2)));
+        }
+#endif
+        for (; i < xsize2; i++) {
+            q[i] = ((int)p1[i*2] + (int)p1[i*2 + 1]
+                  + (int)p2[i*2] + (int)p2[i*2 + 1]) / 4;
+        }
+    }
+}
+
+// Each output pixel is the truncated mean of a 4x4 block.
+static void reduceQuarter(const ARUint8 *__restrict src, const int xsize, const int ysize, ARUint8 *__restrict dst)
+{
+    const ARUint8 *p1, *p2, *p3, *p4;
+    ARUint8       *q;
+    int            xsize2 = xsize/4;
+    int            ysize2 = ysize/4;
+    int            i, j;
+
+    for (j = 0; j < ysize2; j++) {
+        p1 = src + xsize*(j*4 + 0);
+        p2 = src + xsize*(j*4 + 1);
+        p3 = src + xsize*(j*4 + 2);
+        p4 = src + xsize*(j*4 + 3);
+        q  = dst + xsize2*j;
+        i = 0;
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+        for (; i + 4 <= xsize2; i += 4) {
+            uint16x8_t s = vaddq_u16(vaddq_u16(vpaddlq_u8(vld1q_u8(p1 + i*4)), vpaddlq_u8(vld1q_u8(p2 + i*4))),
+                                     vaddq_u16(vpaddlq_u8(vld1q_u8(p3 + i*4)), vpaddlq_u8(vld1q_u8(p4 + i*4))));
+            uint16x4_t r = vmovn_u32(vshrq_n_u32(vpaddlq_u16(s), 4));
+            q[i + 0] = (ARUint8)vget_lane_u16(r, 0);
+            q[i + 1] = (ARUint8)vget_lane_u16(r, 1);
+            q[i + 2] = (ARUint8)vget_lane_u16(r, 2);
+            q[i + 3] = (ARUint8)vget_lane_u16(r, 3);
+        }
+#elif defined(HAVE_INTEL_SIMD)
+        const __m128i lo = _mm_set1_epi16(0x00ff);
+        const __m128i ones = _mm_set1_epi16(1);
+        for (; i + 8 <= xsize2; i += 8) {
+            __m128i a, b, sa, sb;
+            sa = sb = _mm_setzero_si128();
+#define ACCUMULATE_ROW(p) \
+            a = _mm_loadu_si128((const __m128i *)((p) + i*4)); \
+            b = _mm_loadu_si128((const __m128i *)((p) + i*4 + 16)); \
+            sa = _mm_add_epi16(sa, _mm_add_epi16(_mm_and_si128(a, lo), _mm_srli_epi16(a, 8))); \
+            sb = _mm_add_epi16(sb, _mm_add_epi16(_mm_and_si128(b, lo), _mm_srli_epi16(b, 8)));
+            ACCUMULATE_ROW(p1)
+            ACCUMULATE_ROW(p2)
+            ACCUMULATE_ROW(p3)
+            ACCUMULATE_ROW(p4)
+#undef ACCUMULATE_ROW
+            // sa and sb now hold column-pair sums over 4 rows; add adjacent pairs to get 4x4 sums.
+            __m128i s = _mm_packs_epi32(_mm_madd_epi16(sa, ones), _mm_madd_epi16(sb, ones));
+            s = _mm_srli_epi16(s, 4);
+            _mm_storel_epi64((__m128i *)(q + i), _mm_packus_epi16(s, s));
+        }
+#endif
+        for (; i < xsize2; i++) {
+            q[i] = ( (int)p1[i*4] + (int)p1[i*4 + 1] + (int)p1[i*4 + 2] + (int)p1[i*4 + 3]
+                   + (int)p2[i*4] + (int)p2[i*4 + 1] + (int)p2[i*4 + 2] + (int)p2[i*4 + 3]
+                   + (int)p3[i*4] + (int)p3[i*4 + 1] + (int)p3[i*4 + 2] + (int)p3[i*4 + 3]
+                   + (int)p4[i*4] + (int)p4[i*4 + 1] + (int)p4[i*4 + 2] + (int)p4[i*4 + 3]) / 16;
+        }
+    }
+}
+
+// Each output pixel is the truncated mean of a 3x3 block.
+static void reduceOneThird(const ARUint8 *__restrict src, const int xsize, const int ysize, ARUint8 *__restrict dst)
+{
+    const ARUint8 *p1, *p2, *p3;
+    ARUint8       *q;
+    int            xsize2 = xsize/3;
+    int            ysize2 = ysize/3;
+    int            i, j;
+
+    q = dst;
+    for (j = 0; j < ysize2; j++) {
+        p1 = src + xsize*(j*3 + 0);
+        p2 = src + xsize*(j*3 + 1);
+        p3 = src + xsize*(j*3 + 2);
+        for (i = 0; i < xsize2; i++) {
+            *(q++) = ( (int)*(p1+0) + (int)*(p1+1) + (int)*(p1+2)
+                     + (int)*(p2+0) + (int)*(p2+1) + (int)*(p2+2)
+                     + (int)*(p3+0) + (int)*(p3+1) + (int)*(p3+2) ) / 9;
+            p1 += 3;
+            p2 += 3;
+            p3 += 3;
+        }
+    }
+}
+
+// Each 3x3 block of source pixels a..i produces a 2x2 block of output pixels,
+// weighting the centre row and column by 1/2 (centre pixel by 1/4) and normalising by 4/9.
+static void reduceTwoThird(const ARUint8 *__restrict src, const int xsize, const int ysize, ARUint8 *__restrict dst)
+{
+    const ARUint8 *p1, *p2, *p3;
+    ARUint8       *q1, *q2;
+    int            xsize2 = xsize/3*2;
+    int            ysize2 = ysize/3*2;
+    int            i, j;
+
+    for (j = 0; j < ysize2/2; j++) {
+        p1 = src + xsize*(j*3 + 0);
+        p2 = src + xsize*(j*3 + 1);
+        p3 = src + xsize*(j*3 + 2);
+        q1 = dst + xsize2*(j*2 + 0);
+        q2 = dst + xsize2*(j*2 + 1);
+        i = 0;
+#if defined(HAVE_INTEL_SIMD)
+        // For output pixel pair (2g, 2g+1), the fully-weighted source columns are 3g and 3g+2,
+        // and the half-weighted source column is 3g+1. Gather 4 groups (12 source pixels) at a time.
+        const __m128i shufX = _mm_setr_epi8(0, -1, 2, -1, 3, -1, 5, -1, 6, -1, 8, -1, 9, -1, 11, -1);
+        const __m128i shufY = _mm_setr_epi8(1, -1, 1, -1, 4, -1, 4, -1, 7, -1, 7, -1, 10, -1, 10, -1);
+        const __m128i div9 = _mm_set1_epi16(7282); // (v*7282)>>16 == v/9 for all v in [0, 2288].
+        for (; i + 4 <= xsize2/2 && i*3 + 16 <= xsize; i += 4) {
+            __m128i r1 = _mm_loadu_si128((const __m128i *)(p1 + i*3));
+            __m128i r2 = _mm_loadu_si128((const __m128i *)(p2 + i*3));
+            __m128i r3 = _mm_loadu_si128((const __m128i *)(p3 + i*3));
+            __m128i x1 = _mm_shuffle_epi8(r1, shufX), y1 = _mm_shuffle_epi8(r1, shufY);
+            __m128i x2 = _mm_shuffle_epi8(r2, shufX), y2 = _mm_shuffle_epi8(r2, shufY);
+            __m128i x3 = _mm_shuffle_epi8(r3, shufX), y3 = _mm_shuffle_epi8(r3, shufY);
+            __m128i m1 = _mm_add_epi16(x1, _mm_srli_epi16(y1, 1));                  // Outer row 1.
+            __m128i s2 = _mm_add_epi16(_mm_srli_epi16(x2, 1), _mm_srli_epi16(y2, 2)); // Centre row.
+            __m128i m3 = _mm_add_epi16(x3, _mm_srli_epi16(y3, 1));                  // Outer row 2.
+            __m128i o1 = _mm_mulhi_epu16(_mm_slli_epi16(_mm_add_epi16(m1, s2), 2), div9);
+            __m128i o2 = _mm_mulhi_epu16(_mm_slli_epi16(_mm_add_epi16(s2, m3), 2), div9);
+            _mm_storel_epi64((__m128i *)(q1 + i*2), _mm_packus_epi16(o1, o1));
+            _mm_storel_epi64((__m128i *)(q2 + i*2), _mm_packus_epi16(o2, o2));
+        }
+#endif
+        for (; i < xsize2/2; i++) {
+            const ARUint8 *s1 = p1 + i*3, *s2 = p2 + i*3, *s3 = p3 + i*3;
+            q1[i*2 + 0] = ( (int)s1[0]   + (int)s1[1]/2
+                          + (int)s2[0]/2 + (int)s2[1]/4 ) *4/9;
+            q2[i*2 + 0] = ( (int)s2[0]/2 + (int)s2[1]/4
+                          + (int)s3[0]   + (int)s3[1]/2 ) *4/9;
+            q1[i*2 + 1] = ( (int)s1[1]/2 + (int)s1[2]
+                          + (int)s2[1]/4 + (int)s2[2]/2 ) *4/9;
+            q2[i*2 + 1] = ( (int)s2[1]/4 + (int)s2[2]/2
+                          + (int)s3[1]/2 + (int)s3[2]   ) *4/9;
+        }
+    }
+}
@@ -40,13 +40,138 @@
 #include <math.h>
 #include <AR/ar.h>
 #include <AR/param.h>
+#include <thread_sub.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#else
+#  include <io.h> // _access()
+#  include <process.h> // _getpid()
+#  define getpid _getpid
+#endif
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+#  include <arm_neon.h>
+#elif defined(HAVE_INTEL_SIMD)
+#  include <emmintrin.h> // SSE2.
+#endif
 
+static int arParamLTfConvert( const ARParamLTf *paramLTf, const float *lt, const ARParam *param, const int toIdeal,
+                              const float *in, float *out );
+static int arParamLTfBatch( const ARParamLTf *paramLTf, const float *lt, const ARParam *param, const int toIdeal,
+                            const float *in, float *out, const int num );
+
+#define AR_PARAM_LT_CACHE_EXT     "lt"
+
+static char *arParamLTCacheDir = NULL;
+
+
+// Files written by arParamLTSave() begin with a header of fixed layout, written field by field so
+// that it does not depend on the layout of ARParamLT in memory: the magic number, the version,
+// then param (xsize, ysize, mat, dist_factor, dist_function_version) and the table xsize, ysize,
+// xOff, yOff and step, with integers as 32 bits and reals as doubles, in native byte order.
+// The i2o and o2i tables follow. Files from earlier versions hold the ARParamLT structure
+// as it then was, and are still read by arParamLTLoad().
+#define AR_PARAM_LT_FILE_MAGIC    0x544C5241 // "ARLT" in little-endian byte order.
+#define AR_PARAM_LT_FILE_VERSION  1
+#define AR_PARAM_LT_FILE_HEADER_SIZE  (4*4 + 8*12 + 8*AR_DIST_FACTOR_NUM_MAX + 4 + 4*5)
+
+// The layout of ARParamLT in files written before the header was introduced.
+typedef struct {
+    ARParam      param;
+    float       *i2o;
+    float       *o2i;
+    int          xsize;
+    int          ysize;
+    int          xOff;
+    int          yOff;
+} ARParamLTLegacyT;
+
+static unsigned char *arParamLTHeaderPutInt( unsigned char *p, const int v )
+{
+    int32_t  v32 = (int32_t)v;
+    memcpy(p, &v32, 4);
+    return p + 4;
+}
+
+static unsigned char *arParamLTHeaderPutReal( unsigned char *p, const ARdouble v )
+{
+    double   d = (double)v;
+    memcpy(p, &d, 8);
+    return p + 8;
+}
+
+static const unsigned char *arParamLTHeaderGetInt( const unsigned char *p, int *v )
+{
+    int32_t  v32;
+    memcpy(&v32, p, 4);
+    *v = (int)v32;
+    return p + 4;
+}
+
+static const unsigned char *arParamLTHeaderGetReal( const unsigned char *p, ARdouble *v )
+{
+    double   d;
+    memcpy(&d, p, 8);
+    *v = (ARdouble)d;
+    return p + 8;
+}
+
+static void arParamLTHeaderWrite( const ARParamLT *paramLT, unsigned char header[AR_PARAM_LT_FILE_HEADER_SIZE] )
+{
+    unsigned char *p = header;
+    int            i, j;
+
+    p = arParamLTHeaderPutInt(p, AR_PARAM_LT_FILE_MAGIC);
+    p = arParamLTHeaderPutInt(p, AR_PARAM_LT_FILE_VERSION);
+    p = arParamLTHeaderPutInt(p, paramLT->param.xsize);
+    p = arParamLTHeaderPutInt(p, paramLT->param.ysize);
+    for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) p = arParamLTHeaderPutReal(p, paramLT->param.mat[j][i]);
+    for( i = 0; i < AR_DIST_FACTOR_NUM_MAX; i++ ) p = arParamLTHeaderPutReal(p, paramLT->param.dist_factor[i]);
+    p = arParamLTHeaderPutInt(p, paramLT->param.dist_function_version);
+    p = arParamLTHeaderPutInt(p, paramLT->paramLTf.xsize);
+    p = arParamLTHeaderPutInt(p, paramLT->paramLTf.ysize);
+    p = arParamLTHeaderPutInt(p, paramLT->paramLTf.xOff);
+    p = arParamLTHeaderPutInt(p, paramLT->paramLTf.yOff);
+    p = arParamLTHeaderPutInt(p, paramLT->paramLTf.step);
+}
+
+// Fills in paramLT, except for the table pointers, from a header. Returns -1 if it is not a
+// header of a version this library reads.
+static int arParamLTHeaderRead( const unsigned char header[AR_PARAM_LT_FILE_HEADER_SIZE], ARParamLT *paramLT )
+{
+    const unsigned char *p = header;
+    int                  magic, version;
+    int                  i, j;
+
+    p = arParamLTHeaderGetInt(p, &magic);
+    p = arParamLTHeaderGetInt(p, &version);
+    if( magic != AR_PARAM_LT_FILE_MAGIC || version != AR_PARAM_LT_FILE_VERSION ) return -1;
+    p = arParamLTHeaderGetInt(p, &(paramLT->param.xsize));
+    p = arParamLTHeaderGetInt(p, &(paramLT->param.ysize));
+    for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) p = arParamLTHeaderGetReal(p, &(paramLT->param.mat[j][i]));
+    for( i = 0; i < AR_DIST_FACTOR_NUM_MAX; i++ ) p = arParamLTHeaderGetReal(p, &(paramLT->param.dist_factor[i]));
+    p = arParamLTHeaderGetInt(p, &(paramLT->param.dist_function_version));
+    p = arParamLTHeaderGetInt(p, &(paramLT->paramLTf.xsize));
+    p = arParamLTHeaderGetInt(p, &(paramLT->paramLTf.ysize));
+    p = arParamLTHeaderGetInt(p, &(paramLT->paramLTf.xOff));
+    p = arParamLTHeaderGetInt(p, &(paramLT->paramLTf.yOff));
+    p = arParamLTHeaderGetInt(p, &(paramLT->paramLTf.step));
+    if( paramLT->paramLTf.xsize <= 0 || paramLT->paramLTf.ysize <= 0 || paramLT->paramLTf.step < 1 ) return -1;
+    paramLT->paramLTf.i2o = NULL;
+    paramLT->paramLTf.o2i = NULL;
+    paramLT->mapped = NULL;
+    return 0;
+}
 
 int arParamLTSave( char *filename, char *ext, ARParamLT *paramLT )
 {
     FILE  *fp;
     char *buf;
     size_t len;
+    unsigned char header[AR_PARAM_LT_FILE_HEADER_SIZE];
 
     len = strlen(filename) + strlen(ext) + 2;
     arMalloc(buf, char, len);
@@ -58,7 +183,8 @@ int arParamLTSave( char *filename, char *ext, ARParamLT *paramLT )
     }
     free(buf);
 
-    if( fwrite( paramLT, sizeof(ARParamLT), 1, fp ) != 1 ) {
+    arParamLTHeaderWrite(paramLT, header);
+    if( fwrite( header, AR_PARAM_LT_FILE_HEADER_SIZE, 1, fp ) != 1 ) {
         fclose(fp);
         return -1;
     }
@@ -102,6 +228,8 @@ ARParamLT *arParamLTLoad( char *filename, char *ext )
     ARParamLT   *paramLT;
     char *buf;
     size_t len;
+    unsigned char header[AR_PARAM_LT_FILE_HEADER_SIZE];
+    ARParamLTLegacyT legacy;
 
     len = strlen(filename) + strlen(ext) + 2;
     arMalloc(buf, char, len);
@@ -115,10 +243,22 @@ ARParamLT *arParamLTLoad( char *filename, char *ext )
     
     arMalloc(paramLT, ARParamLT, 1);
     
-    if( fread( paramLT, sizeof(ARParamLT), 1, fp ) != 1 ) {
-        fclose(fp);
-        free(paramLT);
-        return NULL;
+    if( fread( header, AR_PARAM_LT_FILE_HEADER_SIZE, 1, fp ) != 1 || arParamLTHeaderRead( header, paramLT ) < 0 ) {
+        // Not a current file, so try the earlier layout, which has no magic number.
+        rewind(fp);
+        if( fread( &legacy, sizeof(ARParamLTLegacyT), 1, fp ) != 1 || legacy.xsize <= 0 || legacy.ysize <= 0 ) {
+            ARLOGe("Error: Unrecognised lookup table file format.\n");
+            fclose(fp);
+            free(paramLT);
+            return NULL;
+        }
+        paramLT->param = legacy.param;
+        paramLT->paramLTf.xsize = legacy.xsize;
+        paramLT->paramLTf.ysize = legacy.ysize;
+        paramLT->paramLTf.xOff = legacy.xOff;
+        paramLT->paramLTf.yOff = legacy.yOff;
+        paramLT->paramLTf.step = 1;
+        paramLT->mapped = NULL;
     }
 
     arMalloc(paramLT->paramLTf.i2o, float, paramLT->paramLTf.xsize*paramLT->paramLTf.ysize*2);
@@ -180,24 +320,280 @@ ARParamLT *arParamLTLoad( char *filename, char *ext )
 
 }
 
+// Calculates table rows [rowStart, rowEnd).
+static void arParamLTCreateRows( void *arg, int rowStart, int rowEnd )
+{
+    ARParamLT      *paramLT = (ARParamLT *)arg;
+    ARdouble       *dist_factor;
+    int             dist_function_version;
+    int             offset;
+    int             step;
+    ARdouble        ix, iy;
+    ARdouble        ox, oy;
+    float          *i2of, *o2if;
+    //short          *i2oi, *o2ii;
+    int             i, j;
+
+    dist_factor = paramLT->param.dist_factor;
+    dist_function_version = paramLT->param.dist_function_version;
+    offset = paramLT->paramLTf.xOff;
+    step = paramLT->paramLTf.step;
+    i2of = paramLT->paramLTf.i2o + rowStart*paramLT->paramLTf.xsize*2;
+    o2if = paramLT->paramLTf.o2i + rowStart*paramLT->paramLTf.xsize*2;
+    //i2oi = paramLT->paramLTi.i2o;
+    //o2ii = paramLT->paramLTi.o2i;
+    for( j = rowStart; j < rowEnd; j++ ) {
+        for( i = 0; i < paramLT->paramLTf.xsize; i++ ) {
+            arParamIdeal2Observ( dist_factor, (float)(i*step-offset), (float)(j*step-offset), &ox, &oy, dist_function_version);
+            *(i2of++) = (float)ox;
+            //*(i2oi++) = (int)(ox+0.5F);
+            *(i2of++) = (float)oy;
+            //*(i2oi++) = (int)(oy+0.5F);
+            arParamObserv2Ideal( dist_factor, (float)(i*step-offset), (float)(j*step-offset), &ix, &iy, dist_function_version);
+            *(o2if++) = (float)ix;
+            //*(o2ii++) = (int)(ix+0.5F);
+            *(o2if++) = (float)iy;
+            //*(o2ii++) = (int)(iy+0.5F);
+        }
+    }
+}
+
+// Splits the table into bands of rows, and calculates each band on its own thread.
+// A row of a compact table is 1/step of the work of a full-resolution row.
+static void arParamLTCreateTables( ARParamLT *paramLT )
+{
+    int     minRows;
+
+    minRows = AR_PARAM_LT_THREAD_MIN_ROWS / paramLT->paramLTf.step;
+    if( minRows < 1 ) minRows = 1;
+    threadParallelRun( paramLT->paramLTf.ysize, minRows, arParamLTCreateRows, paramLT );
+}
+
+// Number of table entries needed to cover size pixels plus offset padding either side.
+static int arParamLTTableSize( const int size, const int offset, const int step )
+{
+    return (size + offset*2 - 1 + step - 1) / step + 1;
+}
+
+#ifdef DEBUG
+// Largest difference between the table, interpolated at cell centres, and the model.
+static float arParamLTMaxError( const ARParamLT *paramLT )
+{
+    const ARParamLTf *ltf = &paramLT->paramLTf;
+    float             in[2], out[2];
+    ARdouble          ox, oy;
+    float             err, maxErr = 0.0f;
+    int               i, j;
+
+    for( j = 0; j < ltf->ysize - 1; j++ ) {
+        for( i = 0; i < ltf->xsize - 1; i++ ) {
+            in[0] = (float)(i*ltf->step - ltf->xOff) + ltf->step*0.5f;
+            in[1] = (float)(j*ltf->step - ltf->yOff) + ltf->step*0.5f;
+            arParamLTfConvert( ltf, ltf->o2i, NULL, 1, in, out );
+            arParamObserv2Ideal( paramLT->param.dist_factor, in[0], in[1], &ox, &oy, paramLT->param.dist_function_version );
+            err = (float)sqrt( (out[0] - ox)*(out[0] - ox) + (out[1] - oy)*(out[1] - oy) );
+            if( err > maxErr ) maxErr = err;
+        }
+    }
+
+    return maxErr;
+}
+#endif
+
+// FNV-1a hash of the fields which determine the table contents.
+static unsigned long long arParamLTCacheHash( const ARParam *param, const int offset, const int step )
+{
+    const unsigned char *p;
+    unsigned long long   hash = 14695981039346656037ULL;
+    size_t               i;
+
+#define AR_PARAM_LT_HASH(v) \
+    for( p = (const unsigned char *)&(v), i = 0; i < sizeof(v); i++ ) { hash ^= p[i]; hash *= 1099511628211ULL; }
+    AR_PARAM_LT_HASH(param->xsize);
+    AR_PARAM_LT_HASH(param->ysize);
+    AR_PARAM_LT_HASH(param->mat);
+    AR_PARAM_LT_HASH(param->dist_factor);
+    AR_PARAM_LT_HASH(param->dist_function_version);
+    AR_PARAM_LT_HASH(offset);
+    AR_PARAM_LT_HASH(step);
+#undef AR_PARAM_LT_HASH
+
+    return hash;
+}
+
+// Returns 1 if the cached table was calculated from param, offset and step.
+static int arParamLTCacheMatches( const ARParamLT *paramLT, const ARParam *param, const int offset, const int step )
+{
+    return( paramLT->param.xsize == param->xsize && paramLT->param.ysize == param->ysize
+         && memcmp( paramLT->param.mat, param->mat, sizeof(param->mat) ) == 0
+         && memcmp( paramLT->param.dist_factor, param->dist_factor, sizeof(param->dist_factor) ) == 0
+         && paramLT->param.dist_function_version == param->dist_function_version
+         && paramLT->paramLTf.xOff == offset && paramLT->paramLTf.yOff == offset
+         && paramLT->paramLTf.step == step
+         && paramLT->paramLTf.xsize == arParamLTTableSize(param->xsize, offset, step)
+         && paramLT->paramLTf.ysize == arParamLTTableSize(param->ysize, offset, step) );
+}
+
+static ARParamLT *arParamLTCacheLoad( const char *name, const ARParam *param, const int offset, const int step )
+{
+    ARParamLT   *paramLT;
+#ifndef _WIN32
+    char        *buf;
+    size_t       len;
+    size_t       nmemb;
+    int          fd;
+    struct stat  st;
+    void        *map;
+
+    len = strlen(name) + strlen(AR_PARAM_LT_CACHE_EXT) + 2;
+    arMalloc(buf, char, len);
+    sprintf(buf, "%s.%s", name, AR_PARAM_LT_CACHE_EXT);
+    fd = open(buf, O_RDONLY);
+    free(buf);
+    if( fd < 0 ) return NULL;
+
+    // Layout is as written by arParamLTSave(): the header, then the i2o and o2i tables.
+    nmemb = (size_t)arParamLTTableSize(param->xsize, offset, step) * (size_t)arParamLTTableSize(param->ysize, offset, step) * 2;
+    if( fstat(fd, &st) != 0 || (size_t)st.st_size != AR_PARAM_LT_FILE_HEADER_SIZE + nmemb*sizeof(float)*2 ) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( map == MAP_FAILED ) return NULL;
+
+    arMalloc(paramLT, ARParamLT, 1);
+    if( arParamLTHeaderRead((const unsigned char *)map, paramLT) < 0 || !arParamLTCacheMatches(paramLT, param, offset, step) ) {
+        munmap(map, (size_t)st.st_size);
+        free(paramLT);
+        return NULL;
+    }
+    paramLT->paramLTf.i2o = (float *)((unsigned char *)map + AR_PARAM_LT_FILE_HEADER_SIZE);
+    paramLT->paramLTf.o2i = paramLT->paramLTf.i2o + nmemb;
+    paramLT->mapped = map;
+#else
+    FILE        *fp;
+    char        *buf;
+    size_t       len;
+
+    // Check existence first, since arParamLTLoad() logs an error for a missing file.
+    len = strlen(name) + strlen(AR_PARAM_LT_CACHE_EXT) + 2;
+    arMalloc(buf, char, len);
+    sprintf(buf, "%s.%s", name, AR_PARAM_LT_CACHE_EXT);
+    fp = fopen(buf, "rb");
+    free(buf);
+    if( !fp ) return NULL;
+    fclose(fp);
+
+    if( (paramLT = arParamLTLoad((char *)name, AR_PARAM_LT_CACHE_EXT)) == NULL ) return NULL;
+    if( !arParamLTCacheMatches(paramLT, param, offset, step) ) {
+        arParamLTFree(&paramLT);
+        return NULL;
+    }
+#endif
+
+    return paramLT;
+}
+
+// Writes the table under a name unique to this process and table, then renames it into place,
+// so that a concurrent reader or writer never sees a partly-written cache file.
+static void arParamLTCacheSave( const char *name, ARParamLT *paramLT )
+{
+    char        *tmpExt, *tmpPath, *path;
+    size_t       len;
+
+    len = strlen(AR_PARAM_LT_CACHE_EXT) + 1 + 10 + 1 + 16 + 4 + 1;
+    arMalloc(tmpExt, char, len);
+    sprintf(tmpExt, "%s-%d-%lx.tmp", AR_PARAM_LT_CACHE_EXT, (int)getpid(), (unsigned long)(size_t)paramLT);
+    len = strlen(name) + 1 + strlen(tmpExt) + 1;
+    arMalloc(tmpPath, char, len);
+    sprintf(tmpPath, "%s.%s", name, tmpExt);
+    len = strlen(name) + 1 + strlen(AR_PARAM_LT_CACHE_EXT) + 1;
+    arMalloc(path, char, len);
+    sprintf(path, "%s.%s", name, AR_PARAM_LT_CACHE_EXT);
+
+    if( arParamLTSave((char *)name, tmpExt, paramLT) < 0 ) {
+        ARLOGw("Warning: Unable to save lookup table to cache '%s'.\n", path);
+        remove(tmpPath);
+    } else if( rename(tmpPath, path) != 0 ) {
+        // On Windows, rename() fails if another process has already cached the same table.
+        remove(tmpPath);
+    }
+
+    free(path);
+    free(tmpPath);
+    free(tmpExt);
+}
+
+int arParamLTSetCacheDirectory( const char *path )
+{
+#ifndef _WIN32
+    struct stat  st;
+#else
+    struct _stat st;
+#endif
+
+    if( path ) {
+#ifndef _WIN32
+        if( stat(path, &st) != 0 || !S_ISDIR(st.st_mode) || access(path, W_OK) != 0 ) {
+#else
+        if( _stat(path, &st) != 0 || !(st.st_mode & _S_IFDIR) || _access(path, 2) != 0 ) {
+#endif
+            ARLOGe("Error: Lookup table cache directory '%s' is not a writable directory.\n", path);
+            return -1;
+        }
+    }
+
+    free(arParamLTCacheDir);
+    arParamLTCacheDir = NULL;
+    if( !path ) return 0;
+
+    arMalloc(arParamLTCacheDir, char, strlen(path) + 1);
+    strcpy(arParamLTCacheDir, path);
+
+    return 0;
+}
+
+const char *arParamLTGetCacheDirectory( void )
+{
+    return arParamLTCacheDir;
+}
+
 ARParamLT  *arParamLTCreate( ARParam *param, int offset )
+{
+    return arParamLTCreateCompact( param, offset, 1 );
+}
+
+ARParamLT  *arParamLTCreateCompact( ARParam *param, int offset, int step )
 {
     ARParamLT   *paramLT;
-    ARdouble    *dist_factor;
-    int          dist_function_version;
-    ARdouble     ix, iy;
-    ARdouble     ox, oy;
-    float       *i2of, *o2if;
-    //short       *i2oi, *o2ii;
-    int          i, j;
-    
+    char        *name = NULL;
+    size_t       len;
+
+    if( !param || offset < 0 || step < 1 ) {
+        ARLOGe("Error: Invalid lookup table parameters.\n");
+        return NULL;
+    }
+
+    if( arParamLTCacheDir ) {
+        len = strlen(arParamLTCacheDir) + 1 + 8 + 16 + 1;
+        arMalloc(name, char, len);
+        sprintf(name, "%s/paramLT-%016llx", arParamLTCacheDir, arParamLTCacheHash(param, offset, step));
+        if( (paramLT = arParamLTCacheLoad(name, param, offset, step)) != NULL ) {
+            free(name);
+            return paramLT;
+        }
+    }
+
     arMalloc(paramLT, ARParamLT, 1);
     paramLT->param = *param;
+    paramLT->mapped = NULL;
     
-    paramLT->paramLTf.xsize = param->xsize + offset*2;
-    paramLT->paramLTf.ysize = param->ysize + offset*2;
+    paramLT->paramLTf.xsize = arParamLTTableSize(param->xsize, offset, step);
+    paramLT->paramLTf.ysize = arParamLTTableSize(param->ysize, offset, step);
     paramLT->paramLTf.xOff = offset;
     paramLT->paramLTf.yOff = offset;
+    paramLT->paramLTf.step = step;
     arMalloc(paramLT->paramLTf.i2o, float, paramLT->paramLTf.xsize*paramLT->paramLTf.ysize*2);
     arMalloc(paramLT->paramLTf.o2i, float, paramLT->paramLTf.xsize*paramLT->paramLTf.ysize*2);
     
@@ -208,25 +604,16 @@ ARParamLT  *arParamLTCreate( ARParam *param, int offset )
     //arMalloc(paramLT->paramLTi.i2o, short, paramLT->paramLTi.xsize*paramLT->paramLTi.ysize*2);
     //arMalloc(paramLT->paramLTi.o2i, short, paramLT->paramLTi.xsize*paramLT->paramLTi.ysize*2);
     
-    dist_factor = param->dist_factor;
-    dist_function_version = param->dist_function_version;
-    i2of = paramLT->paramLTf.i2o;
-    o2if = paramLT->paramLTf.o2i;
-    //i2oi = paramLT->paramLTi.i2o;
-    //o2ii = paramLT->paramLTi.o2i;
-    for( j = 0; j < paramLT->paramLTf.ysize; j++ ) {
-        for( i = 0; i < paramLT->paramLTf.xsize; i++ ) {
-            arParamIdeal2Observ( dist_factor, (float)(i-offset), (float)(j-offset), &ox, &oy, dist_function_version);
-            *(i2of++) = (float)ox;
-            //*(i2oi++) = (int)(ox+0.5F);
-            *(i2of++) = (float)oy;
-            //*(i2oi++) = (int)(oy+0.5F);
-            arParamObserv2Ideal( dist_factor, (float)(i-offset), (float)(j-offset), &ix, &iy, dist_function_version);
-            *(o2if++) = (float)ix;
-            //*(o2ii++) = (int)(ix+0.5F);
-            *(o2if++) = (float)iy;
-            //*(o2ii++) = (int)(iy+0.5F);
-        }
+    arParamLTCreateTables( paramLT );
+#ifdef DEBUG
+    if( step > 1 ) {
+        ARLOGd("Lookup table with step %d: maximum interpolation error %f pixels.\n", step, arParamLTMaxError(paramLT));
+    }
+#endif
+
+    if( name ) {
+        arParamLTCacheSave( name, paramLT );
+        free(name);
     }
     
     return paramLT;
@@ -236,8 +623,15 @@ int arParamLTFree( ARParamLT **paramLT_p )
 {
     if (!paramLT_p || !(*paramLT_p)) return (-1);
     
-    free((*paramLT_p)->paramLTf.i2o);
-    free((*paramLT_p)->paramLTf.o2i);
+#ifndef _WIN32
+    if ((*paramLT_p)->mapped) {
+        munmap((*paramLT_p)->mapped, AR_PARAM_LT_FILE_HEADER_SIZE + (size_t)(*paramLT_p)->paramLTf.xsize*(size_t)(*paramLT_p)->paramLTf.ysize*2*sizeof(float)*2);
+    } else
+#endif
+    {
+        free((*paramLT_p)->paramLTf.i2o);
+        free((*paramLT_p)->paramLTf.o2i);
+    }
     //free((*paramLT_p)->paramLTi.i2o);
     //free((*paramLT_p)->paramLTi.o2i);
     free(*paramLT_p);
@@ -267,7 +661,17 @@ int arParamIdeal2ObservLTf( const ARParamLTf *paramLTf, const float  ix, const f
 {
     int      px, py;
     float   *lt;
+    float    in[2], out[2];
     
+    if( paramLTf->step > 1 ) {
+        in[0] = ix;
+        in[1] = iy;
+        if( arParamLTfConvert( paramLTf, paramLTf->i2o, NULL, 0, in, out ) < 0 ) return -1;
+        *ox = out[0];
+        *oy = out[1];
+        return 0;
+    }
+
     px = (int)(ix+0.5F) + paramLTf->xOff;
     py = (int)(iy+0.5F) + paramLTf->yOff;
     if( px < 0 || px >= paramLTf->xsize ||
@@ -301,7 +705,17 @@ int arParamObserv2IdealLTf( const ARParamLTf *paramLTf, const float  ox, const f
 {
     int      px, py;
     float   *lt;
+    float    in[2], out[2];
     
+    if( paramLTf->step > 1 ) {
+        in[0] = ox;
+        in[1] = oy;
+        if( arParamLTfConvert( paramLTf, paramLTf->o2i, NULL, 1, in, out ) < 0 ) return -1;
+        *ix = out[0];
+        *iy = out[1];
+        return 0;
+    }
+
     px = (int)(ox+0.5F) + paramLTf->xOff;
     py = (int)(oy+0.5F) + paramLTf->yOff;
     if( px < 0 || px >= paramLTf->xsize ||
@@ -313,3 +727,154 @@ int arParamObserv2IdealLTf( const ARParamLTf *paramLTf, const float  ox, const f
     return 0;
 }
 
+int arParamObserv2IdealLTfBatch( const ARParamLTf *paramLTf, const float *o, float *i, const int num )
+{
+    if( !paramLTf || !o || !i || num < 0 ) return -1;
+    return arParamLTfBatch( paramLTf, paramLTf->o2i, NULL, 1, o, i, num );
+}
+
+int arParamIdeal2ObservLTfBatch( const ARParamLTf *paramLTf, const float *i, float *o, const int num )
+{
+    if( !paramLTf || !i || !o || num < 0 ) return -1;
+    return arParamLTfBatch( paramLTf, paramLTf->i2o, NULL, 0, i, o, num );
+}
+
+int arParamObserv2IdealBatch( const ARParamLT *paramLT, const float *o, float *i, const int num )
+{
+    if( !paramLT || !o || !i || num < 0 ) return -1;
+    return arParamLTfBatch( &paramLT->paramLTf, paramLT->paramLTf.o2i, &paramLT->param, 1, o, i, num );
+}
+
+int arParamIdeal2ObservBatch( const ARParamLT *paramLT, const float *i, float *o, const int num )
+{
+    if( !paramLT || !i || !o || num < 0 ) return -1;
+    return arParamLTfBatch( &paramLT->paramLTf, paramLT->paramLTf.i2o, &paramLT->param, 0, i, o, num );
+}
+
+// Converts one pair by bilinear interpolation of lt, falling back to the analytic model in param
+// (if non-NULL) when the pair lies outside the table.
+static int arParamLTfConvert( const ARParamLTf *paramLTf, const float *lt, const ARParam *param, const int toIdeal,
+                              const float *in, float *out )
+{
+    const float *lt00, *lt01;
+    float        x, y, fx, fy, top, bot;
+    ARdouble     ox, oy;
+    int          px, py;
+
+    x = (in[0] + (float)paramLTf->xOff) * (1.0f / (float)paramLTf->step);
+    y = (in[1] + (float)paramLTf->yOff) * (1.0f / (float)paramLTf->step);
+    if( x >= 0.0f && x <= (float)(paramLTf->xsize - 1) && y >= 0.0f && y <= (float)(paramLTf->ysize - 1) ) {
+        px = (int)x;
+        py = (int)y;
+        if( px == paramLTf->xsize - 1 ) px--; // Last column/row: interpolate from the cell before.
+        if( py == paramLTf->ysize - 1 ) py--;
+        fx = x - (float)px;
+        fy = y - (float)py;
+        lt00 = lt + (py*paramLTf->xsize + px)*2;
+        lt01 = lt00 + paramLTf->xsize*2;
+        top = lt00[0] + fx*(lt00[2] - lt00[0]);
+        bot = lt01[0] + fx*(lt01[2] - lt01[0]);
+        x = top + fy*(bot - top);
+        top = lt00[1] + fx*(lt00[3] - lt00[1]);
+        bot = lt01[1] + fx*(lt01[3] - lt01[1]);
+        y = top + fy*(bot - top);
+        out[0] = x;
+        out[1] = y;
+        return 0;
+    }
+    if( !param ) return -1;
+
+    if( toIdeal ) arParamObserv2Ideal( param->dist_factor, (ARdouble)in[0], (ARdouble)in[1], &ox, &oy, param->dist_function_version );
+    else          arParamIdeal2Observ( param->dist_factor, (ARdouble)in[0], (ARdouble)in[1], &ox, &oy, param->dist_function_version );
+    out[0] = (float)ox;
+    out[1] = (float)oy;
+    return 0;
+}
+
+static int arParamLTfBatch( const ARParamLTf *paramLTf, const float *lt, const ARParam *param, const int toIdeal,
+                            const float *in, float *out, const int num )
+{
+    int     n = 0;
+    int     ret = 0;
+
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON) || defined(HAVE_INTEL_SIMD)
+    const float  xOff = (float)paramLTf->xOff, yOff = (float)paramLTf->yOff;
+    const float  xLim = (float)(paramLTf->xsize - 1), yLim = (float)(paramLTf->ysize - 1);
+    const float  scale = 1.0f / (float)paramLTf->step;
+    const int    stride = paramLTf->xsize*2;
+    int          idx[4];
+    const float *a, *b;
+#endif
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+    const float32x4_t off  = {xOff, yOff, xOff, yOff};
+    const float32x4_t lim  = {xLim, yLim, xLim, yLim};
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t vscale = vdupq_n_f32(scale);
+    // Two pairs per step. Table gathers are scalar; offsets, weights and interpolation are vectorised.
+    float32x4_t       p, f, v00, v10, v01, v11, top, bot;
+    float32x4x2_t     w;
+    int32x4_t         pi;
+    uint32x4_t        ok;
+    uint32x2_t        ok2;
+    for( ; n + 2 <= num; n += 2 ) {
+        p = vaddq_f32(vld1q_f32(in + n*2), off);
+        if( scale != 1.0f ) p = vmulq_f32(p, vscale);
+        ok = vandq_u32(vcgeq_f32(p, zero), vcltq_f32(p, lim));
+        ok2 = vand_u32(vget_low_u32(ok), vget_high_u32(ok));
+        if( (vget_lane_u32(ok2, 0) & vget_lane_u32(ok2, 1)) != 0xFFFFFFFFu ) {
+            if( arParamLTfConvert( paramLTf, lt, param, toIdeal, in + n*2,     out + n*2     ) < 0 ) ret = -1;
+            if( arParamLTfConvert( paramLTf, lt, param, toIdeal, in + n*2 + 2, out + n*2 + 2 ) < 0 ) ret = -1;
+            continue;
+        }
+        pi = vcvtq_s32_f32(p); // Truncation is floor, since p >= 0.
+        f = vsubq_f32(p, vcvtq_f32_s32(pi));
+        vst1q_s32(idx, pi);
+        a = lt + idx[1]*stride + idx[0]*2;
+        b = lt + idx[3]*stride + idx[2]*2;
+        v00 = vcombine_f32(vld1_f32(a),              vld1_f32(b));
+        v10 = vcombine_f32(vld1_f32(a + 2),          vld1_f32(b + 2));
+        v01 = vcombine_f32(vld1_f32(a + stride),     vld1_f32(b + stride));
+        v11 = vcombine_f32(vld1_f32(a + stride + 2), vld1_f32(b + stride + 2));
+        w = vtrnq_f32(f, f); // w.val[0] = {fx0, fx0, fx1, fx1}, w.val[1] = {fy0, fy0, fy1, fy1}.
+        top = vaddq_f32(v00, vmulq_f32(w.val[0], vsubq_f32(v10, v00)));
+        bot = vaddq_f32(v01, vmulq_f32(w.val[0], vsubq_f32(v11, v01)));
+        vst1q_f32(out + n*2, vaddq_f32(top, vmulq_f32(w.val[1], vsubq_f32(bot, top))));
+    }
+#elif defined(HAVE_INTEL_SIMD)
+    const __m128 off  = _mm_setr_ps(xOff, yOff, xOff, yOff);
+    const __m128 lim  = _mm_setr_ps(xLim, yLim, xLim, yLim);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 vscale = _mm_set1_ps(scale);
+    // Two pairs per step. Table gathers are scalar; offsets, weights and interpolation are vectorised.
+    __m128       p, f, v00, v10, v01, v11, fx, fy, top, bot;
+    __m128i      pi;
+    for( ; n + 2 <= num; n += 2 ) {
+        p = _mm_add_ps(_mm_loadu_ps(in + n*2), off);
+        if( scale != 1.0f ) p = _mm_mul_ps(p, vscale);
+        if( _mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(p, zero), _mm_cmplt_ps(p, lim))) != 0x0F ) {
+            if( arParamLTfConvert( paramLTf, lt, param, toIdeal, in + n*2,     out + n*2     ) < 0 ) ret = -1;
+            if( arParamLTfConvert( paramLTf, lt, param, toIdeal, in + n*2 + 2, out + n*2 + 2 ) < 0 ) ret = -1;
+            continue;
+        }
+        pi = _mm_cvttps_epi32(p); // Truncation is floor, since p >= 0.
+        f = _mm_sub_ps(p, _mm_cvtepi32_ps(pi));
+        _mm_storeu_si128((__m128i *)idx, pi);
+        a = lt + idx[1]*stride + idx[0]*2;
+        b = lt + idx[3]*stride + idx[2]*2;
+        v00 = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64 *)a),                (const __m64 *)b);
+        v10 = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64 *)(a + 2)),          (const __m64 *)(b + 2));
+        v01 = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64 *)(a + stride)),     (const __m64 *)(b + stride));
+        v11 = _mm_loadh_pi(_mm_loadl_pi(zero, (const __m64 *)(a + stride + 2)), (const __m64 *)(b + stride + 2));
+        fx = _mm_shuffle_ps(f, f, _MM_SHUFFLE(2, 2, 0, 0));
+        fy = _mm_shuffle_ps(f, f, _MM_SHUFFLE(3, 3, 1, 1));
+        top = _mm_add_ps(v00, _mm_mul_ps(fx, _mm_sub_ps(v10, v00)));
+        bot = _mm_add_ps(v01, _mm_mul_ps(fx, _mm_sub_ps(v11, v01)));
+        _mm_storeu_ps(out + n*2, _mm_add_ps(top, _mm_mul_ps(fy, _mm_sub_ps(bot, top))));
+    }
+#endif
+    for( ; n < num; n++ ) {
+        if( arParamLTfConvert( paramLTf, lt, param, toIdeal, in + n*2, out + n*2 ) < 0 ) ret = -1;
+    }
+
+    return ret;
+}
@@ -41,6 +41,53 @@
 #include <stdlib.h>
 #include <AR2/config.h>
 #include <AR2/featureSet.h>
+#include <thread_sub.h>
+#include "private.h"
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+#  include <arm_neon.h>
+#  define AR2_FEATURE_MAP_LANES     4       // Search positions scored at once.
+#elif defined(HAVE_INTEL_SIMD)
+#  include <emmintrin.h> // SSE2.
+#  define AR2_FEATURE_MAP_LANES     4
+#else
+#  define AR2_FEATURE_MAP_LANES     1
+#endif
+
+// The map must not depend on the build: products are summed with separate multiply and add, as in
+// the SIMD code, even where the compiler would otherwise contract them into fused multiply-adds.
+#if defined(__clang__)
+#  pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#  pragma GCC optimize ("fp-contract=off")
+#elif defined(_MSC_VER)
+#  pragma fp_contract (off)
+#endif
+
+#define AR2_FEATURE_MAP_BAND_ROWS   4       // Fewest image rows given to a thread.
+#define AR2_FEATURE_MAP_SD_MARGIN   0.99f   // Templates whose exact variance is below this fraction of the threshold are rejected early.
+
+// Generation of a feature map, split across threads by image row. Template and window sums are
+// taken from integral images where they are exact integers; other sums are accumulated in the
+// same order as make_template() and get_similarity(), so that the map is identical to theirs.
+typedef struct {
+    const ARUint8  *imageBW;
+    int             xsize;
+    int             ysize;
+    const ARUint32 *sum;        // (xsize+1)*(ysize+1) integral images of pixels and squared pixels. Modulo 2^32, which
+    const ARUint32 *sum2;       // leaves the sum over any window exact, as it cannot itself reach 2^32.
+    const float    *fimageBW;   // Pixels, and squared pixels, as floats, so that several search positions can be
+    const float    *fimageBW2;  // scored at once.
+    const float    *grad;       // Gradient magnitude, as computed in ar2GenFeatureMap().
+    int             gradThresh;
+    float          *map;
+    int             ts1;
+    int             ts2;
+    int             search_size1;
+    int             search_size2;
+    float           max_sim_thresh;
+    float           sd_thresh;
+    int             rowsLeft;   // For progress reports.
+} AR2FeatureMapJobT;
 
 static int make_template( ARUint8 *imageBW, int xsize, int ysize,
                           int cx, int cy, int ts1, int ts2, float  sd_thresh,
@@ -50,6 +97,8 @@ static int get_similarity( ARUint8 *imageBW, int xsize, int ysize,
                            float  *template, float  vlen, int ts1, int ts2,
                            int cx, int cy, float  *sim);
 
+static void ar2GenFeatureMapRows( void *arg, int begin, int end );
+
 int ar2FreeFeatureMap( AR2FeatureMapT *featureMap )
 {
     free( featureMap->map );
@@ -133,31 +182,30 @@ AR2FeatureMapT *ar2GenFeatureMap( AR2ImageT *image,
                                   float  max_sim_thresh, float  sd_thresh )
 {
     AR2FeatureMapT  *featureMap;
-    float           *fimage, *fp;
+    AR2FeatureMapJobT job;
+    float           *fimage;
     float           *fimage2, *fp2;
-    float           *template;
-    ARUint8         *p;
+    float           *fimageBW = NULL, *fimageBW2 = NULL;
+    ARUint32        *sum = NULL, *sum2 = NULL;
+    ARUint8         *imageBW, *p;
     float           dx, dy;
     int             xsize, ysize;
-    int             hist[1000], sum;
+    int             hist[1000], count;
     int             i, j, k;
-    float           vlen;
-    float           max, sim;
-    int             ii, jj;
 
     xsize = image->xsize;
     ysize = image->ysize;
     arMalloc(fimage,   float,  xsize*ysize);
     arMalloc(fimage2,  float,  xsize*ysize);
-    arMalloc(template, float , (ts1+ts2+1)*(ts1+ts2+1));
 
 
     fp2 = fimage2;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-    p = image->imgBWBlur[1];
+    imageBW = image->imgBWBlur[1];
 #else
-    p = image->imgBW;
+    imageBW = image->imgBW;
 #endif
+    p = imageBW;
     for( i = 0; i < xsize; i++ ) {*(fp2++) = -1.0f; p++;}
     for( j = 1; j < ysize-1; j++ ) {
         *(fp2++) = -1.0f; p++;
@@ -176,7 +224,7 @@ AR2FeatureMapT *ar2GenFeatureMap( AR2ImageT *image,
     for( i = 0; i < xsize; i++ ) {*(fp2++) = -1.0f; p++;}
 
 
-    sum = 0;
+    count = 0;
     for( i = 0; i < 1000; i++ ) hist[i] = 0;
     fp2 = fimage2 + xsize + 1;
     for( j = 1; j < ysize-1; j++ ) {
@@ -186,7 +234,7 @@ AR2FeatureMapT *ar2GenFeatureMap( AR2ImageT *image,
                 if( k > 999 ) k = 999;
                 if( k < 0   ) k = 0;
                 hist[k]++;
-                sum++;
+                count++;
             }
             fp2++;
         }
@@ -200,74 +248,69 @@ AR2FeatureMapT *ar2GenFeatureMap( AR2ImageT *image,
     }
     k = i;
     ARLOGi("         ImageSize = %7d[pixel]\n", xsize*ysize);
-    ARLOGi("Extracted features = %7d[pixel]\n", sum);
+    ARLOGi("Extracted features = %7d[pixel]\n", count);
     ARLOGi(" Filtered features = %7d[pixel]\n", j);
 
 
-    fp = fimage;
-    fp2 = fimage2;
+    // Border pixels are never features.
     for( i = 0; i < xsize; i++ ) {
-        *(fp++) = 1.0f;
-        fp2++;
+        fimage[i] = 1.0f;
+        fimage[(ysize-1)*xsize+i] = 1.0f;
     }
     for( j = 1; j < ysize-1; j++ ) {
-        ARLOGi("\r%4d/%4d.", j+1, ysize); fflush(stdout);
-        *(fp++) = 1.0f;
-        fp2++;
-        for( i = 1; i < xsize-1; i++ ) {
-            if( *fp2 <= *(fp2-1) || *fp2 <= *(fp2+1) || *fp2 <= *(fp2-xsize) || *fp2 <= *(fp2+xsize) ) {
-                *(fp++) = 1.0f;
-                fp2++;
-                continue;
-            }
-            if( (int)(*fp2 * 1000) < k ) {
-                *(fp++) = 1.0f;
-                fp2++;
-                continue;
-            }
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-            if( make_template(image->imgBWBlur[1], xsize, ysize, i, j, ts1, ts2, sd_thresh, template, &vlen) < 0 ) {
-#else
-            if( make_template(image->imgBW, xsize, ysize, i, j, ts1, ts2, sd_thresh, template, &vlen) < 0 ) {
-#endif
-                *(fp++) = 1.0f;
-                fp2++;
-                continue;
-            }
-
-            max = -1.0f;
-            for( jj = -search_size1; jj <= search_size1; jj++ ) {
-                for( ii = -search_size1; ii <= search_size1; ii++ ) {
-
-                    if( ii*ii + jj*jj <= search_size2*search_size2 ) continue;
-                    //if( jj >= -search_size2 && jj <= search_size2 && ii >= -search_size2 && ii <= search_size2 ) continue;
-
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                    if( get_similarity(image->imgBWBlur[1], xsize, ysize, template, vlen, ts1, ts2, i+ii, j+jj, &sim) < 0 ) continue;
-#else
-                    if( get_similarity(image->imgBW, xsize, ysize, template, vlen, ts1, ts2, i+ii, j+jj, &sim) < 0 ) continue;
-#endif
+        fimage[j*xsize] = 1.0f;
+        fimage[j*xsize+xsize-1] = 1.0f;
+    }
 
-                    if( sim > max ) {
-                        max = sim;
-                        if( max > max_sim_thresh ) break;
-                    }
-                }
-                if( max > max_sim_thresh ) break;
+    job.imageBW        = imageBW;
+    job.xsize          = xsize;
+    job.ysize          = ysize;
+    job.sum            = NULL;
+    job.sum2           = NULL;
+    job.fimageBW       = NULL;
+    job.fimageBW2      = NULL;
+    job.grad           = fimage2;
+    job.gradThresh     = k;
+    job.map            = fimage;
+    job.ts1            = ts1;
+    job.ts2            = ts2;
+    job.search_size1   = search_size1;
+    job.search_size2   = search_size2;
+    job.max_sim_thresh = max_sim_thresh;
+    job.sd_thresh      = sd_thresh;
+    job.rowsLeft       = ysize - 2;
+    // Window sums of pixels are exact in float, and so may be taken from the integral image, if below 2^24.
+    if( (ts1+ts2+1)*(ts1+ts2+1) < (1 << 24) / 255 ) {
+        arMalloc( sum,  ARUint32, (xsize+1)*(ysize+1) );
+        arMalloc( sum2, ARUint32, (xsize+1)*(ysize+1) );
+        arMalloc( fimageBW,  float, xsize*ysize );
+        arMalloc( fimageBW2, float, xsize*ysize );
+        for( i = 0; i <= xsize; i++ ) sum[i] = sum2[i] = 0;
+        for( j = 0; j < ysize; j++ ) {
+            ARUint32    rowSum = 0, rowSum2 = 0;
+            sum[(j+1)*(xsize+1)] = sum2[(j+1)*(xsize+1)] = 0;
+            for( i = 0; i < xsize; i++ ) {
+                ARUint32    v = imageBW[j*xsize+i];
+                rowSum  += v;
+                rowSum2 += v*v;
+                sum [(j+1)*(xsize+1)+i+1] = sum [j*(xsize+1)+i+1] + rowSum;
+                sum2[(j+1)*(xsize+1)+i+1] = sum2[j*(xsize+1)+i+1] + rowSum2;
+                fimageBW [j*xsize+i] = (float)v;
+                fimageBW2[j*xsize+i] = (float)(v*v);
             }
-            *(fp++) = (float)max;
-            fp2++;
         }
-        *(fp++) = 1.0f;
-        fp2++;
+        job.sum       = sum;
+        job.sum2      = sum2;
+        job.fimageBW  = fimageBW;
+        job.fimageBW2 = fimageBW2;
     }
-  	for (i = 0; i < xsize; i++) {
-  		*(fp++) = 1.0f;
-  		fp2++;
-  	}
+    threadParallelRun( ysize - 2, AR2_FEATURE_MAP_BAND_ROWS, ar2GenFeatureMapRows, &job );
     ARLOGi("\n");
     free(fimage2);
-    free(template);
+    free(sum);
+    free(sum2);
+    free(fimageBW);
+    free(fimageBW2);
 
     arMalloc( featureMap, AR2FeatureMapT, 1 );
     featureMap->map = fimage;
@@ -699,3 +742,195 @@ static int get_similarity( ARUint8 *imageBW, int xsize, int ysize,
 
     return 0;
 }
+
+// make_template(), with the mean taken from the integral image, and templates whose exact
+// variance is well below the threshold rejected before the (rounded) float sum is formed.
+static int ar2FeatureMapTemplate( const AR2FeatureMapJobT *job, int cx, int cy, float *template, float *vlen )
+{
+    const ARUint8  *ip;
+    float          *tp;
+    float           vlen1, ave;
+    double          var;
+    ARUint32        s1, s2;
+    int             n, w, i, j;
+
+    if( cy - job->ts1 < 0 || cy + job->ts2 >= job->ysize || cx - job->ts1 < 0 || cx + job->ts2 >= job->xsize ) return -1;
+
+    w = job->xsize + 1;
+    n = (job->ts1+job->ts2+1)*(job->ts1+job->ts2+1);
+    s1 = job->sum [(cy+job->ts2+1)*w+cx+job->ts2+1] - job->sum [(cy-job->ts1)*w+cx+job->ts2+1]
+       - job->sum [(cy+job->ts2+1)*w+cx-job->ts1]   + job->sum [(cy-job->ts1)*w+cx-job->ts1];
+    s2 = job->sum2[(cy+job->ts2+1)*w+cx+job->ts2+1] - job->sum2[(cy-job->ts1)*w+cx+job->ts2+1]
+       - job->sum2[(cy+job->ts2+1)*w+cx-job->ts1]   + job->sum2[(cy-job->ts1)*w+cx-job->ts1];
+    var = ((double)s2*n - (double)s1*s1) / n;
+    if( var < (double)n * job->sd_thresh * job->sd_thresh * AR2_FEATURE_MAP_SD_MARGIN ) return -1;
+
+    ave = (float)s1;
+    ave /= n;
+
+    tp = template;
+    vlen1 = 0.0f;
+    for( j = -job->ts1; j <= job->ts2; j++ ) {
+        ip = &(job->imageBW[(cy+j)*job->xsize+(cx-job->ts1)]);
+        for( i = -job->ts1; i <= job->ts2 ; i++ ) {
+            *tp = (float )(*(ip++)) - ave;
+            vlen1 += *tp * *tp;
+            tp++;
+        }
+    }
+
+    if( vlen1 == 0.0f ) return -1;
+    if( vlen1/n < job->sd_thresh*job->sd_thresh ) return -1;
+
+    *vlen = sqrtf(vlen1);
+
+    return 0;
+}
+
+// Sums of squared pixels, and of pixels times template, over the windows centred on lanes
+// horizontally adjacent positions from (cx, cy), each in the order get_similarity() uses.
+static void ar2FeatureMapWindowSums( const AR2FeatureMapJobT *job, const float *template, int lanes, int cx, int cy,
+                                     float *sxx, float *sxy )
+{
+    const float    *ip, *ip2, *tp;
+    float           t;
+    int             i, j, l;
+
+    tp = template;
+#if AR2_FEATURE_MAP_LANES == 4
+    if( lanes == 4 ) {
+#  if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+        float32x4_t     vxx = vdupq_n_f32(0.0f);
+        float32x4_t     vxy = vdupq_n_f32(0.0f);
+        float32x4_t     v;
+        for( j = -job->ts1; j <= job->ts2; j++ ) {
+            ip  = &(job->fimageBW [(cy+j)*job->xsize+(cx-job->ts1)]);
+            ip2 = &(job->fimageBW2[(cy+j)*job->xsize+(cx-job->ts1)]);
+            for( i = -job->ts1; i <= job->ts2 ; i++ ) {
+                v   = vld1q_f32( ip++ );
+                vxx = vaddq_f32( vxx, vld1q_f32( ip2++ ) );
+                vxy = vaddq_f32( vxy, vmulq_n_f32( v, *(tp++) ) ); // Not fused, as in the scalar code.
+            }
+        }
+        vst1q_f32( sxx, vxx );
+        vst1q_f32( sxy, vxy );
+#  else
+        __m128          vxx = _mm_setzero_ps();
+        __m128          vxy = _mm_setzero_ps();
+        for( j = -job->ts1; j <= job->ts2; j++ ) {
+            ip  = &(job->fimageBW [(cy+j)*job->xsize+(cx-job->ts1)]);
+            ip2 = &(job->fimageBW2[(cy+j)*job->xsize+(cx-job->ts1)]);
+            for( i = -job->ts1; i <= job->ts2 ; i++ ) {
+                vxx = _mm_add_ps( vxx, _mm_loadu_ps( ip2++ ) );
+                vxy = _mm_add_ps( vxy, _mm_mul_ps( _mm_loadu_ps( ip++ ), _mm_set1_ps( *(tp++) ) ) );
+            }
+        }
+        _mm_storeu_ps( sxx, vxx );
+        _mm_storeu_ps( sxy, vxy );
+#  endif
+        return;
+    }
+#endif
+    for( l = 0; l < lanes; l++ ) sxx[l] = sxy[l] = 0.0f;
+    for( j = -job->ts1; j <= job->ts2; j++ ) {
+        ip  = &(job->fimageBW [(cy+j)*job->xsize+(cx-job->ts1)]);
+        ip2 = &(job->fimageBW2[(cy+j)*job->xsize+(cx-job->ts1)]);
+        for( i = -job->ts1; i <= job->ts2 ; i++ ) {
+            t = *(tp++);
+            for( l = 0; l < lanes; l++ ) {
+                sxx[l] += ip2[l];
+                sxy[l] += ip[l] * t;
+            }
+            ip++;
+            ip2++;
+        }
+    }
+}
+
+// Computes the feature map for image rows [begin+1, end+1).
+static void ar2GenFeatureMapRows( void *arg, int begin, int end )
+{
+    AR2FeatureMapJobT  *job = (AR2FeatureMapJobT *)arg;
+    ARUint8            *imageBW = (ARUint8 *)job->imageBW;
+    const float        *fp2;
+    float              *template;
+    float               sxx[AR2_FEATURE_MAP_LANES], sxy[AR2_FEATURE_MAP_LANES];
+    float               vlen, vlen2, sx, max, sim;
+    int                 xsize = job->xsize;
+    int                 ysize = job->ysize;
+    int                 ts1 = job->ts1, ts2 = job->ts2;
+    int                 s1 = job->search_size1, s2 = job->search_size2;
+    int                 n, w, lanes, cx, cy;
+    int                 i, j, ii, jj, l;
+
+    arMalloc(template, float , (ts1+ts2+1)*(ts1+ts2+1));
+    n = (ts1+ts2+1)*(ts1+ts2+1);
+    w = xsize + 1;
+
+    for( j = begin + 1; j < end + 1; j++ ) {
+        ARLOGi("\r%4d/%4d.", ysize - 1 - ar2AtomicDec(&(job->rowsLeft)), ysize); fflush(stdout);
+        for( i = 1; i < xsize-1; i++ ) {
+            fp2 = &(job->grad[j*xsize+i]);
+            job->map[j*xsize+i] = 1.0f;
+            if( *fp2 <= *(fp2-1) || *fp2 <= *(fp2+1) || *fp2 <= *(fp2-xsize) || *fp2 <= *(fp2+xsize) ) continue;
+            if( (int)(*fp2 * 1000) < job->gradThresh ) continue;
+
+            if( job->sum == NULL ) {
+                // Windows too large for exact integral sums; as originally computed.
+                if( make_template(imageBW, xsize, ysize, i, j, ts1, ts2, job->sd_thresh, template, &vlen) < 0 ) continue;
+                max = -1.0f;
+                for( jj = -s1; jj <= s1; jj++ ) {
+                    for( ii = -s1; ii <= s1; ii++ ) {
+                        if( ii*ii + jj*jj <= s2*s2 ) continue;
+                        if( get_similarity(imageBW, xsize, ysize, template, vlen, ts1, ts2, i+ii, j+jj, &sim) < 0 ) continue;
+                        if( sim > max ) {
+                            max = sim;
+                            if( max > job->max_sim_thresh ) break;
+                        }
+                    }
+                    if( max > job->max_sim_thresh ) break;
+                }
+                job->map[j*xsize+i] = max;
+                continue;
+            }
+
+            if( ar2FeatureMapTemplate(job, i, j, template, &vlen) < 0 ) continue;
+
+            // Positions are scored a group of lanes at a time, then taken in order as before, so that
+            // the search stops at the same position and the extra scores are discarded.
+            max = -1.0f;
+            for( jj = -s1; jj <= s1; jj++ ) {
+                cy = j + jj;
+                if( cy - ts1 < 0 || cy + ts2 >= ysize ) continue;
+                for( ii = -s1; ii <= s1; ii += lanes ) {
+                    lanes = s1 - ii + 1;
+                    if( lanes > AR2_FEATURE_MAP_LANES ) lanes = AR2_FEATURE_MAP_LANES;
+                    cx = i + ii;
+                    if( cx - ts1 < 0 || cx + lanes - 1 + ts2 >= xsize ) lanes = 1;
+                    if( cx - ts1 < 0 || cx + ts2 >= xsize ) continue;
+                    // Skip groups lying wholly within the excluded disc, which is convex.
+                    if( ii*ii + jj*jj <= s2*s2 && (ii+lanes-1)*(ii+lanes-1) + jj*jj <= s2*s2 ) continue;
+                    ar2FeatureMapWindowSums( job, template, lanes, cx, cy, sxx, sxy );
+                    for( l = 0; l < lanes; l++ ) {
+                        if( (ii+l)*(ii+l) + jj*jj <= s2*s2 ) continue;
+                        sx = (float)(job->sum[(cy+ts2+1)*w+cx+l+ts2+1] - job->sum[(cy-ts1)*w+cx+l+ts2+1]
+                                   - job->sum[(cy+ts2+1)*w+cx+l-ts1]   + job->sum[(cy-ts1)*w+cx+l-ts1]);
+                        vlen2 = sxx[l] - sx*sx/n;
+                        if( vlen2 == 0.0f ) continue;
+                        vlen2 = sqrtf(vlen2);
+                        sim = sxy[l] / (vlen * vlen2);
+                        if( sim > max ) {
+                            max = sim;
+                            if( max > job->max_sim_thresh ) break;
+                        }
+                    }
+                    if( max > job->max_sim_thresh ) break;
+                }
+                if( max > job->max_sim_thresh ) break;
+            }
+            job->map[j*xsize+i] = max;
+        }
+    }
+
+    free( template );
+}
@@ -38,8 +38,23 @@
 #include <AR/ar.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <AR2/featureSet.h>
 
+static int ar2GetFeatureIndexCell( AR2FeatureIndexT *featureIndex, AR2FeatureCoordT *coord )
+{
+    int     cx, cy;
+
+    cx = (int)((coord->mx - featureIndex->mx0) / featureIndex->cellSize);
+    cy = (int)((coord->my - featureIndex->my0) / featureIndex->cellSize);
+    if( cx < 0 ) cx = 0;
+    if( cy < 0 ) cy = 0;
+    if( cx >= featureIndex->xnum ) cx = featureIndex->xnum - 1;
+    if( cy >= featureIndex->ynum ) cy = featureIndex->ynum - 1;
+
+    return cy*featureIndex->xnum + cx;
+}
+
 AR2FeatureSetT *ar2ReadFeatureSet( char *filename, char *ext )
 {
     AR2FeatureSetT *featureSet = NULL;
@@ -174,3 +189,92 @@ int ar2FreeFeatureSet( AR2FeatureSetT **featureSet )
 
     return 0;
 }
+
+AR2FeatureIndexT *ar2GenFeatureIndex( AR2FeatureSetT *featureSet )
+{
+    AR2FeatureIndexT *featureIndex;
+    AR2FeatureCoordT *coord;
+    float             mx0, my0, mx1, my1;
+    int               maxNum, grid, cellNum;
+    int              *count;
+    int               c;
+    int               i, j, n;
+
+    if( featureSet == NULL || featureSet->num < 1 ) return NULL;
+
+    // Extent of the features of all scales.
+    mx0 = my0 = mx1 = my1 = 0.0F;
+    maxNum = n = 0;
+    for( i = 0; i < featureSet->num; i++ ) {
+        if( featureSet->list[i].num > maxNum ) maxNum = featureSet->list[i].num;
+        for( j = 0; j < featureSet->list[i].num; j++, n++ ) {
+            coord = &(featureSet->list[i].coord[j]);
+            if( n == 0 || coord->mx < mx0 ) mx0 = coord->mx;
+            if( n == 0 || coord->my < my0 ) my0 = coord->my;
+            if( n == 0 || coord->mx > mx1 ) mx1 = coord->mx;
+            if( n == 0 || coord->my > my1 ) my1 = coord->my;
+        }
+    }
+    if( n == 0 ) return NULL;
+
+    arMalloc( featureIndex, AR2FeatureIndexT, 1 );
+    featureIndex->mx0 = mx0;
+    featureIndex->my0 = my0;
+    grid = (int)sqrtf( (float)maxNum / AR2_FEATURE_INDEX_CELL_FEATURES );
+    if( grid < 1 ) grid = 1;
+    if( grid > AR2_FEATURE_INDEX_GRID_MAX ) grid = AR2_FEATURE_INDEX_GRID_MAX;
+    featureIndex->cellSize = ((mx1 - mx0 > my1 - my0) ? mx1 - mx0 : my1 - my0) / grid;
+    if( featureIndex->cellSize <= 0.0F ) featureIndex->cellSize = 1.0F;
+    featureIndex->xnum = (int)ceilf( (mx1 - mx0) / featureIndex->cellSize );
+    featureIndex->ynum = (int)ceilf( (my1 - my0) / featureIndex->cellSize );
+    if( featureIndex->xnum < 1 ) featureIndex->xnum = 1;
+    if( featureIndex->ynum < 1 ) featureIndex->ynum = 1;
+    if( featureIndex->xnum > grid ) featureIndex->xnum = grid;
+    if( featureIndex->ynum > grid ) featureIndex->ynum = grid;
+    cellNum = featureIndex->xnum * featureIndex->ynum;
+
+    featureIndex->num = featureSet->num;
+    arMalloc( featureIndex->cellStart, int *, featureSet->num );
+    arMalloc( featureIndex->cellFeature, int *, featureSet->num );
+    arMalloc( count, int, cellNum );
+    for( i = 0; i < featureSet->num; i++ ) {
+        arMalloc( featureIndex->cellStart[i], int, cellNum + 1 );
+        arMalloc( featureIndex->cellFeature[i], int, (featureSet->list[i].num > 0 ? featureSet->list[i].num : 1) );
+
+        // Counting sort by cell, which keeps features in ascending order within each cell.
+        for( c = 0; c < cellNum; c++ ) count[c] = 0;
+        for( j = 0; j < featureSet->list[i].num; j++ ) {
+            count[ar2GetFeatureIndexCell( featureIndex, &(featureSet->list[i].coord[j]) )]++;
+        }
+        featureIndex->cellStart[i][0] = 0;
+        for( c = 0; c < cellNum; c++ ) {
+            featureIndex->cellStart[i][c + 1] = featureIndex->cellStart[i][c] + count[c];
+            count[c] = featureIndex->cellStart[i][c];
+        }
+        for( j = 0; j < featureSet->list[i].num; j++ ) {
+            c = ar2GetFeatureIndexCell( featureIndex, &(featureSet->list[i].coord[j]) );
+            featureIndex->cellFeature[i][count[c]++] = j;
+        }
+    }
+    free( count );
+
+    return featureIndex;
+}
+
+int ar2FreeFeatureIndex( AR2FeatureIndexT **featureIndex )
+{
+    int     i;
+
+    if( *featureIndex == NULL ) return -1;
+
+    for( i = 0; i < (*featureIndex)->num; i++ ) {
+        free( (*featureIndex)->cellStart[i] );
+        free( (*featureIndex)->cellFeature[i] );
+    }
+    free( (*featureIndex)->cellStart );
+    free( (*featureIndex)->cellFeature );
+    free( *featureIndex );
+    *featureIndex = NULL;
+
+    return 0;
+}
@@ -39,11 +39,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 #include <AR/icp.h>
 #include <AR2/tracking.h>
 #include <AR2/util.h>
 
 static AR2HandleT *ar2CreateHandleSub( AR_PIXEL_FORMAT pixFormat, int xsize, int ysize, int threadNum );
+static void        ar2GetIdealBounds ( ARParamLT *cparamLT, float bounds[4] );
 
 
 AR2HandleT *ar2CreateHandle( ARParamLT *cparamLT, AR_PIXEL_FORMAT pixFormat, int threadNum )
@@ -56,10 +58,46 @@ AR2HandleT *ar2CreateHandle( ARParamLT *cparamLT, AR_PIXEL_FORMAT pixFormat, int
     ar2Handle->cparamLT          = cparamLT;
     ar2Handle->icpHandle         = icpCreateHandle( cparamLT->param.mat );
     icpSetInlierProbability( ar2Handle->icpHandle, 0.0 );
+    ar2GetIdealBounds( cparamLT, ar2Handle->idealBounds );
 
     return ar2Handle;
 }
 
+// Bounds (xmin, xmax, ymin, ymax), in ideal screen coordinates, outside which no point can be
+// observed in the frame. The lens model maps the border of the frame to the border of its ideal
+// image, so only the border is examined. The margin covers the tolerance of ar2MarkerCoord2ScreenCoord2().
+static void ar2GetIdealBounds( ARParamLT *cparamLT, float bounds[4] )
+{
+    const int   xsize = cparamLT->param.xsize;
+    const int   ysize = cparamLT->param.ysize;
+    float       ix, iy;
+    int         x, y, n;
+
+    bounds[0] = bounds[2] =  1.0e10F;
+    bounds[1] = bounds[3] = -1.0e10F;
+    n = 0;
+    for( y = 0; y <= ysize; y++ ) {
+        for( x = 0; x <= xsize; x += ((y == 0 || y == ysize) ? 1 : xsize) ) {
+            if( arParamObserv2IdealLTf( &cparamLT->paramLTf, (float)x, (float)y, &ix, &iy ) < 0 ) continue;
+            if( ix < bounds[0] ) bounds[0] = ix;
+            if( ix > bounds[1] ) bounds[1] = ix;
+            if( iy < bounds[2] ) bounds[2] = iy;
+            if( iy > bounds[3] ) bounds[3] = iy;
+            n++;
+        }
+    }
+    if( n == 0 ) {
+        // No lookup table coverage; disable culling.
+        bounds[0] = bounds[2] = -1.0e10F;
+        bounds[1] = bounds[3] =  1.0e10F;
+        return;
+    }
+    bounds[0] -= AR2_VISIBLE_BOUNDS_MARGIN;
+    bounds[1] += AR2_VISIBLE_BOUNDS_MARGIN;
+    bounds[2] -= AR2_VISIBLE_BOUNDS_MARGIN;
+    bounds[3] += AR2_VISIBLE_BOUNDS_MARGIN;
+}
+
 AR2HandleT *ar2CreateHandleHomography( int xsize, int ysize, AR_PIXEL_FORMAT pixFormat, int threadNum )
 {
     AR2HandleT   *ar2Handle;
@@ -87,6 +125,8 @@ static AR2HandleT *ar2CreateHandleSub( int pixFormat, int xsize, int ysize, int
     ar2Handle->blurLevel         = AR2_DEFAULT_BLUR_LEVEL;
 #endif
     ar2Handle->searchSize        = AR2_DEFAULT_SEARCH_SIZE;
+    ar2Handle->searchPyramidLevel = AR2_DEFAULT_SEARCH_PYRAMID_LEVEL;
+    ar2Handle->adaptiveSearch    = AR2_DEFAULT_ADAPTIVE_SEARCH;
     ar2Handle->templateSize1     = AR2_DEFAULT_TS1;
     ar2Handle->templateSize2     = AR2_DEFAULT_TS2;
     ar2Handle->searchFeatureNum  = AR2_DEFAULT_SEARCH_FEATURE_NUM;
@@ -95,6 +135,13 @@ static AR2HandleT *ar2CreateHandleSub( int pixFormat, int xsize, int ysize, int
     }
     ar2Handle->simThresh         = AR2_DEFAULT_SIM_THRESH;
     ar2Handle->trackingThresh    = AR2_DEFAULT_TRACKING_THRESH;
+    ar2Handle->templateReuseThresh = AR2_DEFAULT_TEMPLATE_REUSE_THRESH;
+    memset( ar2Handle->templateCache, 0, sizeof(ar2Handle->templateCache) );
+    ar2Handle->templateCacheFrame = 0;
+    ar2Handle->idealBounds[0] = ar2Handle->idealBounds[2] = -1.0e10F;
+    ar2Handle->idealBounds[1] = ar2Handle->idealBounds[3] =  1.0e10F;
+    ar2Handle->visibleFeature     = NULL;
+    ar2Handle->visibleFeatureSize = 0;
 
 
 
@@ -109,13 +156,27 @@ static AR2HandleT *ar2CreateHandleSub( int pixFormat, int xsize, int ysize, int
     }
     ar2Handle->threadNum = threadNum;
     ARLOGi("Tracking thread = %d\n", threadNum);
+    ar2Handle->selectSeed    = (unsigned int)time(NULL);
+    ar2Handle->taskNum       = 0;
+    ar2Handle->taskClaim     = 0;
+    ar2Handle->searchPyramid   = NULL;
+    ar2Handle->searchPyramidShared = NULL;
+    ar2Handle->searchLuma      = NULL;
+    ar2Handle->taskSearchImage = NULL;
+    // arg[0] is used by the thread calling ar2Tracking(), which also runs searches.
+    ar2Handle->threadHandle[0] = NULL;
     for( i = 0; i < ar2Handle->threadNum; i++ ) {
-        arMalloc( ar2Handle->arg[i].mfImage, ARUint8, xsize*ysize );
+        ar2Handle->arg[i].ar2Handle = ar2Handle;
         ar2Handle->arg[i].templ = NULL;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
         ar2Handle->arg[i].templ2 = NULL;
 #endif
-        ar2Handle->threadHandle[i] = threadInit(i, &(ar2Handle->arg[i]), ar2Tracking2d);
+        memset( &(ar2Handle->arg[i].scratch), 0, sizeof(AR2MatchingScratchT) );
+        if( i > 0 && (ar2Handle->threadHandle[i] = threadInit(i, &(ar2Handle->arg[i]), ar2Tracking2d)) == NULL ) {
+            ARLOGe("Error: Unable to create tracking thread #%d.\n", i);
+            ar2Handle->threadNum = i;
+            break;
+        }
     }
 
     return ar2Handle;
@@ -128,15 +189,21 @@ int ar2DeleteHandle( AR2HandleT **ar2Handle )
     if( *ar2Handle == NULL ) return -1;
 
     for( i = 0; i < (*ar2Handle)->threadNum; i++ ) {
-        threadWaitQuit( (*ar2Handle)->threadHandle[i] );
-        threadFree( &((*ar2Handle)->threadHandle[i]) );
-        if( (*ar2Handle)->arg[i].mfImage   != NULL )  free( (*ar2Handle)->arg[i].mfImage );
+        if( (*ar2Handle)->threadHandle[i] ) {
+            threadWaitQuit( (*ar2Handle)->threadHandle[i] );
+            threadFree( &((*ar2Handle)->threadHandle[i]) );
+        }
         if( (*ar2Handle)->arg[i].templ  != NULL ) ar2FreeTemplate( (*ar2Handle)->arg[i].templ );
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
         if( (*ar2Handle)->arg[i].templ2 != NULL ) ar2FreeTemplate ( (*ar2Handle)->arg[i].templ2 );
 #endif
+        ar2FreeMatchingScratch( &((*ar2Handle)->arg[i].scratch) );
     }
 
+    for( i = 0; i < AR2_TEMPLATE_CACHE_MAX; i++ ) free( (*ar2Handle)->templateCache[i].templ.img1 );
+    arImagePyramidFinal( (*ar2Handle)->searchPyramid );
+    free( (*ar2Handle)->searchLuma );
+    free( (*ar2Handle)->visibleFeature );
     if( (*ar2Handle)->icpHandle != NULL ) icpDeleteHandle( &((*ar2Handle)->icpHandle) );
     //if( (*ar2Handle)->cparamLT  != NULL ) arParamLTFree( (*ar2Handle)->cparamLT );
     free( *ar2Handle );
@@ -232,6 +299,67 @@ int ar2GetSearchSize( AR2HandleT *ar2Handle, int *searchSize )
     return 0;
 }
 
+int ar2SetAdaptiveSearch( AR2HandleT *ar2Handle, int adaptiveSearch )
+{
+    if( ar2Handle == NULL ) return -1;
+    ar2Handle->adaptiveSearch = (adaptiveSearch ? 1 : 0);
+    return 0;
+}
+
+int ar2GetAdaptiveSearch( AR2HandleT *ar2Handle, int *adaptiveSearch )
+{
+    if( ar2Handle == NULL ) return -1;
+    *adaptiveSearch = ar2Handle->adaptiveSearch;
+    return 0;
+}
+
+int ar2SetSearchPyramidLevel( AR2HandleT *ar2Handle, int searchPyramidLevel )
+{
+    if( ar2Handle == NULL ) return -1;
+    if( searchPyramidLevel < 0 || searchPyramidLevel > AR2_SEARCH_PYRAMID_LEVEL_MAX ) {
+        ARLOGe("Error: search pyramid level %d out of range.\n", searchPyramidLevel);
+        return -1;
+    }
+    ar2Handle->searchPyramidLevel = searchPyramidLevel;
+    return 0;
+}
+
+int ar2GetSearchPyramidLevel( AR2HandleT *ar2Handle, int *searchPyramidLevel )
+{
+    if( ar2Handle == NULL ) return -1;
+    *searchPyramidLevel = ar2Handle->searchPyramidLevel;
+    return 0;
+}
+
+int ar2SetSearchPyramid( AR2HandleT *ar2Handle, ARImagePyramid *pyramid )
+{
+    if( ar2Handle == NULL ) return -1;
+    if( pyramid != NULL && (pyramid->xsize != ar2Handle->xsize || pyramid->ysize != ar2Handle->ysize) ) {
+        ARLOGe("Error: search pyramid size %dx%d does not match frame size %dx%d.\n", pyramid->xsize, pyramid->ysize, ar2Handle->xsize, ar2Handle->ysize);
+        return -1;
+    }
+    ar2Handle->searchPyramidShared = pyramid;
+    return 0;
+}
+
+int ar2SetTemplateReuseThresh( AR2HandleT *ar2Handle, float templateReuseThresh )
+{
+    if( ar2Handle == NULL ) return -1;
+    if( templateReuseThresh < 0.0F ) {
+        ARLOGe("Error: template reuse threshold %f out of range.\n", templateReuseThresh);
+        return -1;
+    }
+    ar2Handle->templateReuseThresh = templateReuseThresh;
+    return 0;
+}
+
+int ar2GetTemplateReuseThresh( AR2HandleT *ar2Handle, float *templateReuseThresh )
+{
+    if( ar2Handle == NULL ) return -1;
+    *templateReuseThresh = ar2Handle->templateReuseThresh;
+    return 0;
+}
+
 int ar2SetSearchFeatureNum( AR2HandleT *ar2Handle, int searchFeatureNum )
 {
     if( ar2Handle == NULL ) return -1;
@@ -43,15 +43,125 @@
 #ifdef _WIN32
 #  define lroundf(x) ((x)>=0.0f?(long)((x)+0.5f):(long)((x)-0.5f))
 #endif
+#if defined(_WIN32) && !defined(_WINRT)
+#  include <windows.h>
+#  include <io.h>
+#elif !defined(_WIN32)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+#if !defined(_WINRT)
+#  include <pthread.h>
+#else
+#  include <windows.h>
+#endif
 #include <AR2/imageFormat.h>
 #include <AR2/imageSet.h>
+#include <thread_sub.h>
+#include "private.h"
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+#  include <arm_neon.h>
+#elif defined(HAVE_INTEL_SIMD)
+#  include <emmintrin.h> // SSE2.
+#endif
+
+#define AR2_RESAMPLE_BAND_ROWS      16  // Fewest output rows given to a thread when resampling.
+
+// Image set container, version AR2_IMAGESET_VERSION. The header is followed by one AR2ImageSetPlaneT
+// per scale, then by the planes, each starting on a multiple of AR2_IMAGESET_PLANE_ALIGN bytes.
+// Values are in the byte order of the writer.
+#define AR2_IMAGESET_MAGIC          "AR2I"
+#define AR2_IMAGESET_PLANE_RAW      0
+#define AR2_IMAGESET_PLANE_LZ4      1
+
+typedef struct {
+    char          magic[4];     // AR2_IMAGESET_MAGIC. Distinct from any scale count, which begins older formats.
+    int32_t       version;
+    int32_t       num;
+    int32_t       reserved;
+} AR2ImageSetHeaderT;
+
+typedef struct {
+    int32_t       xsize;
+    int32_t       ysize;
+    float         dpi;
+    int32_t       compression;  // AR2_IMAGESET_PLANE_RAW or AR2_IMAGESET_PLANE_LZ4.
+    uint64_t      offset;       // From the start of the file.
+    uint64_t      size;         // Bytes stored.
+} AR2ImageSetPlaneT;
+
+// A box-filter resampling of an image, split across threads by output row.
+typedef struct {
+    const ARUint8  *src;
+    int             xsize;
+    int             ysize;
+    int             nc;
+    ARUint8        *dst;
+    int             wx;
+    const int      *sx;         // Per output column, first and last source column of its box.
+    const int      *ex;
+    const int      *sy;         // Per output row, first and last source row of its box.
+    const int      *ey;
+} AR2ResampleT;
+
+// Bookkeeping for an image set whose scales are materialised on demand. All managed sets are
+// kept in one list, so that the least-recently-used scale among them can be found. The list,
+// loading, and imgBW of the scales of managed sets are guarded by ar2ResidencyLock. pinCount and
+// lastUse are updated atomically, so that a scale already in memory can be acquired and released
+// without taking the lock.
+typedef struct _AR2ImageSetResidencyT {
+    AR2ImageSetT                  *imageSet;
+    char                          *filename;    // Image set file, from which released scales are regenerated.
+    AR2ImageSetPlaneT             *plane;       // Plane table of a container file, or NULL for a JPEG image set.
+    volatile int                  *pinCount;    // Per scale, acquisitions not yet released, or -1 if the pixels are not in memory.
+    volatile unsigned long        *lastUse;     // Per scale, value of ar2ResidencyClock at the last acquisition.
+    char                          *loading;     // Per scale, 1 while a thread materialises it with the lock dropped.
+    struct _AR2ImageSetResidencyT *prev;
+    struct _AR2ImageSetResidencyT *next;
+} AR2ImageSetResidencyT;
+
+#if !defined(_WINRT)
+static pthread_mutex_t          ar2ResidencyLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           ar2ResidencyCond = PTHREAD_COND_INITIALIZER; // Signalled when a scale finishes loading.
+#  define ar2ResidencyLockAcquire() pthread_mutex_lock( &ar2ResidencyLock )
+#  define ar2ResidencyLockRelease() pthread_mutex_unlock( &ar2ResidencyLock )
+#  define ar2ResidencyWait()        pthread_cond_wait( &ar2ResidencyCond, &ar2ResidencyLock )
+#  define ar2ResidencyWakeAll()     pthread_cond_broadcast( &ar2ResidencyCond )
+#else
+static SRWLOCK                  ar2ResidencyLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE       ar2ResidencyCond = CONDITION_VARIABLE_INIT; // Signalled when a scale finishes loading.
+#  define ar2ResidencyLockAcquire() AcquireSRWLockExclusive( &ar2ResidencyLock )
+#  define ar2ResidencyLockRelease() ReleaseSRWLockExclusive( &ar2ResidencyLock )
+#  define ar2ResidencyWait()        SleepConditionVariableSRW( &ar2ResidencyCond, &ar2ResidencyLock, INFINITE, 0 )
+#  define ar2ResidencyWakeAll()     WakeAllConditionVariable( &ar2ResidencyCond )
+#endif
+static size_t                   ar2ResidencyBudget   = 0;   // Bytes, or 0 for none.
+static size_t                   ar2ResidencyResident = 0;   // Bytes of pixels held (or being loaded) by managed sets.
+static volatile int             ar2ResidencyOver     = 0;   // 1 if ar2ResidencyResident exceeded the budget at the last trim.
+static volatile unsigned long   ar2ResidencyClock    = 0;
+static AR2ImageSetResidencyT   *ar2ResidencyList     = NULL;
 
 static AR2ImageT *ar2GenImageLayer1 ( ARUint8 *image, int xsize, int ysize, int nc, float srcdpi, float dstdpi );
 static AR2ImageT *ar2GenImageLayer2 ( AR2ImageT *src, float dstdpi );
+static void       ar2Resample       ( const ARUint8 *image, int xsize, int ysize, int nc, float srcdpi, float dstdpi,
+                                      ARUint8 *dst, int wx, int wy );
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
 static void       defocus_image     ( ARUint8 *img, int xsize, int ysize, int n );
 #endif
 static AR2ImageSetT *ar2ReadImageSetOld( FILE *fp );
+static AR2ImageSetT *ar2ReadImageSetPlanes( FILE *fp, char *filename );
+static int        ar2MapImageSetFile  ( FILE *fp, void **map, size_t *mapSize );
+static void       ar2UnmapImageSetFile( void *map, size_t mapSize );
+#if !AR2_CAPABLE_ADAPTIVE_TEMPLATE
+static void       ar2ResidencyRegister  ( AR2ImageSetT *imageSet, char *filename, AR2ImageSetPlaneT *plane );
+static void       ar2ResidencyUnregister( AR2ImageSetT *imageSet );
+static void       ar2ResidencyFree      ( AR2ImageSetResidencyT *residency );
+static int        ar2ResidencyPin       ( AR2ImageSetResidencyT *residency, int scale );
+static int        ar2ResidencyLoad      ( AR2ImageSetT *imageSet, int scale, ARUint8 *srcBW, ARUint8 **pixels );
+static int        ar2ResidencyEvict     ( AR2ImageSetT *imageSet, int scale );
+static void       ar2ResidencyTrim      ( size_t bytes );
+#endif
 
 AR2ImageSetT *ar2GenImageSet( ARUint8 *image, int xsize, int ysize, int nc, float dpi, float dpi_list[], int dpi_num )
 {
@@ -67,6 +177,9 @@ AR2ImageSetT *ar2GenImageSet( ARUint8 *image, int xsize, int ysize, int nc, floa
 
     arMalloc( imageSet, AR2ImageSetT, 1 );
     imageSet->num = dpi_num;
+    imageSet->map = NULL;
+    imageSet->mapSize = 0;
+    imageSet->residency = NULL;
     arMalloc( imageSet->scale,  AR2ImageT*,  imageSet->num );
 
     imageSet->scale[0] = ar2GenImageLayer1( image, xsize, ysize, nc, dpi, dpi_list[0] );
@@ -91,6 +204,7 @@ AR2ImageSetT *ar2ReadImageSet( char *filename )
     size_t         len;
     const char     ext[] = ".iset";
     char          *buf;
+    char           magic[4];
     
     len = strlen(filename) + strlen(ext) + 1; // +1 for nul terminator.
     arMalloc(buf, char, len);
@@ -102,7 +216,15 @@ AR2ImageSetT *ar2ReadImageSet( char *filename )
         return (NULL);
     }
 
+    if( fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, AR2_IMAGESET_MAGIC, sizeof(magic)) == 0 ) {
+        return ar2ReadImageSetPlanes(fp, filename);
+    }
+    rewind(fp);
+
     arMalloc( imageSet, AR2ImageSetT, 1 );
+    imageSet->map = NULL;
+    imageSet->mapSize = 0;
+    imageSet->residency = NULL;
 
     if( fread(&(imageSet->num), sizeof(imageSet->num), 1, fp) != 1 || imageSet->num <= 0) {
         ARLOGe("Error reading imageSet.\n");
@@ -177,6 +299,9 @@ AR2ImageSetT *ar2ReadImageSet( char *filename )
     }
 
     fclose(fp);
+#if !AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    ar2ResidencyRegister( imageSet, filename, NULL );
+#endif
 
     return imageSet;
     
@@ -235,6 +360,248 @@ bailBadWrite:
     return (-1);
 }
 
+int ar2WriteImageSet2( char *filename, AR2ImageSetT *imageSet, int format )
+{
+    static const ARUint8 zero[AR2_IMAGESET_PLANE_ALIGN] = {0};
+    FILE               *fp;
+    AR2ImageSetHeaderT  header;
+    AR2ImageSetPlaneT  *plane;
+    ARUint8            *data, *lz4Buf = NULL;
+    uint64_t            offset;
+    size_t              pad, planeSize;
+    int                 lz4Size;
+    int                 i;
+    size_t              len;
+    const char          ext[] = ".iset";
+    char               *buf;
+
+    if( format == AR2_IMAGESET_FORMAT_JPEG ) return ar2WriteImageSet( filename, imageSet );
+    if( format != AR2_IMAGESET_FORMAT_RAW && format != AR2_IMAGESET_FORMAT_LZ4 ) {
+        ARLOGe("Error: unknown image set format %d.\n", format);
+        return (-1);
+    }
+
+    len = strlen(filename) + strlen(ext) + 1; // +1 for nul terminator.
+    arMalloc(buf, char, len);
+    sprintf(buf, "%s%s", filename, ext);
+    if( (fp=fopen(buf, "wb")) == NULL ) {
+        ARLOGe("Error: unable to open file '%s' for writing.\n", buf);
+        free(buf);
+        return (-1);
+    }
+    free(buf);
+
+    memcpy( header.magic, AR2_IMAGESET_MAGIC, sizeof(header.magic) );
+    header.version  = AR2_IMAGESET_VERSION;
+    header.num      = imageSet->num;
+    header.reserved = 0;
+    arMalloc( plane, AR2ImageSetPlaneT, imageSet->num );
+    memset( plane, 0, sizeof(AR2ImageSetPlaneT) * imageSet->num );
+    if( fwrite(&header, sizeof(header), 1, fp) != 1 ) goto bailBadWrite;
+    if( fwrite(plane, sizeof(AR2ImageSetPlaneT), imageSet->num, fp) != (size_t)imageSet->num ) goto bailBadWrite; // Filled in below.
+    offset = sizeof(header) + sizeof(AR2ImageSetPlaneT) * imageSet->num;
+
+    for( i = 0; i < imageSet->num; i++ ) {
+        plane[i].xsize = imageSet->scale[i]->xsize;
+        plane[i].ysize = imageSet->scale[i]->ysize;
+        plane[i].dpi   = imageSet->scale[i]->dpi;
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+        data = imageSet->scale[i]->imgBWBlur[0];
+#else
+        data = imageSet->scale[i]->imgBW;
+#endif
+        planeSize = (size_t)plane[i].xsize * plane[i].ysize;
+        plane[i].compression = AR2_IMAGESET_PLANE_RAW;
+        plane[i].size        = planeSize;
+        if( format == AR2_IMAGESET_FORMAT_LZ4 ) {
+            free( lz4Buf );
+            arMalloc( lz4Buf, ARUint8, ar2LZ4CompressBound((int)planeSize) );
+            lz4Size = ar2LZ4Compress( data, (int)planeSize, lz4Buf, ar2LZ4CompressBound((int)planeSize) );
+            if( lz4Size > 0 && (size_t)lz4Size < planeSize ) {
+                plane[i].compression = AR2_IMAGESET_PLANE_LZ4;
+                plane[i].size        = lz4Size;
+                data = lz4Buf;
+            }
+        }
+
+        pad = (size_t)((AR2_IMAGESET_PLANE_ALIGN - offset % AR2_IMAGESET_PLANE_ALIGN) % AR2_IMAGESET_PLANE_ALIGN);
+        if( pad > 0 && fwrite(zero, 1, pad, fp) != pad ) goto bailBadWrite;
+        offset += pad;
+        plane[i].offset = offset;
+        if( fwrite(data, 1, (size_t)plane[i].size, fp) != (size_t)plane[i].size ) goto bailBadWrite;
+        offset += plane[i].size;
+    }
+
+    if( fseek(fp, (long)sizeof(header), SEEK_SET) != 0 ) goto bailBadWrite;
+    if( fwrite(plane, sizeof(AR2ImageSetPlaneT), imageSet->num, fp) != (size_t)imageSet->num ) goto bailBadWrite;
+
+    free( lz4Buf );
+    free( plane );
+    fclose(fp);
+    return 0;
+
+bailBadWrite:
+    ARLOGe("Error saving image set: error writing data.\n");
+    free( lz4Buf );
+    free( plane );
+    fclose(fp);
+    return (-1);
+}
+
+// Reads an image set in the container format, the magic number having been read already. Uncompressed
+// planes are left in the file mapping, to be paged in as they are first touched; compressed planes
+// are decoded. Where the file cannot be mapped, all planes are read into memory.
+static AR2ImageSetT *ar2ReadImageSetPlanes( FILE *fp, char *filename )
+{
+    AR2ImageSetHeaderT  header;
+    AR2ImageSetPlaneT  *plane = NULL;
+    AR2ImageSetT       *imageSet = NULL;
+    ARUint8            *src = NULL;
+    size_t              fileSize, planeSize;
+    int                 i;
+
+    rewind(fp);
+    if( fread(&header, sizeof(header), 1, fp) != 1 ) {
+        ARLOGe("Error reading imageSet.\n");
+        fclose(fp);
+        return NULL;
+    }
+    if( header.version != AR2_IMAGESET_VERSION ) {
+        ARLOGe("Error: imageSet is version %d; only version %d is supported.\n", header.version, AR2_IMAGESET_VERSION);
+        fclose(fp);
+        return NULL;
+    }
+    if( header.num <= 0 ) {
+        ARLOGe("Error reading imageSet.\n");
+        fclose(fp);
+        return NULL;
+    }
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    ARLOGe("Error: imageSet version %d cannot be used with adaptive templates.\n", header.version);
+    fclose(fp);
+    return NULL;
+#else
+    ARLOGi("Imageset contains %d images.\n", header.num);
+    arMalloc( plane, AR2ImageSetPlaneT, header.num );
+    if( fread(plane, sizeof(AR2ImageSetPlaneT), header.num, fp) != (size_t)header.num ) {
+        ARLOGe("Error reading imageSet.\n");
+        goto bail;
+    }
+
+    arMalloc( imageSet, AR2ImageSetT, 1 );
+    imageSet->num = 0; // Counts scales read, for cleanup.
+    imageSet->map = NULL;
+    imageSet->mapSize = 0;
+    imageSet->residency = NULL;
+    arMalloc( imageSet->scale, AR2ImageT*, header.num );
+
+    if( ar2MapImageSetFile(fp, &(imageSet->map), &(imageSet->mapSize)) == 0 ) {
+        fileSize = imageSet->mapSize;
+    }
+    else {
+        ARLOGw("Unable to map imageSet into memory; reading it instead.\n");
+        imageSet->map = NULL;
+        if( fseek(fp, 0, SEEK_END) != 0 ) goto bail;
+        fileSize = (size_t)ftell(fp);
+    }
+
+    for( i = 0; i < header.num; i++ ) {
+        planeSize = (size_t)plane[i].xsize * (size_t)plane[i].ysize;
+        if( plane[i].xsize <= 0 || plane[i].ysize <= 0
+         || plane[i].offset > fileSize || plane[i].size > fileSize - plane[i].offset
+         || (plane[i].compression == AR2_IMAGESET_PLANE_RAW && plane[i].size != planeSize)
+         || (plane[i].compression == AR2_IMAGESET_PLANE_LZ4 && (plane[i].size == 0 || planeSize > 0x7FFFFFFF))
+         || (plane[i].compression != AR2_IMAGESET_PLANE_RAW && plane[i].compression != AR2_IMAGESET_PLANE_LZ4) ) {
+            ARLOGe("Error: imageSet scale %d is corrupt.\n", i);
+            goto bail;
+        }
+
+        arMalloc( imageSet->scale[i], AR2ImageT, 1 );
+        imageSet->scale[i]->xsize = plane[i].xsize;
+        imageSet->scale[i]->ysize = plane[i].ysize;
+        imageSet->scale[i]->dpi   = plane[i].dpi;
+        imageSet->scale[i]->imgBW = NULL;
+        imageSet->num++;
+
+        if( imageSet->map && plane[i].compression == AR2_IMAGESET_PLANE_RAW ) {
+            imageSet->scale[i]->imgBW = (ARUint8 *)imageSet->map + plane[i].offset;
+            continue;
+        }
+
+        arMalloc( imageSet->scale[i]->imgBW, ARUint8, planeSize );
+        if( imageSet->map ) {
+            src = (ARUint8 *)imageSet->map + plane[i].offset;
+        }
+        else {
+            if( plane[i].compression == AR2_IMAGESET_PLANE_RAW ) src = imageSet->scale[i]->imgBW;
+            else arMalloc( src, ARUint8, (size_t)plane[i].size );
+            if( fseek(fp, (long)plane[i].offset, SEEK_SET) != 0 || fread(src, 1, (size_t)plane[i].size, fp) != (size_t)plane[i].size ) {
+                ARLOGe("Error reading imageSet.\n");
+                if( src != imageSet->scale[i]->imgBW ) free(src);
+                goto bail;
+            }
+        }
+        if( plane[i].compression == AR2_IMAGESET_PLANE_LZ4 ) {
+            if( ar2LZ4Decompress(src, (int)plane[i].size, imageSet->scale[i]->imgBW, (int)planeSize) != (int)planeSize ) {
+                ARLOGe("Error: imageSet scale %d is corrupt.\n", i);
+                if( !imageSet->map ) free(src);
+                goto bail;
+            }
+            if( !imageSet->map ) free(src);
+        }
+    }
+
+    fclose(fp);
+    ar2ResidencyRegister( imageSet, filename, plane ); // Takes ownership of plane.
+    return imageSet;
+
+bail:
+    if( imageSet ) ar2FreeImageSet( &imageSet );
+    free(plane);
+    fclose(fp);
+    return NULL;
+#endif
+}
+
+static int ar2MapImageSetFile( FILE *fp, void **map, size_t *mapSize )
+{
+#if defined(_WIN32) && !defined(_WINRT)
+    HANDLE          file, mapping;
+    LARGE_INTEGER   size;
+
+    file = (HANDLE)_get_osfhandle( _fileno(fp) );
+    if( file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) || size.QuadPart <= 0 ) return -1;
+    if( (mapping = CreateFileMapping(file, NULL, PAGE_WRITECOPY, 0, 0, NULL)) == NULL ) return -1;
+    *map = MapViewOfFile( mapping, FILE_MAP_COPY, 0, 0, 0 );
+    CloseHandle( mapping ); // The view keeps the mapping open.
+    if( *map == NULL ) return -1;
+    *mapSize = (size_t)size.QuadPart;
+    return 0;
+#elif defined(_WIN32)
+    return -1;
+#else
+    struct stat     st;
+    void           *p;
+
+    if( fstat(fileno(fp), &st) != 0 || st.st_size <= 0 ) return -1;
+    // Private and writable, so that planes may be modified in place like those read into memory.
+    p = mmap( NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0 );
+    if( p == MAP_FAILED ) return -1;
+    *map = p;
+    *mapSize = (size_t)st.st_size;
+    return 0;
+#endif
+}
+
+static void ar2UnmapImageSetFile( void *map, size_t mapSize )
+{
+#if defined(_WIN32) && !defined(_WINRT)
+    UnmapViewOfFile( map );
+#elif !defined(_WIN32)
+    munmap( map, mapSize );
+#endif
+}
+
 int ar2FreeImageSet( AR2ImageSetT **imageSet )
 {
     int    i;
@@ -242,31 +609,404 @@ int ar2FreeImageSet( AR2ImageSetT **imageSet )
     if(  imageSet == NULL ) return -1;
     if( *imageSet == NULL ) return -1;
 
+#if !AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    if( (*imageSet)->residency ) ar2ResidencyUnregister( *imageSet );
+#endif
     for( i = 0; i < (*imageSet)->num; i++ ) {
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
         for( int j = 0; j < AR2_BLUR_IMAGE_MAX; j++ ) {
             free( (*imageSet)->scale[i]->imgBWBlur[j] );
         }
 #else
-        free( (*imageSet)->scale[i]->imgBW  );
+        // Planes lying in the mapped file are released with it.
+        if( (*imageSet)->map == NULL
+         || (*imageSet)->scale[i]->imgBW <  (ARUint8 *)(*imageSet)->map
+         || (*imageSet)->scale[i]->imgBW >= (ARUint8 *)(*imageSet)->map + (*imageSet)->mapSize ) {
+            free( (*imageSet)->scale[i]->imgBW  );
+        }
 #endif
         free( (*imageSet)->scale[i] );
     }
     free( (*imageSet)->scale );
+    if( (*imageSet)->map ) ar2UnmapImageSetFile( (*imageSet)->map, (*imageSet)->mapSize );
     free( *imageSet );
     *imageSet = NULL;
 
     return 0;
 }
 
+int ar2SetImageSetResidencyBudget( size_t budget )
+{
+    ar2ResidencyLockAcquire();
+    ar2ResidencyBudget = budget;
+#if !AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    ar2ResidencyTrim( 0 );
+#endif
+    ar2ResidencyLockRelease();
+
+    return 0;
+}
+
+int ar2GetImageSetResidencyBudget( size_t *budget, size_t *resident )
+{
+    if( budget == NULL ) return -1;
+
+    ar2ResidencyLockAcquire();
+    *budget = ar2ResidencyBudget;
+    if( resident ) *resident = ar2ResidencyResident;
+    ar2ResidencyLockRelease();
+
+    return 0;
+}
+
+int ar2AcquireImageScale( AR2ImageSetT *imageSet, int scale )
+{
+#if !AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    AR2ImageSetResidencyT  *residency;
+    ARUint8                *srcBW, *pixels;
+    size_t                  bytes;
+    int                     srcPinned;
+    int                     ret;
+#endif
+
+    if( imageSet == NULL || scale < 0 || scale >= imageSet->num ) return -1;
+    if( imageSet->residency == NULL ) return 0;
+
+#if !AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    residency = imageSet->residency;
+    if( ar2ResidencyPin( residency, scale ) == 0 ) return 0;
+
+    ar2ResidencyLockAcquire();
+    for(;;) {
+        if( ar2ResidencyPin( residency, scale ) == 0 ) {
+            ar2ResidencyLockRelease();
+            return 0;
+        }
+        if( !residency->loading[scale] ) break;
+        ar2ResidencyWait(); // Another thread is materialising this scale.
+    }
+
+    // Reserve the scale's memory and materialise it with the lock dropped, so that other scales
+    // can be acquired meanwhile. A JPEG image set's scale 0, if in memory, is kept there until done.
+    residency->loading[scale] = 1;
+    bytes = (size_t)imageSet->scale[scale]->xsize * (size_t)imageSet->scale[scale]->ysize;
+    ar2ResidencyTrim( bytes );
+    ar2ResidencyResident += bytes;
+    srcPinned = (residency->plane == NULL && scale != 0 && ar2ResidencyPin( residency, 0 ) == 0);
+    srcBW = (srcPinned ? imageSet->scale[0]->imgBW : NULL);
+    ar2ResidencyLockRelease();
+
+    ret = ar2ResidencyLoad( imageSet, scale, srcBW, &pixels );
+
+    ar2ResidencyLockAcquire();
+    if( srcPinned ) ar2AtomicDec( &(residency->pinCount[0]) );
+    residency->loading[scale] = 0;
+    if( ret < 0 ) {
+        ar2ResidencyResident -= bytes;
+    }
+    else {
+        imageSet->scale[scale]->imgBW = pixels;
+        ar2AtomicSet( &(residency->lastUse[scale]), ar2AtomicInc( &ar2ResidencyClock ) );
+        ar2AtomicCAS( &(residency->pinCount[scale]), -1, 1 ); // Published after imgBW.
+    }
+    ar2ResidencyWakeAll();
+    ar2ResidencyLockRelease();
+
+    return ret;
+#else
+    return 0;
+#endif
+}
+
+int ar2ReleaseImageScale( AR2ImageSetT *imageSet, int scale )
+{
+#if !AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    volatile int   *pinCount;
+    int             count;
+#endif
+
+    if( imageSet == NULL || scale < 0 || scale >= imageSet->num ) return -1;
+    if( imageSet->residency == NULL ) return 0;
+
+#if !AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    pinCount = &(imageSet->residency->pinCount[scale]);
+    do {
+        count = ar2AtomicGet( pinCount );
+        if( count <= 0 ) {
+            ARLOGe("Error: imageSet scale %d released without being acquired.\n", scale);
+            return -1;
+        }
+    } while( !ar2AtomicCAS( pinCount, count, count - 1 ) );
+
+    // Scales in use may have taken the total over budget.
+    if( count == 1 && ar2AtomicGet( &ar2ResidencyOver ) ) {
+        ar2ResidencyLockAcquire();
+        ar2ResidencyTrim( 0 );
+        ar2ResidencyLockRelease();
+    }
+#endif
+
+    return 0;
+}
+
+#if !AR2_CAPABLE_ADAPTIVE_TEMPLATE
+// Places a newly read image set, all of whose scales are in memory, under management if a budget
+// is set, then releases scales to bring the total within it. Takes ownership of plane.
+static void ar2ResidencyRegister( AR2ImageSetT *imageSet, char *filename, AR2ImageSetPlaneT *plane )
+{
+    AR2ImageSetResidencyT  *residency;
+    const char              ext[] = ".iset";
+    int                     i;
+
+    arMalloc( residency, AR2ImageSetResidencyT, 1 );
+    residency->imageSet = imageSet;
+    arMalloc( residency->filename, char, strlen(filename) + strlen(ext) + 1 );
+    sprintf( residency->filename, "%s%s", filename, ext );
+    residency->plane = plane;
+    arMalloc( residency->pinCount, volatile int, imageSet->num );
+    arMalloc( residency->lastUse, volatile unsigned long, imageSet->num );
+    arMalloc( residency->loading, char, imageSet->num );
+    for( i = 0; i < imageSet->num; i++ ) {
+        residency->pinCount[i] = 0;
+        residency->lastUse[i]  = 0; // Not yet used, so first to be released.
+        residency->loading[i]  = 0;
+    }
+
+    // The budget is checked under the same lock as the set is listed, so that a concurrent
+    // ar2SetImageSetResidencyBudget(0) is seen either before or after the set is managed.
+    ar2ResidencyLockAcquire();
+    if( ar2ResidencyBudget == 0 ) {
+        ar2ResidencyLockRelease();
+        ar2ResidencyFree( residency );
+        return;
+    }
+    residency->prev = NULL;
+    residency->next = ar2ResidencyList;
+    if( ar2ResidencyList ) ar2ResidencyList->prev = residency;
+    ar2ResidencyList = residency;
+    imageSet->residency = residency;
+    for( i = 0; i < imageSet->num; i++ ) {
+        ar2ResidencyResident += (size_t)imageSet->scale[i]->xsize * (size_t)imageSet->scale[i]->ysize;
+    }
+    ar2ResidencyTrim( 0 );
+    ar2ResidencyLockRelease();
+}
+
+static void ar2ResidencyUnregister( AR2ImageSetT *imageSet )
+{
+    AR2ImageSetResidencyT  *residency = imageSet->residency;
+    int                     i;
+
+    ar2ResidencyLockAcquire();
+    if( residency->prev ) residency->prev->next = residency->next;
+    else                  ar2ResidencyList      = residency->next;
+    if( residency->next ) residency->next->prev = residency->prev;
+    for( i = 0; i < imageSet->num; i++ ) {
+        if( imageSet->scale[i]->imgBW ) ar2ResidencyResident -= (size_t)imageSet->scale[i]->xsize * (size_t)imageSet->scale[i]->ysize;
+    }
+    ar2ResidencyLockRelease();
+
+    ar2ResidencyFree( residency );
+    imageSet->residency = NULL;
+}
+
+static void ar2ResidencyFree( AR2ImageSetResidencyT *residency )
+{
+    free( residency->loading );
+    free( (void *)residency->lastUse );
+    free( (void *)residency->pinCount );
+    free( residency->plane );
+    free( residency->filename );
+    free( residency );
+}
+
+// Adds an acquisition of a scale if its pixels are in memory. Returns 0 if so, or -1 if the scale
+// has to be materialised first. Needs no lock.
+static int ar2ResidencyPin( AR2ImageSetResidencyT *residency, int scale )
+{
+    int     count;
+
+    do {
+        count = ar2AtomicGet( &(residency->pinCount[scale]) );
+        if( count < 0 ) return -1;
+    } while( !ar2AtomicCAS( &(residency->pinCount[scale]), count, count + 1 ) );
+    ar2AtomicSet( &(residency->lastUse[scale]), ar2AtomicInc( &ar2ResidencyClock ) );
+
+    return 0;
+}
+
+// Regenerates the pixels of a released scale exactly as they were first read, and places a pointer
+// to them in pixels. Uncompressed planes of a mapped container are simply pointed to again; JPEG
+// image sets have scale 0 decoded afresh (unless srcBW, the pinned pixels of scale 0, is non-NULL)
+// and other scales minified from it. Called without ar2ResidencyLock, so touches no shared state.
+static int ar2ResidencyLoad( AR2ImageSetT *imageSet, int scale, ARUint8 *srcBW, ARUint8 **pixels_p )
+{
+    AR2ImageSetResidencyT  *residency = imageSet->residency;
+    AR2ImageT              *image     = imageSet->scale[scale];
+    AR2ImageSetPlaneT      *plane;
+    AR2JpegImageT          *jpgImage;
+    AR2ImageT               src, *dst;
+    ARUint8                *pixels, *data;
+    FILE                   *fp;
+    size_t                  bytes = (size_t)image->xsize * (size_t)image->ysize;
+    int32_t                 num;
+
+    if( residency->plane ) {
+        plane = &(residency->plane[scale]);
+        if( imageSet->map && plane->compression == AR2_IMAGESET_PLANE_RAW ) {
+            *pixels_p = (ARUint8 *)imageSet->map + plane->offset;
+            return 0;
+        }
+
+        arMalloc( pixels, ARUint8, bytes );
+        if( imageSet->map ) {
+            data = (ARUint8 *)imageSet->map + plane->offset;
+        }
+        else {
+            if( plane->compression == AR2_IMAGESET_PLANE_RAW ) data = pixels;
+            else arMalloc( data, ARUint8, (size_t)plane->size );
+            if( (fp = fopen(residency->filename, "rb")) == NULL ) {
+                ARLOGe("Error: unable to open file '%s' for reading.\n", residency->filename);
+                if( data != pixels ) free( data );
+                free( pixels );
+                return -1;
+            }
+            if( fseek(fp, (long)plane->offset, SEEK_SET) != 0 || fread(data, 1, (size_t)plane->size, fp) != (size_t)plane->size ) {
+                ARLOGe("Error reading imageSet '%s'.\n", residency->filename);
+                fclose( fp );
+                if( data != pixels ) free( data );
+                free( pixels );
+                return -1;
+            }
+            fclose( fp );
+        }
+        if( plane->compression == AR2_IMAGESET_PLANE_LZ4
+         && ar2LZ4Decompress(data, (int)plane->size, pixels, (int)bytes) != (int)bytes ) {
+            ARLOGe("Error: imageSet scale %d is corrupt.\n", scale);
+            if( !imageSet->map ) free( data );
+            free( pixels );
+            return -1;
+        }
+        if( !imageSet->map && data != pixels ) free( data );
+        *pixels_p = pixels;
+        return 0;
+    }
+
+    src.xsize = imageSet->scale[0]->xsize;
+    src.ysize = imageSet->scale[0]->ysize;
+    src.dpi   = imageSet->scale[0]->dpi;
+    src.imgBW = srcBW;
+    if( src.imgBW == NULL ) {
+        if( (fp = fopen(residency->filename, "rb")) == NULL ) {
+            ARLOGe("Error: unable to open file '%s' for reading.\n", residency->filename);
+            return -1;
+        }
+        jpgImage = NULL;
+        if( fread(&num, sizeof(num), 1, fp) == 1 ) jpgImage = ar2ReadJpegImage2(fp);
+        fclose( fp );
+        if( jpgImage == NULL ) {
+            ARLOGe("Error reading imageSet '%s'.\n", residency->filename);
+            return -1;
+        }
+        if( jpgImage->nc != 1 || jpgImage->xsize != src.xsize || jpgImage->ysize != src.ysize ) {
+            ARLOGe("Error: imageSet '%s' has changed since it was read.\n", residency->filename);
+            ar2FreeJpegImage( &jpgImage );
+            return -1;
+        }
+        src.imgBW = jpgImage->image;
+        free( jpgImage );
+        if( scale == 0 ) {
+            *pixels_p = src.imgBW;
+            return 0;
+        }
+    }
+    dst = ar2GenImageLayer2( &src, image->dpi );
+    if( src.imgBW != srcBW ) free( src.imgBW );
+    *pixels_p = dst->imgBW;
+    free( dst );
+
+    return 0;
+}
+
+// Releases the pixels of a scale, unless it has just been acquired. Returns 0 if released, or -1
+// if in use. The caller holds ar2ResidencyLock.
+static int ar2ResidencyEvict( AR2ImageSetT *imageSet, int scale )
+{
+    AR2ImageT  *image = imageSet->scale[scale];
+    size_t      bytes = (size_t)image->xsize * (size_t)image->ysize;
+#if !defined(_WIN32) && defined(MADV_DONTNEED)
+    uintptr_t   start, end;
+    long        pageSize;
+#endif
+
+    // Claim the scale against lock-free acquisition in ar2ResidencyPin().
+    if( !ar2AtomicCAS( &(imageSet->residency->pinCount[scale]), 0, -1 ) ) return -1;
+
+    if( imageSet->map && image->imgBW >= (ARUint8 *)imageSet->map && image->imgBW < (ARUint8 *)imageSet->map + imageSet->mapSize ) {
+#if !defined(_WIN32) && defined(MADV_DONTNEED)
+        // Drop the pages lying wholly within the plane; they are read back from the file when next touched.
+        // On other platforms, pages of the mapping are left for the system to reclaim.
+        pageSize = sysconf( _SC_PAGESIZE );
+        if( pageSize > 0 ) {
+            start = ((uintptr_t)image->imgBW + pageSize - 1) / pageSize * pageSize;
+            end   = ((uintptr_t)image->imgBW + bytes) / pageSize * pageSize;
+            if( end > start ) madvise( (void *)start, end - start, MADV_DONTNEED );
+        }
+#endif
+    }
+    else {
+        free( image->imgBW );
+    }
+    image->imgBW = NULL;
+    ar2ResidencyResident -= bytes;
+
+    return 0;
+}
+
+// Releases least-recently-used scales not in use, until bytes more would fit within the budget.
+// The caller holds ar2ResidencyLock.
+static void ar2ResidencyTrim( size_t bytes )
+{
+    AR2ImageSetResidencyT  *residency, *lru;
+    unsigned long           lastUse, lruLastUse;
+    int                     lruScale;
+    int                     i;
+
+    if( ar2ResidencyBudget == 0 ) {
+        ar2AtomicSet( &ar2ResidencyOver, 0 );
+        return;
+    }
+
+    while( ar2ResidencyResident + bytes > ar2ResidencyBudget ) {
+        lru = NULL;
+        lruScale = 0;
+        lruLastUse = 0;
+        for( residency = ar2ResidencyList; residency != NULL; residency = residency->next ) {
+            for( i = 0; i < residency->imageSet->num; i++ ) {
+                if( ar2AtomicGet( &(residency->pinCount[i]) ) != 0 ) continue; // In use, or not in memory.
+                lastUse = ar2AtomicGet( &(residency->lastUse[i]) );
+                if( lru == NULL || lastUse < lruLastUse ) {
+                    lru = residency;
+                    lruScale = i;
+                    lruLastUse = lastUse;
+                }
+            }
+        }
+        if( lru == NULL ) break; // Everything left is in use.
+        ar2ResidencyEvict( lru->imageSet, lruScale ); // If acquired meanwhile, the next pass finds another.
+    }
+    ar2AtomicSet( &ar2ResidencyOver, (ar2ResidencyResident + bytes > ar2ResidencyBudget) ); // bytes are about to be added.
+}
+#endif
+
 static AR2ImageT *ar2GenImageLayer1( ARUint8 *image, int xsize, int ysize, int nc, float srcdpi, float dstdpi )
 {
     AR2ImageT   *dst;
-    ARUint8     *p1, *p2;
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    ARUint8     *p1;
+#endif
+    ARUint8     *p2;
     int          wx, wy;
-    int          sx, sy, ex, ey;
-    int          ii, jj, iii, jjj;
-    int          co, value;
 
     wx = (int)lroundf(xsize * dstdpi / srcdpi);
     wy = (int)lroundf(ysize * dstdpi / srcdpi);
@@ -285,40 +1025,8 @@ static AR2ImageT *ar2GenImageLayer1( ARUint8 *image, int xsize, int ysize, int n
     p2 = dst->imgBW;
 #endif
 
-    // Scale down, nearest neighbour.
-    for( jj = 0; jj < wy; jj++ ) {
-        sy = (int)lroundf( jj    * srcdpi / dstdpi);
-        ey = (int)lroundf((jj+1) * srcdpi / dstdpi) - 1;
-        if( ey >= ysize ) ey = ysize - 1;
-        for( ii = 0; ii < wx; ii++ ) {
-            sx = (int)lroundf( ii    * srcdpi / dstdpi);
-            ex = (int)lroundf((ii+1) * srcdpi / dstdpi) - 1;
-            if( ex >= xsize ) ex = xsize - 1;
-
-            co = value = 0;
-            if( nc == 1 ) {
-                for( jjj = sy; jjj <= ey; jjj++ ) {
-                    p1 = &(image[(jjj*xsize+sx)*nc]);
-                    for( iii = sx; iii <= ex; iii++ ) {
-                        value += *(p1++);
-                        co++;
-                    }
-                }
-            }
-            else {
-                for( jjj = sy; jjj <= ey; jjj++ ) {
-                    p1 = &(image[(jjj*xsize+sx)*nc]);
-                    for( iii = sx; iii <= ex; iii++ ) {
-                        value += *(p1++);
-                        value += *(p1++);
-                        value += *(p1++);
-                        co+=3;
-                    }
-                }
-            }
-            *(p2++) = value / co;
-        }
-    }
+    // Scale down, averaging over the box of source pixels covered by each destination pixel.
+    ar2Resample( image, xsize, ysize, nc, srcdpi, dstdpi, p2, wx, wy );
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     for( int i = 1; i < AR2_BLUR_IMAGE_MAX; i++ ) {
@@ -337,11 +1045,11 @@ static AR2ImageT *ar2GenImageLayer1( ARUint8 *image, int xsize, int ysize, int n
 static AR2ImageT *ar2GenImageLayer2( AR2ImageT *src, float dpi )
 {
     AR2ImageT   *dst;
-    ARUint8     *p1, *p2;
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+    ARUint8     *p1;
+#endif
+    ARUint8     *p2;
     int          wx, wy;
-    int          sx, sy, ex, ey;
-    int          ii, jj, iii, jjj;
-    int          co, value;
 
     wx = (int)lroundf(src->xsize * dpi / src->dpi);
     wy = (int)lroundf(src->ysize * dpi / src->dpi);
@@ -360,30 +1068,11 @@ static AR2ImageT *ar2GenImageLayer2( AR2ImageT *src, float dpi )
     p2 = dst->imgBW;
 #endif
 
-    for( jj = 0; jj < wy; jj++ ) {
-        sy = (int)lroundf( jj    * src->dpi / dpi);
-        ey = (int)lroundf((jj+1) * src->dpi / dpi) - 1;
-        if( ey >= src->ysize ) ey = src->ysize - 1;
-        for( ii = 0; ii < wx; ii++ ) {
-            sx = (int)lroundf( ii    * src->dpi / dpi);
-            ex = (int)lroundf((ii+1) * src->dpi / dpi) - 1;
-            if( ex >= src->xsize ) ex = src->xsize - 1;
-
-            co = value = 0;
-            for( jjj = sy; jjj <= ey; jjj++ ) {
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                p1 = &(src->imgBWBlur[0][jjj*src->xsize+sx]);
+    ar2Resample( src->imgBWBlur[0], src->xsize, src->ysize, 1, src->dpi, dpi, p2, wx, wy );
 #else
-                p1 = &(src->imgBW[jjj*src->xsize+sx]);
+    ar2Resample( src->imgBW, src->xsize, src->ysize, 1, src->dpi, dpi, p2, wx, wy );
 #endif
-                for( iii = sx; iii <= ex; iii++ ) {
-                    value += *(p1++);
-                    co++;
-                }
-            }
-            *(p2++) = value / co;
-        }
-    }
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     defocus_image( dst->imageBWBlur[0], wx, wy, 3 );
@@ -400,6 +1089,118 @@ static AR2ImageT *ar2GenImageLayer2( AR2ImageT *src, float dpi )
     return dst;
 }
 
+// Adds a row of n bytes to n 32-bit column sums.
+static void ar2ResampleAddRow( ARUint32 *sum, const ARUint8 *row, int n )
+{
+    int         i;
+
+    i = 0;
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+    for( ; i + 16 <= n; i += 16 ) {
+        uint8x16_t  p  = vld1q_u8( row + i );
+        uint16x8_t  lo = vmovl_u8( vget_low_u8(p) );
+        uint16x8_t  hi = vmovl_u8( vget_high_u8(p) );
+        vst1q_u32( sum + i,      vaddw_u16( vld1q_u32(sum + i),      vget_low_u16(lo)  ) );
+        vst1q_u32( sum + i + 4,  vaddw_u16( vld1q_u32(sum + i + 4),  vget_high_u16(lo) ) );
+        vst1q_u32( sum + i + 8,  vaddw_u16( vld1q_u32(sum + i + 8),  vget_low_u16(hi)  ) );
+        vst1q_u32( sum + i + 12, vaddw_u16( vld1q_u32(sum + i + 12), vget_high_u16(hi) ) );
+    }
+#elif defined(HAVE_INTEL_SIMD)
+    const __m128i   zero = _mm_setzero_si128();
+    for( ; i + 16 <= n; i += 16 ) {
+        __m128i     p  = _mm_loadu_si128( (const __m128i *)(row + i) );
+        __m128i     lo = _mm_unpacklo_epi8( p, zero );
+        __m128i     hi = _mm_unpackhi_epi8( p, zero );
+        _mm_storeu_si128( (__m128i *)(sum + i),      _mm_add_epi32( _mm_loadu_si128((__m128i *)(sum + i)),      _mm_unpacklo_epi16(lo, zero) ) );
+        _mm_storeu_si128( (__m128i *)(sum + i + 4),  _mm_add_epi32( _mm_loadu_si128((__m128i *)(sum + i + 4)),  _mm_unpackhi_epi16(lo, zero) ) );
+        _mm_storeu_si128( (__m128i *)(sum + i + 8),  _mm_add_epi32( _mm_loadu_si128((__m128i *)(sum + i + 8)),  _mm_unpacklo_epi16(hi, zero) ) );
+        _mm_storeu_si128( (__m128i *)(sum + i + 12), _mm_add_epi32( _mm_loadu_si128((__m128i *)(sum + i + 12)), _mm_unpackhi_epi16(hi, zero) ) );
+    }
+#endif
+    for( ; i < n; i++ ) sum[i] += row[i];
+}
+
+// Computes output rows [begin, end). The rows of each box are summed into per-column totals,
+// whose running (prefix) sum then gives the total of any box in one subtraction. Integer sums
+// are exact, so the result is the same as summing each box pixel by pixel.
+static void ar2ResampleRows( void *arg, int begin, int end )
+{
+    const AR2ResampleT *r = (const AR2ResampleT *)arg;
+    ARUint32           *colSum, *prefix;
+    const ARUint32     *c;
+    ARUint8            *q;
+    int                 ii, jj, jjj, n;
+
+    n = r->xsize * r->nc;
+    arMalloc( colSum, ARUint32, n );
+    arMalloc( prefix, ARUint32, r->xsize + 1 );
+
+    for( jj = begin; jj < end; jj++ ) {
+        memset( colSum, 0, sizeof(ARUint32) * n );
+        for( jjj = r->sy[jj]; jjj <= r->ey[jj]; jjj++ ) ar2ResampleAddRow( colSum, &(r->src[jjj*n]), n );
+
+        prefix[0] = 0;
+        if( r->nc == 1 ) {
+            for( ii = 0; ii < r->xsize; ii++ ) prefix[ii+1] = prefix[ii] + colSum[ii];
+        }
+        else {
+            for( ii = 0, c = colSum; ii < r->xsize; ii++, c += 3 ) prefix[ii+1] = prefix[ii] + c[0] + c[1] + c[2];
+        }
+
+        q = &(r->dst[jj*r->wx]);
+        for( ii = 0; ii < r->wx; ii++ ) {
+            *(q++) = (ARUint8)((int)(prefix[r->ex[ii]+1] - prefix[r->sx[ii]])
+                             / ((r->ey[jj] - r->sy[jj] + 1) * (r->ex[ii] - r->sx[ii] + 1) * r->nc));
+        }
+    }
+
+    free( prefix );
+    free( colSum );
+}
+
+// Box-filters image (xsize x ysize, nc = 1 or 3 interleaved channels, averaged together) at
+// srcdpi into dst (wx x wy) at dstdpi <= srcdpi. Box edges are rounded per pixel exactly as they
+// always have been, so that image sets are reproduced bit for bit.
+static void ar2Resample( const ARUint8 *image, int xsize, int ysize, int nc, float srcdpi, float dstdpi,
+                         ARUint8 *dst, int wx, int wy )
+{
+    AR2ResampleT    r;
+    int            *sx, *ex, *sy, *ey;
+    int             ii, jj;
+
+    arMalloc( sx, int, wx );
+    arMalloc( ex, int, wx );
+    arMalloc( sy, int, wy );
+    arMalloc( ey, int, wy );
+    for( ii = 0; ii < wx; ii++ ) {
+        sx[ii] = (int)lroundf( ii    * srcdpi / dstdpi);
+        ex[ii] = (int)lroundf((ii+1) * srcdpi / dstdpi) - 1;
+        if( ex[ii] >= xsize ) ex[ii] = xsize - 1;
+    }
+    for( jj = 0; jj < wy; jj++ ) {
+        sy[jj] = (int)lroundf( jj    * srcdpi / dstdpi);
+        ey[jj] = (int)lroundf((jj+1) * srcdpi / dstdpi) - 1;
+        if( ey[jj] >= ysize ) ey[jj] = ysize - 1;
+    }
+
+    r.src   = image;
+    r.xsize = xsize;
+    r.ysize = ysize;
+    r.nc    = nc;
+    r.dst   = dst;
+    r.wx    = wx;
+    r.sx    = sx;
+    r.ex    = ex;
+    r.sy    = sy;
+    r.ey    = ey;
+    threadParallelRun( wy, AR2_RESAMPLE_BAND_ROWS, ar2ResampleRows, &r );
+
+    free( ey );
+    free( sy );
+    free( ex );
+    free( sx );
+}
+
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
 static void defocus_image( ARUint8 *img, int xsize, int ysize, int n )
 {
@@ -457,6 +1258,9 @@ static AR2ImageSetT *ar2ReadImageSetOld( FILE *fp )
 #endif
 
     arMalloc( imageSet, AR2ImageSetT, 1 );
+    imageSet->map = NULL;
+    imageSet->mapSize = 0;
+    imageSet->residency = NULL;
     
     if( fread(&(imageSet->num), sizeof(imageSet->num), 1, fp) != 1 || imageSet->num <= 0) {
         ARLOGe("Error reading imageSet.\n");
@@ -0,0 +1,188 @@
+/*
+ *  AR2/lz4.c
+ *  ARToolKit5
+ *
+ *  This file is part of ARToolKit.
+ *
+ *  ARToolKit is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ARToolKit is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with ARToolKit.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As a special exception, the copyright holders of this library give you
+ *  permission to link this library with independent modules to produce an
+ *  executable, regardless of the license terms of these independent modules, and to
+ *  copy and distribute the resulting executable under terms of your choice,
+ *  provided that you also meet, for each linked independent module, the terms and
+ *  conditions of the license of that module. An independent module is a module
+ *  which is neither derived from nor based on this library. If you modify this
+ *  library, you may extend this exception to your version of the library, but you
+ *  are not obligated to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ *  Copyright 2015 Daqri, LLC.
+ *
+ */
+
+// A minimal codec for the LZ4 block format, used for compressed image set planes. Output of
+// ar2LZ4Compress() can be decoded by any LZ4 block decoder, and ar2LZ4Decompress() accepts any
+// valid LZ4 block. The compressor is a simple greedy one; planes are compressed once, offline.
+
+#include <AR/ar.h>
+#include <string.h>
+#include "private.h"
+
+#define LZ4_MIN_MATCH       4
+#define LZ4_LAST_LITERALS   5       // The last 5 bytes of a block are always literals.
+#define LZ4_MF_LIMIT        12      // The last match must start at least 12 bytes before the end of the block.
+#define LZ4_MAX_DISTANCE    65535
+#define LZ4_HASH_LOG        12
+
+static ARUint32 ar2LZ4Read32( const ARUint8 *p )
+{
+    ARUint32    v;
+    memcpy( &v, p, sizeof(v) );
+    return v;
+}
+
+static int ar2LZ4Hash( ARUint32 v )
+{
+    return (int)((v * 2654435761U) >> (32 - LZ4_HASH_LOG));
+}
+
+// Writes a length continuation: as many 255s as needed, then the remainder.
+static ARUint8 *ar2LZ4WriteLength( ARUint8 *op, int len )
+{
+    while( len >= 255 ) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (ARUint8)len;
+    return op;
+}
+
+// Emits one sequence: literals src[0..litLen), then, if matchLen > 0, a match. Returns NULL if dst would overflow.
+static ARUint8 *ar2LZ4WriteSequence( ARUint8 *op, ARUint8 *oend, const ARUint8 *lit, int litLen, int offset, int matchLen )
+{
+    ARUint8    *token;
+
+    if( op + 1 + litLen/255 + 1 + litLen + 2 + (matchLen > 0 ? matchLen/255 + 1 : 0) > oend ) return NULL;
+    token = op++;
+    if( litLen >= 15 ) {
+        *token = 15 << 4;
+        op = ar2LZ4WriteLength( op, litLen - 15 );
+    }
+    else *token = (ARUint8)(litLen << 4);
+    memcpy( op, lit, litLen );
+    op += litLen;
+    if( matchLen == 0 ) return op;
+
+    *op++ = (ARUint8)(offset & 0xFF);
+    *op++ = (ARUint8)(offset >> 8);
+    matchLen -= LZ4_MIN_MATCH;
+    if( matchLen >= 15 ) {
+        *token |= 15;
+        op = ar2LZ4WriteLength( op, matchLen - 15 );
+    }
+    else *token |= (ARUint8)matchLen;
+
+    return op;
+}
+
+int ar2LZ4CompressBound( int srcSize )
+{
+    return srcSize + srcSize/255 + 16;
+}
+
+int ar2LZ4Compress( const ARUint8 *src, int srcSize, ARUint8 *dst, int dstCapacity )
+{
+    int         table[1 << LZ4_HASH_LOG];
+    ARUint8    *op   = dst;
+    ARUint8    *oend = dst + dstCapacity;
+    int         ip, anchor, ref, len, h;
+    int         matchLimit = srcSize - LZ4_LAST_LITERALS;
+
+    if( src == NULL || dst == NULL || srcSize < 0 ) return -1;
+    for( h = 0; h < (1 << LZ4_HASH_LOG); h++ ) table[h] = -1;
+
+    ip = anchor = 0;
+    while( ip + LZ4_MF_LIMIT <= srcSize ) {
+        h = ar2LZ4Hash( ar2LZ4Read32(&src[ip]) );
+        ref = table[h];
+        table[h] = ip;
+        if( ref < 0 || ip - ref > LZ4_MAX_DISTANCE || ar2LZ4Read32(&src[ref]) != ar2LZ4Read32(&src[ip]) ) {
+            ip++;
+            continue;
+        }
+        len = LZ4_MIN_MATCH;
+        while( ip + len < matchLimit && src[ref + len] == src[ip + len] ) len++;
+        if( (op = ar2LZ4WriteSequence( op, oend, &src[anchor], ip - anchor, ip - ref, len )) == NULL ) return -1;
+        ip += len;
+        anchor = ip;
+    }
+    if( (op = ar2LZ4WriteSequence( op, oend, &src[anchor], srcSize - anchor, 0, 0 )) == NULL ) return -1;
+
+    return (int)(op - dst);
+}
+
+int ar2LZ4Decompress( const ARUint8 *src, int srcSize, ARUint8 *dst, int dstSize )
+{
+    const ARUint8  *ip   = src;
+    const ARUint8  *iend = src + srcSize;
+    ARUint8        *op   = dst;
+    ARUint8        *oend = dst + dstSize;
+    const ARUint8  *match;
+    int             token, len, b, offset;
+
+    if( src == NULL || dst == NULL || srcSize <= 0 ) return -1;
+
+    for(;;) {
+        token = *ip++;
+
+        len = token >> 4;
+        if( len == 15 ) {
+            do {
+                if( ip >= iend ) return -1;
+                b = *ip++;
+                len += b;
+                if( len > iend - ip ) return -1; // Also keeps len from overflowing on long runs of 255.
+            } while( b == 255 );
+        }
+        if( len > iend - ip || len > oend - op ) return -1;
+        memcpy( op, ip, len );
+        ip += len;
+        op += len;
+        if( ip == iend ) break; // The last sequence has no match.
+
+        if( iend - ip < 2 ) return -1;
+        offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if( offset == 0 || offset > op - dst ) return -1;
+
+        len = token & 15;
+        if( len == 15 ) {
+            do {
+                if( ip >= iend ) return -1;
+                b = *ip++;
+                len += b;
+                if( len > oend - op ) return -1;
+            } while( b == 255 );
+        }
+        len += LZ4_MIN_MATCH;
+        if( len > oend - op ) return -1;
+        match = op - offset;
+        while( len-- > 0 ) *op++ = *match++; // Byte at a time, as the match may overlap the output.
+
+        if( ip >= iend ) return -1;
+    }
+
+    return (op == oend ? dstSize : -1);
+}
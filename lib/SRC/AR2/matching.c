@@ -42,6 +42,20 @@
 #include <AR2/tracking.h>
 #include <AR2/config.h>
 #include <AR2/template.h>
+#include <string.h> // memset()
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+#  include <arm_neon.h>
+#  define AR2_MATCHING_SIMD 1
+#elif defined(HAVE_INTEL_SIMD)
+#  include <emmintrin.h> // SSE2.
+#  define AR2_MATCHING_SIMD 1
+#endif
+
+#ifdef _MSC_VER
+#  define AR2_INLINE __inline
+#else
+#  define AR2_INLINE inline
+#endif
 
 #define  USE_SEARCH1    1
 #define  USE_SEARCH2    1
@@ -52,22 +66,100 @@
 
 
 static int ar2GetBestMatchingSubFine   ( ARUint8 *img, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
-                                         AR2TemplateT *mtemp, int sx, int sy, int *val);
+                                         AR2TemplateT *mtemp, AR2MatchingScratchT *scratch, int sx, int sy, int *val);
 static void updateCandidate            ( int x, int y, int wval,
                                          int *keep_num, int cx[KEEP_NUM], int cy[KEEP_NUM], int cval[KEEP_NUM] );
 #if 1
 static int ar2GetBestMatchingSubFineOpt( ARUint8 *img, int xsize, int ysize, int sx1, int sy1, AR2TemplateT *mtemp,
-                                         ARUint32 *subImage1, ARUint32 *subImage2, int sx2, int sy2, int *val);
+                                         AR2MatchingScratchT *scratch, int sx2, int sy2, int *val);
 #endif
 
+// Template rows are padded to a whole number of SIMD vectors of this many 16-bit lanes.
+#define  AR2_MATCHING_LANES             8
+#define  AR2_MATCHING_STRIDE(xsize)     (((xsize) + AR2_MATCHING_LANES - 1)/AR2_MATCHING_LANES*AR2_MATCHING_LANES)
+#define  AR2_MATCHING_DEFAULT_BLOCKS    (AR2_MATCHING_STRIDE(AR2_DEFAULT_TS1 + AR2_DEFAULT_TS2 + 1)/AR2_MATCHING_LANES)
+
+#if AR2_MATCHING_SIMD
+static void ar2MatchingPrepareTemplate ( AR2TemplateT *mtemp, AR2MatchingScratchT *scratch );
+static void ar2MatchingSums            ( ARUint8 *img, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                                         AR2TemplateT *mtemp, AR2MatchingScratchT *scratch, int sx, int sy,
+                                         int *sum1, int *sum2, int *sum3 );
+#endif
+
+// Entries needed in each integral image buffer for fine matching of template mtemp.
+#define  AR2_MATCHING_SCRATCH_SIZE(mtemp) \
+    (((mtemp)->xsize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2)) * (((mtemp)->ysize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2))
+
+// Entries needed in each of the padded template and mask buffers for template mtemp.
+#define  AR2_MATCHING_TEMPL_SIZE(mtemp) \
+    (AR2_MATCHING_STRIDE((mtemp)->xsize) * (mtemp)->ysize)
+
+int ar2AllocMatchingScratch( AR2MatchingScratchT *scratch, AR2TemplateT *mtemp )
+{
+    int     size, templSize;
+
+    if( scratch == NULL || mtemp == NULL ) return -1;
+
+    size      = AR2_MATCHING_SCRATCH_SIZE(mtemp);
+    templSize = AR2_MATCHING_TEMPL_SIZE(mtemp);
+    if( scratch->subImage1 != NULL && scratch->size >= size
+     && scratch->templ != NULL && scratch->templSize >= templSize ) return 0;
+
+    ar2FreeMatchingScratch( scratch );
+    scratch->subImage1 = (ARUint32 *)malloc( sizeof(ARUint32)*size );
+    scratch->subImage2 = (ARUint32 *)malloc( sizeof(ARUint32)*size );
+    // templ, mask and the luma row share one block. A padded row is never longer than templSize.
+    scratch->templ     = (ARInt16 *)malloc( sizeof(ARInt16)*templSize*3 );
+    scratch->coarse.img1 = (ARUint16 *)malloc( sizeof(ARUint16)*templSize );
+    if( scratch->subImage1 == NULL || scratch->subImage2 == NULL || scratch->templ == NULL || scratch->coarse.img1 == NULL ) {
+        ARLOGe("Error: malloc\n");
+        ar2FreeMatchingScratch( scratch );
+        return -1;
+    }
+    scratch->mask      = scratch->templ + templSize;
+    scratch->luma      = scratch->mask  + templSize;
+    scratch->size      = size;
+    scratch->templSize = templSize;
+
+    return 0;
+}
+
+int ar2FreeMatchingScratch( AR2MatchingScratchT *scratch )
+{
+    if( scratch == NULL ) return -1;
+
+    free( scratch->subImage1 );
+    free( scratch->subImage2 );
+    free( scratch->templ );
+    free( scratch->coarse.img1 );
+    memset( scratch, 0, sizeof(AR2MatchingScratchT) );
+
+    return 0;
+}
+
+int ar2GetBestMatching( ARUint8 *img, __attribute__((unused)) ARUint8 *mfImage, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                        AR2TemplateT *mtemp, int rx, int ry,
+                        int search[3][2], int *bx, int *by, float *val)
+{
+    AR2MatchingScratchT scratch;
+    int                 ret;
+
+    memset( &scratch, 0, sizeof(AR2MatchingScratchT) );
+
+    if( ar2AllocMatchingScratch( &scratch, mtemp ) < 0 ) return -1;
+    ret = ar2GetBestMatchingScratch( img, xsize, ysize, pixFormat, mtemp, rx, ry, search, bx, by, val, &scratch );
+    ar2FreeMatchingScratch( &scratch );
+
+    return ret;
+}
+
 /*!
     @function
     @abstract Get best match for a candidate feature template.
     @discussion 
     @param img Incoming image to match against.
-    @param mfImage Buffer same size as img, to provide working memory for status of matched features.
-    @param xsize Horizontal size of img and mfImage.
-    @param ysize Vertical size of img and mfImage.
+    @param xsize Horizontal size of img.
+    @param ysize Vertical size of img.
     @param pixFormat Pixel format of img.
     @param mtemp Template undergoing matching.
     @param rx search radius in x dimension.
@@ -76,24 +168,25 @@ static int ar2GetBestMatchingSubFineOpt( ARUint8 *img, int xsize, int ysize, int
     @param bx On return, x position of best candidate.
     @param by On return, y position of best candidate.
     @param val On return, the quality of the match of the best candidate.
+    @param scratch Working memory for fine matching, sized for mtemp by ar2AllocMatchingScratch().
     @result -1 in case of error or no match, or 0 otherwise.
  */
  
-int ar2GetBestMatching( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
-                        AR2TemplateT *mtemp, int rx, int ry,
-                         int search[3][2], int *bx, int *by, float *val)
+int ar2GetBestMatchingScratch( ARUint8 *img, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                               AR2TemplateT *mtemp, int rx, int ry,
+                               int search[3][2], int *bx, int *by, float *val, AR2MatchingScratchT *scratch )
 {
     int              search_flag[] = {USE_SEARCH1, USE_SEARCH2, USE_SEARCH3};
-    int              px, py, sx, sy, ex, ey;
+    int              px, py;
+    int              wx[3], wy[3], wnum;
     int              yts1, yts2;
     int              keep_num;
     int              cx[KEEP_NUM], cy[KEEP_NUM];
     int              cval[KEEP_NUM];
     int              wval, wval2;
-    int              i, j, l;
+    int              i, j, k, l;
     int              ii;
     int              ret;
-    ARUint8         *pmf;
 #if 0
 #else
     ARUint32   *subImage1, *p11, *p12, w1;
@@ -103,37 +196,21 @@ int ar2GetBestMatching( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR
     ARUint8    *p3, *p4;
 #endif
 
-    // First pass: initialise.
-    yts1 = mtemp->yts1;
-    yts2 = mtemp->yts2;
-    for( ii = 0; ii < 3; ii++ ) {
-        if( search_flag[ii] == 0 ) continue;
-        if( search[ii][0] < 0 ) break;
-
-        // "Snap" position to centre of grid square.
-        px = (search[ii][0]/(SKIP_INTERVAL + 1))*(SKIP_INTERVAL + 1) + (SKIP_INTERVAL + 1)/2;
-        py = (search[ii][1]/(SKIP_INTERVAL + 1))*(SKIP_INTERVAL + 1) + (SKIP_INTERVAL + 1)/2;
-
-        sx = px - rx; // Start position in x.
-        if( sx < 0 ) sx = 0;
-        ex = px + rx; // End position in x.
-        if( ex >= xsize ) ex = xsize - 1;
-
-        sy = py - ry; // Start position in y.
-        if( sy < 0 ) sy = 0;
-        ey = py + ry; // End position in y.
-        if( ey >= ysize ) ey = ysize - 1;
-
-        // Initialise mfImage by writing 0s into the potential search space.
-        for( j = sy; j <= ey; j++ ) {
-            pmf = &mfImage[j*xsize + sx];
-            for( i = sx; i <= ex; i++ ) {
-                *(pmf++) = 0;
-            }
-        }
+    if( scratch == NULL || scratch->size < AR2_MATCHING_SCRATCH_SIZE(mtemp) ) {
+        ARLOGe("Error: ar2GetBestMatchingScratch() scratch too small for template.\n");
+        return -1;
     }
+#if AR2_MATCHING_SIMD
+    ar2MatchingPrepareTemplate( mtemp, scratch );
+#endif
 
-    // Second pass: get candidates.
+    // First pass: get candidates.
+    // Every window is sampled on the same lattice (centres are snapped to the middle of a grid square
+    // and all windows have the same radius), so a position has already been evaluated exactly when
+    // it lies inside an earlier window. That test replaces a frame-sized buffer of visited marks.
+    yts1 = mtemp->yts1;
+    yts2 = mtemp->yts2;
+    wnum = 0;
     keep_num = 0;
     ret = 1;
     for( ii = 0; ii < 3; ii++ ) {      
@@ -143,6 +220,7 @@ int ar2GetBestMatching( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR
             else    break;
         }
 
+        // "Snap" position to centre of grid square.
         px = (search[ii][0]/(SKIP_INTERVAL + 1))*(SKIP_INTERVAL + 1) + (SKIP_INTERVAL + 1)/2;
         py = (search[ii][1]/(SKIP_INTERVAL + 1))*(SKIP_INTERVAL + 1) + (SKIP_INTERVAL + 1)/2;
 
@@ -152,18 +230,23 @@ int ar2GetBestMatching( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR
             for( i = px - rx; i <= px + rx; i += SKIP_INTERVAL + 1 ) {
                 if( i - mtemp->xts1*AR2_TEMP_SCALE <  0     ) continue;
                 if( i + mtemp->xts2*AR2_TEMP_SCALE >= xsize ) break;
-                if( mfImage[j*xsize + i] ) continue; // Skip pixels already matched.
-                mfImage[j*xsize + i] = 1; // Mark this pixel as matched.
-                if( ar2GetBestMatchingSubFine(img, xsize, ysize, pixFormat, mtemp, i, j, &wval) < 0 ) {
+                for( k = 0; k < wnum; k++ ) {
+                    if( abs(i - wx[k]) <= rx && abs(j - wy[k]) <= ry ) break;
+                }
+                if( k < wnum ) continue; // Skip pixels already matched.
+                if( ar2GetBestMatchingSubFine(img, xsize, ysize, pixFormat, mtemp, scratch, i, j, &wval) < 0 ) {
                     continue;
                 }
                 ret = 0;
                 updateCandidate(i, j, wval, &keep_num, cx, cy, cval);
             }
         }
+        wx[wnum] = px;
+        wy[wnum] = py;
+        wnum++;
     }
 
-    // Third pass. Determine best candidate.
+    // Second pass. Determine best candidate.
     wval2 = 0;
     ret = -1;
 #if 0
@@ -174,7 +257,7 @@ int ar2GetBestMatching( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR
             for( i = cx[l] - SKIP_INTERVAL; i <= cx[l] + SKIP_INTERVAL; i++ ) {
                 if( i - mtemp->xts1*AR2_TEMP_SCALE <  0     ) continue;
                 if( i + mtemp->xts2*AR2_TEMP_SCALE >= xsize ) break;
-                if( ar2GetBestMatchingSubFine(img, xsize, ysize, pixFormat, mtemp, i, j, &wval) < 0 ) {
+                if( ar2GetBestMatchingSubFine(img, xsize, ysize, pixFormat, mtemp, scratch, i, j, &wval) < 0 ) {
                     continue;
                 }
                 if( wval > wval2 ) {
@@ -188,8 +271,8 @@ int ar2GetBestMatching( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR
         }
     }
 #else
-    arMalloc( subImage1, ARUint32, ( (mtemp->xsize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2)) * ((mtemp->ysize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2) ) );
-    arMalloc( subImage2, ARUint32, ( (mtemp->xsize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2)) * ((mtemp->ysize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2) ) );
+    subImage1 = scratch->subImage1;
+    subImage2 = scratch->subImage2;
 
     for(l = 0; l < keep_num; l++) {
         if( mtemp->validNum != mtemp->xsize*mtemp->ysize
@@ -204,7 +287,7 @@ int ar2GetBestMatching( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR
                 for( i = cx[l] - SKIP_INTERVAL; i <= cx[l] + SKIP_INTERVAL; i++ ) {
                     if( i - mtemp->xts1*AR2_TEMP_SCALE <  0     ) continue;
                     if( i + mtemp->xts2*AR2_TEMP_SCALE >= xsize ) break;
-                    if( ar2GetBestMatchingSubFine(img, xsize, ysize, pixFormat, mtemp, i, j, &wval) < 0 ) {
+                    if( ar2GetBestMatchingSubFine(img, xsize, ysize, pixFormat, mtemp, scratch, i, j, &wval) < 0 ) {
                         continue;
                     }
                     if( wval > wval2 ) {
@@ -252,7 +335,7 @@ int ar2GetBestMatching( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR
             for( j = 0; j < SKIP_INTERVAL*2 + 1; j++ ) {
                  for( i = 0; i < SKIP_INTERVAL*2 + 1; i++) {
                      if( ar2GetBestMatchingSubFineOpt(img, xsize, ysize, px2 + i, py2 + j,
-                         mtemp, subImage1, subImage2, i + AR2_TEMP_SCALE, j + AR2_TEMP_SCALE, &wval) < 0 ) {
+                         mtemp, scratch, i + AR2_TEMP_SCALE, j + AR2_TEMP_SCALE, &wval) < 0 ) {
                          continue;
                      }
                      if( wval > wval2 ) {
@@ -266,18 +349,345 @@ int ar2GetBestMatching( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR
             }
         }
     }
-    free(subImage1);
-    free(subImage2);
 #endif
 
     return ret;
 }
 
+// Builds in scratch->coarse a copy of mtemp reduced by 2^level, for matching at stride AR2_TEMP_SCALE
+// against an image reduced by the same factor. Each coarse sample is the mean of the valid fine
+// samples it covers, and is null if fewer than half of them are valid.
+static int ar2MatchingReduceTemplate( AR2TemplateT *mtemp, int level, AR2MatchingScratchT *scratch )
+{
+    AR2TemplateT        *ctemp = &(scratch->coarse);
+    ARUint16            *p;
+    int                  f, w, sum, sum2, n, k, vlen;
+    int                  ci, cj, i, j, i0, j0;
+
+    f = 1 << level;
+    ctemp->xts1  = mtemp->xts1 / f;
+    ctemp->xts2  = mtemp->xts2 / f;
+    ctemp->yts1  = mtemp->yts1 / f;
+    ctemp->yts2  = mtemp->yts2 / f;
+    ctemp->xsize = ctemp->xts1 + ctemp->xts2 + 1;
+    ctemp->ysize = ctemp->yts1 + ctemp->yts2 + 1;
+
+    p = ctemp->img1;
+    sum = sum2 = k = 0;
+    for( cj = -(ctemp->yts1); cj <= ctemp->yts2; cj++ ) {
+        for( ci = -(ctemp->xts1); ci <= ctemp->xts2; ci++ ) {
+            w = 0;
+            n = 0;
+            for( j0 = cj*f - f/2; j0 < cj*f - f/2 + f; j0++ ) {
+                if( j0 < -(mtemp->yts1) || j0 > mtemp->yts2 ) continue;
+                for( i0 = ci*f - f/2; i0 < ci*f - f/2 + f; i0++ ) {
+                    if( i0 < -(mtemp->xts1) || i0 > mtemp->xts2 ) continue;
+                    j = (j0 + mtemp->yts1)*mtemp->xsize + i0 + mtemp->xts1;
+                    if( mtemp->img1[j] == AR2_TEMPLATE_NULL_PIXEL ) continue;
+                    w += mtemp->img1[j];
+                    n++;
+                }
+            }
+            if( n*2 < f*f ) {
+                *(p++) = AR2_TEMPLATE_NULL_PIXEL;
+                continue;
+            }
+            i = (w + n/2) / n;
+            *(p++) = (ARUint16)i;
+            sum  += i;
+            sum2 += i*i;
+            k++;
+        }
+    }
+    if( k == 0 ) return -1;
+
+    vlen = sum2 - sum*sum/k;
+    ctemp->vlen = (int)sqrtf((float)vlen);
+    ctemp->sum = sum;
+    ctemp->validNum = k;
+    if( ctemp->vlen == 0 ) return -1;
+
+    return 0;
+}
+
+int ar2GetBestMatchingPyramid( ARUint8 *img, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                               const ARUint8 *pyrImg, int pyrLevel,
+                               AR2TemplateT *mtemp, int rx, int ry,
+                               int search[3][2], int *bx, int *by, float *val, AR2MatchingScratchT *scratch )
+{
+    AR2TemplateT    *ctemp;
+    int              search2[3][2];
+    int              f, step, crx, cry, cxsize, cysize;
+    int              px, py;
+    int              wx[3], wy[3], wnum;
+    int              keep_num;
+    int              cx[KEEP_NUM], cy[KEEP_NUM];
+    int              cval[KEEP_NUM];
+    int              wval;
+    int              i, j, k, l;
+    int              ii;
+
+    if( pyrImg == NULL || pyrLevel < 1 || pyrLevel > AR2_SEARCH_PYRAMID_LEVEL_MAX
+     || scratch == NULL || scratch->templSize < AR2_MATCHING_TEMPL_SIZE(mtemp)
+     || ar2MatchingReduceTemplate( mtemp, pyrLevel, scratch ) < 0 ) {
+        return ar2GetBestMatchingScratch( img, xsize, ysize, pixFormat, mtemp, rx, ry, search, bx, by, val, scratch );
+    }
+    ctemp = &(scratch->coarse);
+#if AR2_MATCHING_SIMD
+    ar2MatchingPrepareTemplate( ctemp, scratch );
+#endif
+
+    // Coarse stage: candidates on the reduced image, sampled at the same spacing in full-resolution
+    // pixels as the full-resolution search, with overlapping windows evaluated once.
+    f      = 1 << pyrLevel;
+    step   = (SKIP_INTERVAL + 1) / f;
+    if( step < 1 ) step = 1;
+    crx    = rx / f;
+    cry    = ry / f;
+    cxsize = xsize / f;
+    cysize = ysize / f;
+    wnum = 0;
+    keep_num = 0;
+    for( ii = 0; ii < 3; ii++ ) {
+        if( search[ii][0] < 0 ) break;
+
+        px = (search[ii][0]/f/step)*step + step/2;
+        py = (search[ii][1]/f/step)*step + step/2;
+
+        for( j = py - cry; j <= py + cry; j += step ) {
+            if( j - ctemp->yts1*AR2_TEMP_SCALE <  0      ) continue;
+            if( j + ctemp->yts2*AR2_TEMP_SCALE >= cysize ) break;
+            for( i = px - crx; i <= px + crx; i += step ) {
+                if( i - ctemp->xts1*AR2_TEMP_SCALE <  0      ) continue;
+                if( i + ctemp->xts2*AR2_TEMP_SCALE >= cxsize ) break;
+                for( k = 0; k < wnum; k++ ) {
+                    if( abs(i - wx[k]) <= crx && abs(j - wy[k]) <= cry ) break;
+                }
+                if( k < wnum ) continue;
+                if( ar2GetBestMatchingSubFine((ARUint8 *)pyrImg, cxsize, cysize, AR_PIXEL_FORMAT_MONO, ctemp, scratch, i, j, &wval) < 0 ) {
+                    continue;
+                }
+                updateCandidate(i, j, wval, &keep_num, cx, cy, cval);
+            }
+        }
+        wx[wnum] = px;
+        wy[wnum] = py;
+        wnum++;
+    }
+    if( keep_num == 0 ) return -1;
+
+    // Fine stage: full-resolution search around each coarse candidate, over one coarse step.
+    for( l = 0; l < 3; l++ ) {
+        if( l < keep_num ) {
+            search2[l][0] = cx[l]*f + f/2;
+            search2[l][1] = cy[l]*f + f/2;
+        }
+        else {
+            search2[l][0] = search2[l][1] = -1;
+        }
+    }
+    return ar2GetBestMatchingScratch( img, xsize, ysize, pixFormat, mtemp, step*f, step*f, search2, bx, by, val, scratch );
+}
+
+#if AR2_MATCHING_SIMD
+
+// Builds the padded template and validity mask used by ar2MatchingSums() for the current contents of mtemp.
+static void ar2MatchingPrepareTemplate( AR2TemplateT *mtemp, AR2MatchingScratchT *scratch )
+{
+    ARUint16            *p1;
+    ARInt16             *t, *m;
+    int                  stride;
+    int                  i, j;
+
+    stride = AR2_MATCHING_STRIDE(mtemp->xsize);
+    p1 = mtemp->img1;
+    t  = scratch->templ;
+    m  = scratch->mask;
+    for( j = 0; j < mtemp->ysize; j++ ) {
+        for( i = 0; i < mtemp->xsize; i++ ) {
+            if( *p1 != AR2_TEMPLATE_NULL_PIXEL ) {
+                *(t++) = (ARInt16)*p1;
+                *(m++) = -1;
+            }
+            else {
+                *(t++) = 0;
+                *(m++) = 0;
+            }
+            p1++;
+        }
+        for( ; i < stride; i++ ) {
+            *(t++) = 0;
+            *(m++) = 0;
+        }
+    }
+    for( i = 0; i < stride; i++ ) scratch->luma[i] = 0;
+}
+
+// Fetches n luma samples, AR2_TEMP_SCALE pixels apart, starting at (x, y). Returns -1 for an unsupported format.
+static int ar2MatchingGetLumaRow( ARUint8 *img, int xsize, AR_PIXEL_FORMAT pixFormat, int x, int y, int n, ARInt16 *luma )
+{
+    ARUint8             *p;
+    int                  i;
+
+    if( pixFormat == AR_PIXEL_FORMAT_MONO || pixFormat == AR_PIXEL_FORMAT_420v || pixFormat == AR_PIXEL_FORMAT_420f || pixFormat == AR_PIXEL_FORMAT_NV21 ) {
+        p = &img[y*xsize + x];
+        for( i = 0; i < n; i++, p += AR2_TEMP_SCALE ) luma[i] = *p;
+    }
+    else if( pixFormat == AR_PIXEL_FORMAT_RGB || pixFormat == AR_PIXEL_FORMAT_BGR ) {
+        p = &img[(y*xsize + x)*3];
+        for( i = 0; i < n; i++, p += 3*AR2_TEMP_SCALE ) luma[i] = (*(p + 0) + *(p + 1) + *(p + 2))/3;
+    }
+    else if( pixFormat == AR_PIXEL_FORMAT_RGBA || pixFormat == AR_PIXEL_FORMAT_BGRA ) {
+        p = &img[(y*xsize + x)*4];
+        for( i = 0; i < n; i++, p += 4*AR2_TEMP_SCALE ) luma[i] = (*(p + 0) + *(p + 1) + *(p + 2))/3;
+    }
+    else if( pixFormat == AR_PIXEL_FORMAT_ARGB || pixFormat == AR_PIXEL_FORMAT_ABGR ) {
+        p = &img[(y*xsize + x)*4];
+        for( i = 0; i < n; i++, p += 4*AR2_TEMP_SCALE ) luma[i] = (*(p + 1) + *(p + 2) + *(p + 3))/3;
+    }
+    else if( pixFormat == AR_PIXEL_FORMAT_2vuy ) {
+        p = &img[(y*xsize + x)*2];
+        for( i = 0; i < n; i++, p += 2*AR2_TEMP_SCALE ) luma[i] = *(p + 1);
+    }
+    else if( pixFormat == AR_PIXEL_FORMAT_yuvs ) {
+        p = &img[(y*xsize + x)*2];
+        for( i = 0; i < n; i++, p += 2*AR2_TEMP_SCALE ) luma[i] = *p;
+    }
+    else return -1;
+
+    return 0;
+}
+
+// Sums of I, I*I and I*T over the valid pixels of template T, where I is the luma of the window whose
+// first sample is at (sx, sy). When sum1 is NULL, only the I*T sum is computed. blocks is the number
+// of vectors per padded template row; it is a constant at the specialised call site for the default
+// template size, so the row loop can be fully unrolled there.
+static AR2_INLINE void ar2MatchingSumsBlocks( ARUint8 *img, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                                              AR2TemplateT *mtemp, AR2MatchingScratchT *scratch, int blocks,
+                                              int sx, int sy, int *sum1, int *sum2, int *sum3 )
+{
+    ARInt16             *t, *m;
+    ARUint8             *p, *end;
+    int                  direct;
+    int                  j, k;
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+    int32x4_t            vs1, vs2, vs3;
+    int16x8_t            v, vt;
+    uint16x8_t           lo;
+
+    vs1 = vs2 = vs3 = vdupq_n_s32(0);
+    lo = vdupq_n_u16(0x00FF);
+#else
+    __m128i              vs1, vs2, vs3;
+    __m128i              v, vt, ones, lo;
+
+    vs1 = vs2 = vs3 = _mm_setzero_si128();
+    ones = _mm_set1_epi16(1);
+    lo = _mm_set1_epi16(0x00FF);
+#endif
+
+    // Planar luma at the default scale can be read straight from the image, 2 bytes per lane,
+    // on rows where the whole vector load stays inside the luma plane.
+    direct = (AR2_TEMP_SCALE == 2 && (pixFormat == AR_PIXEL_FORMAT_MONO || pixFormat == AR_PIXEL_FORMAT_420v || pixFormat == AR_PIXEL_FORMAT_420f || pixFormat == AR_PIXEL_FORMAT_NV21));
+    end = img + xsize*ysize;
+    t = scratch->templ;
+    m = scratch->mask;
+    for( j = 0; j < mtemp->ysize; j++ ) {
+        p = &img[(sy + j*AR2_TEMP_SCALE)*xsize + sx];
+        if( !direct || p + blocks*AR2_MATCHING_LANES*2 > end ) {
+            if( ar2MatchingGetLumaRow( img, xsize, pixFormat, sx, sy + j*AR2_TEMP_SCALE, mtemp->xsize, scratch->luma ) < 0 ) {
+                *sum3 = 0;
+                if( sum1 ) *sum1 = *sum2 = 0;
+                return;
+            }
+            p = NULL;
+        }
+        for( k = 0; k < blocks; k++ ) {
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+            if( p ) v = vreinterpretq_s16_u16(vandq_u16(vreinterpretq_u16_u8(vld1q_u8(p + k*AR2_MATCHING_LANES*2)), lo));
+            else    v = vld1q_s16(scratch->luma + k*AR2_MATCHING_LANES);
+            v  = vandq_s16(v, vld1q_s16(m));
+            vt = vld1q_s16(t);
+            vs3 = vmlal_s16(vs3, vget_low_s16(v), vget_low_s16(vt));
+            vs3 = vmlal_s16(vs3, vget_high_s16(v), vget_high_s16(vt));
+            if( sum1 ) {
+                vs1 = vpadalq_s16(vs1, v);
+                vs2 = vmlal_s16(vs2, vget_low_s16(v), vget_low_s16(v));
+                vs2 = vmlal_s16(vs2, vget_high_s16(v), vget_high_s16(v));
+            }
+#else
+            if( p ) v = _mm_and_si128(_mm_loadu_si128((__m128i *)(p + k*AR2_MATCHING_LANES*2)), lo);
+            else    v = _mm_loadu_si128((__m128i *)(scratch->luma + k*AR2_MATCHING_LANES));
+            v  = _mm_and_si128(v, _mm_loadu_si128((__m128i *)m));
+            vt = _mm_loadu_si128((__m128i *)t);
+            vs3 = _mm_add_epi32(vs3, _mm_madd_epi16(v, vt));
+            if( sum1 ) {
+                vs1 = _mm_add_epi32(vs1, _mm_madd_epi16(v, ones));
+                vs2 = _mm_add_epi32(vs2, _mm_madd_epi16(v, v));
+            }
+#endif
+            t += AR2_MATCHING_LANES;
+            m += AR2_MATCHING_LANES;
+        }
+    }
+
+#if defined(HAVE_ARM_NEON) || defined(HAVE_ARM64_NEON)
+    *sum3 = vgetq_lane_s32(vs3, 0) + vgetq_lane_s32(vs3, 1) + vgetq_lane_s32(vs3, 2) + vgetq_lane_s32(vs3, 3);
+    if( sum1 ) {
+        *sum1 = vgetq_lane_s32(vs1, 0) + vgetq_lane_s32(vs1, 1) + vgetq_lane_s32(vs1, 2) + vgetq_lane_s32(vs1, 3);
+        *sum2 = vgetq_lane_s32(vs2, 0) + vgetq_lane_s32(vs2, 1) + vgetq_lane_s32(vs2, 2) + vgetq_lane_s32(vs2, 3);
+    }
+#else
+    vs3 = _mm_add_epi32(vs3, _mm_srli_si128(vs3, 8));
+    vs3 = _mm_add_epi32(vs3, _mm_srli_si128(vs3, 4));
+    *sum3 = _mm_cvtsi128_si32(vs3);
+    if( sum1 ) {
+        vs1 = _mm_add_epi32(vs1, _mm_srli_si128(vs1, 8));
+        vs1 = _mm_add_epi32(vs1, _mm_srli_si128(vs1, 4));
+        *sum1 = _mm_cvtsi128_si32(vs1);
+        vs2 = _mm_add_epi32(vs2, _mm_srli_si128(vs2, 8));
+        vs2 = _mm_add_epi32(vs2, _mm_srli_si128(vs2, 4));
+        *sum2 = _mm_cvtsi128_si32(vs2);
+    }
+#endif
+}
+
+static void ar2MatchingSums( ARUint8 *img, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+                             AR2TemplateT *mtemp, AR2MatchingScratchT *scratch, int sx, int sy,
+                             int *sum1, int *sum2, int *sum3 )
+{
+    int     blocks = AR2_MATCHING_STRIDE(mtemp->xsize)/AR2_MATCHING_LANES;
+
+    if( blocks == AR2_MATCHING_DEFAULT_BLOCKS ) {
+        ar2MatchingSumsBlocks( img, xsize, ysize, pixFormat, mtemp, scratch, AR2_MATCHING_DEFAULT_BLOCKS, sx, sy, sum1, sum2, sum3 );
+    }
+    else {
+        ar2MatchingSumsBlocks( img, xsize, ysize, pixFormat, mtemp, scratch, blocks, sx, sy, sum1, sum2, sum3 );
+    }
+}
+
+#endif // AR2_MATCHING_SIMD
+
 static int ar2GetBestMatchingSubFine(ARUint8 *img, int xsize,
+#if AR2_MATCHING_SIMD
+                                     int ysize,
+#else
                                      __attribute__((unused)) int ysize,
+#endif
                                      AR_PIXEL_FORMAT pixFormat,
-                                     AR2TemplateT *mtemp, int sx, int sy,
+#if AR2_MATCHING_SIMD
+                                     AR2TemplateT *mtemp, AR2MatchingScratchT *scratch, int sx, int sy,
+#else
+                                     AR2TemplateT *mtemp, __attribute__((unused)) AR2MatchingScratchT *scratch, int sx, int sy,
+#endif
                                      int *val) {
+#if AR2_MATCHING_SIMD
+    int                  sum1, sum2, sum3;
+    int                  vlen;
+
+    ar2MatchingSums( img, xsize, ysize, pixFormat, mtemp, scratch,
+                     sx - mtemp->xts1*AR2_TEMP_SCALE, sy - mtemp->yts1*AR2_TEMP_SCALE, &sum1, &sum2, &sum3 );
+#else
     ARUint16            *p1;
     ARUint8             *p2;
     int                  w;
@@ -398,6 +808,7 @@ static int ar2GetBestMatchingSubFine(ARUint8 *img, int xsize,
             }
         }
     }
+#endif
     
     sum3 -= sum1 * mtemp->sum / mtemp->validNum;
     vlen = sum2 - sum1*sum1/mtemp->validNum;
@@ -409,16 +820,25 @@ static int ar2GetBestMatchingSubFine(ARUint8 *img, int xsize,
 
 #if 1
 static int ar2GetBestMatchingSubFineOpt(ARUint8 *img, int xsize,
+#if AR2_MATCHING_SIMD
+                                        int ysize,
+#else
                                         __attribute__((unused)) int ysize,
+#endif
                                         int sx1, int sy1, AR2TemplateT *mtemp,
-                                        ARUint32 *subImage1,
-                                        ARUint32 *subImage2, int sx2, int sy2,
+                                        AR2MatchingScratchT *scratch, int sx2, int sy2,
                                         int *val) {
-    ARUint16            *p1;
-    ARUint8             *p2, *p3;
+    ARUint32            *subImage1 = scratch->subImage1;
+    ARUint32            *subImage2 = scratch->subImage2;
     int                  sum1, sum2, sum3;
     int                  vlen;
     int                  subImageXsize, px1, px2, py1, py2;
+#if AR2_MATCHING_SIMD
+    // Window sums come from the integral images below, so only the correlation is needed.
+    ar2MatchingSums( img, xsize, ysize, AR_PIXEL_FORMAT_MONO, mtemp, scratch, sx1, sy1, NULL, NULL, &sum3 );
+#else
+    ARUint16            *p1;
+    ARUint8             *p2, *p3;
     int                  i, j;
     
     p1 = mtemp->img1;
@@ -431,6 +851,7 @@ static int ar2GetBestMatchingSubFineOpt(ARUint8 *img, int xsize,
         }
         p2 = p3 += AR2_TEMP_SCALE*xsize;
     }
+#endif
 
     subImageXsize = (mtemp->xsize + 1)*AR2_TEMP_SCALE + (SKIP_INTERVAL*2);
     px1 =  sx2 + (mtemp->xsize - 1)*AR2_TEMP_SCALE;
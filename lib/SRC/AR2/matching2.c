@@ -62,53 +62,28 @@ static void updateCandidate            ( int x, int y, int wval,
 
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-int ar2GetBestMatching2( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
+int ar2GetBestMatching2( ARUint8 *img, __attribute__((unused)) ARUint8 *mfImage, int xsize, int ysize, AR_PIXEL_FORMAT pixFormat,
                          AR2Template2T *mtemp, int rx, int ry,
                          int search[3][2], int *bx, int *by, float *val, int *blurLevel)
 {
     int              search_flag[] = {USE_SEARCH1, USE_SEARCH2, USE_SEARCH3};
-    int              px, py, sx, sy, ex, ey;
+    int              px, py;
+    int              wx[3], wy[3], wnum;
     int              yts1, yts2;
     int              keep_num;
     int              cx[KEEP_NUM], cy[KEEP_NUM];
     int              cval[KEEP_NUM];
     int              wval, wval2;
     int              wlevel;
-    int              i, j, l;
+    int              i, j, k, l;
     int              ii;
     int              ret;
-    ARUint8         *pmf;
-
-    keep_num = 0;
 
+    // Windows share one sampling lattice, so a position inside an earlier window has already been evaluated.
     yts1 = mtemp->yts1;
     yts2 = mtemp->yts2;
-
-    for( ii = 0; ii < 3; ii++ ) {
-        if( search_flag[ii] == 0 ) continue;
-        if( search[ii][0] < 0 ) break;
-
-        px = (search[ii][0]/(SKIP_INTERVAL+1))*(SKIP_INTERVAL+1) + (SKIP_INTERVAL+1)/2;
-        py = (search[ii][1]/(SKIP_INTERVAL+1))*(SKIP_INTERVAL+1) + (SKIP_INTERVAL+1)/2;
-
-        sx = px - rx;
-        if( sx < 0 ) sx = 0;
-        ex = px + rx;
-        if( ex >= xsize ) ex = xsize-1;
-
-        sy = py - ry;
-        if( sy < 0 ) sy = 0;
-        ey = py + ry;
-        if( ey >= ysize ) ey = ysize-1;
-
-        for( j = sy; j <= ey; j++ ) {
-            pmf = &mfImage[j*xsize+sx];
-            for( i = sx; i <= ex; i++ ) {
-                *(pmf++) = 0;
-            }
-        }
-    }
-
+    wnum = 0;
+    keep_num = 0;
     ret = 1;
     for( ii = 0; ii < 3; ii++ ) {      
         if( search_flag[ii] == 0 ) continue;
@@ -126,8 +101,10 @@ int ar2GetBestMatching2( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, A
             for( i = px - rx; i <= px + rx; i += SKIP_INTERVAL+1 ) {
                 if( i - mtemp->xts1*AR2_TEMP_SCALE <  0     ) continue;
                 if( i + mtemp->xts2*AR2_TEMP_SCALE >= xsize ) break;
-                if( mfImage[j*xsize+i] ) continue;
-                mfImage[j*xsize+i] = 1;
+                for( k = 0; k < wnum; k++ ) {
+                    if( abs(i - wx[k]) <= rx && abs(j - wy[k]) <= ry ) break;
+                }
+                if( k < wnum ) continue;
                 if( ar2GetBestMatchingSubFine(img,xsize,ysize,pixFormat,mtemp,i,j,&wval) < 0 ) {
                     continue;
                 }
@@ -135,6 +112,9 @@ int ar2GetBestMatching2( ARUint8 *img, ARUint8 *mfImage, int xsize, int ysize, A
                 updateCandidate(i, j, wval, &keep_num, cx, cy, cval);
             }
         }
+        wx[wnum] = px;
+        wy[wnum] = py;
+        wnum++;
     }
 
     wval2 = 0;
@@ -7,4 +7,26 @@
 
 char *ar2_read_content_line(char *buffer, int n, FILE *fp);
 
+// LZ4 block format codec (lz4.c). Both return the number of bytes written to dst, or -1 on error.
+int ar2LZ4CompressBound( int srcSize );
+int ar2LZ4Compress     ( const unsigned char *src, int srcSize, unsigned char *dst, int dstCapacity );
+int ar2LZ4Decompress   ( const unsigned char *src, int srcSize, unsigned char *dst, int dstSize );
+
+// Atomic operations used by the tracking task queue and the image set residency manager.
+// All are full memory barriers.
+#if defined(_MSC_VER)
+#  include <windows.h>
+#  define ar2AtomicGet(p)             InterlockedCompareExchange((volatile LONG *)(p), 0, 0)
+#  define ar2AtomicSet(p, v)          InterlockedExchange((volatile LONG *)(p), (v))
+#  define ar2AtomicCAS(p, old, new)   (InterlockedCompareExchange((volatile LONG *)(p), (new), (old)) == (old))
+#  define ar2AtomicInc(p)             InterlockedIncrement((volatile LONG *)(p))
+#  define ar2AtomicDec(p)             InterlockedDecrement((volatile LONG *)(p))
+#else
+#  define ar2AtomicGet(p)             __sync_fetch_and_add((p), 0)
+#  define ar2AtomicSet(p, v)          (__sync_synchronize(), (void)__sync_lock_test_and_set((p), (v)), __sync_synchronize())
+#  define ar2AtomicCAS(p, old, new)   __sync_bool_compare_and_swap((p), (old), (new))
+#  define ar2AtomicInc(p)             __sync_add_and_fetch((p), 1)
+#  define ar2AtomicDec(p)             __sync_sub_and_fetch((p), 1)
+#endif
+
 #endif
@@ -38,7 +38,6 @@
 #include <AR/ar.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 #include <math.h>
 #include <AR2/template.h>
 
@@ -131,7 +130,7 @@ int ar2GetResolution2( const ARParam *cparam, const float  trans[3][4], const fl
 }
 
 int ar2SelectTemplate( AR2TemplateCandidateT *candidate, AR2TemplateCandidateT *prevFeature, int num,
-                       float  pos[4][2], int xsize, int ysize )
+                       float  pos[4][2], int xsize, int ysize, unsigned int *seed )
 {
     if( num < 0 ) return -1;
 
@@ -249,7 +248,6 @@ int ar2SelectTemplate( AR2TemplateCandidateT *candidate, AR2TemplateCandidateT *
 
     else {
         int     i, j, k;
-        static  int s = 0;
 
         for( i = 0; prevFeature[i].flag != -1; i++ ) {
             if( prevFeature[i].flag != 0 ) continue;
@@ -267,16 +265,14 @@ int ar2SelectTemplate( AR2TemplateCandidateT *candidate, AR2TemplateCandidateT *
         }
         prevFeature[0].flag = -1;
 
-        if( s == 0 ) srand((unsigned int)time(NULL));
-        s++;
-        if( s == 128 ) s = 0;
-
         for( i = j = 0; candidate[i].flag != -1; i++ ) {
             if( candidate[i].flag == 0 ) j++;
         }
         if( j == 0 ) return -1;
 
-        k = (int)((float )j * rand() / (RAND_MAX + 1.0F));
+        // Same linear congruential generator as the C standard's example rand(), on the caller's state.
+        *seed = *seed * 1103515245U + 12345U;
+        k = (int)((float )j * ((*seed >> 16) & 0x7FFF) / 32768.0F);
         for( i = j = 0; candidate[i].flag != -1; i++ ) {
             if( candidate[i].flag != 0 ) continue;
             if( j == k ) {
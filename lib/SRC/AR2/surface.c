@@ -94,6 +94,7 @@ AR2SurfaceSetT *ar2ReadSurfaceSet( const char *filename, const char *ext, ARPatt
         surfaceSet->num     = 1;
         surfaceSet->contNum = 0;
     }
+    surfaceSet->searchRadius = 0.0F;
     arMalloc(surfaceSet->surface, AR2SurfaceT, surfaceSet->num);
 
     for( i = 0; i < surfaceSet->num; i++ ) {
@@ -184,6 +185,8 @@ AR2SurfaceSetT *ar2ReadSurfaceSet( const char *filename, const char *ext, ARPatt
         }
         arUtilMatInvf( (const float (*)[4])surfaceSet->surface[i].trans, surfaceSet->surface[i].itrans );
 
+        surfaceSet->surface[i].featureIndex = ar2GenFeatureIndex( surfaceSet->surface[i].featureSet );
+
         ar2UtilReplaceExt( name, 256, "jpg");
         arMalloc( surfaceSet->surface[i].jpegName, char, 256);
         strncpy( surfaceSet->surface[i].jpegName, name, 256 );
@@ -205,6 +208,9 @@ int ar2FreeSurfaceSet( AR2SurfaceSetT **surfaceSet )
     for( i = 0; i < (*surfaceSet)->num; i++ ) {
         ar2FreeImageSet( &((*surfaceSet)->surface[i].imageSet) );
         ar2FreeFeatureSet( &((*surfaceSet)->surface[i].featureSet) );
+        if( (*surfaceSet)->surface[i].featureIndex != NULL ) {
+            ar2FreeFeatureIndex( &((*surfaceSet)->surface[i].featureIndex) );
+        }
         if( (*surfaceSet)->surface[i].markerSet != NULL ) {
             ar2FreeMarkerSet( &((*surfaceSet)->surface[i].markerSet) );
         }
@@ -224,6 +230,7 @@ int ar2SetInitTrans( AR2SurfaceSetT *surfaceSet, float  trans[3][4] )
 
     if( surfaceSet == NULL ) return -1;
     surfaceSet->contNum = 1;
+    surfaceSet->searchRadius = 0.0F;
     for( j = 0; j < 3; j++ ) {
         for( i = 0; i < 4; i++ ) surfaceSet->trans1[j][i] = trans[j][i];
     }
@@ -44,6 +44,22 @@
 #include <AR2/featureSet.h>
 #include <AR2/template.h>
 #include <AR2/tracking.h>
+#if defined(HAVE_ARM64_NEON)
+#  include <arm_neon.h>
+#  define AR2_TEMPLATE_SIMD 1
+#elif defined(HAVE_INTEL_SIMD)
+#  include <emmintrin.h> // SSE2.
+#  define AR2_TEMPLATE_SIMD 1
+#endif
+
+#ifdef _MSC_VER
+#  define AR2_INLINE __inline
+#else
+#  define AR2_INLINE inline
+#endif
+
+// Template pixels are warped this many at a time.
+#define  AR2_TEMPLATE_WARP_CHUNK    32
 
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
@@ -110,11 +126,6 @@ int ar2FreeTemplate2( AR2Template2T *templ2 )
 int ar2SetTemplateSub( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
                        AR2FeaturePointsT *featurePoints, int num, int blurLevel,
                        AR2TemplateT *templ )
-#else
-int ar2SetTemplateSub( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
-                       AR2FeaturePointsT *featurePoints, int num,
-                       AR2TemplateT *templ )
-#endif
 {
     float    mx, my;
     float    sx, sy;
@@ -156,11 +167,7 @@ int ar2SetTemplateSub( const ARParamLT *cparamLT, const float  trans[3][4], AR2I
                 }
 
                 ret = ar2GetImageValue( NULL, (const float (*)[4])wtrans, imageSet->scale[featurePoints->scale],
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
                                        sx, sy, blurLevel, &pixel );
-#else
-                                        sx, sy, &pixel );
-#endif
                 if( ret < 0 ) {
                     *(img1++) = AR2_TEMPLATE_NULL_PIXEL;
                 }
@@ -189,11 +196,7 @@ int ar2SetTemplateSub( const ARParamLT *cparamLT, const float  trans[3][4], AR2I
             for( i = -(templ->xts1); i <= templ->xts2; i++, ix2+=AR2_TEMP_SCALE ) {
                 
                 ret = ar2GetImageValue( NULL, trans, imageSet->scale[featurePoints->scale],
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
                                        (float)ix2, (float)iy2, blurLevel, &pixel );
-#else
-                                       (float)ix2, (float)iy2, &pixel );
-#endif
                 if( ret < 0 ) {
                     *(img1++) = AR2_TEMPLATE_NULL_PIXEL;
                 }
@@ -216,6 +219,218 @@ int ar2SetTemplateSub( const ARParamLT *cparamLT, const float  trans[3][4], AR2I
     return 0;
 }
 
+#else
+
+// Homography taking ideal screen coordinates p = (x, y, 1) to reference image coordinates
+// u = G[0].p/G[2].p and v = G[1].p/G[2].p. This is the inverse of the marker-to-screen
+// homography in columns 0, 1 and 3 of trans, followed by the millimetre-to-pixel scaling
+// of ar2GetImageValue(), so that each template pixel costs a single projective division.
+static int ar2TemplateGetWarp( const float trans[3][4], const AR2ImageT *image, float G[3][3] )
+{
+    float   inv[3][3];
+    float   det, k;
+    int     i;
+
+    inv[0][0] = trans[1][1]*trans[2][3] - trans[1][3]*trans[2][1];
+    inv[0][1] = trans[0][3]*trans[2][1] - trans[0][1]*trans[2][3];
+    inv[0][2] = trans[0][1]*trans[1][3] - trans[0][3]*trans[1][1];
+    inv[1][0] = trans[1][3]*trans[2][0] - trans[1][0]*trans[2][3];
+    inv[1][1] = trans[0][0]*trans[2][3] - trans[0][3]*trans[2][0];
+    inv[1][2] = trans[0][3]*trans[1][0] - trans[0][0]*trans[1][3];
+    inv[2][0] = trans[1][0]*trans[2][1] - trans[1][1]*trans[2][0];
+    inv[2][1] = trans[0][1]*trans[2][0] - trans[0][0]*trans[2][1];
+    inv[2][2] = trans[0][0]*trans[1][1] - trans[0][1]*trans[1][0];
+    det = trans[0][0]*inv[0][0] + trans[0][1]*inv[1][0] + trans[0][3]*inv[2][0];
+    if( det == 0.0F ) return -1;
+
+    // The scale of a homography is arbitrary, so the adjugate serves as the inverse.
+    k = image->dpi / 25.4F;
+    for( i = 0; i < 3; i++ ) {
+        G[0][i] = k * inv[0][i];
+        G[1][i] = (float)image->ysize * inv[2][i] - k * inv[1][i];
+        G[2][i] = inv[2][i];
+    }
+
+    return 0;
+}
+
+static AR2_INLINE void ar2TemplateStorePixels( const AR2ImageT *image, const ARUint8 *valid,
+                                               const int *ix, const int *iy, const int *inside, int n,
+                                               ARUint16 *out, int *sum, int *sum2, int *k )
+{
+    ARUint8     pixel;
+    int         i;
+
+    for( i = 0; i < n; i++ ) {
+        if( !valid[i] || !inside[i] ) {
+            out[i] = AR2_TEMPLATE_NULL_PIXEL;
+            continue;
+        }
+        pixel = image->imgBW[iy[i]*image->xsize + ix[i]];
+        out[i] = pixel;
+        *sum  += pixel;
+        *sum2 += pixel*pixel;
+        (*k)++;
+    }
+}
+
+// Samples the reference image at the n points (x[i], y[i]) of a template row, given in ideal
+// screen coordinates, as ar2GetImageValue() would. Points with valid[i] == 0 or which fall
+// outside the image give AR2_TEMPLATE_NULL_PIXEL. n may not exceed AR2_TEMPLATE_WARP_CHUNK.
+static void ar2TemplateWarpRow( const float G[3][3], const AR2ImageT *image,
+                                const float *x, const float *y, const ARUint8 *valid, int n,
+                                ARUint16 *out, int *sum, int *sum2, int *k )
+{
+    const float xmax = (float)image->xsize;
+    const float ymax = (float)image->ysize;
+    float       w, u, v;
+    int         ix[AR2_TEMPLATE_WARP_CHUNK], iy[AR2_TEMPLATE_WARP_CHUNK];
+    int         inside[AR2_TEMPLATE_WARP_CHUNK];
+    int         i;
+
+    i = 0;
+#if AR2_TEMPLATE_SIMD
+    // Four points at a time. A zero divisor gives an infinite or NaN position, which fails the
+    // range test just as the scalar path rejects it; rejected lanes are zeroed before conversion.
+    for( ; i + 4 <= n; i += 4 ) {
+#  if defined(HAVE_INTEL_SIMD)
+        __m128  vx = _mm_loadu_ps( x + i );
+        __m128  vy = _mm_loadu_ps( y + i );
+        __m128  vw = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps(G[2][0]), vx ), _mm_mul_ps( _mm_set1_ps(G[2][1]), vy ) ), _mm_set1_ps(G[2][2]) );
+        __m128  vu = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps(G[0][0]), vx ), _mm_mul_ps( _mm_set1_ps(G[0][1]), vy ) ), _mm_set1_ps(G[0][2]) );
+        __m128  vv = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps(G[1][0]), vx ), _mm_mul_ps( _mm_set1_ps(G[1][1]), vy ) ), _mm_set1_ps(G[1][2]) );
+        __m128  in;
+        vu = _mm_add_ps( _mm_div_ps( vu, vw ), _mm_set1_ps(0.5F) );
+        vv = _mm_add_ps( _mm_div_ps( vv, vw ), _mm_set1_ps(0.5F) );
+        in = _mm_and_ps( _mm_and_ps( _mm_cmpgt_ps( vu, _mm_set1_ps(-1.0F) ), _mm_cmplt_ps( vu, _mm_set1_ps(xmax) ) ),
+                         _mm_and_ps( _mm_cmpgt_ps( vv, _mm_set1_ps(-1.0F) ), _mm_cmplt_ps( vv, _mm_set1_ps(ymax) ) ) );
+        _mm_storeu_si128( (__m128i *)ix, _mm_cvttps_epi32( _mm_and_ps( vu, in ) ) );
+        _mm_storeu_si128( (__m128i *)iy, _mm_cvttps_epi32( _mm_and_ps( vv, in ) ) );
+        _mm_storeu_si128( (__m128i *)inside, _mm_castps_si128( in ) );
+#  else
+        float32x4_t vx = vld1q_f32( x + i );
+        float32x4_t vy = vld1q_f32( y + i );
+        float32x4_t vw = vaddq_f32( vaddq_f32( vmulq_n_f32( vx, G[2][0] ), vmulq_n_f32( vy, G[2][1] ) ), vdupq_n_f32(G[2][2]) );
+        float32x4_t vu = vaddq_f32( vaddq_f32( vmulq_n_f32( vx, G[0][0] ), vmulq_n_f32( vy, G[0][1] ) ), vdupq_n_f32(G[0][2]) );
+        float32x4_t vv = vaddq_f32( vaddq_f32( vmulq_n_f32( vx, G[1][0] ), vmulq_n_f32( vy, G[1][1] ) ), vdupq_n_f32(G[1][2]) );
+        uint32x4_t  in;
+        vu = vaddq_f32( vdivq_f32( vu, vw ), vdupq_n_f32(0.5F) );
+        vv = vaddq_f32( vdivq_f32( vv, vw ), vdupq_n_f32(0.5F) );
+        in = vandq_u32( vandq_u32( vcgtq_f32( vu, vdupq_n_f32(-1.0F) ), vcltq_f32( vu, vdupq_n_f32(xmax) ) ),
+                        vandq_u32( vcgtq_f32( vv, vdupq_n_f32(-1.0F) ), vcltq_f32( vv, vdupq_n_f32(ymax) ) ) );
+        vst1q_s32( ix, vcvtq_s32_f32( vreinterpretq_f32_u32( vandq_u32( vreinterpretq_u32_f32(vu), in ) ) ) );
+        vst1q_s32( iy, vcvtq_s32_f32( vreinterpretq_f32_u32( vandq_u32( vreinterpretq_u32_f32(vv), in ) ) ) );
+        vst1q_s32( inside, vreinterpretq_s32_u32( in ) );
+#  endif
+        ar2TemplateStorePixels( image, valid + i, ix, iy, inside, 4, out + i, sum, sum2, k );
+    }
+#endif
+    for( ; i < n; i++ ) {
+        inside[0] = 0;
+        w = G[2][0]*x[i] + G[2][1]*y[i] + G[2][2];
+        if( w != 0.0F ) {
+            u = (G[0][0]*x[i] + G[0][1]*y[i] + G[0][2]) / w + 0.5F;
+            v = (G[1][0]*x[i] + G[1][1]*y[i] + G[1][2]) / w + 0.5F;
+            // Same as 0 <= (int)u < xsize, without converting out-of-range values.
+            if( u > -1.0F && u < xmax && v > -1.0F && v < ymax ) {
+                ix[0] = (int)u;
+                iy[0] = (int)v;
+                inside[0] = 1;
+            }
+        }
+        ar2TemplateStorePixels( image, valid + i, ix, iy, inside, 1, out + i, sum, sum2, k );
+    }
+}
+
+static int ar2SetTemplateSubImage( const ARParamLT *cparamLT, const float  trans[3][4], const AR2ImageT *image,
+                                   AR2FeaturePointsT *featurePoints, int num,
+                                   AR2TemplateT *templ )
+{
+    float    mx, my;
+    float    sx, sy;
+    float    wtrans[3][4];
+    float    G[3][3];
+    float    x[AR2_TEMPLATE_WARP_CHUNK], y[AR2_TEMPLATE_WARP_CHUNK];
+    ARUint8  valid[AR2_TEMPLATE_WARP_CHUNK];
+    ARUint16 *img1;
+    int      sum, sum2;
+    int      vlen;
+    int      ix, iy;
+    int      ix2, iy2;
+    int      i, j, k, l, n;
+
+    mx = featurePoints->coord[num].mx;
+    my = featurePoints->coord[num].my;
+    if( cparamLT != NULL ) {
+#ifdef ARDOUBLE_IS_FLOAT
+        arUtilMatMul( cparamLT->param.mat, trans, wtrans );
+#else
+        arUtilMatMuldff( cparamLT->param.mat, trans, wtrans );
+#endif
+        if( ar2MarkerCoord2ScreenCoord( NULL, (const float (*)[4])wtrans, mx, my, &mx, &my ) < 0 ) return -1;
+        if( arParamIdeal2ObservLTf( &cparamLT->paramLTf, mx, my, &sx, &sy ) < 0 ) return -1;
+        if( ar2TemplateGetWarp( (const float (*)[4])wtrans, image, G ) < 0 ) return -1;
+    }
+    else {
+        if( ar2MarkerCoord2ScreenCoord( NULL, trans, mx, my, &sx, &sy ) < 0 ) return -1;
+        if( ar2TemplateGetWarp( trans, image, G ) < 0 ) return -1;
+    }
+    ix = (int)(sx + 0.5F);
+    iy = (int)(sy + 0.5F);
+
+    // Template pixels lie on a grid in observed screen coordinates. Each row is converted to
+    // ideal coordinates (through the lens distortion table in 6DOF mode) and then warped into
+    // the reference image a chunk at a time.
+    img1 = templ->img1;
+    sum = sum2 = 0;
+    k = 0;
+    iy2 = iy - (templ->yts1)*AR2_TEMP_SCALE;
+    for( j = 0; j < templ->ysize; j++, iy2 += AR2_TEMP_SCALE ) {
+        ix2 = ix - (templ->xts1)*AR2_TEMP_SCALE;
+        for( i = 0; i < templ->xsize; i += n, ix2 += n*AR2_TEMP_SCALE ) {
+            n = templ->xsize - i;
+            if( n > AR2_TEMPLATE_WARP_CHUNK ) n = AR2_TEMPLATE_WARP_CHUNK;
+            if( cparamLT != NULL ) {
+                for( l = 0; l < n; l++ ) {
+                    valid[l] = (arParamObserv2IdealLTf( &cparamLT->paramLTf, (float)(ix2 + l*AR2_TEMP_SCALE), (float)iy2, &x[l], &y[l] ) == 0);
+                }
+            }
+            else {
+                for( l = 0; l < n; l++ ) {
+                    x[l] = (float)(ix2 + l*AR2_TEMP_SCALE);
+                    y[l] = (float)iy2;
+                    valid[l] = 1;
+                }
+            }
+            ar2TemplateWarpRow( (const float (*)[3])G, image, x, y, valid, n, img1, &sum, &sum2, &k );
+            img1 += n;
+        }
+    }
+    if( k == 0 ) return -1;
+
+    vlen = sum2 - sum*sum/k;
+    templ->vlen = (int)sqrtf((float)vlen);
+    templ->sum = sum;
+    templ->validNum = k;
+
+    return 0;
+}
+
+int ar2SetTemplateSub( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
+                       AR2FeaturePointsT *featurePoints, int num,
+                       AR2TemplateT *templ )
+{
+    int      ret;
+
+    // The scale's pixels are needed only while the template is sampled; the template keeps its own copy.
+    if( ar2AcquireImageScale( imageSet, featurePoints->scale ) < 0 ) return -1;
+    ret = ar2SetTemplateSubImage( cparamLT, trans, imageSet->scale[featurePoints->scale], featurePoints, num, templ );
+    ar2ReleaseImageScale( imageSet, featurePoints->scale );
+
+    return ret;
+}
+#endif
+
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
 int ar2SetTemplate2Sub( const ARParamLT *cparamLT, const float  trans[3][4], AR2ImageSetT *imageSet,
                         AR2FeaturePointsT *featurePoints, int num, int blurLevel,
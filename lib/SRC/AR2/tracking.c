@@ -48,6 +48,7 @@
 #include <AR2/featureSet.h>
 #include <AR2/template.h>
 #include <AR2/tracking.h>
+#include "private.h"
 
 static float  ar2GetTransMat            ( ICPHandleT *icpHandle, float  initConv[3][4],
                                           float  pos2d[][2], float  pos3d[][3], int num, float  conv[3][4], int robustMode );
@@ -55,23 +56,39 @@ static float  ar2GetTransMatHomography        ( float  initConv[3][4], float  po
                                           float  conv[3][4], int robustMode, float inlierProb );
 static float  ar2GetTransMatHomography2       ( float  initConv[3][4], float  pos2d[][2], float  pos3d[][3], int num, float  conv[3][4] );
 static float  ar2GetTransMatHomographyRobust  ( float  initConv[3][4], float  pos2d[][2], float  pos3d[][3], int num, float  conv[3][4], float inlierProb );
-static int    extractVisibleFeatures    ( const ARParamLT *cparamLT, const float  trans1[][3][4], AR2SurfaceSetT *surfaceSet,
+typedef struct {
+    int         visible;            // 0 if no feature in the cell can project inside the frame.
+    float       dpiMin, dpiMax;     // Range of resolution across the cell, widened by AR2_VISIBLE_DPI_MARGIN. dpiMin < 0 if unknown.
+} AR2FeatureCellT;
+
+static int    extractVisibleFeatures    ( AR2HandleT *ar2Handle, const float  trans1[][3][4], AR2SurfaceSetT *surfaceSet,
                                           AR2TemplateCandidateT candidate[],
                                           AR2TemplateCandidateT candidate2[] );
-static int    extractVisibleFeaturesHomography( int xsize, int ysize, float  trans1[][3][4], AR2SurfaceSetT *surfaceSet,
+static int    extractVisibleFeaturesHomography( AR2HandleT *ar2Handle, float  trans1[][3][4], AR2SurfaceSetT *surfaceSet,
                                           AR2TemplateCandidateT candidate[],
                                           AR2TemplateCandidateT candidate2[] );
+static void   ar2GetFeatureCells        ( const ARParam *cparam, const float  trans[3][4], const AR2FeatureIndexT *featureIndex,
+                                          const float bounds[4], AR2FeatureCellT cell[] );
+static int    ar2GetVisibleFeatures     ( AR2HandleT *ar2Handle, const AR2FeatureIndexT *featureIndex, const AR2FeatureCellT cell[],
+                                          const AR2FeaturePointsT *featurePoints, int level );
+static int    compInt( const void *a, const void *b );
+static int    compE( const void *a, const void *b );
 static int    getDeltaS( float  H[8], float  dU[], float  J_U_H[][8], int n );
+static const ARUint8 *ar2GetSearchImage( AR2HandleT *ar2Handle, ARUint8 *dataPtr );
+static AR_IMAGE_PYRAMID_LEVEL ar2GetSearchPyramidImageLevel( AR2HandleT *ar2Handle );
+static void   ar2AssignTemplateCache    ( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, int taskNum );
+static int    ar2GetFrameSearchSize     ( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet );
+static void   ar2UpdateSearchRadius     ( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet );
 
 
 int ar2Tracking( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, ARUint8 *dataPtr, float  trans[3][4], float  *err )
 {
     AR2TemplateCandidateT  *candidatePtr;
-    AR2TemplateCandidateT  *cp[AR2_THREAD_MAX];
+    AR2Tracking2DTaskT     *task;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     float                   aveBlur;
 #endif
-    int                     num, num2;
+    int                     num, woken, generation;
     int                     i, j, k;
 
     if (!ar2Handle || !surfaceSet || !dataPtr || !trans || !err) return (-1);
@@ -90,87 +107,81 @@ int ar2Tracking( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, ARUint8 *dat
     }
 
     if( ar2Handle->trackingMode == AR2_TRACKING_6DOF ) {
-        extractVisibleFeatures(ar2Handle->cparamLT, ar2Handle->wtrans1, surfaceSet, ar2Handle->candidate, ar2Handle->candidate2);
+        extractVisibleFeatures(ar2Handle, ar2Handle->wtrans1, surfaceSet, ar2Handle->candidate, ar2Handle->candidate2);
     }
     else {
-        extractVisibleFeaturesHomography(ar2Handle->xsize, ar2Handle->ysize, ar2Handle->wtrans1, surfaceSet, ar2Handle->candidate, ar2Handle->candidate2);
+        extractVisibleFeaturesHomography(ar2Handle, ar2Handle->wtrans1, surfaceSet, ar2Handle->candidate, ar2Handle->candidate2);
     }
 
+    // Close the queue before any task field changes: an exhausted claim in a new generation, so
+    // that no claim read for an earlier frame can succeed against the tasks about to be written.
+    generation = ((ar2AtomicGet( &(ar2Handle->taskClaim) ) >> 16) + 1) & 0x7FFF;
+    ar2AtomicSet( &(ar2Handle->taskClaim), (generation << 16) | 0xFFFF );
+
     candidatePtr = ar2Handle->candidate;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     aveBlur = 0.0F;
 #endif
-    i = 0; // Counts up to searchFeatureNum.
-    num = 0;
-    while( i < ar2Handle->searchFeatureNum ) {
-        num2 = num;
-        for( j = 0; j < ar2Handle->threadNum; j++ ) {
-            if( i == ar2Handle->searchFeatureNum ) break;
-
-            k = ar2SelectTemplate( candidatePtr, surfaceSet->prevFeature, num2, ar2Handle->pos, ar2Handle->xsize, ar2Handle->ysize );
-            if( k < 0 ) {
-                if( candidatePtr == ar2Handle->candidate ) {
-                    candidatePtr = ar2Handle->candidate2;
-                    k = ar2SelectTemplate( candidatePtr, surfaceSet->prevFeature, num2, ar2Handle->pos, ar2Handle->xsize, ar2Handle->ysize );
-                    if( k < 0 ) break; // PRL 2012-05-15: Give up if we can't select template from alternate candidate either.
-                }
-                else break;
+    // Select all templates to be searched for up front. Each selection assumes that the
+    // searches already selected will succeed.
+    for( i = 0; i < ar2Handle->searchFeatureNum; i++ ) {
+        k = ar2SelectTemplate( candidatePtr, surfaceSet->prevFeature, i, ar2Handle->pos, ar2Handle->xsize, ar2Handle->ysize, &(ar2Handle->selectSeed) );
+        if( k < 0 ) {
+            if( candidatePtr == ar2Handle->candidate ) {
+                candidatePtr = ar2Handle->candidate2;
+                k = ar2SelectTemplate( candidatePtr, surfaceSet->prevFeature, i, ar2Handle->pos, ar2Handle->xsize, ar2Handle->ysize, &(ar2Handle->selectSeed) );
+                if( k < 0 ) break; // PRL 2012-05-15: Give up if we can't select template from alternate candidate either.
             }
-
-            cp[j] = &(candidatePtr[k]);
-            ar2Handle->pos[num2][0] = candidatePtr[k].sx;
-            ar2Handle->pos[num2][1] = candidatePtr[k].sy;
-            ar2Handle->arg[j].ar2Handle  = ar2Handle;
-            ar2Handle->arg[j].surfaceSet = surfaceSet;
-            ar2Handle->arg[j].candidate  = &(candidatePtr[k]);
-            ar2Handle->arg[j].dataPtr    = dataPtr;
-
-            threadStartSignal( ar2Handle->threadHandle[j] );
-            num2++;
-            if( num2 == 5 ) num2 = num;
-            i++;
+            else break;
         }
-        k = j;
-        if( k == 0 ) break;
-
-        for( j = 0; j < k; j++ ) {
-            threadEndWait( ar2Handle->threadHandle[j] );
-
-            if( ar2Handle->arg[j].ret == 0 && ar2Handle->arg[j].result.sim > ar2Handle->simThresh ) {
-                if( ar2Handle->trackingMode == AR2_TRACKING_6DOF ) {
-#ifdef ARDOUBLE_IS_FLOAT
-                    arParamObserv2Ideal(ar2Handle->cparamLT->param.dist_factor,
-                                        ar2Handle->arg[j].result.pos2d[0], ar2Handle->arg[j].result.pos2d[1],
-                                        &ar2Handle->pos2d[num][0], &ar2Handle->pos2d[num][1], ar2Handle->cparamLT->param.dist_function_version);
-#else
-                    ARdouble pos2d0, pos2d1;
-                    arParamObserv2Ideal(ar2Handle->cparamLT->param.dist_factor,                    
-                                        (ARdouble)(ar2Handle->arg[j].result.pos2d[0]), (ARdouble)(ar2Handle->arg[j].result.pos2d[1]),
-                                        &pos2d0, &pos2d1, ar2Handle->cparamLT->param.dist_function_version);
-                    ar2Handle->pos2d[num][0] = (float)pos2d0;
-                    ar2Handle->pos2d[num][1] = (float)pos2d1;
-#endif
-                }
-                else {
-                    ar2Handle->pos2d[num][0] = ar2Handle->arg[j].result.pos2d[0];
-                    ar2Handle->pos2d[num][1] = ar2Handle->arg[j].result.pos2d[1];
-                }
-                ar2Handle->pos3d[num][0] = ar2Handle->arg[j].result.pos3d[0];
-                ar2Handle->pos3d[num][1] = ar2Handle->arg[j].result.pos3d[1];
-                ar2Handle->pos3d[num][2] = ar2Handle->arg[j].result.pos3d[2];
-                ar2Handle->pos[num][0] = cp[j]->sx;
-                ar2Handle->pos[num][1] = cp[j]->sy;
-                ar2Handle->usedFeature[num].snum  = cp[j]->snum;
-                ar2Handle->usedFeature[num].level = cp[j]->level;
-                ar2Handle->usedFeature[num].num   = cp[j]->num;
-                ar2Handle->usedFeature[num].flag  = 0;
+        ar2Handle->pos[i][0] = candidatePtr[k].sx;
+        ar2Handle->pos[i][1] = candidatePtr[k].sy;
+        ar2Handle->task[i].candidate = &(candidatePtr[k]);
+    }
+
+    // Publish the queue, wake as many workers as there are other tasks, and join in. A worker
+    // leaves the queue only once every task is claimed, and a claimed task is completed before
+    // its worker ends, so all tasks are done once every woken worker has ended.
+    ar2AssignTemplateCache( ar2Handle, surfaceSet, i );
+    ar2Handle->taskNum        = i;
+    ar2Handle->taskSurfaceSet = surfaceSet;
+    ar2Handle->taskDataPtr    = dataPtr;
+    ar2Handle->taskSearchSize = ar2GetFrameSearchSize( ar2Handle, surfaceSet );
+    ar2Handle->taskSearchImage = (ar2Handle->taskNum > 0 ? ar2GetSearchImage( ar2Handle, dataPtr ) : NULL);
+    ar2AtomicSet( &(ar2Handle->taskClaim), generation << 16 );
+    for( woken = 1; woken < ar2Handle->threadNum && woken < ar2Handle->taskNum; woken++ ) {
+        threadStartSignal( ar2Handle->threadHandle[woken] );
+    }
+    ar2Tracking2dRun( &(ar2Handle->arg[0]) );
+    for( j = 1; j < woken; j++ ) {
+        threadEndWait( ar2Handle->threadHandle[j] );
+    }
+
+    // Collect the successful searches, in selection order.
+    num = 0;
+    for( i = 0; i < ar2Handle->taskNum; i++ ) {
+        task = &(ar2Handle->task[i]);
+        if( task->ret == 0 && task->result.sim > ar2Handle->simThresh ) {
+            ar2Handle->pos2d[num][0] = task->result.pos2d[0];
+            ar2Handle->pos2d[num][1] = task->result.pos2d[1];
+            ar2Handle->pos3d[num][0] = task->result.pos3d[0];
+            ar2Handle->pos3d[num][1] = task->result.pos3d[1];
+            ar2Handle->pos3d[num][2] = task->result.pos3d[2];
+            ar2Handle->usedFeature[num].snum  = task->candidate->snum;
+            ar2Handle->usedFeature[num].level = task->candidate->level;
+            ar2Handle->usedFeature[num].num   = task->candidate->num;
+            ar2Handle->usedFeature[num].flag  = 0;
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-                aveBlur += ar2Handle->arg[j].result.blurLevel;
+            aveBlur += task->result.blurLevel;
 #endif
-                num++;
-            }
+            num++;
         }
     }
+    if( ar2Handle->adaptiveSearch ) ar2UpdateSearchRadius( ar2Handle, surfaceSet );
+    if( ar2Handle->trackingMode == AR2_TRACKING_6DOF ) {
+        // Undistort all matched positions in one pass.
+        arParamObserv2IdealBatch( ar2Handle->cparamLT, &(ar2Handle->pos2d[0][0]), &(ar2Handle->pos2d[0][0]), num );
+    }
     for( i = 0; i < num; i++ ) {
         surfaceSet->prevFeature[i] = ar2Handle->usedFeature[i];
     }
@@ -267,16 +278,20 @@ int ar2Tracking( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, ARUint8 *dat
     return 0;
 }
 
-static int extractVisibleFeatures(const ARParamLT *cparamLT, const float  trans1[][3][4], AR2SurfaceSetT *surfaceSet,
+static int extractVisibleFeatures(AR2HandleT *ar2Handle, const float  trans1[][3][4], AR2SurfaceSetT *surfaceSet,
                                   AR2TemplateCandidateT candidate[],  // candidates inside DPI range of [mindpi, maxdpi].
                                   AR2TemplateCandidateT candidate2[]) // candidates inside DPI range of [mindpi/2, maxdpi*2].
 {
+    const ARParamLT    *cparamLT = ar2Handle->cparamLT;
+    AR2FeatureIndexT   *featureIndex;
+    AR2FeatureCellT     cell[AR2_FEATURE_INDEX_GRID_MAX*AR2_FEATURE_INDEX_GRID_MAX];
     float       trans2[3][4];
     float       sx, sy;
     float       wpos[2], w[2];
     float       vdir[3], vlen;
     int         xsize, ysize;
     int         i, j, k, l, l2;
+    int         n, featureNum;
 
     xsize = cparamLT->param.xsize;
     ysize = cparamLT->param.ysize;
@@ -284,9 +299,20 @@ static int extractVisibleFeatures(const ARParamLT *cparamLT, const float  trans1
     l = l2 = 0;
     for( i = 0; i < surfaceSet->num; i++ ) {
         for(j=0;j<3;j++) for(k=0;k<4;k++) trans2[j][k] = trans1[i][j][k];
+        featureIndex = surfaceSet->surface[i].featureIndex;
+        if( featureIndex != NULL ) {
+            ar2GetFeatureCells( &(cparamLT->param), (const float (*)[4])trans2, featureIndex, ar2Handle->idealBounds, cell );
+        }
 
         for( j = 0; j < surfaceSet->surface[i].featureSet->num; j++ ) {
-            for( k = 0; k < surfaceSet->surface[i].featureSet->list[j].num; k++ ) {
+            if( featureIndex != NULL ) {
+                featureNum = ar2GetVisibleFeatures( ar2Handle, featureIndex, cell, &(surfaceSet->surface[i].featureSet->list[j]), j );
+            }
+            else {
+                featureNum = surfaceSet->surface[i].featureSet->list[j].num;
+            }
+            for( n = 0; n < featureNum; n++ ) {
+                k = (featureIndex != NULL)? ar2Handle->visibleFeature[n]: n;
 
                 if( ar2MarkerCoord2ScreenCoord2( cparamLT, (const float (*)[4])trans2,
                                                  surfaceSet->surface[i].featureSet->list[j].coord[k].mx,
@@ -354,22 +380,45 @@ static int extractVisibleFeatures(const ARParamLT *cparamLT, const float  trans1
     return 0;
 }
 
-static int extractVisibleFeaturesHomography(int xsize, int ysize, float  trans1[][3][4], AR2SurfaceSetT *surfaceSet,
+static int extractVisibleFeaturesHomography(AR2HandleT *ar2Handle, float  trans1[][3][4], AR2SurfaceSetT *surfaceSet,
                                       AR2TemplateCandidateT candidate[],
                                       AR2TemplateCandidateT candidate2[])
 {
+    AR2FeatureIndexT   *featureIndex;
+    AR2FeatureCellT     cell[AR2_FEATURE_INDEX_GRID_MAX*AR2_FEATURE_INDEX_GRID_MAX];
     float       trans2[3][4];
     float       sx, sy;
     float       wpos[2], w[2];
     //float       vdir[3], vlen;
+    float       bounds[4];
+    int         xsize, ysize;
     int         i, j, k, l, l2;
+    int         n, featureNum;
+
+    xsize = ar2Handle->xsize;
+    ysize = ar2Handle->ysize;
+    bounds[0] = -AR2_VISIBLE_BOUNDS_MARGIN;
+    bounds[1] = xsize + AR2_VISIBLE_BOUNDS_MARGIN;
+    bounds[2] = -AR2_VISIBLE_BOUNDS_MARGIN;
+    bounds[3] = ysize + AR2_VISIBLE_BOUNDS_MARGIN;
 
     l = l2 = 0;
     for( i = 0; i < surfaceSet->num; i++ ) {
         for(j=0;j<3;j++) for(k=0;k<4;k++) trans2[j][k] = trans1[i][j][k];
+        featureIndex = surfaceSet->surface[i].featureIndex;
+        if( featureIndex != NULL ) {
+            ar2GetFeatureCells( NULL, (const float (*)[4])trans2, featureIndex, bounds, cell );
+        }
 
         for( j = 0; j < surfaceSet->surface[i].featureSet->num; j++ ) {
-            for( k = 0; k < surfaceSet->surface[i].featureSet->list[j].num; k++ ) {
+            if( featureIndex != NULL ) {
+                featureNum = ar2GetVisibleFeatures( ar2Handle, featureIndex, cell, &(surfaceSet->surface[i].featureSet->list[j]), j );
+            }
+            else {
+                featureNum = surfaceSet->surface[i].featureSet->list[j].num;
+            }
+            for( n = 0; n < featureNum; n++ ) {
+                k = (featureIndex != NULL)? ar2Handle->visibleFeature[n]: n;
 
                 if( ar2MarkerCoord2ScreenCoord2( NULL, (const float (*)[4])trans2,
                                                  surfaceSet->surface[i].featureSet->list[j].coord[k].mx,
@@ -439,17 +488,308 @@ static int extractVisibleFeaturesHomography(int xsize, int ysize, float  trans1[
     return 0;
 }
 
+// Projects the corners of the cells of a feature index with the given pose, and marks the cells
+// which lie wholly outside the bounds (in ideal screen coordinates), along with the range of
+// resolution over each cell. Cells reaching behind the camera are left visible with unknown resolution.
+static void ar2GetFeatureCells( const ARParam *cparam, const float  trans[3][4], const AR2FeatureIndexT *featureIndex,
+                                const float bounds[4], AR2FeatureCellT cell[] )
+{
+    float       wtrans[3][4];
+    float       cx[(AR2_FEATURE_INDEX_GRID_MAX+1)*(AR2_FEATURE_INDEX_GRID_MAX+1)];
+    float       cy[(AR2_FEATURE_INDEX_GRID_MAX+1)*(AR2_FEATURE_INDEX_GRID_MAX+1)];
+    float       cdpi[(AR2_FEATURE_INDEX_GRID_MAX+1)*(AR2_FEATURE_INDEX_GRID_MAX+1)];
+    int         cfront[(AR2_FEATURE_INDEX_GRID_MAX+1)*(AR2_FEATURE_INDEX_GRID_MAX+1)];
+    float       pos[2], w[2];
+    float       hx, hy, h;
+    int         corner[4];
+    int         xnum1 = featureIndex->xnum + 1;
+    int         i, j, c, n;
+
+    if( cparam != NULL ) arUtilMatMuldff( cparam->mat, trans, wtrans );
+    else                 for(j=0;j<3;j++) for(i=0;i<4;i++) wtrans[j][i] = trans[j][i];
+
+    for( j = 0; j <= featureIndex->ynum; j++ ) {
+        for( i = 0; i <= featureIndex->xnum; i++ ) {
+            c = j*xnum1 + i;
+            pos[0] = featureIndex->mx0 + i*featureIndex->cellSize;
+            pos[1] = featureIndex->my0 + j*featureIndex->cellSize;
+            hx = wtrans[0][0] * pos[0] + wtrans[0][1] * pos[1] + wtrans[0][3];
+            hy = wtrans[1][0] * pos[0] + wtrans[1][1] * pos[1] + wtrans[1][3];
+            h  = wtrans[2][0] * pos[0] + wtrans[2][1] * pos[1] + wtrans[2][3];
+            cfront[c] = (h > 0.0F);
+            if( !cfront[c] ) continue;
+            cx[c] = hx / h;
+            cy[c] = hy / h;
+            ar2GetResolution2( cparam, trans, pos, w );
+            cdpi[c] = (w[1] >= 0.0F)? w[1]: -1.0F; // Also catches NaN.
+        }
+    }
+
+    for( j = 0; j < featureIndex->ynum; j++ ) {
+        for( i = 0; i < featureIndex->xnum; i++ ) {
+            n = j*featureIndex->xnum + i;
+            corner[0] = j*xnum1 + i;
+            corner[1] = corner[0] + 1;
+            corner[2] = corner[0] + xnum1;
+            corner[3] = corner[2] + 1;
+            cell[n].visible = 1;
+            cell[n].dpiMin  = -1.0F;
+            cell[n].dpiMax  = -1.0F;
+            if( !cfront[corner[0]] || !cfront[corner[1]] || !cfront[corner[2]] || !cfront[corner[3]] ) continue;
+
+            // A cell in front of the camera projects inside the convex hull of its corners.
+            if( (cx[corner[0]] < bounds[0] && cx[corner[1]] < bounds[0] && cx[corner[2]] < bounds[0] && cx[corner[3]] < bounds[0])
+             || (cx[corner[0]] > bounds[1] && cx[corner[1]] > bounds[1] && cx[corner[2]] > bounds[1] && cx[corner[3]] > bounds[1])
+             || (cy[corner[0]] < bounds[2] && cy[corner[1]] < bounds[2] && cy[corner[2]] < bounds[2] && cy[corner[3]] < bounds[2])
+             || (cy[corner[0]] > bounds[3] && cy[corner[1]] > bounds[3] && cy[corner[2]] > bounds[3] && cy[corner[3]] > bounds[3]) ) {
+                cell[n].visible = 0;
+                continue;
+            }
+
+            if( cdpi[corner[0]] < 0.0F || cdpi[corner[1]] < 0.0F || cdpi[corner[2]] < 0.0F || cdpi[corner[3]] < 0.0F ) continue;
+            cell[n].dpiMin = cell[n].dpiMax = cdpi[corner[0]];
+            for( c = 1; c < 4; c++ ) {
+                if( cdpi[corner[c]] < cell[n].dpiMin ) cell[n].dpiMin = cdpi[corner[c]];
+                if( cdpi[corner[c]] > cell[n].dpiMax ) cell[n].dpiMax = cdpi[corner[c]];
+            }
+            // Where resolution changes fast across the cell (e.g. when seen edge on), corners are poor samples of it.
+            if( cell[n].dpiMax > cell[n].dpiMin * AR2_VISIBLE_DPI_MARGIN ) {
+                cell[n].dpiMin = cell[n].dpiMax = -1.0F;
+                continue;
+            }
+            cell[n].dpiMin /= AR2_VISIBLE_DPI_MARGIN;
+            cell[n].dpiMax *= AR2_VISIBLE_DPI_MARGIN;
+        }
+    }
+}
+
+// Gathers into ar2Handle->visibleFeature, in ascending order, the features of one scale lying in
+// cells which are visible and whose resolution range meets [mindpi/2, maxdpi*2]. Returns their number.
+static int ar2GetVisibleFeatures( AR2HandleT *ar2Handle, const AR2FeatureIndexT *featureIndex, const AR2FeatureCellT cell[],
+                                  const AR2FeaturePointsT *featurePoints, int level )
+{
+    const int  *cellStart   = featureIndex->cellStart[level];
+    const int  *cellFeature = featureIndex->cellFeature[level];
+    int         cellNum     = featureIndex->xnum * featureIndex->ynum;
+    int         c, k, num, sorted;
+
+    if( ar2Handle->visibleFeatureSize < featurePoints->num ) {
+        free( ar2Handle->visibleFeature );
+        arMalloc( ar2Handle->visibleFeature, int, featurePoints->num );
+        ar2Handle->visibleFeatureSize = featurePoints->num;
+    }
+
+    num = 0;
+    sorted = 1;
+    for( c = 0; c < cellNum; c++ ) {
+        if( cellStart[c] == cellStart[c+1] ) continue;
+        if( !cell[c].visible ) continue;
+        if( cell[c].dpiMin >= 0.0F
+         && (cell[c].dpiMax < featurePoints->mindpi/2 || cell[c].dpiMin > featurePoints->maxdpi*2) ) continue;
+        if( num > 0 && cellFeature[cellStart[c]] < ar2Handle->visibleFeature[num-1] ) sorted = 0;
+        for( k = cellStart[c]; k < cellStart[c+1]; k++ ) ar2Handle->visibleFeature[num++] = cellFeature[k];
+    }
+    // Candidates are examined in feature order, as without the index.
+    if( !sorted ) qsort( ar2Handle->visibleFeature, num, sizeof(int), compInt );
+
+    return num;
+}
+
+static int compInt( const void *a, const void *b )
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+// Gives each queued search sole use, for this frame, of a template cache entry: the entry already
+// holding a template for its feature if there is one, or else the least recently used entry.
+static void ar2AssignTemplateCache( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet, int taskNum )
+{
+    AR2TemplateCandidateT  *candidate;
+    AR2TemplateCacheT      *cache, *entry;
+    int                     xsize, ysize;
+    int                     i, j;
+
+    if( ar2Handle->templateReuseThresh <= 0.0F ) {
+        for( i = 0; i < taskNum; i++ ) ar2Handle->task[i].cache = NULL;
+        return;
+    }
+
+    cache = ar2Handle->templateCache;
+    if( ++ar2Handle->templateCacheFrame <= 0 ) {
+        for( j = 0; j < AR2_TEMPLATE_CACHE_MAX; j++ ) cache[j].frame = 0;
+        ar2Handle->templateCacheFrame = 1;
+    }
+    xsize = ar2Handle->templateSize1 + ar2Handle->templateSize2 + 1;
+    ysize = xsize;
+
+    for( i = 0; i < taskNum; i++ ) {
+        candidate = ar2Handle->task[i].candidate;
+        entry = NULL;
+        for( j = 0; j < AR2_TEMPLATE_CACHE_MAX; j++ ) {
+            if( cache[j].frame != 0 && cache[j].surfaceSet == surfaceSet && cache[j].snum == candidate->snum
+             && cache[j].level == candidate->level && cache[j].num == candidate->num ) {
+                entry = &(cache[j]);
+                break;
+            }
+        }
+        if( entry == NULL ) {
+            entry = &(cache[0]);
+            for( j = 1; j < AR2_TEMPLATE_CACHE_MAX; j++ ) {
+                if( cache[j].frame < entry->frame ) entry = &(cache[j]);
+            }
+            if( entry->frame == ar2Handle->templateCacheFrame ) {
+                ar2Handle->task[i].cache = NULL; // All entries are in use this frame.
+                continue;
+            }
+            entry->surfaceSet = surfaceSet;
+            entry->snum       = candidate->snum;
+            entry->level      = candidate->level;
+            entry->num        = candidate->num;
+            entry->valid      = 0;
+        }
+        // The pose has just been set by ar2SetInitTrans(), so may be unrelated to the one the template was built for.
+        if( surfaceSet->contNum == 1 ) entry->valid = 0;
+
+        if( entry->templ.img1 == NULL || entry->templ.xsize != xsize || entry->templ.ysize != ysize ) {
+            free( entry->templ.img1 );
+            entry->templ.xts1  = entry->templ.yts1 = ar2Handle->templateSize1;
+            entry->templ.xts2  = entry->templ.yts2 = ar2Handle->templateSize2;
+            entry->templ.xsize = xsize;
+            entry->templ.ysize = ysize;
+            entry->valid       = 0;
+            if( (entry->templ.img1 = (ARUint16 *)malloc( sizeof(ARUint16)*xsize*ysize )) == NULL ) {
+                ARLOGe("Error: malloc\n");
+                entry->frame = 0;
+                ar2Handle->task[i].cache = NULL;
+                continue;
+            }
+        }
+        entry->frame = ar2Handle->templateCacheFrame;
+        ar2Handle->task[i].cache = entry;
+    }
+}
+
+// Returns the search radius for this frame: the adaptive radius if there is one, else the search size.
+static int ar2GetFrameSearchSize( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet )
+{
+    int     searchSize;
+
+    if( !ar2Handle->adaptiveSearch || surfaceSet->searchRadius <= 0.0F ) return ar2Handle->searchSize;
+    searchSize = (int)ceilf( surfaceSet->searchRadius );
+    if( searchSize < AR2_SEARCH_SIZE_MIN ) searchSize = AR2_SEARCH_SIZE_MIN;
+
+    return (searchSize < ar2Handle->searchSize ? searchSize : ar2Handle->searchSize);
+}
+
+// Sets the search radius for the next frame from how far matches in this frame lay from where they
+// were predicted. A high percentile of the residuals is used, so that a few false matches do not
+// inflate the radius. The radius grows at once but shrinks gradually, and falls back to the full
+// search size when too few searches succeed for the residuals to be trusted.
+static void ar2UpdateSearchRadius( AR2HandleT *ar2Handle, AR2SurfaceSetT *surfaceSet )
+{
+    float   residual[AR2_SEARCH_FEATURE_MAX];
+    float   target;
+    int     num;
+    int     i;
+
+    num = 0;
+    for( i = 0; i < ar2Handle->taskNum; i++ ) {
+        if( ar2Handle->task[i].ret == 0 && ar2Handle->task[i].result.sim > ar2Handle->simThresh ) {
+            residual[num++] = ar2Handle->task[i].result.residual;
+        }
+    }
+    if( num == 0 || num*2 < ar2Handle->taskNum ) {
+        surfaceSet->searchRadius = 0.0F;
+        return;
+    }
+    qsort( residual, num, sizeof(float), compE );
+
+    // Allow for the truncation of search points to whole pixels.
+    target = residual[(num*4)/5] * AR2_SEARCH_RADIUS_GAIN + 2.0F;
+    if( target >= surfaceSet->searchRadius || surfaceSet->searchRadius <= 0.0F ) {
+        surfaceSet->searchRadius = target;
+    }
+    else {
+        surfaceSet->searchRadius = surfaceSet->searchRadius * AR2_SEARCH_RADIUS_DECAY + target * (1.0F - AR2_SEARCH_RADIUS_DECAY);
+    }
+    if( surfaceSet->searchRadius > (float)ar2Handle->searchSize ) surfaceSet->searchRadius = (float)ar2Handle->searchSize;
+}
+
+// Reduces the frame for the first search stage, or returns NULL if searches are at full resolution only.
+// Non-planar frames are first converted to luma, as in template matching. A pyramid set by the caller
+// is already set to the frame's luma.
+static const ARUint8 *ar2GetSearchImage( AR2HandleT *ar2Handle, ARUint8 *dataPtr )
+{
+    AR_PIXEL_FORMAT  pixFormat = ar2Handle->pixFormat;
+    ARUint8         *luma, *p;
+    int              n, i;
+
+    if( ar2Handle->searchPyramidLevel <= 0 ) return NULL;
+    if( ar2Handle->searchPyramidShared != NULL ) {
+        return arImagePyramidGetLevel( ar2Handle->searchPyramidShared, ar2GetSearchPyramidImageLevel( ar2Handle ), NULL, NULL );
+    }
+    if( ar2Handle->searchPyramid == NULL ) {
+        if( (ar2Handle->searchPyramid = arImagePyramidInit( ar2Handle->xsize, ar2Handle->ysize )) == NULL ) return NULL;
+    }
+
+    n = ar2Handle->xsize * ar2Handle->ysize;
+    if( pixFormat == AR_PIXEL_FORMAT_MONO || pixFormat == AR_PIXEL_FORMAT_420v || pixFormat == AR_PIXEL_FORMAT_420f || pixFormat == AR_PIXEL_FORMAT_NV21 ) {
+        luma = dataPtr;
+    }
+    else {
+        if( ar2Handle->searchLuma == NULL ) arMalloc( ar2Handle->searchLuma, ARUint8, n );
+        luma = ar2Handle->searchLuma;
+        p = dataPtr;
+        if( pixFormat == AR_PIXEL_FORMAT_RGB || pixFormat == AR_PIXEL_FORMAT_BGR ) {
+            for( i = 0; i < n; i++, p += 3 ) luma[i] = (*(p + 0) + *(p + 1) + *(p + 2))/3;
+        }
+        else if( pixFormat == AR_PIXEL_FORMAT_RGBA || pixFormat == AR_PIXEL_FORMAT_BGRA ) {
+            for( i = 0; i < n; i++, p += 4 ) luma[i] = (*(p + 0) + *(p + 1) + *(p + 2))/3;
+        }
+        else if( pixFormat == AR_PIXEL_FORMAT_ARGB || pixFormat == AR_PIXEL_FORMAT_ABGR ) {
+            for( i = 0; i < n; i++, p += 4 ) luma[i] = (*(p + 1) + *(p + 2) + *(p + 3))/3;
+        }
+        else if( pixFormat == AR_PIXEL_FORMAT_2vuy ) {
+            for( i = 0; i < n; i++, p += 2 ) luma[i] = *(p + 1);
+        }
+        else if( pixFormat == AR_PIXEL_FORMAT_yuvs ) {
+            for( i = 0; i < n; i++, p += 2 ) luma[i] = *p;
+        }
+        else return NULL;
+    }
+
+    arImagePyramidSetImage( ar2Handle->searchPyramid, luma );
+    return arImagePyramidGetLevel( ar2Handle->searchPyramid, ar2GetSearchPyramidImageLevel( ar2Handle ), NULL, NULL );
+}
+
+int ar2PrepareSearchPyramid( AR2HandleT *ar2Handle )
+{
+    if( ar2Handle == NULL ) return -1;
+    if( ar2Handle->searchPyramidShared == NULL || ar2Handle->searchPyramidLevel <= 0 ) return 0;
+    if( arImagePyramidGetLevel( ar2Handle->searchPyramidShared, ar2GetSearchPyramidImageLevel( ar2Handle ), NULL, NULL ) == NULL ) return -1;
+    return 0;
+}
+
+// The level of an ARImagePyramid searched first, for searchPyramidLevel 1 or 2.
+static AR_IMAGE_PYRAMID_LEVEL ar2GetSearchPyramidImageLevel( AR2HandleT *ar2Handle )
+{
+    return (ar2Handle->searchPyramidLevel == 1 ? AR_IMAGE_PYRAMID_LEVEL_HALF : AR_IMAGE_PYRAMID_LEVEL_QUARTER);
+}
+
 static float  ar2GetTransMat( ICPHandleT *icpHandle, float  initConv[3][4], float  pos2d[][2], float  pos3d[][3], int num,
                               float  conv[3][4], int robustMode )
 {   
     ICPDataT       data;
+    ICP2DCoordT    screenCoord[AR2_SEARCH_FEATURE_MAX];
+    ICP3DCoordT    worldCoord[AR2_SEARCH_FEATURE_MAX];
     float          dx, dy, dz;
     ARdouble       initMat[3][4], mat[3][4];
     ARdouble       err;
     int            i, j;
     
-    arMalloc( data.screenCoord, ICP2DCoordT, num );
-    arMalloc( data.worldCoord,  ICP3DCoordT, num );
+    if( num > AR2_SEARCH_FEATURE_MAX ) return 100000000.0F;
+    data.screenCoord = screenCoord;
+    data.worldCoord  = worldCoord;
     
     dx = dy = dz = 0.0;
     for( i = 0; i < num; i++ ) {
@@ -488,9 +828,6 @@ static float  ar2GetTransMat( ICPHandleT *icpHandle, float  initConv[3][4], floa
         }
     }
 
-    free( data.screenCoord );
-    free( data.worldCoord );
-
     for( j = 0; j < 3; j++ ) {
         for( i = 0; i < 3; i++ ) conv[j][i] = (float)mat[j][i];
     }
@@ -515,25 +852,16 @@ static float  ar2GetTransMatHomography( float  initConv[3][4], float  pos2d[][2]
 static float  ar2GetTransMatHomography2( float  initConv[3][4], float  pos2d[][2], float  pos3d[][3], int num, float  conv[3][4] )
 {
     float         err = 100000000.0F;
-    float        *J_U_H;
-    float        *dU;
+    float         J_U_H[16*AR2_SEARCH_FEATURE_MAX];
+    float         dU[2*AR2_SEARCH_FEATURE_MAX];
     float         hx, hy, h, hh, ux, uy, dx, dy;
     float         dH[8];
     float         err0, err1;
     int           i, j;
 
-    if( num < 4 ) return err;
+    if( num < 4 || num > AR2_SEARCH_FEATURE_MAX ) return err;
     if( initConv[2][3] == 0.0F ) return err;
 
-    if( (J_U_H = (float  *)malloc( sizeof(float)*16*num )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        return -1;
-    }
-    if( (dU = (float  *)malloc( sizeof(float)*2*num )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_H);
-        return -1;
-    }
     for( j = 0; j < 3; j++ ) {
         for( i = 0; i < 4; i++ ) conv[j][i] = initConv[j][i]/ initConv[2][3];
     }
@@ -545,8 +873,6 @@ static float  ar2GetTransMatHomography2( float  initConv[3][4], float  pos2d[][2
             hy = conv[1][0] * pos3d[j][0] + conv[1][1] * pos3d[j][1] + conv[1][3];
             h  = conv[2][0] * pos3d[j][0] + conv[2][1] * pos3d[j][1] + 1.0f;
             if( h == 0.0 ) {
-                free(J_U_H);
-                free(dU);
                 return err;
             }
             hh = h*h;
@@ -582,8 +908,6 @@ static float  ar2GetTransMatHomography2( float  initConv[3][4], float  pos2d[][2
         err0 = err1;
 
         if( getDeltaS( dH, dU, (float  (*)[8])J_U_H, num*2 ) < 0 ) {
-            free(J_U_H);
-            free(dU);
             return err;
         }
         //for(j=0;j<8;j++) ARLOG("%f\t", dH[j]); ARLOG("\n");
@@ -600,9 +924,6 @@ static float  ar2GetTransMatHomography2( float  initConv[3][4], float  pos2d[][2
     //ARLOG("*********** %f\n", err1);
     //ARLOG("Loop = %d\n", i);
 
-    free(J_U_H);
-    free(dU);
-
     return err1;
 }
 
@@ -620,44 +941,21 @@ static int compE( const void *a, const void *b )
 static float  ar2GetTransMatHomographyRobust  ( float  initConv[3][4], float  pos2d[][2], float  pos3d[][3], int num, float  conv[3][4], float inlierProb )
 {
     float         err = 100000000.0F;
-    float        *J_U_H;
-    float        *dU;
-    float        *E, *E2, K2, W;
+    float         J_U_H[16*AR2_SEARCH_FEATURE_MAX];
+    float         dU[2*AR2_SEARCH_FEATURE_MAX];
+    float         E[AR2_SEARCH_FEATURE_MAX], E2[AR2_SEARCH_FEATURE_MAX], K2, W;
     float         hx, hy, h, hh, ux, uy, dx, dy;
     float         dH[8];
     float         err0, err1;
     int           inlierNum;
     int           i, j, k;
 
-    if( num < 4 ) return err;
+    if( num < 4 || num > AR2_SEARCH_FEATURE_MAX ) return err;
     if( initConv[2][3] == 0.0F ) return err;
 
     inlierNum = (int)(num * inlierProb) - 1;
     if( inlierNum < 4 ) inlierNum = 4;
 
-    if( (J_U_H = (float  *)malloc( sizeof(float)*16*num )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        return -1;
-    }
-    if( (dU = (float  *)malloc( sizeof(float)*2*num )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_H);
-        return -1;
-    }
-    if( (E = (float  *)malloc( sizeof(float)*num )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_H);
-        free(dU);
-        return -1;
-    }
-    if( (E2 = (float  *)malloc( sizeof(float)*num )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_H);
-        free(dU);
-        free(E);
-        return -1;
-    }
-
     for( j = 0; j < 3; j++ ) {
         for( i = 0; i < 4; i++ ) conv[j][i] = initConv[j][i]/ initConv[2][3];
     }
@@ -668,10 +966,6 @@ static float  ar2GetTransMatHomographyRobust  ( float  initConv[3][4], float  po
             hy = conv[1][0] * pos3d[j][0] + conv[1][1] * pos3d[j][1] + conv[1][3];
             h  = conv[2][0] * pos3d[j][0] + conv[2][1] * pos3d[j][1] + 1.0F;
             if( h == 0.0f ) {
-                free(J_U_H);
-                free(dU);
-                free(E);
-                free(E2);
                 return err;
             }
             hh = h*h;
@@ -742,18 +1036,10 @@ static float  ar2GetTransMatHomographyRobust  ( float  initConv[3][4], float  po
             }
         }
         if( k < 6 ) {
-            free(J_U_H);
-            free(dU);
-            free(E);
-            free(E2);
             return -1;
         }
 
         if( getDeltaS( dH, dU, (float (*)[8])J_U_H, k ) < 0 ) {
-            free(J_U_H);
-            free(dU);
-            free(E);
-            free(E2);
             return err;
         }
         //for(j=0;j<8;j++) ARLOG("%f\t", dH[j]); ARLOG("\n");
@@ -770,59 +1056,40 @@ static float  ar2GetTransMatHomographyRobust  ( float  initConv[3][4], float  po
     //ARLOG("*********** %f\n", err1);
     //ARLOG("Loop = %d\n", i);
 
-    free(J_U_H);
-    free(dU);
-    free(E);
-    free(E2);
-
     return err1;
 }
 
 static int getDeltaS( float  H[8], float  dU[], float  J_U_H[][8], int n )
 {
-    ARMatf  matH, matU, matJ;
-    ARMatf *matJt, *matJtJ, *matJtU;
-    int ret = 0;
+    ARMatf  matH, matJtJ, matJtU;
+    float   JtJ[8][8], JtU[8];
+    int     i, j, k;
+
+    // J^T.J and J^T.dU are only 8x8 and 8x1, so build them directly rather than allocating J^T.
+    for( j = 0; j < 8; j++ ) {
+        for( i = j; i < 8; i++ ) {
+            JtJ[j][i] = 0.0f;
+            for( k = 0; k < n; k++ ) JtJ[j][i] += J_U_H[k][j] * J_U_H[k][i];
+            JtJ[i][j] = JtJ[j][i];
+        }
+        JtU[j] = 0.0f;
+        for( k = 0; k < n; k++ ) JtU[j] += J_U_H[k][j] * dU[k];
+    }
 
     matH.row = 8;
     matH.clm = 1;
     matH.m   = H;
 
-    matU.row = n;
-    matU.clm = 1;
-    matU.m   = dU;
-
-    matJ.row = n;
-    matJ.clm = 8;
-    matJ.m   = &J_U_H[0][0];
-
-    matJt = arMatrixAllocTransf( &matJ );
-    if( matJt == NULL ) {
-        ret = -1;
-        goto bail;
-    }
-    matJtJ = arMatrixAllocMulf( matJt, &matJ );
-    if( matJtJ == NULL ) {
-        ret = -1;
-        goto bail1;
-    }
-    matJtU = arMatrixAllocMulf( matJt, &matU );
-    if( matJtU == NULL ) {
-        ret = -1;
-        goto bail2;
-    }
-    if( arMatrixSelfInvf(matJtJ) < 0 ) {
-        ret = -1;
-        goto bail3;
-    }
-
-    arMatrixMulf( &matH, matJtJ, matJtU );
-bail3:
-    arMatrixFreef( matJtU );
-bail2:
-    arMatrixFreef( matJtJ );
-bail1:
-    arMatrixFreef( matJt );
-bail:
-    return (ret);
+    matJtJ.row = 8;
+    matJtJ.clm = 8;
+    matJtJ.m   = &JtJ[0][0];
+
+    matJtU.row = 8;
+    matJtU.clm = 1;
+    matJtU.m   = JtU;
+
+    if( arMatrixSelfInvf(&matJtJ) < 0 ) return -1;
+    arMatrixMulf( &matH, &matJtJ, &matJtU );
+
+    return 0;
 }
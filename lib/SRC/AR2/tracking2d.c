@@ -39,21 +39,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h> // memcpy()
 #include <AR2/config.h>
 #include <AR2/featureSet.h>
 #include <AR2/template.h>
 #include <AR2/searchPoint.h>
 #include <AR2/tracking.h>
+#include "private.h"
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
 static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR2TemplateCandidateT *candidate,
-                              ARUint8 *dataPtr, ARUint8 *mfImage, AR2TemplateT **templ,
-                              AR2Template2T **templ2, AR2Tracking2DResultT *result );
+                              ARUint8 *dataPtr, AR2TemplateT **templ,
+                              AR2Template2T **templ2, AR2MatchingScratchT *scratch, AR2Tracking2DResultT *result );
 #else
 static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR2TemplateCandidateT *candidate,
-                              ARUint8 *dataPtr, ARUint8 *mfImage, AR2TemplateT **templ,
-                              AR2Tracking2DResultT *result );
+                              AR2TemplateCacheT *cache, ARUint8 *dataPtr, AR2TemplateT **templ,
+                              AR2MatchingScratchT *scratch, AR2Tracking2DResultT *result );
+static int ar2SetTemplateCached( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR2TemplateCandidateT *candidate,
+                                 AR2TemplateCacheT *cache, AR2TemplateT *templ );
 #endif
+static int   ar2GetFeatureSearchSize( AR2HandleT *handle, int search[3][2] );
+static float ar2GetSearchResidual( int search[3][2], int bx, int by );
 
 void *ar2Tracking2d( THREAD_HANDLE_T *threadHandle )
 {
@@ -66,14 +72,7 @@ void *ar2Tracking2d( THREAD_HANDLE_T *threadHandle )
     ARLOGi("Start tracking_thread #%d.\n", ID);
     for(;;) {
         if( threadStartWait(threadHandle) < 0 ) break;
-
-#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
-        arg->ret = ar2Tracking2dSub( arg->ar2Handle, arg->surfaceSet, arg->candidate,
-                                     arg->dataPtr, arg->mfImage, &(arg->templ), &(arg->templ2), &(arg->result) );
-#else
-        arg->ret = ar2Tracking2dSub( arg->ar2Handle, arg->surfaceSet, arg->candidate,
-                                     arg->dataPtr, arg->mfImage, &(arg->templ), &(arg->result) );
-#endif
+        ar2Tracking2dRun( arg );
         threadEndSignal(threadHandle);
     }
     ARLOGi("End tracking_thread #%d.\n", ID);
@@ -81,15 +80,42 @@ void *ar2Tracking2d( THREAD_HANDLE_T *threadHandle )
     return NULL;
 }
 
+// Claims and runs tasks from the queue until none are left unclaimed.
+// A claim is a compare-and-swap of taskClaim, which carries a generation number. ar2Tracking()
+// closes the queue with an exhausted claim before writing any task field, so a claim read
+// before then fails, whatever taskNum is read alongside it.
+void ar2Tracking2dRun( AR2Tracking2DParamT *arg )
+{
+    AR2HandleT           *handle = arg->ar2Handle;
+    AR2Tracking2DTaskT   *task;
+    int                   claim, k;
+
+    for(;;) {
+        claim = ar2AtomicGet( &(handle->taskClaim) );
+        k = claim & 0xFFFF;
+        if( k >= handle->taskNum ) break;
+        if( !ar2AtomicCAS( &(handle->taskClaim), claim, claim + 1 ) ) continue;
+
+        task = &(handle->task[k]);
+#if AR2_CAPABLE_ADAPTIVE_TEMPLATE
+        task->ret = ar2Tracking2dSub( handle, handle->taskSurfaceSet, task->candidate,
+                                      handle->taskDataPtr, &(arg->templ), &(arg->templ2), &(arg->scratch), &(task->result) );
+#else
+        task->ret = ar2Tracking2dSub( handle, handle->taskSurfaceSet, task->candidate, task->cache,
+                                      handle->taskDataPtr, &(arg->templ), &(arg->scratch), &(task->result) );
+#endif
+    }
+}
+
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
 static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR2TemplateCandidateT *candidate,
-                              ARUint8 *dataPtr, ARUint8 *mfImage, AR2TemplateT **templ,
-                              AR2Template2T **templ2, AR2Tracking2DResultT *result )
+                              ARUint8 *dataPtr, AR2TemplateT **templ,
+                              AR2Template2T **templ2, AR2MatchingScratchT *scratch, AR2Tracking2DResultT *result )
 #else
 static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR2TemplateCandidateT *candidate,
-                              ARUint8 *dataPtr, ARUint8 *mfImage, AR2TemplateT **templ,
-                              AR2Tracking2DResultT *result )
+                              AR2TemplateCacheT *cache, ARUint8 *dataPtr, AR2TemplateT **templ,
+                              AR2MatchingScratchT *scratch, AR2Tracking2DResultT *result )
 #endif
 {
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
@@ -97,13 +123,17 @@ static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR
 #endif
     int                   snum, level, fnum;
     int                   search[3][2];
+    int                   searchSize;
     int                   bx, by;
 
     snum  = candidate->snum;
     level = candidate->level;
     fnum  = candidate->num;
 
-    if( *templ == NULL )  *templ = ar2GenTemplate( handle->templateSize1, handle->templateSize2 );
+    if( *templ == NULL ) {
+        *templ = ar2GenTemplate( handle->templateSize1, handle->templateSize2 );
+        if( ar2AllocMatchingScratch( scratch, *templ ) < 0 ) return -1;
+    }
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     if( *templ2 == NULL ) *templ2 = ar2GenTemplate2( handle->templateSize1, handle->templateSize2 );
 #endif
@@ -140,12 +170,7 @@ static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR
         }
     }
 #else
-    if( ar2SetTemplateSub( handle->cparamLT,
-                           (const float (*)[4])handle->wtrans1[snum],
-                           surfaceSet->surface[snum].imageSet,
-                         &(surfaceSet->surface[snum].featureSet->list[level]),
-                           fnum,
-                          *templ ) < 0 ) return -1;
+    if( ar2SetTemplateCached( handle, surfaceSet, candidate, cache, *templ ) < 0 ) return -1;
 
     if( (*templ)->vlen * (*templ)->vlen
           < ((*templ)->xts1 + (*templ)->xts2 + 1) * ((*templ)->yts1 + (*templ)->yts2 + 1)
@@ -176,33 +201,36 @@ static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR
                          &(surfaceSet->surface[snum].featureSet->list[level].coord[fnum]),
                            search );
     }
+    searchSize = ar2GetFeatureSearchSize( handle, search );
 
 #if AR2_CAPABLE_ADAPTIVE_TEMPLATE
     if( handle->blurMethod == AR2_CONSTANT_BLUR ) {
-        if( ar2GetBestMatching( dataPtr,
-                                mfImage,
-                                handle->xsize,
-                                handle->ysize,
-                                handle->pixFormat,
-                               *templ,
-                                handle->searchSize,
-                                handle->searchSize,
-                                search,
-                                &bx, &by,
-                              &(result->sim)) < 0 ) {
+        if( ar2GetBestMatchingPyramid( dataPtr,
+                                       handle->xsize,
+                                       handle->ysize,
+                                       handle->pixFormat,
+                                       handle->taskSearchImage,
+                                       handle->searchPyramidLevel,
+                                      *templ,
+                                       searchSize,
+                                       searchSize,
+                                       search,
+                                       &bx, &by,
+                                     &(result->sim),
+                                       scratch) < 0 ) {
             return -1;
         }
         result->blurLevel = handle->blurLevel;
     }
     else {
         if( ar2GetBestMatching2( dataPtr,
-                                 mfImage,
+                                 NULL,
                                  handle->xsize,
                                  handle->ysize,
                                  handle->pixFormat,
                                 *templ2,
-                                 handle->searchSize,
-                                 handle->searchSize,
+                                 searchSize,
+                                 searchSize,
                                  search,
                                  &bx, &by,
                                &(result->sim),
@@ -211,23 +239,26 @@ static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR
         }
     }
 #else
-    if( ar2GetBestMatching( dataPtr,
-                            mfImage,
-                            handle->xsize,
-                            handle->ysize,
-                            handle->pixFormat,
-                           *templ,
-                            handle->searchSize,
-                            handle->searchSize,
-                            search,
-                            &bx, &by,
-                          &(result->sim)) < 0 ) {
+    if( ar2GetBestMatchingPyramid( dataPtr,
+                                   handle->xsize,
+                                   handle->ysize,
+                                   handle->pixFormat,
+                                   handle->taskSearchImage,
+                                   handle->searchPyramidLevel,
+                                  *templ,
+                                   searchSize,
+                                   searchSize,
+                                   search,
+                                   &bx, &by,
+                                 &(result->sim),
+                                   scratch) < 0 ) {
         return -1;
     }
 #endif
 
     result->pos2d[0] = (float)bx;
     result->pos2d[1] = (float)by;
+    result->residual = ar2GetSearchResidual( search, bx, by );
     result->pos3d[0] = surfaceSet->surface[snum].trans[0][0] * surfaceSet->surface[snum].featureSet->list[level].coord[fnum].mx
                      + surfaceSet->surface[snum].trans[0][1] * surfaceSet->surface[snum].featureSet->list[level].coord[fnum].my
                      + surfaceSet->surface[snum].trans[0][3];
@@ -240,3 +271,152 @@ static int ar2Tracking2dSub ( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR
 
     return 0;
 }
+
+// Search radius for one feature: the radius for the frame, widened by the disagreement between the
+// feature's linear and quadratic predictions, which grows as the feature accelerates on screen.
+static int ar2GetFeatureSearchSize( AR2HandleT *handle, int search[3][2] )
+{
+    int     searchSize, dx, dy;
+
+    searchSize = handle->taskSearchSize;
+    if( searchSize >= handle->searchSize ) return handle->searchSize;
+    if( search[1][0] >= 0 && search[2][0] >= 0 ) {
+        dx = abs( search[1][0] - search[2][0] );
+        dy = abs( search[1][1] - search[2][1] );
+        searchSize += (dx > dy ? dx : dy);
+    }
+
+    return (searchSize < handle->searchSize ? searchSize : handle->searchSize);
+}
+
+// Chebyshev distance from a match to the nearest point searched around, i.e. the smallest search
+// radius which would have found it.
+static float ar2GetSearchResidual( int search[3][2], int bx, int by )
+{
+    int     d, dmin, dx, dy;
+    int     i;
+
+    dmin = -1;
+    for( i = 0; i < 3; i++ ) {
+        if( search[i][0] < 0 ) break;
+        dx = abs( bx - search[i][0] );
+        dy = abs( by - search[i][1] );
+        d  = (dx > dy ? dx : dy);
+        if( dmin < 0 || d < dmin ) dmin = d;
+    }
+
+    return (float)(dmin < 0 ? 0 : dmin);
+}
+
+#if !AR2_CAPABLE_ADAPTIVE_TEMPLATE
+// Jacobian of the screen position of marker point (mx, my) under the pose, in ideal screen coordinates,
+// and the observed screen position itself, as ar2SetTemplateSub() computes it to centre the template.
+static int ar2GetScreenJacobian( const ARParamLT *cparamLT, const float trans[3][4], float mx, float my, float J[2][2], float pos[2] )
+{
+    float    wtrans[3][4];
+    float    hx, hy, h;
+
+    if( cparamLT != NULL ) {
+#ifdef ARDOUBLE_IS_FLOAT
+        arUtilMatMul( cparamLT->param.mat, trans, wtrans );
+#else
+        arUtilMatMuldff( cparamLT->param.mat, trans, wtrans );
+#endif
+        trans = (const float (*)[4])wtrans;
+    }
+    h  = trans[2][0]*mx + trans[2][1]*my + trans[2][3];
+    if( h == 0.0F ) return -1;
+    hx = (trans[0][0]*mx + trans[0][1]*my + trans[0][3]) / h;
+    hy = (trans[1][0]*mx + trans[1][1]*my + trans[1][3]) / h;
+    J[0][0] = (trans[0][0] - hx*trans[2][0]) / h;
+    J[0][1] = (trans[0][1] - hx*trans[2][1]) / h;
+    J[1][0] = (trans[1][0] - hy*trans[2][0]) / h;
+    J[1][1] = (trans[1][1] - hy*trans[2][1]) / h;
+    if( cparamLT != NULL ) {
+        if( arParamIdeal2ObservLTf( &cparamLT->paramLTf, hx, hy, &pos[0], &pos[1] ) < 0 ) return -1;
+    }
+    else {
+        pos[0] = hx;
+        pos[1] = hy;
+    }
+
+    return 0;
+}
+
+// Builds the template for a candidate, or copies it from the cache if the template there was built
+// at a pose close enough to the current one. Templates are sampled on the pixel grid around the
+// rounded feature position, so a template pixel at grid offset s from that pixel samples the marker
+// at J0^-1 (s - f0), where J0 is the Jacobian and f0 the sub-pixel offset of the feature when the
+// template was built. At the current pose that marker point lies at offset f + J J0^-1 (s - f0) from
+// the feature's pixel, where it is now searched for at s; the pixel therefore moves by
+// (J J0^-1 - I) s + f - J J0^-1 f0. The template is reused while this is no more than
+// templateReuseThresh in x and y for every pixel of the template.
+static int ar2SetTemplateCached( AR2HandleT *handle, AR2SurfaceSetT *surfaceSet, AR2TemplateCandidateT *candidate,
+                                 AR2TemplateCacheT *cache, AR2TemplateT *templ )
+{
+    AR2FeaturePointsT    *featurePoints;
+    float                 J[2][2], A[2][2], pos[2], offset[2];
+    float                 det, r, d0, d1;
+    int                   snum;
+
+    snum = candidate->snum;
+    featurePoints = &(surfaceSet->surface[snum].featureSet->list[candidate->level]);
+
+    if( cache != NULL && (cache->templ.xsize != templ->xsize || cache->templ.ysize != templ->ysize
+                          || cache->templ.xts1 != templ->xts1 || cache->templ.yts1 != templ->yts1) ) cache = NULL;
+    if( cache != NULL
+     && ar2GetScreenJacobian( handle->cparamLT, (const float (*)[4])handle->wtrans1[snum],
+                              featurePoints->coord[candidate->num].mx, featurePoints->coord[candidate->num].my, J, pos ) < 0 ) cache = NULL;
+    if( cache != NULL ) {
+        offset[0] = pos[0] - (float)(int)(pos[0] + 0.5F);
+        offset[1] = pos[1] - (float)(int)(pos[1] + 0.5F);
+    }
+
+    if( cache != NULL && cache->valid ) {
+        det = cache->J[0][0]*cache->J[1][1] - cache->J[0][1]*cache->J[1][0];
+        if( det != 0.0F ) {
+            A[0][0] = (J[0][0]*cache->J[1][1] - J[0][1]*cache->J[1][0]) / det - 1.0F;
+            A[0][1] = (J[0][1]*cache->J[0][0] - J[0][0]*cache->J[0][1]) / det;
+            A[1][0] = (J[1][0]*cache->J[1][1] - J[1][1]*cache->J[1][0]) / det;
+            A[1][1] = (J[1][1]*cache->J[0][0] - J[1][0]*cache->J[0][1]) / det - 1.0F;
+            r  = (float)((templ->xts1 > templ->xts2 ? templ->xts1 : templ->xts2) * AR2_TEMP_SCALE);
+            d0 = (fabsf(A[0][0]) + fabsf(A[0][1])) * r
+               + fabsf(offset[0] - (A[0][0] + 1.0F)*cache->offset[0] - A[0][1]*cache->offset[1]);
+            d1 = (fabsf(A[1][0]) + fabsf(A[1][1])) * r
+               + fabsf(offset[1] - A[1][0]*cache->offset[0] - (A[1][1] + 1.0F)*cache->offset[1]);
+            if( (d0 > d1 ? d0 : d1) <= handle->templateReuseThresh ) {
+                memcpy( templ->img1, cache->templ.img1, sizeof(ARUint16)*templ->xsize*templ->ysize );
+                templ->vlen     = cache->templ.vlen;
+                templ->sum      = cache->templ.sum;
+                templ->validNum = cache->templ.validNum;
+                return 0;
+            }
+        }
+    }
+
+    if( ar2SetTemplateSub( handle->cparamLT,
+                           (const float (*)[4])handle->wtrans1[snum],
+                           surfaceSet->surface[snum].imageSet,
+                           featurePoints,
+                           candidate->num,
+                           templ ) < 0 ) {
+        if( cache != NULL ) cache->valid = 0;
+        return -1;
+    }
+    if( cache != NULL ) {
+        memcpy( cache->templ.img1, templ->img1, sizeof(ARUint16)*templ->xsize*templ->ysize );
+        cache->templ.vlen     = templ->vlen;
+        cache->templ.sum      = templ->sum;
+        cache->templ.validNum = templ->validNum;
+        cache->J[0][0] = J[0][0];
+        cache->J[0][1] = J[0][1];
+        cache->J[1][0] = J[1][0];
+        cache->J[1][1] = J[1][1];
+        cache->offset[0] = offset[0];
+        cache->offset[1] = offset[1];
+        cache->valid = 1;
+    }
+
+    return 0;
+}
+#endif
@@ -45,18 +45,19 @@
 #  define SQRT sqrtf
 #  define COS cosf
 #  define SIN sinf
+#  define LOG logf
 #  define ONE 1.0f
 #else
 #  define SQRT sqrt
 #  define COS cos
 #  define SIN sin
+#  define LOG log
 #  define ONE 1.0
 #endif
 
 
 static int icpGetJ_U_Xc( ARdouble J_U_Xc[2][3], ARdouble matXc2U[3][4], ICP3DCoordT *cameraCoord );
 static int icpGetJ_Xc_S( ARdouble J_Xc_S[3][6], ICP3DCoordT *cameraCoord, ARdouble T0[3][4], ICP3DCoordT *worldCoord );
-static int icpGetJ_T_S( ARdouble J_T_S[12][6] );
 static int icpGetQ_from_S( ARdouble q[7], ARdouble s[6] );
 static int icpGetMat_from_Q( ARdouble mat[3][4], ARdouble q[7] );
 
@@ -126,77 +127,156 @@ int icpGetJ_U_S( ARdouble J_U_S[2][6], ARdouble matXc2U[3][4], ARdouble matXw2Xc
     return 0;
 }
 
-int icpGetDeltaS( ARdouble S[6], ARdouble dU[], ARdouble J_U_S[][6], int n )
+void icpNormalEquationsInit( ARdouble JtJ[6][6], ARdouble JtU[6] )
 {
-    ARMat   matS, matU, matJ;
-    ARMat  *matJt, *matJtJ, *matJtU;
+    int     i, j;
 
-    matS.row = 6;
-    matS.clm = 1;
-    matS.m   = S;
+    for( j = 0; j < 6; j++ ) {
+        for( i = 0; i < 6; i++ ) JtJ[j][i] = 0.0;
+        JtU[j] = 0.0;
+    }
+}
 
-    matU.row = n;
-    matU.clm = 1;
-    matU.m   = dU;
+void icpNormalEquationsAdd( ARdouble JtJ[6][6], ARdouble JtU[6], ARdouble J_U_S[2][6], ARdouble dU[2], ARdouble w )
+{
+    ARdouble  wJx, wJy;
+    int       i, j;
+
+    // Only the upper triangle of JtJ is accumulated; icpNormalEquationsSolve() completes it.
+    for( j = 0; j < 6; j++ ) {
+        wJx = w * J_U_S[0][j];
+        wJy = w * J_U_S[1][j];
+        for( i = j; i < 6; i++ ) {
+            JtJ[j][i] += wJx * J_U_S[0][i] + wJy * J_U_S[1][i];
+        }
+        JtU[j] += wJx * dU[0] + wJy * dU[1];
+    }
+}
 
-    matJ.row = n;
-    matJ.clm = 6;
-    matJ.m   = &J_U_S[0][0];
+int icpNormalEquationsSolve( ARdouble S[6], ARdouble JtJ[6][6], ARdouble JtU[6] )
+{
+    ARdouble  L[6][6];
+    ARdouble  y[6];
+    ARdouble  sum;
+    int       i, j, k;
 
 #if ICP_DEBUG
-    ARLOG("cc1 - matU\n");
-    arMatrixDisp( &matU );
-    ARLOG("cc1 - matJ\n");
-    arMatrixDisp( &matJ );
-#endif
-    matJt = arMatrixAllocTrans( &matJ );
-    if( matJt == NULL ) return -1;
-#if ICP_DEBUG
-    ARLOG("cc1 - matJt\n");
-    arMatrixDisp( matJt );
+    icpDispMat( "JtJ", (ARdouble *)JtJ, 6, 6 );
+    icpDispMat( "JtU", (ARdouble *)JtU, 6, 1 );
 #endif
-    matJtJ = arMatrixAllocMul( matJt, &matJ );
-    if( matJtJ == NULL ) {
-        arMatrixFree( matJt );
-        return -1;
+    // Cholesky decomposition JtJ = L.Lt, reading only the upper triangle of JtJ.
+    for( j = 0; j < 6; j++ ) {
+        for( i = j; i < 6; i++ ) {
+            sum = JtJ[j][i];
+            for( k = 0; k < j; k++ ) sum -= L[i][k] * L[j][k];
+            if( i == j ) {
+                if( sum <= 0.0 ) return -1;
+                L[j][j] = SQRT(sum);
+            }
+            else {
+                L[i][j] = sum / L[j][j];
+            }
+        }
     }
-#if ICP_DEBUG
-    ARLOG("cc2 - matJtJ\n");
-    arMatrixDisp( matJtJ );
-#endif
-    matJtU = arMatrixAllocMul( matJt, &matU );
-    if( matJtU == NULL ) {
-        arMatrixFree( matJt );
-        arMatrixFree( matJtJ );
-        return -1;
+
+    // Forward substitution L.y = JtU, then back substitution Lt.S = y.
+    for( i = 0; i < 6; i++ ) {
+        sum = JtU[i];
+        for( k = 0; k < i; k++ ) sum -= L[i][k] * y[k];
+        y[i] = sum / L[i][i];
     }
-#if ICP_DEBUG
-    ARLOG("cc3 -- matJtU\n");
-    arMatrixDisp( matJtU );
-#endif
-    if( arMatrixSelfInv(matJtJ) < 0 ) {
-        arMatrixFree( matJt );
-        arMatrixFree( matJtJ );
-        arMatrixFree( matJtU );
-        return -1;
+    for( i = 5; i >= 0; i-- ) {
+        sum = y[i];
+        for( k = i+1; k < 6; k++ ) sum -= L[k][i] * S[k];
+        S[i] = sum / L[i][i];
     }
-
-#if ICP_DEBUG
-    ARLOG("cc4 -- matJtJ_Inv\n");
-    arMatrixDisp( matJtJ );
-#endif
-    arMatrixMul( &matS, matJtJ, matJtU );
-    arMatrixFree( matJt );
-    arMatrixFree( matJtJ );
-    arMatrixFree( matJtU );
 #if ICP_DEBUG
-    ARLOG("cc5 -- matS\n");
-    arMatrixDisp( &matS );
+    icpDispMat( "S", S, 6, 1 );
 #endif
 
     return 0;
 }
 
+int icpGetDeltaS( ARdouble S[6], ARdouble dU[], ARdouble J_U_S[][6], int n )
+{
+    ARdouble  JtJ[6][6];
+    ARdouble  JtU[6];
+    int       i, j, k;
+
+    icpNormalEquationsInit( JtJ, JtU );
+    for( k = 0; k < n; k++ ) {
+        for( j = 0; j < 6; j++ ) {
+            for( i = j; i < 6; i++ ) JtJ[j][i] += J_U_S[k][j] * J_U_S[k][i];
+            JtU[j] += J_U_S[k][j] * dU[k];
+        }
+    }
+
+    return icpNormalEquationsSolve( S, JtJ, JtU );
+}
+
+ARdouble icpSelectNth( ARdouble *E, int num, int n )
+{
+    ARdouble  pivot, t;
+    int       left, right, i, j;
+
+    // Hoare-partition quickselect. E is partially reordered so that E[n] holds the value
+    // it would have if E were sorted ascending.
+    left  = 0;
+    right = num - 1;
+    while( left < right ) {
+        pivot = E[(left + right) / 2];
+        i = left;
+        j = right;
+        do {
+            while( E[i] < pivot ) i++;
+            while( pivot < E[j] ) j--;
+            if( i <= j ) {
+                t = E[i]; E[i] = E[j]; E[j] = t;
+                i++;
+                j--;
+            }
+        } while( i <= j );
+        if( j < n ) left = i;
+        if( n < i ) right = j;
+    }
+
+    return E[n];
+}
+
+ARdouble icpRobustWeight( int robustMode, ARdouble e2, ARdouble K2 )
+{
+    ARdouble  W;
+
+    switch( robustMode ) {
+        case ICP_ROBUST_MODE_HUBER:
+            if( e2 <= K2 ) return ONE;
+            return SQRT(K2/e2);
+        case ICP_ROBUST_MODE_CAUCHY:
+            return ONE / (ONE + e2/K2);
+        case ICP_ROBUST_MODE_TUKEY:
+        default:
+            // Matches the original weighting, in which both J and dU were scaled by W.
+            if( e2 > K2 ) return 0.0;
+            W = (ONE - e2/K2)*(ONE - e2/K2);
+            return W*W;
+    }
+}
+
+ARdouble icpRobustError( int robustMode, ARdouble e2, ARdouble K2 )
+{
+    switch( robustMode ) {
+        case ICP_ROBUST_MODE_HUBER:
+            if( e2 <= K2 ) return e2 / 2.0;
+            return SQRT(K2*e2) - K2 / 2.0;
+        case ICP_ROBUST_MODE_CAUCHY:
+            return K2 / 2.0 * LOG(ONE + e2/K2);
+        case ICP_ROBUST_MODE_TUKEY:
+        default:
+            if( e2 > K2 ) return K2/6.0;
+            return K2/6.0 * (ONE - (ONE - e2/K2)*(ONE - e2/K2)*(ONE - e2/K2));
+    }
+}
+
 int icpUpdateMat( ARdouble matXw2Xc[3][4], ARdouble dS[6] )
 {
     ARdouble   q[7];
@@ -263,8 +343,7 @@ static int icpGetJ_U_Xc( ARdouble J_U_Xc[2][3], ARdouble matXc2U[3][4], ICP3DCoo
 static int icpGetJ_Xc_S( ARdouble J_Xc_S[3][6], ICP3DCoordT *cameraCoord, ARdouble T0[3][4], ICP3DCoordT *worldCoord )
 {
     ARdouble   J_Xc_T[3][12];
-    ARdouble   J_T_S[12][6];
-    int      i, j, k;
+    int      j;
 
     cameraCoord->x = T0[0][0]*worldCoord->x + T0[0][1]*worldCoord->y + T0[0][2]*worldCoord->z + T0[0][3];
     cameraCoord->y = T0[1][0]*worldCoord->x + T0[1][1]*worldCoord->y + T0[1][2]*worldCoord->z + T0[1][3];
@@ -309,109 +388,20 @@ static int icpGetJ_Xc_S( ARdouble J_Xc_S[3][6], ICP3DCoordT *cameraCoord, ARdoub
     J_Xc_T[2][10] = T0[2][1];
     J_Xc_T[2][11] = T0[2][2];
 
-    if( icpGetJ_T_S( J_T_S ) < 0 ) return -1;
-
+    // J_Xc_S = J_Xc_T . J_T_S. J_T_S is a constant matrix with only nine non-zero (+/-1) entries,
+    // so the product reduces to the following additions.
     for( j = 0; j < 3; j++ ) {
-        for( i = 0; i < 6; i++ ) {
-            J_Xc_S[j][i] = 0.0;
-            for( k = 0; k < 12; k++ ) {
-                J_Xc_S[j][i] += J_Xc_T[j][k] * J_T_S[k][i];
-            }
-        }
+        J_Xc_S[j][0] = J_Xc_T[j][7] - J_Xc_T[j][5];
+        J_Xc_S[j][1] = J_Xc_T[j][2] - J_Xc_T[j][6];
+        J_Xc_S[j][2] = J_Xc_T[j][3] - J_Xc_T[j][1];
+        J_Xc_S[j][3] = J_Xc_T[j][9];
+        J_Xc_S[j][4] = J_Xc_T[j][10];
+        J_Xc_S[j][5] = J_Xc_T[j][11];
     }
 
     return 0;
 }
 
-static int icpGetJ_T_S( ARdouble J_T_S[12][6] )
-{
-    J_T_S[0][0] = 0.0;
-    J_T_S[0][1] = 0.0;
-    J_T_S[0][2] = 0.0;
-    J_T_S[0][3] = 0.0;
-    J_T_S[0][4] = 0.0;
-    J_T_S[0][5] = 0.0;
-
-    J_T_S[1][0] = 0.0;
-    J_T_S[1][1] = 0.0;
-    J_T_S[1][2] = -1.0;
-    J_T_S[1][3] = 0.0;
-    J_T_S[1][4] = 0.0;
-    J_T_S[1][5] = 0.0;
-
-    J_T_S[2][0] = 0.0;
-    J_T_S[2][1] = 1.0;
-    J_T_S[2][2] = 0.0;
-    J_T_S[2][3] = 0.0;
-    J_T_S[2][4] = 0.0;
-    J_T_S[2][5] = 0.0;
-
-    J_T_S[3][0] = 0.0;
-    J_T_S[3][1] = 0.0;
-    J_T_S[3][2] = 1.0;
-    J_T_S[3][3] = 0.0;
-    J_T_S[3][4] = 0.0;
-    J_T_S[3][5] = 0.0;
-
-    J_T_S[4][0] = 0.0;
-    J_T_S[4][1] = 0.0;
-    J_T_S[4][2] = 0.0;
-    J_T_S[4][3] = 0.0;
-    J_T_S[4][4] = 0.0;
-    J_T_S[4][5] = 0.0;
-
-    J_T_S[5][0] = -1.0;
-    J_T_S[5][1] = 0.0;
-    J_T_S[5][2] = 0.0;
-    J_T_S[5][3] = 0.0;
-    J_T_S[5][4] = 0.0;
-    J_T_S[5][5] = 0.0;
-
-    J_T_S[6][0] = 0.0;
-    J_T_S[6][1] = -1.0;
-    J_T_S[6][2] = 0.0;
-    J_T_S[6][3] = 0.0;
-    J_T_S[6][4] = 0.0;
-    J_T_S[6][5] = 0.0;
-
-    J_T_S[7][0] = 1.0;
-    J_T_S[7][1] = 0.0;
-    J_T_S[7][2] = 0.0;
-    J_T_S[7][3] = 0.0;
-    J_T_S[7][4] = 0.0;
-    J_T_S[7][5] = 0.0;
-
-    J_T_S[8][0] = 0.0;
-    J_T_S[8][1] = 0.0;
-    J_T_S[8][2] = 0.0;
-    J_T_S[8][3] = 0.0;
-    J_T_S[8][4] = 0.0;
-    J_T_S[8][5] = 0.0;
-
-    J_T_S[9][0] = 0.0;
-    J_T_S[9][1] = 0.0;
-    J_T_S[9][2] = 0.0;
-    J_T_S[9][3] = 1.0;
-    J_T_S[9][4] = 0.0;
-    J_T_S[9][5] = 0.0;
-
-    J_T_S[10][0] = 0.0;
-    J_T_S[10][1] = 0.0;
-    J_T_S[10][2] = 0.0;
-    J_T_S[10][3] = 0.0;
-    J_T_S[10][4] = 1.0;
-    J_T_S[10][5] = 0.0;
-
-    J_T_S[11][0] = 0.0;
-    J_T_S[11][1] = 0.0;
-    J_T_S[11][2] = 0.0;
-    J_T_S[11][3] = 0.0;
-    J_T_S[11][4] = 0.0;
-    J_T_S[11][5] = 1.0;
-
-    return 0;
-}
-
 static int icpGetQ_from_S( ARdouble q[7], ARdouble s[6] )
 {
     ARdouble    ra;
@@ -60,6 +60,8 @@ ICPHandleT  *icpCreateHandle( ARdouble matXc2U[3][4] )
     handle->breakLoopErrorRatioThresh = ICP_BREAK_LOOP_ERROR_RATIO_THRESH;
     handle->breakLoopErrorThresh2     = ICP_BREAK_LOOP_ERROR_THRESH2;
     handle->inlierProb                = ICP_INLIER_PROBABILITY;
+    handle->robustMode                = ICP_ROBUST_MODE_DEFAULT;
+    handle->breakLoopDeltaThresh      = ICP_BREAK_LOOP_DELTA_THRESH;
 
     return handle;
 }
@@ -179,3 +181,36 @@ int icpGetInlierProbability( ICPHandleT *handle, ARdouble *inlierProb )
     *inlierProb = handle->inlierProb;
     return 0;
 }
+
+int icpSetRobustMode( ICPHandleT *handle, int robustMode )
+{
+    if( handle == NULL ) return -1;
+    if( robustMode != ICP_ROBUST_MODE_TUKEY && robustMode != ICP_ROBUST_MODE_HUBER && robustMode != ICP_ROBUST_MODE_CAUCHY ) return -1;
+
+    handle->robustMode = robustMode;
+    return 0;
+}
+
+int icpGetRobustMode( ICPHandleT *handle, int *robustMode )
+{
+    if( handle == NULL ) return -1;
+
+    *robustMode = handle->robustMode;
+    return 0;
+}
+
+int icpSetBreakLoopDeltaThresh( ICPHandleT *handle, ARdouble breakLoopDeltaThresh )
+{
+    if( handle == NULL ) return -1;
+
+    handle->breakLoopDeltaThresh = breakLoopDeltaThresh;
+    return 0;
+}
+
+int icpGetBreakLoopDeltaThresh( ICPHandleT *handle, ARdouble *breakLoopDeltaThresh )
+{
+    if( handle == NULL ) return -1;
+
+    *breakLoopDeltaThresh = handle->breakLoopDeltaThresh;
+    return 0;
+}
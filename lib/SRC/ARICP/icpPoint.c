@@ -43,8 +43,6 @@
 #include <AR/icp.h>
 
 
-static void   icpGetXw2XcCleanup( char *message, ARdouble *J_U_S, ARdouble *dU );
-
 int icpPoint( ICPHandleT   *handle,
               ICPDataT     *data,
               ARdouble        initMatXw2Xc[3][4],
@@ -52,8 +50,9 @@ int icpPoint( ICPHandleT   *handle,
               ARdouble       *err )
 {
     ICP2DCoordT   U;
-    ARdouble        *J_U_S;
-    ARdouble        *dU, dx, dy;
+    ARdouble         J_U_S[2][6];
+    ARdouble         dU[2], dx, dy;
+    ARdouble         JtJ[6][6], JtU[6];
     ARdouble         matXw2U[3][4];
     ARdouble         dS[6];
     ARdouble         err0, err1;
@@ -61,15 +60,6 @@ int icpPoint( ICPHandleT   *handle,
 
     if( data->num < 3 ) return -1;
 
-    if( (J_U_S = (ARdouble *)malloc( sizeof(ARdouble)*12*(data->num) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        return -1;
-    }
-    if( (dU = (ARdouble *)malloc( sizeof(ARdouble)*2*(data->num) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_S);
-        return -1;
-    }
     for( j = 0; j < 3; j++ ) {
         for( i = 0; i < 4; i++ ) matXw2Xc[j][i] = initMatXw2Xc[j][i];
     }
@@ -83,14 +73,12 @@ int icpPoint( ICPHandleT   *handle,
         err1 = 0.0;
         for( j = 0; j < data->num; j++ ) {
             if( icpGetU_from_X_by_MatX2U( &U, matXw2U, &(data->worldCoord[j]) ) < 0 ) {
-                icpGetXw2XcCleanup("icpGetU_from_X_by_MatX2U", J_U_S, dU);
+                ARLOGd("Error: icpGetU_from_X_by_MatX2U\n");
                 return -1;
             }
             dx = data->screenCoord[j].x - U.x;
             dy = data->screenCoord[j].y - U.y;
             err1 += dx*dx + dy*dy;
-            dU[j*2+0] = dx;
-            dU[j*2+1] = dy;
         }
         err1 /= data->num;
 #if ICP_DEBUG
@@ -101,17 +89,26 @@ int icpPoint( ICPHandleT   *handle,
         if( i == handle->maxLoop ) break;
         err0 = err1;
 
+        // Accumulate the normal equations directly rather than building the full Jacobian.
+        icpNormalEquationsInit( JtJ, JtU );
         for( j = 0; j < data->num; j++ ) {
-            if( icpGetJ_U_S( (ARdouble (*)[6])(&J_U_S[12*j]), handle->matXc2U, matXw2Xc, &(data->worldCoord[j]) ) < 0 ) {
-                icpGetXw2XcCleanup("icpGetJ_U_S", J_U_S, dU);
+            if( icpGetU_from_X_by_MatX2U( &U, matXw2U, &(data->worldCoord[j]) ) < 0 ) {
+                ARLOGd("Error: icpGetU_from_X_by_MatX2U\n");
+                return -1;
+            }
+            dU[0] = data->screenCoord[j].x - U.x;
+            dU[1] = data->screenCoord[j].y - U.y;
+            if( icpGetJ_U_S( J_U_S, handle->matXc2U, matXw2Xc, &(data->worldCoord[j]) ) < 0 ) {
+                ARLOGd("Error: icpGetJ_U_S\n");
                 return -1;
             }
 #if ICP_DEBUG
-            icpDispMat( "J_U_S", (ARdouble *)(&J_U_S[j*12]), 2, 6 );
+            icpDispMat( "J_U_S", (ARdouble *)J_U_S, 2, 6 );
 #endif
+            icpNormalEquationsAdd( JtJ, JtU, J_U_S, dU, 1.0 );
         }
-        if( icpGetDeltaS( dS, dU, (ARdouble (*)[6])J_U_S, (data->num)*2 ) < 0 ) {
-            icpGetXw2XcCleanup("icpGetDeltaS", J_U_S, dU);
+        if( icpNormalEquationsSolve( dS, JtJ, JtU ) < 0 ) {
+            ARLOGd("Error: icpNormalEquationsSolve\n");
             return -1;
         }
 
@@ -124,15 +121,6 @@ int icpPoint( ICPHandleT   *handle,
 #endif
 
     *err = err1;
-    free(J_U_S);
-    free(dU);
 
     return 0;
 }
-
-static void icpGetXw2XcCleanup( char *message, ARdouble *J_U_S, ARdouble *dU )
-{
-    ARLOGd("Error: %s\n", message);
-    free(J_U_S);
-    free(dU);
-}
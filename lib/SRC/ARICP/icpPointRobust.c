@@ -47,23 +47,48 @@
 #define     K2_FACTOR     4.0f
 #endif
 
-static void   icpGetXw2XcRobustCleanup( char *message, ARdouble *J_U_S, ARdouble *dU, ARdouble *E, ARdouble *E2 );
-static int    compE(const void *a, const void *b );
-
 int icpPointRobust( ICPHandleT   *handle,
                     ICPDataT     *data,
                     ARdouble        initMatXw2Xc[3][4],
                     ARdouble        matXw2Xc[3][4],
                     ARdouble       *err )
+{
+    ARdouble      work[ICP_ROBUST_WORK_SIZE(ICP_ROBUST_STACK_POINT_NUM)];
+    ARdouble     *heapWork;
+    int           ret;
+
+    // The workspace is on the stack for typical numbers of correspondences, so that calls do not allocate,
+    // and nothing is kept in the handle, which may be shared between threads.
+    if( data->num <= ICP_ROBUST_STACK_POINT_NUM ) {
+        return icpPointRobustWork( handle, data, initMatXw2Xc, matXw2Xc, err, work );
+    }
+    if( (heapWork = (ARdouble *)malloc( sizeof(ARdouble)*ICP_ROBUST_WORK_SIZE(data->num) )) == NULL ) {
+        ARLOGe("Error: malloc\n");
+        return -1;
+    }
+    ret = icpPointRobustWork( handle, data, initMatXw2Xc, matXw2Xc, err, heapWork );
+    free( heapWork );
+
+    return ret;
+}
+
+int icpPointRobustWork( ICPHandleT   *handle,
+                        ICPDataT     *data,
+                        ARdouble        initMatXw2Xc[3][4],
+                        ARdouble        matXw2Xc[3][4],
+                        ARdouble       *err,
+                        ARdouble       *work )
 {
     ICP2DCoordT   U;
-    ARdouble       *J_U_S;
-    ARdouble       *dU, dx, dy;
+    ARdouble        J_U_S[2][6];
+    ARdouble        dU[2], dx, dy;
+    ARdouble        JtJ[6][6], JtU[6];
     ARdouble       *E, *E2, K2, W;
     ARdouble        matXw2U[3][4];
     ARdouble        dS[6];
     ARdouble        err0, err1;
     int           inlierNum;
+    int           converged;
     int           i, j, k;
 
     if( data->num < 4 ) return -1;
@@ -71,31 +96,12 @@ int icpPointRobust( ICPHandleT   *handle,
     inlierNum = (int)(data->num * handle->inlierProb) - 1;
     if( inlierNum < 3 ) inlierNum = 3;
 
-    if( (J_U_S = (ARdouble *)malloc( sizeof(ARdouble)*12*(data->num) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        return -1;
-    }
-    if( (dU = (ARdouble *)malloc( sizeof(ARdouble)*2*(data->num) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_S);
-        return -1;
-    }
-    if( (E = (ARdouble *)malloc( sizeof(ARdouble)*(data->num) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_S);
-        free(dU);
-        return -1;
-    }
-    if( (E2 = (ARdouble *)malloc( sizeof(ARdouble)*(data->num) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_S);
-        free(dU);
-        free(E);
-        return -1;
-    }
+    E = work;
+    E2 = E + data->num;
     for( j = 0; j < 3; j++ ) {
         for( i = 0; i < 4; i++ ) matXw2Xc[j][i] = initMatXw2Xc[j][i];
     }
+    converged = 0;
 
 
     for( i = 0;; i++ ) {
@@ -106,23 +112,20 @@ int icpPointRobust( ICPHandleT   *handle,
 
         for( j = 0; j < data->num; j++ ) {
             if( icpGetU_from_X_by_MatX2U( &U, matXw2U, &(data->worldCoord[j]) ) < 0 ) {
-                icpGetXw2XcRobustCleanup("icpGetU_from_X_by_MatX2U",J_U_S,dU,E,E2);
+                ARLOGd("Error: icpGetU_from_X_by_MatX2U\n");
                 return -1;
             }
             dx = data->screenCoord[j].x - U.x;
             dy = data->screenCoord[j].y - U.y;
-            dU[j*2+0] = dx;
-            dU[j*2+1] = dy;
             E[j] = E2[j] = dx*dx + dy*dy;
         }
-        qsort(E2, data->num, sizeof(ARdouble), compE);
-        K2 = E2[inlierNum] * K2_FACTOR;
+        // Only the inlierNum'th smallest residual is needed, so select rather than sort.
+        K2 = icpSelectNth(E2, data->num, inlierNum) * K2_FACTOR;
         if( K2 < 16.0 ) K2 = 16.0;
 
         err1 = 0.0;
         for( j = 0; j < data->num; j++ ) {
-            if( E2[j] > K2 ) err1 += K2/6.0;
-            else err1 += K2/6.0 * (1.0 - (1.0-E2[j]/K2)*(1.0-E2[j]/K2)*(1.0-E2[j]/K2));
+            err1 += icpRobustError(handle->robustMode, E[j], K2);
         }
         err1 /= data->num;
 #if ICP_DEBUG
@@ -133,48 +136,47 @@ int icpPointRobust( ICPHandleT   *handle,
         if( err1 < handle->breakLoopErrorThresh ) break;
         if( i > 0 && err1 < handle->breakLoopErrorThresh2 && err1/err0 > handle->breakLoopErrorRatioThresh ) break;
         if( i == handle->maxLoop ) break;
+        if( converged ) break;
         err0 = err1;
 
+        icpNormalEquationsInit( JtJ, JtU );
         k = 0;
         for( j = 0; j < data->num; j++ ) {
-            if( E[j] <= K2 ) {
-                if( icpGetJ_U_S( (ARdouble (*)[6])(&J_U_S[6*k]), handle->matXc2U, matXw2Xc, &(data->worldCoord[j]) ) < 0 ) {
-                    icpGetXw2XcRobustCleanup("icpGetJ_U_S", J_U_S, dU, E, E2);
+            W = icpRobustWeight(handle->robustMode, E[j], K2);
+            if( W > 0.0 ) {
+                if( icpGetU_from_X_by_MatX2U( &U, matXw2U, &(data->worldCoord[j]) ) < 0 ) {
+                    ARLOGd("Error: icpGetU_from_X_by_MatX2U\n");
+                    return -1;
+                }
+                dU[0] = data->screenCoord[j].x - U.x;
+                dU[1] = data->screenCoord[j].y - U.y;
+                if( icpGetJ_U_S( J_U_S, handle->matXc2U, matXw2Xc, &(data->worldCoord[j]) ) < 0 ) {
+                    ARLOGd("Error: icpGetJ_U_S\n");
                     return -1;
                 }
 #if ICP_DEBUG
-                icpDispMat( "J_U_S", (ARdouble *)(&J_U_S[6*k]), 2, 6 );
+                icpDispMat( "J_U_S", (ARdouble *)J_U_S, 2, 6 );
 #endif
-                W = (1.0 - E[j]/K2)*(1.0 - E[j]/K2);
-                J_U_S[k*6+0] *= W;
-                J_U_S[k*6+1] *= W;
-                J_U_S[k*6+2] *= W;
-                J_U_S[k*6+3] *= W;
-                J_U_S[k*6+4] *= W;
-                J_U_S[k*6+5] *= W;
-                J_U_S[k*6+6] *= W;
-                J_U_S[k*6+7] *= W;
-                J_U_S[k*6+8] *= W;
-                J_U_S[k*6+9] *= W;
-                J_U_S[k*6+10] *= W;
-                J_U_S[k*6+11] *= W;
-                dU[k+0] = dU[j*2+0] * W;
-                dU[k+1] = dU[j*2+1] * W;
+                icpNormalEquationsAdd( JtJ, JtU, J_U_S, dU, W );
                 k+=2;
             }
         }
 
         if( k < 6 ) {
-            icpGetXw2XcRobustCleanup("icpPointRobust: k < 6",J_U_S,dU,E,E2);
+            ARLOGd("Error: icpPointRobust: k < 6\n");
             return -1;
         }
 
-        if( icpGetDeltaS( dS, dU, (ARdouble (*)[6])J_U_S, k ) < 0 ) {
-            icpGetXw2XcRobustCleanup("icpGetDeltaS",J_U_S,dU,E,E2);
+        if( icpNormalEquationsSolve( dS, JtJ, JtU ) < 0 ) {
+            ARLOGd("Error: icpNormalEquationsSolve\n");
             return -1;
         }
 
         icpUpdateMat( matXw2Xc, dS );
+
+        // Stop after re-evaluating the error once the update has become negligible.
+        if( dS[0]*dS[0] + dS[1]*dS[1] + dS[2]*dS[2] + dS[3]*dS[3] + dS[4]*dS[4] + dS[5]*dS[5]
+            < handle->breakLoopDeltaThresh*handle->breakLoopDeltaThresh ) converged = 1;
     }
 
 #if ICP_DEBUG
@@ -183,28 +185,6 @@ int icpPointRobust( ICPHandleT   *handle,
 #endif
 
     *err = err1;
-    free(J_U_S);
-    free(dU);
-    free(E);
-    free(E2);
 
     return 0;
 }
-
-static void icpGetXw2XcRobustCleanup( char *message, ARdouble *J_U_S, ARdouble *dU, ARdouble *E, ARdouble *E2 )
-{
-    ARLOGd("Error: %s\n", message);
-    free(J_U_S);
-    free(dU);
-    free(E);
-    free(E2);
-}
-
-static int compE( const void *a, const void *b )
-{
-    ARdouble  c;
-    c = *(ARdouble *)a - *(ARdouble *)b;
-    if( c < 0.0 ) return -1;
-    if( c > 0.0 ) return  1;
-    return 0;
-}
@@ -81,6 +81,8 @@ ICPStereoHandleT *icpStereoCreateHandle( ARdouble matXcl2Ul[3][4], ARdouble matX
     handle->breakLoopErrorRatioThresh = ICP_BREAK_LOOP_ERROR_RATIO_THRESH;
     handle->breakLoopErrorThresh2     = ICP_BREAK_LOOP_ERROR_THRESH2;
     handle->inlierProb                = ICP_INLIER_PROBABILITY;
+    handle->robustMode                = ICP_ROBUST_MODE_DEFAULT;
+    handle->breakLoopDeltaThresh      = ICP_BREAK_LOOP_DELTA_THRESH;
 
     return handle;
 }
@@ -247,3 +249,36 @@ int icpStereoSetInlierProbability( ICPStereoHandleT *handle, ARdouble inlierProb
     handle->inlierProb = inlierProb;
     return 0;
 }
+
+int icpStereoSetRobustMode( ICPStereoHandleT *handle, int robustMode )
+{
+    if( handle == NULL ) return -1;
+    if( robustMode != ICP_ROBUST_MODE_TUKEY && robustMode != ICP_ROBUST_MODE_HUBER && robustMode != ICP_ROBUST_MODE_CAUCHY ) return -1;
+
+    handle->robustMode = robustMode;
+    return 0;
+}
+
+int icpStereoGetRobustMode( ICPStereoHandleT *handle, int *robustMode )
+{
+    if( handle == NULL ) return -1;
+
+    *robustMode = handle->robustMode;
+    return 0;
+}
+
+int icpStereoSetBreakLoopDeltaThresh( ICPStereoHandleT *handle, ARdouble breakLoopDeltaThresh )
+{
+    if( handle == NULL ) return -1;
+
+    handle->breakLoopDeltaThresh = breakLoopDeltaThresh;
+    return 0;
+}
+
+int icpStereoGetBreakLoopDeltaThresh( ICPStereoHandleT *handle, ARdouble *breakLoopDeltaThresh )
+{
+    if( handle == NULL ) return -1;
+
+    *breakLoopDeltaThresh = handle->breakLoopDeltaThresh;
+    return 0;
+}
@@ -42,8 +42,6 @@
 #include <AR/icp.h>
 
 
-static void   icpStereoGetXw2XcCleanup( char *message, ARdouble *J_U_S, ARdouble *dU );
-
 int icpStereoPoint( ICPStereoHandleT   *handle,
                     ICPStereoDataT     *data,
                     ARdouble              initMatXw2Xc[3][4],
@@ -51,8 +49,9 @@ int icpStereoPoint( ICPStereoHandleT   *handle,
                     ARdouble             *err )
 {
     ICP2DCoordT   U;
-    ARdouble       *J_U_S;
-    ARdouble       *dU, dx, dy;
+    ARdouble        J_U_S[2][6];
+    ARdouble        dU[2], dx, dy;
+    ARdouble        JtJ[6][6], JtU[6];
     ARdouble        matXw2Ul[3][4];
     ARdouble        matXw2Ur[3][4];
     ARdouble        matXc2Ul[3][4];
@@ -63,15 +62,6 @@ int icpStereoPoint( ICPStereoHandleT   *handle,
 
     if( data->numL + data->numR < 3 ) return -1;
 
-    if( (J_U_S = (ARdouble *)malloc( sizeof(ARdouble)*12*(data->numL + data->numR) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        return -1;
-    }
-    if( (dU = (ARdouble *)malloc( sizeof(ARdouble)*2*(data->numL + data->numR) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_S);
-        return -1;
-    }
     for( j = 0; j < 3; j++ ) {
         for( i = 0; i < 4; i++ ) matXw2Xc[j][i] = initMatXw2Xc[j][i];
     }
@@ -89,25 +79,21 @@ int icpStereoPoint( ICPStereoHandleT   *handle,
         err1 = 0.0;
         for( j = 0; j < data->numL; j++ ) {
             if( icpGetU_from_X_by_MatX2U( &U, matXw2Ul, &(data->worldCoordL[j]) ) < 0 ) {
-                icpStereoGetXw2XcCleanup("icpGetU_from_X_by_MatX2U",J_U_S,dU);
+                ARLOGd("Error: icpGetU_from_X_by_MatX2U\n");
                 return -1;
             }
             dx = data->screenCoordL[j].x - U.x;
             dy = data->screenCoordL[j].y - U.y;
             err1 += dx*dx + dy*dy; 
-            dU[j*2+0] = dx;
-            dU[j*2+1] = dy;
         }   
         for( j = 0; j < data->numR; j++ ) {
             if( icpGetU_from_X_by_MatX2U( &U, matXw2Ur, &(data->worldCoordR[j]) ) < 0 ) {
-                icpStereoGetXw2XcCleanup("icpGetU_from_X_by_MatX2U",J_U_S,dU);
+                ARLOGd("Error: icpGetU_from_X_by_MatX2U\n");
                 return -1;
             }
             dx = data->screenCoordR[j].x - U.x;
             dy = data->screenCoordR[j].y - U.y;
             err1 += dx*dx + dy*dy; 
-            dU[(data->numL+j)*2+0] = dx;
-            dU[(data->numL+j)*2+1] = dy;
         }   
         err1 /= (data->numL + data->numR);
 
@@ -116,26 +102,35 @@ int icpStereoPoint( ICPStereoHandleT   *handle,
         if( i == handle->maxLoop ) break;
         err0 = err1;
 
+        icpNormalEquationsInit( JtJ, JtU );
         for( j = 0; j < data->numL; j++ ) {
-            if( icpGetJ_U_S( (ARdouble (*)[6])(&J_U_S[12*j]), matXc2Ul, matXw2Xc, &(data->worldCoordL[j]) ) < 0 ) {
-                icpStereoGetXw2XcCleanup("icpGetJ_U_S",J_U_S,dU);
+            icpGetU_from_X_by_MatX2U( &U, matXw2Ul, &(data->worldCoordL[j]) );
+            dU[0] = data->screenCoordL[j].x - U.x;
+            dU[1] = data->screenCoordL[j].y - U.y;
+            if( icpGetJ_U_S( J_U_S, matXc2Ul, matXw2Xc, &(data->worldCoordL[j]) ) < 0 ) {
+                ARLOGd("Error: icpGetJ_U_S\n");
                 return -1; 
             }
 #if ICP_DEBUG   
-            icpDispMat( "J_U_S", (ARdouble *)(&J_U_S[j*12]), 2, 6 );
+            icpDispMat( "J_U_S", (ARdouble *)J_U_S, 2, 6 );
 #endif      
+            icpNormalEquationsAdd( JtJ, JtU, J_U_S, dU, 1.0 );
         }   
         for( j = 0; j < data->numR; j++ ) {
-            if( icpGetJ_U_S( (ARdouble (*)[6])(&J_U_S[12*(j+data->numL)]), matXc2Ur, matXw2Xc, &(data->worldCoordR[j]) ) < 0 ) {
-                icpStereoGetXw2XcCleanup("icpGetJ_U_S",J_U_S,dU);
+            icpGetU_from_X_by_MatX2U( &U, matXw2Ur, &(data->worldCoordR[j]) );
+            dU[0] = data->screenCoordR[j].x - U.x;
+            dU[1] = data->screenCoordR[j].y - U.y;
+            if( icpGetJ_U_S( J_U_S, matXc2Ur, matXw2Xc, &(data->worldCoordR[j]) ) < 0 ) {
+                ARLOGd("Error: icpGetJ_U_S\n");
                 return -1; 
             }
 #if ICP_DEBUG   
-            icpDispMat( "J_U_S", (ARdouble *)(&J_U_S[12*(j+data->numL)]), 2, 6 );
+            icpDispMat( "J_U_S", (ARdouble *)J_U_S, 2, 6 );
 #endif      
+            icpNormalEquationsAdd( JtJ, JtU, J_U_S, dU, 1.0 );
         }   
-        if( icpGetDeltaS( dS, dU, (ARdouble (*)[6])J_U_S, (data->numL + data->numR)*2 ) < 0 ) {
-            icpStereoGetXw2XcCleanup("icpGetS",J_U_S,dU);
+        if( icpNormalEquationsSolve( dS, JtJ, JtU ) < 0 ) {
+            ARLOGd("Error: icpGetS\n");
             return -1;
         }
 
@@ -143,15 +138,6 @@ int icpStereoPoint( ICPStereoHandleT   *handle,
     }
 
     *err = err1;
-    free(J_U_S);
-    free(dU);
 
     return 0;
 }
-
-static void   icpStereoGetXw2XcCleanup( char *message, ARdouble *J_U_S, ARdouble *dU )
-{
-    ARLOGd("Error: %s\n", message);
-    free(J_U_S);
-    free(dU);
-}
@@ -43,18 +43,42 @@
 
 #define     K2_FACTOR     4.0
 
-static void   icpStereoGetXw2XcRobustCleanup( char *message, ARdouble *J_U_S, ARdouble *dU, ARdouble *E, ARdouble *E2 );
-static int    compERobust( const void *a, const void *b );
-
 int icpStereoPointRobust( ICPStereoHandleT *handle,
                           ICPStereoDataT   *data,
                           ARdouble         initMatXw2Xc[3][4],
                           ARdouble         matXw2Xc[3][4],
                           ARdouble         *err )
+{
+    ARdouble      work[ICP_ROBUST_WORK_SIZE(ICP_ROBUST_STACK_POINT_NUM)];
+    ARdouble     *heapWork;
+    int           ret;
+
+    // The workspace is on the stack for typical numbers of correspondences, so that calls do not allocate,
+    // and nothing is kept in the handle, which may be shared between threads.
+    if( data->numL + data->numR <= ICP_ROBUST_STACK_POINT_NUM ) {
+        return icpStereoPointRobustWork( handle, data, initMatXw2Xc, matXw2Xc, err, work );
+    }
+    if( (heapWork = (ARdouble *)malloc( sizeof(ARdouble)*ICP_ROBUST_WORK_SIZE(data->numL + data->numR) )) == NULL ) {
+        ARLOGe("Error: malloc\n");
+        return -1;
+    }
+    ret = icpStereoPointRobustWork( handle, data, initMatXw2Xc, matXw2Xc, err, heapWork );
+    free( heapWork );
+
+    return ret;
+}
+
+int icpStereoPointRobustWork( ICPStereoHandleT *handle,
+                              ICPStereoDataT   *data,
+                              ARdouble         initMatXw2Xc[3][4],
+                              ARdouble         matXw2Xc[3][4],
+                              ARdouble         *err,
+                              ARdouble         *work )
 {
     ICP2DCoordT U;
-    ARdouble    *J_U_S;
-    ARdouble    *dU, dx, dy;
+    ARdouble    J_U_S[2][6];
+    ARdouble    dU[2], dx, dy;
+    ARdouble    JtJ[6][6], JtU[6];
     ARdouble    *E, *E2, K2, W;
     ARdouble    matXw2Ul[3][4];
     ARdouble    matXw2Ur[3][4];
@@ -63,6 +87,7 @@ int icpStereoPointRobust( ICPStereoHandleT *handle,
     ARdouble    dS[6];
     ARdouble    err0, err1;
     int         inlierNum;
+    int         converged;
     int         i, j, k;
 #if ICP_DEBUG
     int         l;
@@ -73,31 +98,12 @@ int icpStereoPointRobust( ICPStereoHandleT *handle,
     inlierNum = (int)((data->numL + data->numR) * handle->inlierProb) - 1;
     if( inlierNum < 3 ) inlierNum = 3;
 
-    if( (J_U_S = (ARdouble *)malloc( sizeof(ARdouble)*12*(data->numL + data->numR) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        return -1;
-    }
-    if( (dU = (ARdouble *)malloc( sizeof(ARdouble)*2*(data->numL + data->numR) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_S);
-        return -1;
-    }
-    if( (E = (ARdouble *)malloc( sizeof(ARdouble)*(data->numL + data->numR) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_S);
-        free(dU);
-        return -1;
-    }
-    if( (E2 = (ARdouble *)malloc( sizeof(ARdouble)*(data->numL + data->numR) )) == NULL ) {
-        ARLOGe("Error: malloc\n");
-        free(J_U_S);
-        free(dU);
-        free(E);
-        return -1;
-    }
+    E = work;
+    E2 = E + (data->numL + data->numR);
     for( j = 0; j < 3; j++ ) {
         for( i = 0; i < 4; i++ ) matXw2Xc[j][i] = initMatXw2Xc[j][i];
     }
+    converged = 0;
 
     arUtilMatMul( (const ARdouble (*)[4])handle->matXcl2Ul, (const ARdouble (*)[4])handle->matC2L, matXc2Ul );
     arUtilMatMul( (const ARdouble (*)[4])handle->matXcr2Ur, (const ARdouble (*)[4])handle->matC2R, matXc2Ur );
@@ -111,34 +117,29 @@ int icpStereoPointRobust( ICPStereoHandleT *handle,
 
         for( j = 0; j < data->numL; j++ ) {
             if( icpGetU_from_X_by_MatX2U( &U, matXw2Ul, &(data->worldCoordL[j]) ) < 0 ) {
-                icpStereoGetXw2XcRobustCleanup("icpGetU_from_X_by_MatX2U",J_U_S,dU,E,E2);
+                ARLOGd("Error: icpGetU_from_X_by_MatX2U\n");
                 return -1;
             }
             dx = data->screenCoordL[j].x - U.x;
             dy = data->screenCoordL[j].y - U.y;
-            dU[j*2+0] = dx;
-            dU[j*2+1] = dy;
             E[j] = E2[j] = dx*dx + dy*dy;
         }   
         for( j = 0; j < data->numR; j++ ) {
             if( icpGetU_from_X_by_MatX2U( &U, matXw2Ur, &(data->worldCoordR[j]) ) < 0 ) {
-                icpStereoGetXw2XcRobustCleanup("icpGetU_from_X_by_MatX2U",J_U_S,dU,E,E2);
+                ARLOGd("Error: icpGetU_from_X_by_MatX2U\n");
                 return -1;
             }
             dx = data->screenCoordR[j].x - U.x;
             dy = data->screenCoordR[j].y - U.y;
-            dU[(data->numL+j)*2+0] = dx;
-            dU[(data->numL+j)*2+1] = dy;
             E[data->numL+j] = E2[data->numL+j] = dx*dx + dy*dy;
         }
-        qsort(E2, (data->numL + data->numR), sizeof(ARdouble), compERobust);
-        K2 = E2[inlierNum] * K2_FACTOR;
+        // Only the inlierNum'th smallest residual is needed, so select rather than sort.
+        K2 = icpSelectNth(E2, (data->numL + data->numR), inlierNum) * K2_FACTOR;
         if( K2 < 16.0 ) K2 = 16.0;
 
         err1 = 0.0;
         for( j = 0; j < data->numL + data->numR; j++ ) {
-            if( E2[j] > K2 ) err1 += K2/6.0;
-            else err1 += K2/6.0 * (1.0 - (1.0-E2[j]/K2)*(1.0-E2[j]/K2)*(1.0-E2[j]/K2));
+            err1 += icpRobustError(handle->robustMode, E[j], K2);
         }
         err1 /= (data->numL + data->numR);
 #if ICP_DEBUG
@@ -148,36 +149,28 @@ int icpStereoPointRobust( ICPStereoHandleT *handle,
         if( err1 < handle->breakLoopErrorThresh ) break;
         if( i > 0 && err1 < ICP_BREAK_LOOP_ERROR_THRESH2 && err1/err0 > handle->breakLoopErrorRatioThresh ) break;
         if( i == handle->maxLoop ) break;
+        if( converged ) break;
         err0 = err1;
 
+        icpNormalEquationsInit( JtJ, JtU );
         k = 0;
 #if ICP_DEBUG
         l = 0;
 #endif                        
         for( j = 0; j < data->numL; j++ ) {
-            if( E[j] <= K2 ) {
-                if( icpGetJ_U_S( (ARdouble (*)[6])(&J_U_S[6*k]), matXc2Ul, matXw2Xc, &(data->worldCoordL[j]) ) < 0 ) {
-                    icpStereoGetXw2XcRobustCleanup("icpGetJ_U_S",J_U_S,dU,E,E2);
+            W = icpRobustWeight(handle->robustMode, E[j], K2);
+            if( W > 0.0 ) {
+                icpGetU_from_X_by_MatX2U( &U, matXw2Ul, &(data->worldCoordL[j]) );
+                dU[0] = data->screenCoordL[j].x - U.x;
+                dU[1] = data->screenCoordL[j].y - U.y;
+                if( icpGetJ_U_S( J_U_S, matXc2Ul, matXw2Xc, &(data->worldCoordL[j]) ) < 0 ) {
+                    ARLOGd("Error: icpGetJ_U_S\n");
                     return -1; 
                 }
 #if ICP_DEBUG
-                icpDispMat( "J_U_S", (ARdouble *)(&J_U_S[6*k]), 2, 6 );
+                icpDispMat( "J_U_S", (ARdouble *)J_U_S, 2, 6 );
 #endif                        
-                W = (1.0 - E[j]/K2)*(1.0 - E[j]/K2);
-                J_U_S[k*6+0] *= W;
-                J_U_S[k*6+1] *= W;
-                J_U_S[k*6+2] *= W;
-                J_U_S[k*6+3] *= W;
-                J_U_S[k*6+4] *= W;
-                J_U_S[k*6+5] *= W;
-                J_U_S[k*6+6] *= W;
-                J_U_S[k*6+7] *= W;
-                J_U_S[k*6+8] *= W;
-                J_U_S[k*6+9] *= W;
-                J_U_S[k*6+10] *= W;
-                J_U_S[k*6+11] *= W;
-                dU[k+0] = dU[j*2+0] * W;
-                dU[k+1] = dU[j*2+1] * W;
+                icpNormalEquationsAdd( JtJ, JtU, J_U_S, dU, W );
                 k+=2;
 #if ICP_DEBUG
                 l++;
@@ -191,29 +184,19 @@ int icpStereoPointRobust( ICPStereoHandleT *handle,
         l = 0;
 #endif                        
         for( j = 0; j < data->numR; j++ ) {
-            if( E[data->numL+j] <= K2 ) {
-                if( icpGetJ_U_S( (ARdouble (*)[6])(&J_U_S[6*k]), matXc2Ur, matXw2Xc, &(data->worldCoordR[j]) ) < 0 ) {
-                    icpStereoGetXw2XcRobustCleanup("icpGetJ_U_S",J_U_S,dU,E,E2);
+            W = icpRobustWeight(handle->robustMode, E[data->numL+j], K2);
+            if( W > 0.0 ) {
+                icpGetU_from_X_by_MatX2U( &U, matXw2Ur, &(data->worldCoordR[j]) );
+                dU[0] = data->screenCoordR[j].x - U.x;
+                dU[1] = data->screenCoordR[j].y - U.y;
+                if( icpGetJ_U_S( J_U_S, matXc2Ur, matXw2Xc, &(data->worldCoordR[j]) ) < 0 ) {
+                    ARLOGd("Error: icpGetJ_U_S\n");
                     return -1; 
                 }
 #if ICP_DEBUG
-                icpDispMat( "J_U_S", (ARdouble *)(&J_U_S[6*k]), 2, 6 );
+                icpDispMat( "J_U_S", (ARdouble *)J_U_S, 2, 6 );
 #endif                        
-                W = (1.0 - E[data->numL+j]/K2)*(1.0 - E[data->numL+j]/K2);
-                J_U_S[k*6+0] *= W;
-                J_U_S[k*6+1] *= W;
-                J_U_S[k*6+2] *= W;
-                J_U_S[k*6+3] *= W;
-                J_U_S[k*6+4] *= W;
-                J_U_S[k*6+5] *= W;
-                J_U_S[k*6+6] *= W;
-                J_U_S[k*6+7] *= W;
-                J_U_S[k*6+8] *= W;
-                J_U_S[k*6+9] *= W;
-                J_U_S[k*6+10] *= W;
-                J_U_S[k*6+11] *= W;
-                dU[k+0] = dU[(data->numL+j)*2+0] * W;
-                dU[k+1] = dU[(data->numL+j)*2+1] * W;
+                icpNormalEquationsAdd( JtJ, JtU, J_U_S, dU, W );
                 k+=2;
 #if ICP_DEBUG
                 l++;
@@ -226,16 +209,20 @@ int icpStereoPointRobust( ICPStereoHandleT *handle,
 
         if( k < 6 ) {
             //COVHI10425, COVHI10406, COVHI10393, COVHI10325
-            icpStereoGetXw2XcRobustCleanup("icpStereoPointRobust(), if (k < 6)", J_U_S, dU, E, E2);
+            ARLOGd("Error: icpStereoPointRobust(), if (k < 6)\n");
             return -1;
         }
 
-        if( icpGetDeltaS( dS, dU, (ARdouble (*)[6])J_U_S, k ) < 0 ) {
-            icpStereoGetXw2XcRobustCleanup("icpGetS",J_U_S,dU,E,E2);
+        if( icpNormalEquationsSolve( dS, JtJ, JtU ) < 0 ) {
+            ARLOGd("Error: icpGetS\n");
             return -1;
         }
 
         icpUpdateMat( matXw2Xc, dS );
+
+        // Stop after re-evaluating the error once the update has become negligible.
+        if( dS[0]*dS[0] + dS[1]*dS[1] + dS[2]*dS[2] + dS[3]*dS[3] + dS[4]*dS[4] + dS[5]*dS[5]
+            < handle->breakLoopDeltaThresh*handle->breakLoopDeltaThresh ) converged = 1;
     }
 
 #if ICP_DEBUG
@@ -244,28 +231,6 @@ int icpStereoPointRobust( ICPStereoHandleT *handle,
 #endif
 
     *err = err1;
-    free(J_U_S);
-    free(dU);
-    free(E);
-    free(E2);
 
     return 0;
 }
-
-static void icpStereoGetXw2XcRobustCleanup( char *message, ARdouble *J_U_S, ARdouble *dU, ARdouble *E, ARdouble *E2 )
-{
-    ARLOGd("Error: %s\n", message);
-    free(J_U_S);
-    free(dU);
-    free(E);
-    free(E2);
-}
-
-static int compERobust( const void *a, const void *b )
-{
-    ARdouble  c;
-    c = *(ARdouble *)a - *(ARdouble *)b;
-    if( c < 0.0 ) return -1;
-    if( c > 0.0 ) return  1;
-    return 0;
-}
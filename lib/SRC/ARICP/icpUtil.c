@@ -43,19 +43,27 @@
 
 #ifdef ARDOUBLE_IS_FLOAT
 #  define SQRT sqrtf
+#  define FABS fabsf
 #  define _0_0 0.0f
 #  define _0_5 0.5f
 #  define _1_0 1.0f
 #  define _2_0 2.0f
 #else
 #  define SQRT sqrt
+#  define FABS fabs
 #  define _0_0 0.0
 #  define _0_5 0.5
 #  define _1_0 1.0
 #  define _2_0 2.0
 #endif
 
+#define ICP_IPPE_STACK_POINTS   16
+
 static int check_rotation( ARdouble rot[2][3] );
+static int icpSolveLinear8( ARdouble a[8][9], ARdouble x[8] );
+static void icpGetIPPERotations( ARdouble j00, ARdouble j01, ARdouble j10, ARdouble j11, ARdouble p, ARdouble q,
+                                 ARdouble R1[3][3], ARdouble R2[3][3] );
+static int icpGetIPPETranslation( ARdouble R[3][3], ARdouble (*obj)[2], ARdouble (*img)[2], int num, ARdouble t[3] );
 
 #if 0
 static void icpGetInitXw2XcSub( ARdouble       rot[3][4],
@@ -244,6 +252,287 @@ int icpGetInitXw2Xc_from_PlanarData( ARdouble       matXc2U[3][4],
 }
 
 
+/*
+ *  Planar pose by Infinitesimal Plane-based Pose Estimation (IPPE; Collins & Bartoli, IJCV 2014).
+ *  The homography from the (centred) model plane to normalised image coordinates is estimated,
+ *  and the two candidate rotations are recovered in closed form from its Jacobian at the model
+ *  centroid. The candidate with the lower reprojection error is returned.
+ */
+int icpGetInitXw2Xc_from_PlanarDataIPPE( ARdouble       matXc2U[3][4],
+                                         ICP2DCoordT  screenCoord[],
+                                         ICP3DCoordT  worldCoord[],
+                                         int          num,
+                                         ARdouble       initMatXw2Xc[3][4] )
+{
+    ARdouble   buf[ICP_IPPE_WORK_SIZE(ICP_IPPE_STACK_POINTS)];
+    ARdouble  *work;
+    int        ret;
+
+    // Square markers (and small marker sets) need no heap allocation.
+    if( num <= ICP_IPPE_STACK_POINTS ) work = buf;
+    else if( (work = (ARdouble *)malloc( sizeof(ARdouble)*ICP_IPPE_WORK_SIZE(num) )) == NULL ) {
+        ARLOGe("Error: malloc\n");
+        return -1;
+    }
+    ret = icpGetInitXw2Xc_from_PlanarDataIPPEWork( matXc2U, screenCoord, worldCoord, num, initMatXw2Xc, work );
+    if( work != buf ) free( work );
+
+    return ret;
+}
+
+int icpGetInitXw2Xc_from_PlanarDataIPPEWork( ARdouble       matXc2U[3][4],
+                                             ICP2DCoordT  screenCoord[],
+                                             ICP3DCoordT  worldCoord[],
+                                             int          num,
+                                             ARdouble       initMatXw2Xc[3][4],
+                                             ARdouble      *work )
+{
+    ARdouble   (*obj)[2], (*img)[2];
+    ARdouble   a[8][9], h[8], row[2][9];
+    ARdouble   R[2][3][3], t[2][3], mat[3][4];
+    ARdouble   mx, my, scale, err, minErr;
+    int        i, j, k, l, best;
+
+    if( num < 4 ) return -1;
+    for( i = 0; i < num; i++ ) {
+        if( worldCoord[i].z != 0.0 ) return -1;
+    }
+    if( matXc2U[0][0] == 0.0 ) return -1;
+    if( matXc2U[1][0] != 0.0 ) return -1;
+    if( matXc2U[1][1] == 0.0 ) return -1;
+    if( matXc2U[2][0] != 0.0 ) return -1;
+    if( matXc2U[2][1] != 0.0 ) return -1;
+    if( matXc2U[2][2] != 1.0 ) return -1;
+    if( matXc2U[0][3] != 0.0 ) return -1;
+    if( matXc2U[1][3] != 0.0 ) return -1;
+    if( matXc2U[2][3] != 0.0 ) return -1;
+
+    obj = (ARdouble (*)[2])work;
+    img = obj + num;
+
+    // Centre the model points, and map the image points to normalised camera coordinates.
+    mx = my = _0_0;
+    for( i = 0; i < num; i++ ) {
+        mx += worldCoord[i].x;
+        my += worldCoord[i].y;
+    }
+    mx /= num;
+    my /= num;
+    scale = _0_0;
+    for( i = 0; i < num; i++ ) {
+        obj[i][0] = worldCoord[i].x - mx;
+        obj[i][1] = worldCoord[i].y - my;
+        scale += SQRT( obj[i][0]*obj[i][0] + obj[i][1]*obj[i][1] );
+        img[i][1] = (screenCoord[i].y - matXc2U[1][2]) / matXc2U[1][1];
+        img[i][0] = (screenCoord[i].x - matXc2U[0][2] - matXc2U[0][1]*img[i][1]) / matXc2U[0][0];
+    }
+    if( scale == _0_0 ) return -1;
+    scale = num / scale;
+
+    // Least-squares homography (h22 = 1) from the scaled model plane to the normalised image.
+    for( j = 0; j < 8; j++ ) for( i = 0; i < 9; i++ ) a[j][i] = _0_0;
+    for( k = 0; k < num; k++ ) {
+        ARdouble x = obj[k][0]*scale, y = obj[k][1]*scale, u = img[k][0], v = img[k][1];
+        row[0][0] = x;   row[0][1] = y;   row[0][2] = _1_0;
+        row[0][3] = _0_0; row[0][4] = _0_0; row[0][5] = _0_0;
+        row[0][6] = -x*u; row[0][7] = -y*u; row[0][8] = u;
+        row[1][0] = _0_0; row[1][1] = _0_0; row[1][2] = _0_0;
+        row[1][3] = x;   row[1][4] = y;   row[1][5] = _1_0;
+        row[1][6] = -x*v; row[1][7] = -y*v; row[1][8] = v;
+        for( l = 0; l < 2; l++ ) {
+            for( j = 0; j < 8; j++ ) {
+                if( row[l][j] == _0_0 ) continue;
+                for( i = 0; i < 9; i++ ) a[j][i] += row[l][j] * row[l][i];
+            }
+        }
+    }
+    if( icpSolveLinear8( a, h ) < 0 ) return -1;
+
+    // Jacobian of the homography at the model origin (with respect to the scaled plane
+    // coordinates; the scale is absorbed by IPPE's depth factor and does not affect rotation).
+    icpGetIPPERotations( h[0] - h[6]*h[2], h[1] - h[7]*h[2], h[3] - h[6]*h[5], h[4] - h[7]*h[5], h[2], h[5], R[0], R[1] );
+
+    best = -1;
+    minErr = _0_0;
+    for( k = 0; k < 2; k++ ) {
+        if( icpGetIPPETranslation( R[k], obj, img, num, t[k] ) < 0 ) continue;
+        if( t[k][2] <= _0_0 ) continue;
+        for( j = 0; j < 3; j++ ) {
+            for( i = 0; i < 3; i++ ) mat[j][i] = R[k][j][i];
+            mat[j][3] = t[k][j] - R[k][j][0]*mx - R[k][j][1]*my;
+        }
+        err = icpGetReprojectionError( matXc2U, mat, screenCoord, worldCoord, num );
+        if( best < 0 || err < minErr ) {
+            best = k;
+            minErr = err;
+            for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) initMatXw2Xc[j][i] = mat[j][i];
+        }
+    }
+
+    return (best < 0)? -1: 0;
+}
+
+ARdouble icpGetReprojectionError( ARdouble       matXc2U[3][4],
+                                  ARdouble       matXw2Xc[3][4],
+                                  ICP2DCoordT  screenCoord[],
+                                  ICP3DCoordT  worldCoord[],
+                                  int          num )
+{
+    ICP2DCoordT  U;
+    ARdouble       matXw2U[3][4];
+    ARdouble       dx, dy, err;
+    int          i;
+
+    if( num <= 0 ) return _0_0;
+
+    arUtilMatMul( (const ARdouble (*)[4])matXc2U, (const ARdouble (*)[4])matXw2Xc, matXw2U );
+    err = _0_0;
+    for( i = 0; i < num; i++ ) {
+        if( icpGetU_from_X_by_MatX2U( &U, matXw2U, &(worldCoord[i]) ) < 0 ) return 100000000.0;
+        dx = screenCoord[i].x - U.x;
+        dy = screenCoord[i].y - U.y;
+        err += dx*dx + dy*dy;
+    }
+
+    return err / num;
+}
+
+// Solve the 8x8 system held in augmented form in a, by Gaussian elimination with partial pivoting.
+static int icpSolveLinear8( ARdouble a[8][9], ARdouble x[8] )
+{
+    ARdouble  w;
+    int       i, j, k, p;
+
+    for( k = 0; k < 8; k++ ) {
+        p = k;
+        for( j = k+1; j < 8; j++ ) {
+            if( FABS(a[j][k]) > FABS(a[p][k]) ) p = j;
+        }
+        if( a[p][k] == _0_0 ) return -1;
+        if( p != k ) {
+            for( i = k; i < 9; i++ ) { w = a[k][i]; a[k][i] = a[p][i]; a[p][i] = w; }
+        }
+        for( j = k+1; j < 8; j++ ) {
+            w = a[j][k] / a[k][k];
+            for( i = k; i < 9; i++ ) a[j][i] -= w * a[k][i];
+        }
+    }
+    for( k = 7; k >= 0; k-- ) {
+        w = a[k][8];
+        for( i = k+1; i < 8; i++ ) w -= a[k][i] * x[i];
+        x[k] = w / a[k][k];
+    }
+
+    return 0;
+}
+
+// Two-fold rotation ambiguity of IPPE, from the homography Jacobian J at the model origin
+// and the normalised image position (p, q) of that origin.
+static void icpGetIPPERotations( ARdouble j00, ARdouble j01, ARdouble j10, ARdouble j11, ARdouble p, ARdouble q,
+                                 ARdouble R1[3][3], ARdouble R2[3][3] )
+{
+    ARdouble  Rv[3][3];
+    ARdouble  ax, ay, az, nrm, d;
+    ARdouble  b00, b01, b10, b11, dtinv;
+    ARdouble  a00, a01, a10, a11;
+    ARdouble  ata00, ata01, ata11, gamma;
+    ARdouble  r00, r01, r10, r11, c0, c1, c2, sp;
+    int       j;
+
+    // Rv is the transpose of the rotation taking (p, q, 1) to the optical axis.
+    nrm = SQRT( p*p + q*q + _1_0 );
+    ax = p / nrm;
+    ay = q / nrm;
+    az = _1_0 / nrm;
+    d = _1_0 / (_1_0 + az);
+    Rv[0][0] = _1_0 - ax*ax*d;
+    Rv[0][1] = -ax*ay*d;
+    Rv[0][2] = ax;
+    Rv[1][0] = -ax*ay*d;
+    Rv[1][1] = _1_0 - ay*ay*d;
+    Rv[1][2] = ay;
+    Rv[2][0] = -ax;
+    Rv[2][1] = -ay;
+    Rv[2][2] = _1_0 - (ax*ax + ay*ay)*d;
+
+    b00 = Rv[0][0] - p * Rv[2][0];
+    b01 = Rv[0][1] - p * Rv[2][1];
+    b10 = Rv[1][0] - q * Rv[2][0];
+    b11 = Rv[1][1] - q * Rv[2][1];
+    dtinv = _1_0 / (b00 * b11 - b01 * b10);
+
+    a00 = dtinv * ( b11 * j00 - b01 * j10);
+    a01 = dtinv * ( b11 * j01 - b01 * j11);
+    a10 = dtinv * (-b10 * j00 + b00 * j10);
+    a11 = dtinv * (-b10 * j01 + b00 * j11);
+
+    // Largest singular value of the 2x2 matrix A.
+    ata00 = a00 * a00 + a01 * a01;
+    ata01 = a00 * a10 + a01 * a11;
+    ata11 = a10 * a10 + a11 * a11;
+    gamma = SQRT( _0_5 * (ata00 + ata11 + SQRT((ata00 - ata11) * (ata00 - ata11) + 4.0 * ata01 * ata01)) );
+
+    r00 = a00 / gamma;
+    r01 = a01 / gamma;
+    r10 = a10 / gamma;
+    r11 = a11 / gamma;
+    c0 = _1_0 - r00*r00 - r10*r10;
+    c1 = _1_0 - r01*r01 - r11*r11;
+    c0 = (c0 > _0_0)? SQRT(c0): _0_0;
+    c1 = (c1 > _0_0)? SQRT(c1): _0_0;
+    sp = -r00 * r01 - r10 * r11;
+    if( sp < _0_0 ) c1 = -c1;
+    c2 = r00 * r11 - r01 * r10;
+
+    for( j = 0; j < 3; j++ ) {
+        R1[j][0] = r00 * Rv[j][0] + r10 * Rv[j][1] + c0 * Rv[j][2];
+        R1[j][1] = r01 * Rv[j][0] + r11 * Rv[j][1] + c1 * Rv[j][2];
+        R1[j][2] = (c1 * r10 - c0 * r11) * Rv[j][0] + (c0 * r01 - c1 * r00) * Rv[j][1] + c2 * Rv[j][2];
+        R2[j][0] = r00 * Rv[j][0] + r10 * Rv[j][1] - c0 * Rv[j][2];
+        R2[j][1] = r01 * Rv[j][0] + r11 * Rv[j][1] - c1 * Rv[j][2];
+        R2[j][2] = (c0 * r11 - c1 * r10) * Rv[j][0] + (c1 * r00 - c0 * r01) * Rv[j][1] + c2 * Rv[j][2];
+    }
+}
+
+// Least-squares translation for rotation R, given centred model points obj and normalised image points img.
+static int icpGetIPPETranslation( ARdouble R[3][3], ARdouble (*obj)[2], ARdouble (*img)[2], int num, ARdouble t[3] )
+{
+    ARdouble  su, sv, suv, b0, b1, b2;
+    ARdouble  rx, ry, rz, e0, e1;
+    ARdouble  c00, c01, c02, c11, c12, c22, det;
+    int       i;
+
+    su = sv = suv = b0 = b1 = b2 = _0_0;
+    for( i = 0; i < num; i++ ) {
+        rx = R[0][0] * obj[i][0] + R[0][1] * obj[i][1];
+        ry = R[1][0] * obj[i][0] + R[1][1] * obj[i][1];
+        rz = R[2][0] * obj[i][0] + R[2][1] * obj[i][1];
+        e0 = img[i][0] * rz - rx;
+        e1 = img[i][1] * rz - ry;
+        su  += img[i][0];
+        sv  += img[i][1];
+        suv += img[i][0]*img[i][0] + img[i][1]*img[i][1];
+        b0  += e0;
+        b1  += e1;
+        b2  -= img[i][0] * e0 + img[i][1] * e1;
+    }
+
+    // Solve [n 0 -su; 0 n -sv; -su -sv suv] t = b via the adjugate (symmetric).
+    c00 = num * suv - sv * sv;
+    c01 = su * sv;
+    c02 = num * su;
+    c11 = num * suv - su * su;
+    c12 = num * sv;
+    c22 = (ARdouble)num * num;
+    det = num * c00 - su * c02;
+    if( det == _0_0 ) return -1;
+    t[0] = (c00 * b0 + c01 * b1 + c02 * b2) / det;
+    t[1] = (c01 * b0 + c11 * b1 + c12 * b2) / det;
+    t[2] = (c02 * b0 + c12 * b1 + c22 * b2) / det;
+
+    return 0;
+}
+
 
 static int check_rotation( ARdouble rot[2][3] )
 {
@@ -53,6 +53,10 @@
 
 int arMultiFreeConfig( ARMultiMarkerInfoT *config )
 {
+    free( config->index );
+    free( config->screenCoord );
+    free( config->worldCoord );
+    free( config->icpWork );
     free( config->marker );
     free( config );
     config = NULL;
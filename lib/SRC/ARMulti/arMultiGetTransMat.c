@@ -53,6 +53,12 @@
 
 static ARdouble  arGetTransMatMultiSquare2(AR3DHandle *handle, ARMarkerInfo *marker_info, int marker_num,
                                          ARMultiMarkerInfoT *config, int robustFlag);
+static void      arGetTransMatMultiMatch(ARMarkerInfo *marker_info, int marker_num, ARMultiMarkerInfoT *config);
+static void      arGetTransMatMultiMatchEach(ARMarkerInfo *marker_info, int j, ARMultiMarkerInfoT *config,
+                                             int type, uint64_t id);
+static ARdouble  arGetTransMatMultiICP(AR3DHandle *handle, ARdouble initConv[3][4], ICPDataT *data,
+                                       ARdouble conv[3][4], int robustFlag, ARdouble *work);
+static void      arGetTransMatMultiInitPlanar(AR3DHandle *handle, ICPDataT *data, ARdouble trans[3][4], ARdouble *work);
 
 ARdouble  arGetTransMatMultiSquare(AR3DHandle *handle, ARMarkerInfo *marker_info, int marker_num,
                                  ARMultiMarkerInfoT *config)
@@ -69,46 +75,21 @@ ARdouble  arGetTransMatMultiSquareRobust(AR3DHandle *handle, ARMarkerInfo *marke
 static ARdouble  arGetTransMatMultiSquare2(AR3DHandle *handle, ARMarkerInfo *marker_info, int marker_num,
                                          ARMultiMarkerInfoT *config, int robustFlag)
 {
-    ARdouble              *pos2d, *pos3d;
+    ICPDataT              data;
     ARdouble              trans1[3][4], trans2[3][4];
     ARdouble              err, err2;
     int                   max, maxArea;
     int                   vnum;
     int                   dir;
-    int                   i, j, k;
-    //char  mes[12];
+    int                   i, j, k, l;
 
-    //ARLOG("-- Pass1--\n");
-    for( i = 0; i < config->marker_num; i++ ) {
-        k = -1;
-        if( config->marker[i].patt_type == AR_MULTI_PATTERN_TYPE_TEMPLATE ) {
-            for( j = 0; j < marker_num; j++ ) {
-                if( marker_info[j].idPatt != config->marker[i].patt_id ) continue;
-                if( marker_info[j].cfPatt < config->cfPattCutoff ) continue;
-                if( k == -1 ) k = j;
-                else if( marker_info[k].cfPatt < marker_info[j].cfPatt ) k = j;
-            }
-            config->marker[i].visible = k;
-            if( k >= 0 ) marker_info[k].dir = marker_info[k].dirPatt;
-        }
-        else { // config->marker[i].patt_type == AR_MULTI_PATTERN_TYPE_MATRIX
-            for( j = 0; j < marker_num; j++ ) {
-                // Check if we need to examine the globalID rather than patt_id.
-                if (marker_info[j].idMatrix == 0 && marker_info[j].globalID != 0ULL) {
-                    if( marker_info[j].globalID != config->marker[i].globalID ) continue;
-                } else {
-                    if( marker_info[j].idMatrix != config->marker[i].patt_id ) continue;
-                }
-                if( marker_info[j].cfMatrix < config->cfMatrixCutoff ) continue;
-                if( k == -1 ) k = j;
-                else if( marker_info[k].cfMatrix < marker_info[j].cfMatrix ) k = j;
-            }
-            config->marker[i].visible = k;
-            if( k >= 0 ) marker_info[k].dir = marker_info[k].dirMatrix;
-        }
-        //if(k>=0) ARLOG(" *%d\n",i);
+    if( config->index == NULL || config->indexed_marker_num != config->marker_num ) {
+        if( arMultiUpdateConfigIndex( config ) < 0 ) return -1;
     }
 
+    //ARLOG("-- Pass1--\n");
+    arGetTransMatMultiMatch( marker_info, marker_num, config );
+
     //ARLOG("-- Pass2--\n");
     vnum = 0;
     for( i = 0; i < config->marker_num; i++ ) {
@@ -143,100 +124,88 @@ static ARdouble  arGetTransMatMultiSquare2(AR3DHandle *handle, ARMarkerInfo *mar
     }
     arUtilMatMul( (const ARdouble (*)[4])trans1, (const ARdouble (*)[4])config->marker[max].itrans, trans2 ); 
     
-    arMalloc(pos2d, ARdouble, vnum*4*2);
-    arMalloc(pos3d, ARdouble, vnum*4*3);
-    
     j = 0; 
     for( i = 0; i < config->marker_num; i++ ) { 
         if( (k=config->marker[i].visible) < 0 ) continue;
         
         dir = marker_info[k].dir;
-        pos2d[j*8+0] = marker_info[k].vertex[(4-dir)%4][0];
-        pos2d[j*8+1] = marker_info[k].vertex[(4-dir)%4][1];
-        pos2d[j*8+2] = marker_info[k].vertex[(5-dir)%4][0];
-        pos2d[j*8+3] = marker_info[k].vertex[(5-dir)%4][1];
-        pos2d[j*8+4] = marker_info[k].vertex[(6-dir)%4][0];
-        pos2d[j*8+5] = marker_info[k].vertex[(6-dir)%4][1];
-        pos2d[j*8+6] = marker_info[k].vertex[(7-dir)%4][0];
-        pos2d[j*8+7] = marker_info[k].vertex[(7-dir)%4][1];
-        pos3d[j*12+0] = config->marker[i].pos3d[0][0];
-        pos3d[j*12+1] = config->marker[i].pos3d[0][1];
-        pos3d[j*12+2] = config->marker[i].pos3d[0][2];
-        pos3d[j*12+3] = config->marker[i].pos3d[1][0];
-        pos3d[j*12+4] = config->marker[i].pos3d[1][1];
-        pos3d[j*12+5] = config->marker[i].pos3d[1][2];
-        pos3d[j*12+6] = config->marker[i].pos3d[2][0];
-        pos3d[j*12+7] = config->marker[i].pos3d[2][1];
-        pos3d[j*12+8] = config->marker[i].pos3d[2][2];
-        pos3d[j*12+9] = config->marker[i].pos3d[3][0];
-        pos3d[j*12+10] = config->marker[i].pos3d[3][1];
-        pos3d[j*12+11] = config->marker[i].pos3d[3][2];
+        for( l = 0; l < 4; l++ ) {
+            config->screenCoord[j*4+l].x = marker_info[k].vertex[(4+l-dir)%4][0];
+            config->screenCoord[j*4+l].y = marker_info[k].vertex[(4+l-dir)%4][1];
+            config->worldCoord[j*4+l].x  = config->marker[i].pos3d[l][0];
+            config->worldCoord[j*4+l].y  = config->marker[i].pos3d[l][1];
+            config->worldCoord[j*4+l].z  = config->marker[i].pos3d[l][2];
+        }
         j++;
     }
+    data.screenCoord = config->screenCoord;
+    data.worldCoord  = config->worldCoord;
+    data.num         = vnum*4;
     
+    // For boards with more than one visible marker, an analytic planar pose from all
+    // visible corners is usually a better starting point than the largest marker's pose.
+    if( vnum > 1 ) arGetTransMatMultiInitPlanar( handle, &data, trans2, config->icpWork );
 
     if( config->prevF == 0 ) {
         if( robustFlag ) {
-            err = arGetTransMat( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+            err = arGetTransMatMultiICP( handle, trans2, &data, config->trans, 0, config->icpWork );
             if( err >= AR_MULTI_POSE_ERROR_CUTOFF_COMBINED_DEFAULT ) {
                 icpSetInlierProbability( handle->icpHandle, 0.8 );
-                err = arGetTransMatRobust( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+                err = arGetTransMatMultiICP( handle, trans2, &data, config->trans, 1, config->icpWork );
                 if( err >= AR_MULTI_POSE_ERROR_CUTOFF_COMBINED_DEFAULT ) {
                     icpSetInlierProbability( handle->icpHandle, 0.6 );
-                    err = arGetTransMatRobust( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+                    err = arGetTransMatMultiICP( handle, trans2, &data, config->trans, 1, config->icpWork );
                     if( err >= AR_MULTI_POSE_ERROR_CUTOFF_COMBINED_DEFAULT ) {
                         icpSetInlierProbability( handle->icpHandle, 0.4 );
-                        err = arGetTransMatRobust( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+                        err = arGetTransMatMultiICP( handle, trans2, &data, config->trans, 1, config->icpWork );
                         if( err >= AR_MULTI_POSE_ERROR_CUTOFF_COMBINED_DEFAULT ) {
                             icpSetInlierProbability( handle->icpHandle, 0.0 );
-                            err = arGetTransMatRobust( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+                            err = arGetTransMatMultiICP( handle, trans2, &data, config->trans, 1, config->icpWork );
                         }
                     }
                 }
             }
         }
         else {
-            err = arGetTransMat( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+            err = arGetTransMatMultiICP( handle, trans2, &data, config->trans, 0, config->icpWork );
         }
-        free(pos3d);
-        free(pos2d);
     }
     else {
         if( robustFlag ) {
-            err2 = arGetTransMat( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, trans1 );
-            err = arGetTransMat( handle, config->trans, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+            err2 = arGetTransMatMultiICP( handle, trans2, &data, trans1, 0, config->icpWork );
+            err = arGetTransMatMultiICP( handle, config->trans, &data, config->trans, 0, config->icpWork );
             if( err2 < err ) {
                 for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) config->trans[j][i] = trans1[j][i];
                 err = err2;
             }
             if( err >= AR_MULTI_POSE_ERROR_CUTOFF_COMBINED_DEFAULT ) {
                 icpSetInlierProbability( handle->icpHandle, 0.8 );
-                err2 = arGetTransMatRobust( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, trans1 );
-                err = arGetTransMatRobust( handle, config->trans, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+                err2 = arGetTransMatMultiICP( handle, trans2, &data, trans1, 1, config->icpWork );
+                err = arGetTransMatMultiICP( handle, config->trans, &data, config->trans, 1, config->icpWork );
                 if( err2 < err ) {
                     for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) config->trans[j][i] = trans1[j][i];
                     err = err2;
                 }
                 if( err >= AR_MULTI_POSE_ERROR_CUTOFF_COMBINED_DEFAULT ) {
                     icpSetInlierProbability( handle->icpHandle, 0.6 );
-                    err2 = arGetTransMatRobust( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, trans1 );
-                    err = arGetTransMatRobust( handle, config->trans, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+                    err2 = arGetTransMatMultiICP( handle, trans2, &data, trans1, 1, config->icpWork );
+                    err = arGetTransMatMultiICP( handle, config->trans, &data, config->trans, 1, config->icpWork );
                     if( err2 < err ) {
                         for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) config->trans[j][i] = trans1[j][i];
                         err = err2;
                     }
                     if( err >= AR_MULTI_POSE_ERROR_CUTOFF_COMBINED_DEFAULT ) {
                         icpSetInlierProbability( handle->icpHandle, 0.4 );
-                        err2 = arGetTransMatRobust( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, trans1 );
-                        err = arGetTransMatRobust( handle, config->trans, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+                        err2 = arGetTransMatMultiICP( handle, trans2, &data, trans1, 1, config->icpWork );
+                        err = arGetTransMatMultiICP( handle, config->trans, &data, config->trans, 1, config->icpWork );
                         if( err2 < err ) {
                             for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) config->trans[j][i] = trans1[j][i];
                             err = err2;
                         }
                         if( err >= AR_MULTI_POSE_ERROR_CUTOFF_COMBINED_DEFAULT ) {
                             icpSetInlierProbability( handle->icpHandle, 0.0 );
-                            err2 = arGetTransMatRobust( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, trans1 );
-                            err = arGetTransMatRobust( handle, config->trans, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+                            err2 = arGetTransMatMultiICP( handle, trans2, &data, trans1, 1, config->icpWork );
+                            err = arGetTransMatMultiICP( handle, config->trans, &data, config->trans, 1, config->icpWork );
                             if( err2 < err ) {
                                 for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) config->trans[j][i] = trans1[j][i];
                                 err = err2;
@@ -247,15 +216,13 @@ static ARdouble  arGetTransMatMultiSquare2(AR3DHandle *handle, ARMarkerInfo *mar
             }
         }
         else {
-            err2 = arGetTransMat( handle, trans2, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, trans1 );
-            err = arGetTransMat( handle, config->trans, (ARdouble (*)[2])pos2d, (ARdouble (*)[3])pos3d, vnum*4, config->trans );
+            err2 = arGetTransMatMultiICP( handle, trans2, &data, trans1, 0, config->icpWork );
+            err = arGetTransMatMultiICP( handle, config->trans, &data, config->trans, 0, config->icpWork );
             if( err2 < err ) {
                 for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) config->trans[j][i] = trans1[j][i];
                 err = err2;
             }
         }
-        free(pos3d);
-        free(pos2d);
     }
     
     if (err < AR_MULTI_POSE_ERROR_CUTOFF_COMBINED_DEFAULT) config->prevF = 1;
@@ -269,3 +236,91 @@ static ARdouble  arGetTransMatMultiSquare2(AR3DHandle *handle, ARMarkerInfo *mar
 
     return err;
 }
+
+// Sets config->marker[i].visible to the index of the most confident detected marker matching
+// config marker i, or -1. Detected markers are looked up in config->index, so the cost is
+// O(marker_num * log(config->marker_num)) rather than O(marker_num * config->marker_num).
+static void arGetTransMatMultiMatch(ARMarkerInfo *marker_info, int marker_num, ARMultiMarkerInfoT *config)
+{
+    int     i, j, k;
+
+    for( i = 0; i < config->marker_num; i++ ) config->marker[i].visible = -1;
+
+    for( j = 0; j < marker_num; j++ ) {
+        if( marker_info[j].cfPatt >= config->cfPattCutoff ) {
+            arGetTransMatMultiMatchEach( marker_info, j, config, AR_MULTI_INDEX_KEY_TEMPLATE, (uint64_t)(int64_t)marker_info[j].idPatt );
+        }
+        if( marker_info[j].cfMatrix >= config->cfMatrixCutoff ) {
+            // Check if we need to examine the globalID rather than patt_id.
+            if( marker_info[j].idMatrix == 0 && marker_info[j].globalID != 0ULL ) {
+                arGetTransMatMultiMatchEach( marker_info, j, config, AR_MULTI_INDEX_KEY_GLOBAL_ID, marker_info[j].globalID );
+            } else {
+                arGetTransMatMultiMatchEach( marker_info, j, config, AR_MULTI_INDEX_KEY_MATRIX, (uint64_t)(int64_t)marker_info[j].idMatrix );
+            }
+        }
+    }
+
+    for( i = 0; i < config->marker_num; i++ ) {
+        if( (k = config->marker[i].visible) < 0 ) continue;
+        if( config->marker[i].patt_type == AR_MULTI_PATTERN_TYPE_TEMPLATE ) marker_info[k].dir = marker_info[k].dirPatt;
+        else                                                               marker_info[k].dir = marker_info[k].dirMatrix;
+    }
+}
+
+static void arGetTransMatMultiMatchEach(ARMarkerInfo *marker_info, int j, ARMultiMarkerInfoT *config,
+                                        int type, uint64_t id)
+{
+    ARMultiMarkerIndexT  *index = config->index;
+    int                   lo, hi, mid, i, k;
+
+    // Lower bound of (type, id).
+    lo = 0;
+    hi = config->index_num;
+    while( lo < hi ) {
+        mid = (lo + hi) / 2;
+        if( index[mid].type < type || (index[mid].type == type && index[mid].id < id) ) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for( ; lo < config->index_num && index[lo].type == type && index[lo].id == id; lo++ ) {
+        i = index[lo].marker;
+        k = config->marker[i].visible;
+        if( type == AR_MULTI_INDEX_KEY_TEMPLATE ) {
+            if( k == -1 || marker_info[k].cfPatt < marker_info[j].cfPatt ) config->marker[i].visible = j;
+        } else {
+            if( k == -1 || marker_info[k].cfMatrix < marker_info[j].cfMatrix ) config->marker[i].visible = j;
+        }
+    }
+}
+
+static ARdouble arGetTransMatMultiICP(AR3DHandle *handle, ARdouble initConv[3][4], ICPDataT *data,
+                                      ARdouble conv[3][4], int robustFlag, ARdouble *work)
+{
+    ARdouble    err;
+
+    if( robustFlag ) {
+        if( icpPointRobustWork( handle->icpHandle, data, initConv, conv, &err, work ) < 0 ) err = 100000000.0;
+    }
+    else {
+        if( icpPoint( handle->icpHandle, data, initConv, conv, &err ) < 0 ) err = 100000000.0;
+    }
+
+    return err;
+}
+
+static void arGetTransMatMultiInitPlanar(AR3DHandle *handle, ICPDataT *data, ARdouble trans[3][4], ARdouble *work)
+{
+    ARdouble      initTrans[3][4];
+    int           i, j;
+
+    // Only applicable when all markers lie in the board's z = 0 plane.
+    for( i = 0; i < data->num; i++ ) {
+        if( data->worldCoord[i].z != 0.0 ) return;
+    }
+
+    if( icpGetInitXw2Xc_from_PlanarDataIPPEWork( handle->icpHandle->matXc2U, data->screenCoord, data->worldCoord, data->num, initTrans, work ) == 0
+        && icpGetReprojectionError( handle->icpHandle->matXc2U, initTrans, data->screenCoord, data->worldCoord, data->num )
+         < icpGetReprojectionError( handle->icpHandle->matXc2U, trans, data->screenCoord, data->worldCoord, data->num ) ) {
+        for( j = 0; j < 3; j++ ) for( i = 0; i < 4; i++ ) trans[j][i] = initTrans[j][i];
+    }
+}
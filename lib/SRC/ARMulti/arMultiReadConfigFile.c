@@ -53,6 +53,7 @@
 #include <AR/arMulti.h>
 
 static char *get_buff( char *buf, int n, FILE *fp );
+static int   arMultiIndexCompare( const void *a, const void *b );
 
 ARMultiMarkerInfoT *arMultiReadConfigFile( const char *filename, ARPattHandle *pattHandle )
 {
@@ -200,6 +201,16 @@ ARMultiMarkerInfoT *arMultiReadConfigFile( const char *filename, ARPattHandle *p
     else                           marker_info->patt_type = AR_MULTI_PATTERN_DETECTION_MODE_MATRIX;
     marker_info->cfPattCutoff = AR_MULTI_CONFIDENCE_PATTERN_CUTOFF_DEFAULT;
     marker_info->cfMatrixCutoff = AR_MULTI_CONFIDENCE_MATRIX_CUTOFF_DEFAULT;
+    marker_info->index       = NULL;
+    marker_info->index_num   = 0;
+    marker_info->screenCoord = NULL;
+    marker_info->worldCoord  = NULL;
+    marker_info->icpWork     = NULL;
+    marker_info->indexed_marker_num = 0;
+    if( arMultiUpdateConfigIndex( marker_info ) < 0 ) {
+        arMultiFreeConfig( marker_info );
+        return NULL;
+    }
 
     return marker_info;
     
@@ -209,6 +220,63 @@ bail:
     return NULL;
 }
 
+int arMultiUpdateConfigIndex( ARMultiMarkerInfoT *config )
+{
+    int     i, n;
+
+    if( !config ) return -1;
+
+    free( config->index );
+    free( config->screenCoord );
+    free( config->worldCoord );
+    free( config->icpWork );
+    config->index       = NULL;
+    config->index_num   = 0;
+    config->screenCoord = NULL;
+    config->worldCoord  = NULL;
+    config->icpWork     = NULL;
+    config->indexed_marker_num = 0;
+    if( config->marker_num <= 0 ) return 0;
+
+    // Matrix markers can be matched either by matrix code ID or by global ID, so get two entries.
+    arMalloc( config->index, ARMultiMarkerIndexT, config->marker_num*2 );
+    arMalloc( config->screenCoord, ICP2DCoordT, config->marker_num*4 );
+    arMalloc( config->worldCoord,  ICP3DCoordT, config->marker_num*4 );
+    // Sized for both consumers, so that pose estimation does not allocate however many markers are visible.
+    n = ICP_ROBUST_WORK_SIZE(config->marker_num*4);
+    if( n < ICP_IPPE_WORK_SIZE(config->marker_num*4) ) n = ICP_IPPE_WORK_SIZE(config->marker_num*4);
+    arMalloc( config->icpWork,     ARdouble,    n );
+    n = 0;
+    for( i = 0; i < config->marker_num; i++ ) {
+        config->index[n].marker = i;
+        config->index[n].id     = (uint64_t)(int64_t)config->marker[i].patt_id;
+        if( config->marker[i].patt_type == AR_MULTI_PATTERN_TYPE_TEMPLATE ) {
+            config->index[n++].type = AR_MULTI_INDEX_KEY_TEMPLATE;
+        } else {
+            config->index[n++].type = AR_MULTI_INDEX_KEY_MATRIX;
+            config->index[n].marker = i;
+            config->index[n].id     = config->marker[i].globalID;
+            config->index[n++].type = AR_MULTI_INDEX_KEY_GLOBAL_ID;
+        }
+    }
+    qsort( config->index, n, sizeof(ARMultiMarkerIndexT), arMultiIndexCompare );
+    config->index_num = n;
+    config->indexed_marker_num = config->marker_num;
+
+    return 0;
+}
+
+static int arMultiIndexCompare( const void *a, const void *b )
+{
+    const ARMultiMarkerIndexT *ia = (const ARMultiMarkerIndexT *)a;
+    const ARMultiMarkerIndexT *ib = (const ARMultiMarkerIndexT *)b;
+
+    if( ia->type != ib->type ) return (ia->type < ib->type)? -1: 1;
+    if( ia->id != ib->id ) return (ia->id < ib->id)? -1: 1;
+    if( ia->marker != ib->marker ) return (ia->marker < ib->marker)? -1: 1;
+    return 0;
+}
+
 static char *get_buff(char *buf, int n, FILE *fp)
 {
     char *ret;
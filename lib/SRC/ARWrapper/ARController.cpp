@@ -95,14 +95,20 @@ ARController::ARController() :
     m_arPattHandle(NULL),
     m_ar3DHandle(NULL),
     m_ar3DStereoHandle(NULL),
+    m_detectionThread1(NULL),
+    m_detectionImage1(NULL),
+    m_detectionResult1(0),
 #if HAVE_NFT
     doNFTMarkerDetection(false),
     m_nftMultiMode(false),
     m_kpmRequired(true),
     m_kpmBusy(false),
     trackingThreadHandle(NULL),
-    m_ar2Handle(NULL),
     m_kpmHandle(NULL),
+    m_nftPyramid(NULL),
+    m_nftTrackingThreadCount(0),
+    m_nftTrackingImage(NULL),
+    m_nftTrackingPageCount(0),
 #endif
     m_error(ARW_ERROR_NONE)
 {
@@ -111,7 +117,11 @@ ARController::ARController() :
     //syslog(LOG_ERR, "Hello world!\n");
 #endif
 #if HAVE_NFT
-    for (int i = 0; i < PAGES_MAX; i++) surfaceSet[i] = NULL;
+    for (int i = 0; i < PAGES_MAX; i++) {
+        surfaceSet[i] = NULL;
+        m_ar2Handles[i] = NULL;
+        m_nftTrackingThreads[i] = NULL;
+    }
 #endif
     pthread_mutex_init(&m_videoSourceLock, NULL);
 }
@@ -531,19 +541,40 @@ bool ARController::update()
             }
         }
 
-        if (m_arHandle0) {
-            if (arDetectMarker(m_arHandle0, image0) < 0) {
-                logv(AR_LOG_LEVEL_ERROR, "ARController::update(): Error: arDetectMarker(), exiting returning false");
-                return false;
+        // In stereo mode, detect in the right frame on a worker thread while the left frame is processed here.
+        // Each eye has its own ARHandle, so the two passes share no state.
+        bool detect1Async = false;
+        if (m_videoSourceIsStereo && m_arHandle1) {
+            if (!m_detectionThread1 && threadGetCPU() > 1) {
+                m_detectionThread1 = threadInit(1, this, detectionWorker1);
+                if (!m_detectionThread1) logv(AR_LOG_LEVEL_WARN, "ARController::update(): Unable to start detection thread, detecting serially.");
+            }
+            if (m_detectionThread1) {
+                m_detectionImage1 = image1;
+                threadStartSignal(m_detectionThread1);
+                detect1Async = true;
+            }
+        }
+
+        int ret0 = 0, ret1 = 0;
+        if (m_arHandle0) ret0 = arDetectMarker(m_arHandle0, image0);
+        if (m_videoSourceIsStereo && m_arHandle1) {
+            if (detect1Async) {
+                threadEndWait(m_detectionThread1);
+                ret1 = m_detectionResult1;
+            } else {
+                ret1 = arDetectMarker(m_arHandle1, image1);
             }
+        }
+        if (ret0 < 0 || ret1 < 0) {
+            logv(AR_LOG_LEVEL_ERROR, "ARController::update(): Error: arDetectMarker(), exiting returning false");
+            return false;
+        }
+        if (m_arHandle0) {
             markerInfo0 = arGetMarker(m_arHandle0);
             markerNum0 = arGetMarkerNum(m_arHandle0);
         }
         if (m_videoSourceIsStereo && m_arHandle1) {
-            if (arDetectMarker(m_arHandle1, image1) < 0) {
-                logv(AR_LOG_LEVEL_ERROR, "ARController::update(): Error: arDetectMarker(), exiting returning false");
-                return false;
-            }
             markerInfo1 = arGetMarker(m_arHandle1);
             markerNum1 = arGetMarkerNum(m_arHandle1);
         }
@@ -573,7 +604,7 @@ bool ARController::update()
     if (doNFTMarkerDetection) {
         logv(AR_LOG_LEVEL_DEBUG, "ARWrapper::ARController::update(): if (doNFTMarkerDetection) true");
 
-        if (!m_kpmHandle || !m_ar2Handle) {
+        if (!m_kpmHandle) {
             if (!initNFT()) {
                 logv(AR_LOG_LEVEL_ERROR, "ARController::update(): Error initialising NFT, exiting returning false");
                 return false;
@@ -586,12 +617,12 @@ bool ARController::update()
         if (trackingThreadHandle) {
 
             // Do KPM tracking.
-            float err;
             float trackingTrans[3][4];
+            arImagePyramidSetImage(m_nftPyramid, image0->buffLuma);
 
             if (m_kpmRequired) {
                 if (!m_kpmBusy) {
-                    trackingInitStart(trackingThreadHandle, image0->buffLuma);
+                    trackingInitStart(trackingThreadHandle, m_nftPyramid);
                     m_kpmBusy = true;
                 } else {
                     int ret;
@@ -615,8 +646,28 @@ bool ARController::update()
                 }
             }
 
-            // Do AR2 tracking and update NFT markers.
+            // Do AR2 tracking. Each page has its own AR2 handle, so the pages being tracked are
+            // shared out between the calling thread and the page tracking workers.
             int page = 0;
+            m_nftTrackingImage = image0->buff;
+            m_nftTrackingPageCount = 0;
+            for (std::vector<ARMarker *>::iterator it = markers.begin(); it != markers.end(); ++it) {
+                if ((*it)->type == ARMarker::NFT) {
+                    if (surfaceSet[page] && m_ar2Handles[page] && surfaceSet[page]->contNum > 0) {
+                        ar2PrepareSearchPyramid(m_ar2Handles[page]); // Before the pyramid is shared between threads.
+                        m_nftTrackingPages[m_nftTrackingPageCount++] = page;
+                    }
+                    page++;
+                }
+            }
+            int workers = m_nftTrackingPageCount - 1;
+            if (workers > m_nftTrackingThreadCount) workers = m_nftTrackingThreadCount;
+            for (int i = 0; i < workers; i++) threadStartSignal(m_nftTrackingThreads[i]);
+            trackNFTPages(0);
+            for (int i = 0; i < workers; i++) threadEndWait(m_nftTrackingThreads[i]);
+
+            // Update NFT markers, in page order.
+            page = 0;
             int pagesTracked = 0;
             bool success = true;
             ARdouble *transL2R = (m_videoSourceIsStereo ? (ARdouble *)m_transL2R : NULL);
@@ -624,13 +675,13 @@ bool ARController::update()
             for (std::vector<ARMarker *>::iterator it = markers.begin(); it != markers.end(); ++it) {
                 if ((*it)->type == ARMarker::NFT) {
 
-                    if (surfaceSet[page]->contNum > 0) {
-                        if (ar2Tracking(m_ar2Handle, surfaceSet[page], image0->buff, trackingTrans, &err) < 0) {
+                    if (surfaceSet[page] && m_ar2Handles[page] && surfaceSet[page]->contNum > 0) {
+                        if (m_nftTrackingResults[page] < 0) {
                             //logv("Tracking lost on page %d.", page);
                             success &= ((ARMarkerNFT *)(*it))->updateWithNFTResults(-1, NULL, NULL);
                         } else {
-                            //logv("Tracked page %d (pos = {% 4f, % 4f, % 4f}).\n", page, trackingTrans[0][3], trackingTrans[1][3], trackingTrans[2][3]);
-                            success &= ((ARMarkerNFT *)(*it))->updateWithNFTResults(page, trackingTrans, (ARdouble (*)[4])transL2R);
+                            //logv("Tracked page %d (pos = {% 4f, % 4f, % 4f}).\n", page, m_nftTrackingTrans[page][0][3], m_nftTrackingTrans[page][1][3], m_nftTrackingTrans[page][2][3]);
+                            success &= ((ARMarkerNFT *)(*it))->updateWithNFTResults(page, m_nftTrackingTrans[page], (ARdouble (*)[4])transL2R);
                             pagesTracked++;
                         }
                     }
@@ -731,6 +782,27 @@ bail:
     return false;
 }
 
+void *ARController::detectionWorker1(THREAD_HANDLE_T *threadHandle)
+{
+    ARController *controller = (ARController *)threadGetArg(threadHandle);
+
+    while (threadStartWait(threadHandle) == 0) {
+        controller->m_detectionResult1 = arDetectMarker(controller->m_arHandle1, controller->m_detectionImage1);
+        threadEndSignal(threadHandle);
+    }
+    return (NULL);
+}
+
+void ARController::stopDetectionThread(void)
+{
+    if (m_detectionThread1) {
+        logv(AR_LOG_LEVEL_DEBUG, "ARWrapper::ARController::stopDetectionThread(): stopping stereo detection thread");
+        threadWaitQuit(m_detectionThread1);
+        threadFree(&m_detectionThread1);
+        m_detectionImage1 = NULL;
+    }
+}
+
 #if HAVE_NFT
 bool ARController::initNFT(void)
 {
@@ -747,33 +819,70 @@ bool ARController::initNFT(void)
     }
     //kpmSetProcMode( m_kpmHandle, KpmProcHalfSize );
 
-    // AR2 init.
-    if( (m_ar2Handle = ar2CreateHandle(m_videoSource0->getCameraParameters(), m_videoSource0->getPixelFormat(), AR2_TRACKING_DEFAULT_THREAD_NUM)) == NULL ) {
-        logv(AR_LOG_LEVEL_ERROR, "ARController::initNFT(): Error: ar2CreateHandle, exiting, returning false");
+    // Each frame is reduced once for KPM and all the AR2 handles.
+    m_nftPyramid = arImagePyramidInit(kpmHandleGetXSize(m_kpmHandle), kpmHandleGetYSize(m_kpmHandle));
+    if (!m_nftPyramid) {
+        logv(AR_LOG_LEVEL_ERROR, "ARController::initNFT(): Error: arImagePyramidInit, exiting, returning false");
         kpmDeleteHandle(&m_kpmHandle);
         return (false);
     }
+
+    // AR2 handles are created per page in loadNFTData().
+
+    logv(AR_LOG_LEVEL_DEBUG, "ARController::initNFT(): NFT initialisation complete, exiting, returning true");
+    return (true);
+}
+
+AR2HandleT *ARController::createAR2Handle(int threadNum)
+{
+    AR2HandleT *ar2Handle;
+
+    if( (ar2Handle = ar2CreateHandle(m_videoSource0->getCameraParameters(), m_videoSource0->getPixelFormat(), threadNum)) == NULL ) {
+        logv(AR_LOG_LEVEL_ERROR, "ARController::createAR2Handle(): Error: ar2CreateHandle, exiting, returning NULL");
+        return (NULL);
+    }
     if (threadGetCPU() <= 1) {
-        logv(AR_LOG_LEVEL_INFO, "Using NFT tracking settings for a single CPU");
         // Settings for devices with single-core CPUs.
-        ar2SetTrackingThresh( m_ar2Handle, 5.0 );
-        ar2SetSimThresh( m_ar2Handle, 0.50 );
-        ar2SetSearchFeatureNum(m_ar2Handle, 16);
-        ar2SetSearchSize(m_ar2Handle, 6);
-        ar2SetTemplateSize1(m_ar2Handle, 6);
-        ar2SetTemplateSize2(m_ar2Handle, 6);
+        ar2SetTrackingThresh( ar2Handle, 5.0 );
+        ar2SetSimThresh( ar2Handle, 0.50 );
+        ar2SetSearchFeatureNum(ar2Handle, 16);
+        ar2SetSearchSize(ar2Handle, 6);
+        ar2SetTemplateSize1(ar2Handle, 6);
+        ar2SetTemplateSize2(ar2Handle, 6);
     } else {
-        logv(AR_LOG_LEVEL_INFO, "Using NFT tracking settings for more than one CPU");
         // Settings for devices with dual/multi-core CPUs.
-        ar2SetTrackingThresh( m_ar2Handle, 5.0 );
-        ar2SetSimThresh( m_ar2Handle, 0.50 );
-        ar2SetSearchFeatureNum(m_ar2Handle, 16);
-        ar2SetSearchSize(m_ar2Handle, 12);
-        ar2SetTemplateSize1(m_ar2Handle, 6);
-        ar2SetTemplateSize2(m_ar2Handle, 6);
+        ar2SetTrackingThresh( ar2Handle, 5.0 );
+        ar2SetSimThresh( ar2Handle, 0.50 );
+        ar2SetSearchFeatureNum(ar2Handle, 16);
+        ar2SetSearchSize(ar2Handle, 12);
+        ar2SetTemplateSize1(ar2Handle, 6);
+        ar2SetTemplateSize2(ar2Handle, 6);
+    }
+    ar2SetSearchPyramid(ar2Handle, m_nftPyramid);
+    return (ar2Handle);
+}
+
+void *ARController::nftTrackingWorker(THREAD_HANDLE_T *threadHandle)
+{
+    ARController *controller = (ARController *)threadGetArg(threadHandle);
+    int index = threadGetID(threadHandle);
+
+    while (threadStartWait(threadHandle) == 0) {
+        controller->trackNFTPages(index);
+        threadEndSignal(threadHandle);
+    }
+    return (NULL);
+}
+
+// Thread "index" tracks pages m_nftTrackingPages[index], [index + stride], [index + 2*stride], ...
+void ARController::trackNFTPages(int index)
+{
+    int stride = m_nftTrackingThreadCount + 1;
+
+    for (int i = index; i < m_nftTrackingPageCount; i += stride) {
+        int page = m_nftTrackingPages[i];
+        m_nftTrackingResults[page] = ar2Tracking(m_ar2Handles[page], surfaceSet[page], m_nftTrackingImage, m_nftTrackingTrans[page], &m_nftTrackingErr[page]);
     }
-    logv(AR_LOG_LEVEL_DEBUG, "ARController::initNFT(): NFT initialisation complete, exiting, returning true");
-    return (true);
 }
 
 bool ARController::unloadNFTData(void)
@@ -785,7 +894,16 @@ bool ARController::unloadNFTData(void)
         trackingInitQuit(&trackingThreadHandle);
         m_kpmBusy = false;
     }
-    for (i = 0; i < PAGES_MAX; i++) surfaceSet[i] = NULL; // Discard weak-references.
+    for (i = 0; i < m_nftTrackingThreadCount; i++) {
+        threadWaitQuit(m_nftTrackingThreads[i]);
+        threadFree(&m_nftTrackingThreads[i]);
+    }
+    m_nftTrackingThreadCount = 0;
+    m_nftTrackingPageCount = 0;
+    for (i = 0; i < PAGES_MAX; i++) {
+        if (m_ar2Handles[i]) ar2DeleteHandle(&m_ar2Handles[i]); // Sets m_ar2Handles[i] to NULL.
+        surfaceSet[i] = NULL; // Discard weak-references.
+    }
     m_kpmRequired = true;
 
     return true;
@@ -842,6 +960,29 @@ bool ARController::loadNFTData(void)
     }
     kpmDeleteRefDataSet(&refDataSet);
 
+    // Create one AR2 handle per page, and enough workers to track that many pages at once.
+    // The CPUs are divided between the page workers and each handle's own template-matching threads.
+    int cpus = threadGetCPU();
+    int pageThreads = (pageCount < cpus ? pageCount : cpus);
+    if (pageThreads < 1) pageThreads = 1;
+    if (cpus <= 1) {
+        logv(AR_LOG_LEVEL_INFO, "Using NFT tracking settings for a single CPU");
+    } else {
+        logv(AR_LOG_LEVEL_INFO, "Using NFT tracking settings for more than one CPU");
+    }
+    for (int i = 0; i < pageCount; i++) {
+        if (!(m_ar2Handles[i] = createAR2Handle(cpus / pageThreads))) {
+            logv(AR_LOG_LEVEL_ERROR, "ARController::loadNFTData(): Error: createAR2Handle, exit(-1)");
+            exit(-1);
+        }
+    }
+    for (m_nftTrackingThreadCount = 0; m_nftTrackingThreadCount < pageThreads - 1; m_nftTrackingThreadCount++) {
+        if (!(m_nftTrackingThreads[m_nftTrackingThreadCount] = threadInit(m_nftTrackingThreadCount + 1, this, nftTrackingWorker))) {
+            logv(AR_LOG_LEVEL_WARN, "ARController::loadNFTData(): Unable to start page tracking thread, tracking with %d threads.", m_nftTrackingThreadCount + 1);
+            break;
+        }
+    }
+
     // Start the KPM tracking thread.
     logv(AR_LOG_LEVEL_INFO, "Starting NFT tracking thread.");
     trackingThreadHandle = trackingInitInit(m_kpmHandle);
@@ -901,14 +1042,12 @@ bool ARController::stopRunning()
 #if HAVE_NFT
     // NFT cleanup.
     //logv("Cleaning up ARToolKit NFT handles.");
-    if (m_ar2Handle) {
-        logv(AR_LOG_LEVEL_DEBUG, "ARWrapper::ARController::stopRunning(): calling ar2DeleteHandle(&m_ar2Handle)");
-        ar2DeleteHandle(&m_ar2Handle); // Sets m_ar2Handle to NULL.
-    }
     if (m_kpmHandle) {
         logv(AR_LOG_LEVEL_DEBUG, "ARWrapper::ARController::stopRunning(): calling kpmDeleteHandle(&m_kpmHandle)");
         kpmDeleteHandle(&m_kpmHandle); // Sets m_kpmHandle to NULL.
     }
+    arImagePyramidFinal(m_nftPyramid);
+    m_nftPyramid = NULL;
 #endif
 
 	//logv("Cleaning up ARToolKit handles.");
@@ -928,6 +1067,7 @@ bool ARController::stopRunning()
 		m_arHandle0 = NULL;
 	}
 
+    stopDetectionThread();
     if (m_arHandle1) {
         logv(AR_LOG_LEVEL_DEBUG, "ARWrapper::ARController::stopRunning(): if (m_arHandle1) true");
 		arPattDetach(m_arHandle1);
@@ -190,7 +190,11 @@ bool AndroidVideoSource::getVideoReadyAndroid2(const ARParam *cparam_p)
 #endif
         arParamChangeSize(&cparam, videoWidth, videoHeight, &cparam);
     }
+#if AR_PARAM_LT_MOBILE_STEP > 1
+	if (!(cparamLT = arParamLTCreateCompact(&cparam, AR_PARAM_LT_DEFAULT_OFFSET, AR_PARAM_LT_MOBILE_STEP))) {
+#else
 	if (!(cparamLT = arParamLTCreate(&cparam, AR_PARAM_LT_DEFAULT_OFFSET))) {
+#endif
     	ARController::logv(AR_LOG_LEVEL_ERROR, "Error: Failed to create camera parameters lookup table.");
         goto bail;
 	}
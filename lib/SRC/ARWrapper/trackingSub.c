@@ -47,6 +47,7 @@
 typedef struct {
     KpmHandle              *kpmHandle;      // KPM-related data.
     ARUint8                *imageLumaPtr;   // Pointer to image being tracked.
+    ARImagePyramid         *pyramid;        // Copy of the frame being tracked, with the level KPM reads.
     int                     imageSize;      // Bytes per image.
     float                   trans[3][4];    // Transform containing pose of tracked image.
     int                     page;           // Assigned page number of tracked image.
@@ -70,6 +71,7 @@ int trackingInitQuit( THREAD_HANDLE_T **threadHandle_p )
     trackingInitHandle = (TrackingInitHandle *)threadGetArg(*threadHandle_p);
     if (trackingInitHandle) {
         free( trackingInitHandle->imageLumaPtr );
+        arImagePyramidFinal( trackingInitHandle->pyramid );
         free( trackingInitHandle );
     }
     threadFree( threadHandle_p );
@@ -91,18 +93,20 @@ THREAD_HANDLE_T *trackingInitInit( KpmHandle *kpmHandle )
     trackingInitHandle->kpmHandle = kpmHandle;
     trackingInitHandle->imageSize = kpmHandleGetXSize(kpmHandle) * kpmHandleGetYSize(kpmHandle);
     trackingInitHandle->imageLumaPtr  = (ARUint8 *)malloc(trackingInitHandle->imageSize);
+    trackingInitHandle->pyramid   = arImagePyramidInit(kpmHandleGetXSize(kpmHandle), kpmHandleGetYSize(kpmHandle));
     trackingInitHandle->flag      = 0;
 
     threadHandle = threadInit(0, trackingInitHandle, trackingInitMain);
     return threadHandle;
 }
 
-int trackingInitStart( THREAD_HANDLE_T *threadHandle, ARUint8 *imageLumaPtr )
+int trackingInitStart( THREAD_HANDLE_T *threadHandle, ARImagePyramid *pyramid )
 {
     TrackingInitHandle     *trackingInitHandle;
+    AR_IMAGE_PYRAMID_LEVEL  level;
 
-    if (!threadHandle || !imageLumaPtr) {
-        ARLOGe("trackingInitStart(): Error: NULL threadHandle or imagePtr.\n");
+    if (!threadHandle || !pyramid) {
+        ARLOGe("trackingInitStart(): Error: NULL threadHandle or pyramid.\n");
         return (-1);
     }
     
@@ -111,7 +115,13 @@ int trackingInitStart( THREAD_HANDLE_T *threadHandle, ARUint8 *imageLumaPtr )
         ARLOGe("trackingInitStart(): Error: NULL trackingInitHandle.\n");
         return (-1);
     }
-    memcpy( trackingInitHandle->imageLumaPtr, imageLumaPtr, trackingInitHandle->imageSize );
+    // The level KPM reads is built in the caller's pyramid, where other consumers of the frame can
+    // share it, and copied along with the frame, as KPM runs on after the caller moves to the next frame.
+    if (kpmGetPyramidLevel( trackingInitHandle->kpmHandle, &level ) < 0) return (-1);
+    if (arImagePyramidCopy( trackingInitHandle->pyramid, pyramid, trackingInitHandle->imageLumaPtr, level ) < 0) {
+        ARLOGe("trackingInitStart(): Error: unable to copy frame.\n");
+        return (-1);
+    }
     threadStartSignal( threadHandle );
 
     return 0;
@@ -146,7 +156,7 @@ static void *trackingInitMain( THREAD_HANDLE_T *threadHandle )
     KpmHandle              *kpmHandle;
     KpmResult              *kpmResult = NULL;
     int                     kpmResultNum;
-    ARUint8                *imageLumaPtr;
+    ARImagePyramid         *pyramid;
     float                  err;
     int                    i, j, k;
 
@@ -160,9 +170,9 @@ static void *trackingInitMain( THREAD_HANDLE_T *threadHandle )
         return (NULL);
     }
     kpmHandle          = trackingInitHandle->kpmHandle;
-    imageLumaPtr       = trackingInitHandle->imageLumaPtr;
-    if (!kpmHandle || !imageLumaPtr) {
-        ARLOGe("Error starting tracking thread: empty kpmHandle/imageLumaPtr.\n");
+    pyramid            = trackingInitHandle->pyramid;
+    if (!kpmHandle || !trackingInitHandle->imageLumaPtr || !pyramid) {
+        ARLOGe("Error starting tracking thread: empty kpmHandle/imageLumaPtr/pyramid.\n");
         return (NULL);
     }
     ARLOGi("Start tracking thread.\n");
@@ -172,7 +182,7 @@ static void *trackingInitMain( THREAD_HANDLE_T *threadHandle )
     for(;;) {
         if( threadStartWait(threadHandle) < 0 ) break;
 
-        kpmMatching(kpmHandle, imageLumaPtr);
+        kpmMatchingPyramid(kpmHandle, pyramid);
         trackingInitHandle->flag = 0;
         for( i = 0; i < kpmResultNum; i++ ) {
             if( kpmResult[i].camPoseF != 0 ) continue;
@@ -107,6 +107,8 @@ static KpmHandle *kpmCreateHandleCore( ARParamLT *cparamLT, int xsize, int ysize
     kpmHandle->result                  = NULL;
     kpmHandle->resultNum               = 0;
 
+    kpmHandle->pyramid                 = NULL;
+
 #if !BINARY_FEATURE
     switch (kpmHandle->procMode) {
         case KpmProcFullSize:     surfXSize = xsize;     surfYSize = ysize;     break;
@@ -199,6 +201,13 @@ int kpmGetProcMode( KpmHandle *kpmHandle, KPM_PROC_MODE *mode )
     return 0;
 }
 
+int kpmGetPyramidLevel( KpmHandle *kpmHandle, AR_IMAGE_PYRAMID_LEVEL *level )
+{
+    if( kpmHandle == NULL || level == NULL ) return -1;
+    *level = kpmUtilGetPyramidLevel( kpmHandle->procMode );
+    return 0;
+}
+
 int kpmSetDetectedFeatureMax( KpmHandle *kpmHandle, int  detectedMaxFeature )
 {
     kpmHandle->detectedMaxFeature = detectedMaxFeature;
@@ -263,6 +272,7 @@ int kpmDeleteHandle( KpmHandle **kpmHandle )
     if( (*kpmHandle)->inDataSet.coord != NULL ) {
         free( (*kpmHandle)->inDataSet.coord );
     }
+    arImagePyramidFinal( (*kpmHandle)->pyramid );
 
     free( *kpmHandle );
     *kpmHandle = NULL;
@@ -381,12 +381,27 @@ int kpmSetMatchingSkipRegion( KpmHandle *kpmHandle, SurfSubRect *skipRegion, int
 #endif
 
 int kpmMatching(KpmHandle *kpmHandle, ARUint8 *inImageLuma)
+{
+    if (!kpmHandle || !inImageLuma) {
+        ARLOGe("kpmMatching(): NULL kpmHandle/inImageLuma.\n");
+        return -1;
+    }
+    
+    if (!kpmHandle->pyramid) {
+        kpmHandle->pyramid = arImagePyramidInit(kpmHandle->xsize, kpmHandle->ysize);
+        if (!kpmHandle->pyramid) return -1;
+    }
+    arImagePyramidSetImage(kpmHandle->pyramid, inImageLuma);
+    
+    return kpmMatchingPyramid(kpmHandle, kpmHandle->pyramid);
+}
+
+int kpmMatchingPyramid(KpmHandle *kpmHandle, ARImagePyramid *pyramid)
 {
     int               xsize, ysize;
     int               xsize2, ysize2;
     int               procMode;
-    ARUint8          *imageLuma;
-    int               imageLumaWasAllocated;
+    const ARUint8    *imageLuma;
     int               i;
 #if !BINARY_FEATURE
     FeatureVector     featureVector;
@@ -401,8 +416,8 @@ int kpmMatching(KpmHandle *kpmHandle, ARUint8 *inImageLuma)
 #endif
     int               ret;
     
-    if (!kpmHandle || !inImageLuma) {
-        ARLOGe("kpmMatching(): NULL kpmHandle/inImageLuma.\n");
+    if (!kpmHandle || !pyramid || !pyramid->image) {
+        ARLOGe("kpmMatchingPyramid(): NULL kpmHandle/pyramid/image.\n");
         return -1;
     }
     
@@ -410,17 +425,16 @@ int kpmMatching(KpmHandle *kpmHandle, ARUint8 *inImageLuma)
     ysize           = kpmHandle->ysize;
     procMode        = kpmHandle->procMode;
     
-    if (procMode == KpmProcFullSize) {
-        imageLuma = inImageLuma;
-        imageLumaWasAllocated = 0;
-    } else {
-        imageLuma = kpmUtilResizeImage(inImageLuma, xsize, ysize, procMode, &xsize2, &ysize2);
-        if (!imageLuma) return -1;
-        imageLumaWasAllocated = 1;
+    if (pyramid->xsize != xsize || pyramid->ysize != ysize) {
+        ARLOGe("kpmMatchingPyramid(): Pyramid size %dx%d does not match KPM handle size %dx%d.\n", pyramid->xsize, pyramid->ysize, xsize, ysize);
+        return -1;
     }
+    
+    imageLuma = arImagePyramidGetLevel(pyramid, kpmUtilGetPyramidLevel(procMode), &xsize2, &ysize2);
+    if (!imageLuma) return -1;
 
 #if BINARY_FEATURE
-    kpmHandle->freakMatcher->query(imageLuma, xsize ,ysize);
+    kpmHandle->freakMatcher->query(const_cast<ARUint8 *>(imageLuma), xsize2, ysize2);
     kpmHandle->inDataSet.num = (int)kpmHandle->freakMatcher->getQueryFeaturePoints().size();
 #else
     surfSubExtractFeaturePoint( kpmHandle->surfHandle, inImageBW, kpmHandle->skipRegion.region, kpmHandle->skipRegion.regionNum );
@@ -467,13 +481,8 @@ int kpmMatching(KpmHandle *kpmHandle, ARUint8 *inImageLuma)
                 }
                 featureVector.sf[i].l = surfSubGetFeatureSign( kpmHandle->surfHandle, i );
 #endif
-                if( kpmHandle->cparamLT != NULL ) {
-                    arParamObserv2IdealLTf( &(kpmHandle->cparamLT->paramLTf), x, y, &(kpmHandle->inDataSet.coord[i].x), &(kpmHandle->inDataSet.coord[i].y) );
-                }
-                else {
-                    kpmHandle->inDataSet.coord[i].x = x;
-                    kpmHandle->inDataSet.coord[i].y = y;
-                }
+                kpmHandle->inDataSet.coord[i].x = x;
+                kpmHandle->inDataSet.coord[i].y = y;
             }
         }
         else if( procMode == KpmProcTwoThirdSize ) {
@@ -489,13 +498,8 @@ int kpmMatching(KpmHandle *kpmHandle, ARUint8 *inImageLuma)
                 }
                 featureVector.sf[i].l = surfSubGetFeatureSign( kpmHandle->surfHandle, i );
 #endif
-                if( kpmHandle->cparamLT != NULL ) {
-                    arParamObserv2IdealLTf( &(kpmHandle->cparamLT->paramLTf), x*1.5f, y*1.5f, &(kpmHandle->inDataSet.coord[i].x), &(kpmHandle->inDataSet.coord[i].y) );
-                }
-                else {
-                    kpmHandle->inDataSet.coord[i].x = x*1.5f;
-                    kpmHandle->inDataSet.coord[i].y = y*1.5f;
-                }
+                kpmHandle->inDataSet.coord[i].x = x*1.5f;
+                kpmHandle->inDataSet.coord[i].y = y*1.5f;
             }
         }
         else if( procMode == KpmProcHalfSize ) {
@@ -511,13 +515,8 @@ int kpmMatching(KpmHandle *kpmHandle, ARUint8 *inImageLuma)
                 }
                 featureVector.sf[i].l = surfSubGetFeatureSign( kpmHandle->surfHandle, i );
 #endif
-                if( kpmHandle->cparamLT != NULL ) {
-                    arParamObserv2IdealLTf( &(kpmHandle->cparamLT->paramLTf), x*2.0f, y*2.0f, &(kpmHandle->inDataSet.coord[i].x), &(kpmHandle->inDataSet.coord[i].y) );
-                }
-                else {
-                    kpmHandle->inDataSet.coord[i].x = x*2.0f;
-                    kpmHandle->inDataSet.coord[i].y = y*2.0f;
-                }
+                kpmHandle->inDataSet.coord[i].x = x*2.0f;
+                kpmHandle->inDataSet.coord[i].y = y*2.0f;
             }
         }
         else if( procMode == KpmProcOneThirdSize ) {
@@ -533,13 +532,8 @@ int kpmMatching(KpmHandle *kpmHandle, ARUint8 *inImageLuma)
                 }
                 featureVector.sf[i].l = surfSubGetFeatureSign( kpmHandle->surfHandle, i );
 #endif
-                if( kpmHandle->cparamLT != NULL ) {
-                    arParamObserv2IdealLTf( &(kpmHandle->cparamLT->paramLTf), x*3.0f, y*3.0f, &(kpmHandle->inDataSet.coord[i].x), &(kpmHandle->inDataSet.coord[i].y) );
-                }
-                else {
-                    kpmHandle->inDataSet.coord[i].x = x*3.0f;
-                    kpmHandle->inDataSet.coord[i].y = y*3.0f;
-                }
+                kpmHandle->inDataSet.coord[i].x = x*3.0f;
+                kpmHandle->inDataSet.coord[i].y = y*3.0f;
             }
         }
         else { // procMode == KpmProcQuatSize
@@ -555,15 +549,13 @@ int kpmMatching(KpmHandle *kpmHandle, ARUint8 *inImageLuma)
                 }
                 featureVector.sf[i].l = surfSubGetFeatureSign( kpmHandle->surfHandle, i );
 #endif
-                if( kpmHandle->cparamLT != NULL ) {
-                    arParamObserv2IdealLTf( &(kpmHandle->cparamLT->paramLTf), x*4.0f, y*4.0f, &(kpmHandle->inDataSet.coord[i].x), &(kpmHandle->inDataSet.coord[i].y) );
-                }
-                else {
-                    kpmHandle->inDataSet.coord[i].x = x*4.0f;
-                    kpmHandle->inDataSet.coord[i].y = y*4.0f;
-                }
+                kpmHandle->inDataSet.coord[i].x = x*4.0f;
+                kpmHandle->inDataSet.coord[i].y = y*4.0f;
             }
         }
+        if( kpmHandle->cparamLT != NULL ) {
+            arParamObserv2IdealBatch( kpmHandle->cparamLT, (const float *)kpmHandle->inDataSet.coord, (float *)kpmHandle->inDataSet.coord, kpmHandle->inDataSet.num );
+        }
 
 #if !BINARY_FEATURE
         ann2 = (CAnnMatch2*)kpmHandle->ann2;
@@ -674,8 +666,6 @@ int kpmMatching(KpmHandle *kpmHandle, ARUint8 *inImageLuma)
     }
     
     for( i = 0; i < kpmHandle->resultNum; i++ ) kpmHandle->result[i].skipF = 0;
-
-    if (imageLumaWasAllocated) free(imageLuma);
     
     return 0;
 }
@@ -88,6 +88,10 @@ struct _KpmHandle {
     KpmResult                *result;
     int                       resultNum;
     int                       pageIDs[DB_IMAGE_MAX];
+
+    ARImagePyramid           *pyramid;          // Used by kpmMatching() to hold reduced copies of the input image.
 };
 
+AR_IMAGE_PYRAMID_LEVEL kpmUtilGetPyramidLevel( int procMode );
+
 #endif // !__kpmPrivate_h__
@@ -48,12 +48,6 @@
 #include <KPM/surfSub.h>
 #endif
 
-static ARUint8 *genBWImageFull      ( ARUint8 *image, int xsize, int ysize, int *newXsize, int *newYsize );
-static ARUint8 *genBWImageHalf      ( ARUint8 *image, int xsize, int ysize, int *newXsize, int *newYsize );
-static ARUint8 *genBWImageOneThird  ( ARUint8 *image, int xsize, int ysize, int *newXsize, int *newYsize );
-static ARUint8 *genBWImageTwoThird  ( ARUint8 *image, int xsize, int ysize, int *newXsize, int *newYsize );
-static ARUint8 *genBWImageQuart     ( ARUint8 *image, int xsize, int ysize, int *newXsize, int *newYsize );
-
 
 #if !BINARY_FEATURE
 static int kpmUtilGetInitPoseHomography( float *sCoord, float *wCoord, int num, float initPose[3][4] );
@@ -161,23 +155,25 @@ int kpmUtilGetCorner( ARUint8 *inImage, int xsize, int ysize, int procMode, int
     return 0;
 }
 
+AR_IMAGE_PYRAMID_LEVEL kpmUtilGetPyramidLevel( int procMode )
+{
+    if( procMode == KpmProcFullSize )          return AR_IMAGE_PYRAMID_LEVEL_FULL;
+    else if( procMode == KpmProcTwoThirdSize ) return AR_IMAGE_PYRAMID_LEVEL_TWO_THIRD;
+    else if( procMode == KpmProcHalfSize )     return AR_IMAGE_PYRAMID_LEVEL_HALF;
+    else if( procMode == KpmProcOneThirdSize ) return AR_IMAGE_PYRAMID_LEVEL_ONE_THIRD;
+    else                                       return AR_IMAGE_PYRAMID_LEVEL_QUARTER;
+}
+
 ARUint8 *kpmUtilResizeImage( ARUint8 *image, int xsize, int ysize, int procMode, int *newXsize, int *newYsize )
 {
-    if( procMode == KpmProcFullSize ) {
-        return genBWImageFull( image, xsize, ysize, newXsize, newYsize );
-    }
-    else if( procMode == KpmProcTwoThirdSize ) {
-        return genBWImageTwoThird( image, xsize, ysize, newXsize, newYsize );
-    }
-    else if( procMode == KpmProcHalfSize ) {
-        return genBWImageHalf( image, xsize, ysize, newXsize, newYsize );
-    }
-    else if( procMode == KpmProcOneThirdSize ) {
-        return genBWImageOneThird( image, xsize, ysize, newXsize, newYsize );
-    }
-    else {
-        return genBWImageQuart( image, xsize, ysize, newXsize, newYsize );
-    }
+    ARUint8                *newImage;
+    AR_IMAGE_PYRAMID_LEVEL  level = kpmUtilGetPyramidLevel( procMode );
+
+    arImagePyramidGetLevelSize( xsize, ysize, level, newXsize, newYsize );
+    arMalloc( newImage, ARUint8, (*newXsize)*(*newYsize) );
+    arImagePyramidReduce( image, xsize, ysize, level, newImage );
+
+    return newImage;
 }
 
 #if !BINARY_FEATURE
@@ -463,147 +459,6 @@ int kpmUtilGetPoseHomography( KpmMatchResult *matchData, KpmRefDataSet *refDataS
 }
 #endif
 
-static ARUint8 *genBWImageFull( ARUint8 *image, int xsize, int ysize, int *newXsize, int *newYsize )
-{
-    ARUint8  *newImage;
-    int       xsize2, ysize2;
-
-    *newXsize = xsize2 = xsize;
-    *newYsize = ysize2 = ysize;
-    arMalloc( newImage, ARUint8, xsize*ysize );
-    memcpy(newImage, image, xsize*ysize);
-
-    return newImage;
-}
-
-static ARUint8 *genBWImageHalf( ARUint8 *image, int xsize, int ysize, int *newXsize, int *newYsize )
-{
-    ARUint8  *newImage;
-    ARUint8  *p, *p1, *p2;
-    int       xsize2, ysize2;
-    int       i, j;
-    
-    *newXsize = xsize2 = xsize/2;
-    *newYsize = ysize2 = ysize/2;
-    arMalloc( newImage, ARUint8, xsize2*ysize2 );
-
-    p  = newImage;
-    for( j = 0; j < ysize2; j++ ) {
-        p1 = image + xsize*(j*2+0);
-        p2 = image + xsize*(j*2+1);
-        for( i = 0; i < xsize2; i++ ) {
-            *(p++) = ( (int)*(p1+0) + (int)*(p1+1)
-                     + (int)*(p2+0) + (int)*(p2+1) ) / 4;
-            p1+=2;
-            p2+=2;
-        }
-    }
-
-    return newImage;
-}
-
-static ARUint8 *genBWImageQuart( ARUint8 *image, int xsize, int ysize, int *newXsize, int *newYsize )
-{
-    ARUint8  *newImage;
-    ARUint8  *p, *p1, *p2, *p3, *p4;
-    int       xsize2, ysize2;
-    int       i, j;
-    
-    *newXsize = xsize2 = xsize/4;
-    *newYsize = ysize2 = ysize/4;
-    arMalloc( newImage, ARUint8, xsize2*ysize2 );
-    
-    p  = newImage;
-    for( j = 0; j < ysize2; j++ ) {
-        p1 = image + xsize*(j*4+0);
-        p2 = image + xsize*(j*4+1);
-        p3 = image + xsize*(j*4+2);
-        p4 = image + xsize*(j*4+3);
-        for( i = 0; i < xsize2; i++ ) {
-            *(p++) = ( (int)*(p1+0) + (int)*(p1+1) + (int)*(p1+2) + (int)*(p1+3)
-                     + (int)*(p2+0) + (int)*(p2+1) + (int)*(p2+2) + (int)*(p2+3)
-                     + (int)*(p3+0) + (int)*(p3+1) + (int)*(p3+2) + (int)*(p3+3)
-                     + (int)*(p4+0) + (int)*(p4+1) + (int)*(p4+2) + (int)*(p4+3)) / 16;
-            p1+=4;
-            p2+=4;
-            p3+=4;
-            p4+=4;
-        }
-    }
-
-    return newImage;
-}
-
-
-static ARUint8 *genBWImageOneThird( ARUint8 *image, int xsize, int ysize, int *newXsize, int *newYsize )
-{
-    ARUint8  *newImage;
-    ARUint8  *p, *p1, *p2, *p3;
-    int       xsize2, ysize2;
-    int       i, j;
-    
-    *newXsize = xsize2 = xsize/3;
-    *newYsize = ysize2 = ysize/3;
-    arMalloc( newImage, ARUint8, xsize2*ysize2 );
-
-    p  = newImage;
-    for( j = 0; j < ysize2; j++ ) {
-        p1 = image + xsize*(j*3+0);
-        p2 = image + xsize*(j*3+1);
-        p3 = image + xsize*(j*3+2);
-        for( i = 0; i < xsize2; i++ ) {
-            *(p++) = ( (int)*(p1+0) + (int)*(p1+1) + (int)*(p1+2)
-                     + (int)*(p2+0) + (int)*(p2+1) + (int)*(p2+2)
-                     + (int)*(p3+0) + (int)*(p3+1) + (int)*(p3+2) ) / 9;
-            p1+=3;
-            p2+=3;
-            p3+=3;
-        }
-    }
-
-    return newImage;
-}
-
-static ARUint8 *genBWImageTwoThird  ( ARUint8 *image, int xsize, int ysize, int *newXsize, int *newYsize )
-{
-    ARUint8  *newImage;
-    ARUint8  *q1, *q2, *p1, *p2, *p3;
-    int       xsize2, ysize2;
-    int       i, j;
-    
-    *newXsize = xsize2 = xsize/3*2;
-    *newYsize = ysize2 = ysize/3*2;
-    arMalloc( newImage, ARUint8, xsize2*ysize2 );
-
-    q1  = newImage;
-    q2  = newImage + xsize2;
-    for( j = 0; j < ysize2/2; j++ ) {
-        p1 = image + xsize*(j*3+0);
-        p2 = image + xsize*(j*3+1);
-        p3 = image + xsize*(j*3+2);
-        for( i = 0; i < xsize2/2; i++ ) {
-            *(q1++) = ( (int)*(p1+0)   + (int)*(p1+1)/2
-                      + (int)*(p2+0)/2 + (int)*(p2+1)/4 ) *4/9;
-            *(q2++) = ( (int)*(p2+0)/2 + (int)*(p2+1)/4
-                      + (int)*(p3+0)   + (int)*(p3+1)/2 ) *4/9;
-            p1++;
-            p2++;
-            p3++;
-            *(q1++) = ( (int)*(p1+0)/2 + (int)*(p1+1)
-                      + (int)*(p2+0)/4 + (int)*(p2+1)/2 ) *4/9;
-            *(q2++) = ( (int)*(p2+0)/4 + (int)*(p2+1)/2
-                      + (int)*(p3+0)/2 + (int)*(p3+1)   ) *4/9;
-            p1+=2;
-            p2+=2;
-            p3+=2;
-        }
-        q1 += xsize2;
-        q2 += xsize2;
-    }
-
-    return newImage;
-}
-
 #if !BINARY_FEATURE
 static int kpmUtilGetInitPoseHomography( float *sCoord, float *wCoord, int num, float initPose[3][4] )
 {
@@ -248,6 +248,7 @@ int threadWaitQuit( THREAD_HANDLE_T *flag )
     while (flag->endF != 2) {
         pthread_cond_wait(&(flag->cond2), &(flag->mut));
     }
+    pthread_mutex_unlock(&(flag->mut));
     return 0;
 }
 
@@ -267,3 +268,113 @@ int threadGetCPU(void)
 #endif
 }
 
+//
+// Thread pool.
+//
+
+typedef struct {
+    void            (*func)( void *arg, int begin, int end );
+    void             *arg;
+    int               begin;
+    int               end;
+} THREAD_POOL_BAND_T;
+
+struct _THREAD_POOL_T {
+    int               threadNum; // Including the calling thread.
+    THREAD_HANDLE_T  *threadHandle[THREAD_POOL_MAX]; // threadHandle[0] is unused.
+    THREAD_POOL_BAND_T band[THREAD_POOL_MAX];
+};
+
+static void *threadPoolWorker( THREAD_HANDLE_T *threadHandle )
+{
+    THREAD_POOL_BAND_T *band = (THREAD_POOL_BAND_T *)threadGetArg(threadHandle);
+
+    while (threadStartWait(threadHandle) == 0) {
+        band->func(band->arg, band->begin, band->end);
+        threadEndSignal(threadHandle);
+    }
+    return NULL;
+}
+
+THREAD_POOL_T *threadPoolInit( int threadNum )
+{
+    THREAD_POOL_T *pool;
+
+    if (threadNum < 0) return NULL;
+    if (threadNum == 0) threadNum = threadGetCPU();
+    if (threadNum < 1) threadNum = 1;
+    if (threadNum > THREAD_POOL_MAX) threadNum = THREAD_POOL_MAX;
+
+    if ((pool = malloc(sizeof(THREAD_POOL_T))) == NULL) return NULL;
+    for (pool->threadNum = 1; pool->threadNum < threadNum; pool->threadNum++) {
+        pool->threadHandle[pool->threadNum] = threadInit(pool->threadNum, &(pool->band[pool->threadNum]), threadPoolWorker);
+        if (!pool->threadHandle[pool->threadNum]) break; // Run with the threads that did start.
+    }
+    return pool;
+}
+
+int threadPoolFree( THREAD_POOL_T **pool )
+{
+    int i;
+
+    if (!pool || !*pool) return -1;
+    for (i = 1; i < (*pool)->threadNum; i++) {
+        threadWaitQuit((*pool)->threadHandle[i]);
+        threadFree(&((*pool)->threadHandle[i]));
+    }
+    free(*pool);
+    *pool = NULL;
+    return 0;
+}
+
+int threadPoolGetThreadNum( THREAD_POOL_T *pool )
+{
+    if (!pool) return -1;
+    return pool->threadNum;
+}
+
+int threadPoolRun( THREAD_POOL_T *pool, int count, int minCount, void (*func)( void *arg, int begin, int end ), void *arg )
+{
+    int bandNum;
+    int i;
+
+    if (!pool || !func) return -1;
+    if (count <= 0) return 0;
+    if (minCount < 1) minCount = 1;
+    bandNum = count / minCount;
+    if (bandNum > pool->threadNum) bandNum = pool->threadNum;
+    if (bandNum <= 1) {
+        func(arg, 0, count);
+        return 0;
+    }
+
+    for (i = 0; i < bandNum; i++) {
+        pool->band[i].func  = func;
+        pool->band[i].arg   = arg;
+        pool->band[i].begin = (int)((long long)count *  i      / bandNum);
+        pool->band[i].end   = (int)((long long)count * (i + 1) / bandNum);
+    }
+    for (i = 1; i < bandNum; i++) threadStartSignal(pool->threadHandle[i]);
+    func(arg, pool->band[0].begin, pool->band[0].end);
+    for (i = 1; i < bandNum; i++) threadEndWait(pool->threadHandle[i]);
+    return 0;
+}
+
+int threadParallelRun( int count, int minCount, void (*func)( void *arg, int begin, int end ), void *arg )
+{
+    THREAD_POOL_T *pool;
+    int threadNum;
+
+    if (!func) return -1;
+    if (count <= 0) return 0;
+    if (minCount < 1) minCount = 1;
+    threadNum = threadGetCPU();
+    if (threadNum > count / minCount) threadNum = count / minCount;
+    if (threadNum <= 1 || (pool = threadPoolInit(threadNum)) == NULL) {
+        func(arg, 0, count);
+        return 0;
+    }
+    threadPoolRun(pool, count, minCount, func, arg);
+    threadPoolFree(&pool);
+    return 0;
+}
@@ -90,6 +90,7 @@ enum {
 
 static int                  genfset = 1;
 static int                  genfset3 = 1;
+static int                  isetFormat = AR2_IMAGESET_FORMAT_JPEG;
 
 static char                 filename[MAXPATHLEN] = "";
 static AR2JpegImageT       *jpegImage;
@@ -160,6 +161,11 @@ int main( int argc, char *argv[] )
             if( sscanf(&argv[i][9], "%f", &dpiMax) != 1 ) usage(argv[0]);
         } else if( strncmp(argv[i], "-min_dpi=", 9) == 0 ) {
             if( sscanf(&argv[i][9], "%f", &dpiMin) != 1 ) usage(argv[0]);
+        } else if( strncmp(argv[i], "-iset_format=", 13) == 0 ) {
+            if( strcmp(&argv[i][13], "jpeg") == 0 ) isetFormat = AR2_IMAGESET_FORMAT_JPEG;
+            else if( strcmp(&argv[i][13], "raw") == 0 ) isetFormat = AR2_IMAGESET_FORMAT_RAW;
+            else if( strcmp(&argv[i][13], "lz4") == 0 ) isetFormat = AR2_IMAGESET_FORMAT_LZ4;
+            else usage(argv[0]);
         } else if( strcmp(argv[i], "-background") == 0 ) {
             background = 1;
         } else if( strcmp(argv[i], "-nofset") == 0 ) {
@@ -366,7 +372,7 @@ int main( int argc, char *argv[] )
     ARLOGi("  Done.\n");
     ar2UtilRemoveExt( filename );
     ARLOGi("Saving to %s.iset...\n", filename);
-    if( ar2WriteImageSet( filename, imageSet ) < 0 ) {
+    if( ar2WriteImageSet2( filename, imageSet, isetFormat ) < 0 ) {
         ARLOGe("Save error: %s.iset\n", filename );
         EXIT(E_DATA_PROCESSING_ERROR);
     }
@@ -583,6 +589,8 @@ static void usage( char *com )
         ARLOG("    -dpi=f: Override embedded JPEG DPI value.\n");
         ARLOG("    -max_dpi=<max_dpi>\n");
         ARLOG("    -min_dpi=<min_dpi>\n");
+        ARLOG("    -iset_format=x\n"
+              "         x is one of: jpeg (compact), raw (fastest to load, memory-mapped), lz4 (raw, compressed). Default jpeg.\n");
         ARLOG("    -background\n");
         ARLOG("         Run in background, i.e. as daemon detached from controlling terminal. (Mac OS X and Linux only.)\n");
         ARLOG("    -log=<path>\n");